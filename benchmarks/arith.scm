@@ -0,0 +1,35 @@
+; Fixnum arithmetic and comparison microbenchmark.
+;
+;     time ./interpreter < benchmarks/arith.scm
+;     time ./interpreter -fno-type-inference < benchmarks/arith.scm
+;
+; The first run calls the unchecked fixnum primitives where the optimizer can
+; prove the operands are fixnums; the second goes through the generic
+; primitives and their two-argument fast paths.  Neither loop overflows, so
+; both print the same results.
+
+(define (sum-squares n)
+  (do ((i 0 (+ i 1))
+       (acc 0 (+ acc (* i i))))
+      ((= i n) acc)))
+
+(define (count-below n limit)
+  (let loop ((i 0) (count 0))
+    (if (< i n)
+        (loop (+ i 1) (if (<= (- (* 3 i) 7) limit) (+ count 1) count))
+        count)))
+
+(define (collatz-steps n)
+  (let loop ((n n) (steps 0))
+    (cond ((= n 1) steps)
+          ((= (modulo n 2) 0) (loop (/ n 2) (+ steps 1)))
+          (else (loop (+ (* 3 n) 1) (+ steps 1))))))
+
+(define (collatz-total n)
+  (do ((i 1 (+ i 1))
+       (total 0 (+ total (collatz-steps i))))
+      ((> i n) total)))
+
+(sum-squares 300000)
+(count-below 300000 450000)
+(collatz-total 3000)
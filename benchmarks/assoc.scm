@@ -0,0 +1,36 @@
+; Repeated association list lookup microbenchmark.
+;
+;     time ./interpreter < benchmarks/assoc.scm
+;
+; Looks up 20000 keys, lists of two fixnums, with assoc in one association
+; list of 3000 entries, as legacy scripts do.  The lookups are timed
+; twice: once as they are, which after the first few searches answers from
+; the hidden index assoc builds for the list, and once with a set-car! on an
+; unrelated pair before each lookup, which discards the index so that every
+; lookup searches the list.
+
+(define (make-key i)
+  (list (quotient i 7) (remainder i 7)))
+
+(define table
+  (let loop ((i 2999) (alist '()))
+    (if (< i 0) alist (loop (- i 1) (cons (cons (make-key i) i) alist)))))
+
+(define scratch (list 0))
+
+(define (lookups n mutate)
+  (let loop ((i 0) (sum 0))
+    (if (= i n)
+        sum
+        (begin
+          (if mutate (set-car! scratch i) #f)
+          (loop (+ i 1) (+ sum (cdr (assoc (make-key (modulo (* i 7919) 3000)) table))))))))
+
+(define (time-jiffies thunk)
+  (let ((start (current-jiffy)))
+    (thunk)
+    (- (current-jiffy) start)))
+
+(= (lookups 2000 #f) (lookups 2000 #t))
+(time-jiffies (lambda () (lookups 20000 #f)))
+(time-jiffies (lambda () (lookups 20000 #t)))
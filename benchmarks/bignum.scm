@@ -0,0 +1,42 @@
+; Bignum multiplication microbenchmark.
+;
+;     time ./interpreter < benchmarks/bignum.scm
+;
+; Computes 100000! by multiplying the two halves of the range recursively,
+; so that the large products are between operands of similar size, where
+; Karatsuba multiplication pays off, and the 100000th Fibonacci number by
+; fast doubling.  Values are never freed, so the plain loops, which build a
+; new bignum at every step, would run out of memory first.  Printing the
+; 456574 digits of 100000! would take longer than computing it, so only
+; the remainders of both by a large prime are shown.
+
+(define (product lo hi)
+  (if (> (- hi lo) 8)
+      (let ((mid (quotient (+ lo hi) 2)))
+        (* (product lo mid) (product (+ mid 1) hi)))
+      (do ((i lo (+ i 1))
+           (acc 1 (* acc i)))
+          ((> i hi) acc))))
+
+(define (factorial n)
+  (product 1 n))
+
+; Returns (F(n) . F(n + 1)), using F(2k) = F(k) (2 F(k + 1) - F(k)) and
+; F(2k + 1) = F(k)^2 + F(k + 1)^2.
+(define (fib-pair n)
+  (if (= n 0)
+      (cons 0 1)
+      (let* ((p (fib-pair (quotient n 2)))
+             (a (car p))
+             (b (cdr p))
+             (c (* a (- (* 2 b) a)))
+             (d (+ (* a a) (* b b))))
+        (if (= (remainder n 2) 0)
+            (cons c d)
+            (cons d (+ c d))))))
+
+(define (fib n)
+  (car (fib-pair n)))
+
+(modulo (factorial 100000) 1000000007)
+(modulo (fib 100000) 1000000007)
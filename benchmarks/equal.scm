@@ -0,0 +1,40 @@
+; equal? microbenchmark.
+;
+;     time ./interpreter < benchmarks/equal.scm
+;
+; Compares two equal trees of 40000 pairs, and two which differ only in
+; their last atom, 500 times each.  The first two comparisons of each walk
+; the trees; later ones are answered from the structural hashes cached for
+; them, until a set-car! anywhere discards the cache, as it does before the
+; last round.  Then compares two lists nested a million deep in their cars,
+; which the recursive equal? overflowed the C stack on.
+
+(define (tree depth leaf)
+  (if (= depth 0)
+      (list leaf "leaf" 'sym)
+      (cons (tree (- depth 1) 0) (tree (- depth 1) leaf))))
+
+(define a (tree 13 1))
+(define b (tree 13 1))
+(define c (tree 13 2))
+
+(define (repeat n thunk)
+  (let loop ((i 0) (result #f))
+    (if (= i n) result (loop (+ i 1) (thunk)))))
+
+(define (time-jiffies thunk)
+  (let ((start (current-jiffy)))
+    (thunk)
+    (- (current-jiffy) start)))
+
+(time-jiffies (lambda () (repeat 500 (lambda () (equal? a b)))))
+(time-jiffies (lambda () (repeat 500 (lambda () (equal? a c)))))
+(set-car! (list 0) 1)
+(repeat 500 (lambda () (equal? a b)))
+(repeat 500 (lambda () (equal? a c)))
+
+(define (nest n)
+  (let loop ((i 0) (acc '()))
+    (if (= i n) acc (loop (+ i 1) (list acc)))))
+
+(equal? (nest 1000000) (nest 1000000))
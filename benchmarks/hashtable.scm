@@ -0,0 +1,53 @@
+; Hash table microbenchmark.
+;
+;     time ./interpreter < benchmarks/hashtable.scm
+;
+; Looks up each of 2000 keys, lists of two fixnums compared under equal?,
+; first in an association list searched by recursive Scheme code, which
+; takes time proportional to the square of the number of keys, and then in
+; a hash table, and then counts the words of a small text repeated 20000
+; times in a string=? table.  The load-factor statistics of each table are
+; shown, for tuning.
+
+(define (make-key i)
+  (list (quotient i 7) (remainder i 7)))
+
+(define (build-alist n)
+  (let loop ((i 0) (alist '()))
+    (if (= i n) alist (loop (+ i 1) (cons (cons (make-key i) i) alist)))))
+
+(define (assoc-ref key alist)
+  (cond ((null? alist) #f)
+        ((equal? key (car (car alist))) (cdr (car alist)))
+        (else (assoc-ref key (cdr alist)))))
+
+(define (sum-alist alist n)
+  (let loop ((i 0) (sum 0))
+    (if (= i n) sum (loop (+ i 1) (+ sum (assoc-ref (make-key i) alist))))))
+
+(define (build-table n)
+  (let ((table (make-hash-table equal?)))
+    (do ((i 0 (+ i 1)))
+        ((= i n) table)
+      (hash-table-set! table (make-key i) i))))
+
+(define (sum-table table n)
+  (let loop ((i 0) (sum 0))
+    (if (= i n) sum (loop (+ i 1) (+ sum (hash-table-ref table (make-key i)))))))
+
+(define words '("the" "quick" "brown" "fox" "jumps" "over" "the" "lazy" "dog"))
+
+(define (count-words table times)
+  (do ((i 0 (+ i 1)))
+      ((= i times) table)
+    (do ((w words (cdr w)))
+        ((null? w))
+      (hash-table-update!/default table (car w) (lambda (n) (+ n 1)) 0))))
+
+(sum-alist (build-alist 2000) 2000)
+(define table (build-table 2000))
+(sum-table table 2000)
+(hash-table-stats table)
+(define counts (count-words (make-hash-table string=?) 20000))
+(hash-table-ref counts "the")
+(hash-table-stats counts)
@@ -0,0 +1,58 @@
+; List library microbenchmark.
+;
+;     time ./interpreter < benchmarks/list.scm
+;
+; Runs length, reverse, list-ref, assoc and for-each over a list of 200000
+; elements, first as Scheme definitions written as loops, then as the
+; native procedures, which walk the list in a loop in C.  The
+; last lines print and compare a list of a million elements, which the old
+; recursive printer overflowed the C stack on.
+
+(define (iota n)
+  (let loop ((i (- n 1)) (acc '()))
+    (if (< i 0) acc (loop (- i 1) (cons i acc)))))
+
+(define (scheme-length list)
+  (let loop ((list list) (n 0))
+    (if (null? list) n (loop (cdr list) (+ n 1)))))
+
+(define (scheme-reverse list)
+  (let loop ((list list) (acc '()))
+    (if (null? list) acc (loop (cdr list) (cons (car list) acc)))))
+
+(define (scheme-list-ref list k)
+  (let loop ((list list) (k k))
+    (if (= k 0) (car list) (loop (cdr list) (- k 1)))))
+
+(define (scheme-assoc key alist)
+  (let loop ((alist alist))
+    (cond ((null? alist) #f)
+          ((equal? key (car (car alist))) (car alist))
+          (else (loop (cdr alist))))))
+
+(define (scheme-for-each f list)
+  (let loop ((list list))
+    (if (null? list) #t (begin (f (car list)) (loop (cdr list))))))
+
+(define items (iota 200000))
+(define alist (map (lambda (i) (cons (list i) i)) items))
+(define total 0)
+
+(scheme-length items)
+(car (scheme-reverse items))
+(scheme-list-ref items 199999)
+(scheme-assoc (list 199999) alist)
+(scheme-for-each (lambda (x) (set! total (+ total x))) items)
+total
+
+(set! total 0)
+(length items)
+(car (reverse items))
+(list-ref items 199999)
+(assoc (list 199999) alist)
+(for-each (lambda (x) (set! total (+ total x))) items)
+total
+
+(define million (iota 1000000))
+(equal? million (reverse (reverse million)))
+(length (list-tail million 999990))
@@ -0,0 +1,64 @@
+; Matrix multiplication test and benchmark.
+;
+;     ./interpreter < benchmarks/matrix.scm
+;     ./interpreter -fmatrix-threads=4 < benchmarks/matrix.scm
+;
+; First checks matrix-multiply against a naive multiply of nested lists, for
+; shapes which are not multiples of the block size or the SIMD width.  Both
+; sum each element in order of the inner index, so they must agree exactly.
+; Then times the product of two 512 by 512 matrices and shows the rate in
+; GFLOP/s.
+
+(define (iota n)
+  (let loop ((i (- n 1)) (acc '()))
+    (if (< i 0) acc (loop (- i 1) (cons i acc)))))
+
+; A rows by cols list of lists of numbers which are not exactly representable
+; in few bits, so that any change in summation order shows.
+(define (test-rows rows cols seed)
+  (map (lambda (i)
+         (map (lambda (j) (/ (+ (* i 7.1) (* j 3.3) seed) 17.0))
+              (iota cols)))
+       (iota rows)))
+
+(define (list-ref xs k)
+  (if (= k 0) (car xs) (list-ref (cdr xs) (- k 1))))
+
+(define (length xs)
+  (if (null? xs) 0 (+ 1 (length (cdr xs)))))
+
+(define (column rows j)
+  (map (lambda (row) (list-ref row j)) rows))
+
+(define (dot xs ys)
+  (let loop ((xs xs) (ys ys) (acc 0.0))
+    (if (null? xs) acc (loop (cdr xs) (cdr ys) (+ acc (* (car xs) (car ys)))))))
+
+(define (naive-multiply a b)
+  (let ((cols (map (lambda (j) (column b j)) (iota (length (car b))))))
+    (map (lambda (row) (map (lambda (col) (dot row col)) cols)) a)))
+
+(define (check n m p)
+  (let ((a (test-rows n m 1.0))
+        (b (test-rows m p 2.0)))
+    (equal? (matrix->list (matrix-multiply (list->matrix a) (list->matrix b)))
+            (naive-multiply a b))))
+
+(check 1 1 1)
+(check 3 5 2)
+(check 17 19 23)
+(check 130 131 129)
+(check 40 300 45)
+(let ((a (list->matrix (test-rows 37 53 0.5))))
+  (equal? (matrix->list (matrix-transpose a))
+          (let ((rows (matrix->list a)))
+            (map (lambda (j) (column rows j)) (iota 53)))))
+
+(define n 512)
+(define a (make-matrix n n 0.5))
+(define b (make-matrix n n 0.25))
+(define start (current-jiffy))
+(define c (matrix-multiply a b))
+(define seconds (/ (- (current-jiffy) start) (* 1.0 (jiffies-per-second))))
+(matrix-ref c 0 0)
+(/ (* 2.0 n n n) (* seconds 1000000000.0))
@@ -0,0 +1,61 @@
+; Memoization microbenchmark.
+;
+;     time ./interpreter < benchmarks/memo.scm
+;
+; Counts the lattice paths across a 10 by 10 grid three ways: by plain
+; exponential recursion, memoized by hand in an alist, as the scripts this
+; replaces did, and with define-memoized, whose native table keyed on the
+; argument list makes each of the 121 subproblems one call.  Then finds the
+; edit distance of two 120-element lists, and the 3000th Fibonacci number
+; under a cache of at most 8 entries, which is enough: each call's second
+; recursive call is for a result its first has just made.
+
+(define (paths r c)
+  (if (or (= r 0) (= c 0)) 1 (+ (paths (- r 1) c) (paths r (- c 1)))))
+
+(define table '())
+
+(define (alist-paths r c)
+  (let ((known (assoc (list r c) table)))
+    (if (not (eq? known #f))
+        (cdr known)
+        (let ((result (if (or (= r 0) (= c 0))
+                          1
+                          (+ (alist-paths (- r 1) c) (alist-paths r (- c 1))))))
+          (set! table (cons (cons (list r c) result) table))
+          result))))
+
+(define-memoized (memo-paths r c)
+  (if (or (= r 0) (= c 0)) 1 (+ (memo-paths (- r 1) c) (memo-paths r (- c 1)))))
+
+(paths 10 10)
+(alist-paths 10 10)
+(memo-paths 10 10)
+(memoize-stats memo-paths)
+
+(define (numbers n seed)
+  (let loop ((i 0) (x seed) (acc '()))
+    (if (= i n) acc (loop (+ i 1) (modulo (+ (* x 1103515245) 12345) 2147483648) (cons (modulo x 10) acc)))))
+
+(define a (numbers 120 1))
+(define b (numbers 120 2))
+
+(define (min-of x y z)
+  (if (< x y) (if (< x z) x z) (if (< y z) y z)))
+
+(define-memoized (edit a b)
+  (cond ((null? a) (length b))
+        ((null? b) (length a))
+        ((= (car a) (car b)) (edit (cdr a) (cdr b)))
+        (else (+ 1 (min-of (edit (cdr a) b) (edit a (cdr b)) (edit (cdr a) (cdr b)))))))
+
+(edit a b)
+(memoize-stats edit)
+
+(define fib
+  (memoize
+   (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+   8))
+
+(fib 3000)
+(memoize-stats fib)
@@ -0,0 +1,58 @@
+; Persistent collection microbenchmark.
+;
+;     time ./interpreter < benchmarks/persistent.scm
+;
+; Makes 1000 functional updates to a collection of 1000 elements, keeping
+; every version: first to a list, where each update copies the elements
+; before the one changed with append, and then to a pvector, where each
+; copies only the path to it, and likewise 1000 functional updates to maps
+; of 1000 keys, as association lists, where each update removes the old
+; pair by copying the list, and as pmaps.  Every version is kept, as
+; functional code often does, so the lists cost memory in proportion to
+; their size and the persistent collections to the logarithm of theirs.
+
+(define n 1000)
+
+(define (iota n)
+  (let loop ((i (- n 1)) (acc '()))
+    (if (< i 0) acc (loop (- i 1) (cons i acc)))))
+
+(define (take xs k)
+  (if (= k 0) '() (cons (car xs) (take (cdr xs) (- k 1)))))
+
+(define (drop xs k)
+  (if (= k 0) xs (drop (cdr xs) (- k 1))))
+
+(define (list-set xs k x)
+  (append (take xs k) (cons x (drop (cdr xs) k))))
+
+(define (list-ref xs k)
+  (if (= k 0) (car xs) (list-ref (cdr xs) (- k 1))))
+
+(define (alist-set alist key value)
+  (cons (cons key value) (filter (lambda (pair) (not (equal? (car pair) key))) alist)))
+
+(define (alist-ref alist key)
+  (cond ((null? alist) #f)
+        ((equal? (car (car alist)) key) (cdr (car alist)))
+        (else (alist-ref (cdr alist) key))))
+
+; Applies update to version i - 1 to make version i, for i up to n, and
+; returns the list of all the versions, newest first.
+(define (versions first update)
+  (let loop ((i 1) (all (list first)))
+    (if (> i n) all (loop (+ i 1) (cons (update (car all) i) all)))))
+
+(define (slot i) (modulo (* i 7919) n))
+
+(define lists (versions (iota n) (lambda (xs i) (list-set xs (slot i) (- i)))))
+(list-ref (car lists) (slot n))
+(define pvectors (versions (list->pvector (iota n)) (lambda (v i) (pvector-set v (slot i) (- i)))))
+(pvector-ref (car pvectors) (slot n))
+(equal? (pvector->list (car pvectors)) (car lists))
+
+(define alists (versions (map (lambda (i) (cons i i)) (iota n)) (lambda (a i) (alist-set a (slot i) (- i)))))
+(alist-ref (car alists) (slot n))
+(define pmaps (versions (alist->pmap (map (lambda (i) (cons i i)) (iota n))) (lambda (m i) (pmap-set m (slot i) (- i)))))
+(pmap-ref (car pmaps) (slot n))
+(equal? (car pmaps) (alist->pmap (car alists)))
@@ -0,0 +1,45 @@
+; Sorting microbenchmark.
+;
+;     time ./interpreter < benchmarks/sort.scm
+;     time ./interpreter -fsort-threads=1 < benchmarks/sort.scm
+;
+; Sorts 2000 pseudo-random fixnums with the insertion sort in Scheme which
+; our scripts have used, then with the native sort given a closure, which
+; calls back into the interpreter for each comparison, then with the native
+; sort given <, which compares in C.  Then sorts 200000 fixnums with <,
+; which is split across threads unless -fsort-threads=1, and sorts the
+; result again, which takes one pass since it is a single run.
+
+(define (lcg x) (modulo (+ (* x 1103515245) 12345) 2147483648))
+
+(define (randoms n seed)
+  (let loop ((i 0) (x seed) (acc '()))
+    (if (= i n) acc (loop (+ i 1) (lcg x) (cons (modulo x 1000000) acc)))))
+
+(define (insert x sorted)
+  (if (null? sorted)
+      (list x)
+      (if (< x (car sorted))
+          (cons x sorted)
+          (cons (car sorted) (insert x (cdr sorted))))))
+
+(define (insertion-sort list)
+  (fold insert '() list))
+
+(define (time-jiffies thunk)
+  (let ((start (current-jiffy)))
+    (thunk)
+    (- (current-jiffy) start)))
+
+(define small (randoms 2000 7))
+(equal? (insertion-sort small) (sort small <))
+(time-jiffies (lambda () (insertion-sort small)))
+(time-jiffies (lambda () (sort small (lambda (a b) (< a b)))))
+(time-jiffies (lambda () (sort small <)))
+
+(define large (list->vector (randoms 200000 11)))
+(define sorted #f)
+(time-jiffies (lambda () (set! sorted (sort large <))))
+(time-jiffies (lambda () (sort sorted <)))
+(vector-ref sorted 0)
+(vector-ref sorted 199999)
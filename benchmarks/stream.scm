@@ -0,0 +1,33 @@
+; Stream microbenchmark.
+;
+;     time ./interpreter < benchmarks/stream.scm
+;
+; Sums the squares of the first 20000 integers divisible by 7 drawn from
+; the unbounded stream of the naturals, through stream-filter, stream-map
+; and stream-take, computing only the 140000 naturals needed; the eager
+; version must guess a bound and builds the whole list of naturals, then
+; its filtered and mapped copies.  Then forces a chain of a million
+; delay-forces, and finds the first element past 500000 of a filtered
+; stream, each of which recursive forcing would overflow the C stack on.
+
+(define (ints n) (stream-cons n (ints (+ n 1))))
+
+(define (stream-sum s)
+  (let loop ((s s) (acc 0))
+    (if (stream-null? s) acc (loop (stream-cdr s) (+ acc (stream-car s))))))
+
+(define (divisible? x) (= 0 (modulo x 7)))
+
+(stream-sum (stream-take 20000 (stream-map (lambda (x) (* x x)) (stream-filter divisible? (ints 1)))))
+
+(define (range n)
+  (let loop ((i n) (acc '()))
+    (if (= i 0) acc (loop (- i 1) (cons i acc)))))
+
+(fold + 0 (map (lambda (x) (* x x)) (filter divisible? (range 140000))))
+
+(define (chain n) (if (= n 0) (delay 'done) (delay-force (chain (- n 1)))))
+
+(force (chain 1000000))
+
+(stream-car (stream-filter (lambda (x) (> x 500000)) (ints 0)))
@@ -0,0 +1,33 @@
+; String microbenchmark.
+;
+;     time ./interpreter < benchmarks/string.scm
+;     time ./interpreter -fno-simd < benchmarks/string.scm
+;
+; Builds a 2MB string of comma-separated records by appending one record at
+; a time, which joins ropes rather than copying the string each time; then
+; searches it 200 times for a pattern found only at its end, which compares
+; 16 or 32 candidate positions at once against the first and last bytes of
+; the pattern; then splits it into its 400000 fields, each a substring
+; sharing the characters of the whole, and reads back the numbers in a few.
+
+(define (repeat n thunk)
+  (let loop ((i 0) (result #f))
+    (if (= i n) result (loop (+ i 1) (thunk)))))
+
+(define text
+  (let loop ((i 0) (acc ""))
+    (if (= i 100000)
+        (string-append acc "a-needle-in-the-haystack")
+        (loop (+ i 1) (string-append acc "alpha," (number->string i) ",beta,gamma,")))))
+
+(string-length text)
+
+(repeat 200 (lambda () (string-search "a-needle" text)))
+
+(define fields (string-split text ","))
+
+(length fields)
+
+(string->number (list-ref fields 1))
+(string->number (list-ref fields 399997))
+(string-search "zzz" text)
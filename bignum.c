@@ -0,0 +1,481 @@
+/* bignum.c
+ *
+ * Arbitrary-precision integers, which fixnum arithmetic overflows into.  A
+ * magnitude is an array of 32-bit limbs, least significant first, so that
+ * the product of two limbs plus two more fits in 64 bits.  Multiplication
+ * is schoolbook below KARATSUBA_THRESHOLD limbs and Karatsuba above it;
+ * division is Knuth's algorithm D.
+ *
+ * The limbs of results are allocated with talloc, like every other value;
+ * scratch space for intermediate products is allocated with malloc and freed
+ * before returning, since a large product would otherwise leave several
+ * times its own size behind in the arena.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "bignum.h"
+
+// Operands with fewer limbs than this are multiplied by the schoolbook
+// method, whose lower overhead wins below it.
+#define KARATSUBA_THRESHOLD 32
+
+// The largest power of ten which fits in a limb, and its exponent.
+#define DECIMAL_LIMB 1000000000
+#define DECIMAL_LIMB_DIGITS 9
+
+
+////////////////////////////////////////
+////////////// MAGNITUDES //////////////
+////////////////////////////////////////
+
+/* Returns scratch space for n limbs, to be released with free. */
+uint32_t *scratch_limbs(int n) {
+    uint32_t *limbs = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    assert(limbs != NULL);
+    return limbs;
+}
+
+/* Returns the number of limbs in the magnitude a of n limbs without its
+ * leading zero limbs. */
+int limbs_trim(const uint32_t *a, int n) {
+    while (n > 0 && a[n - 1] == 0)
+        n--;
+    return n;
+}
+
+/* Returns a negative number, zero or a positive number as the trimmed
+ * magnitude a is less than, equal to or greater than the trimmed b. */
+int mag_compare(const uint32_t *a, int an, const uint32_t *b, int bn) {
+    int i;
+    if (an != bn)
+        return an > bn ? 1 : -1;
+    for (i = an - 1; i >= 0; i--)
+        if (a[i] != b[i])
+            return a[i] > b[i] ? 1 : -1;
+    return 0;
+}
+
+/* Stores a + b in r, which has room for an + 1 limbs and may be a, and
+ * returns its size.  Requires an >= bn. */
+int mag_add(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    uint64_t carry = 0;
+    int i;
+    for (i = 0; i < bn; i++) {
+        carry += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; i < an; i++) {
+        carry += a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r[an] = (uint32_t)carry;
+    return an + (carry != 0);
+}
+
+/* Adds b into the rn limbs of r, which must be enough to hold the sum. */
+void mag_add_into(uint32_t *r, int rn, const uint32_t *b, int bn) {
+    uint64_t carry = 0;
+    int i;
+    for (i = 0; i < bn; i++) {
+        carry += (uint64_t)r[i] + b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry != 0 && i < rn; i++) {
+        carry += r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+/* Stores a - b in r, which may be a, and returns its trimmed size.  Requires
+ * a >= b and an >= bn. */
+int mag_sub(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    uint64_t borrow = 0, difference;
+    int i;
+    for (i = 0; i < bn; i++) {
+        difference = (uint64_t)a[i] - b[i] - borrow;
+        r[i] = (uint32_t)difference;
+        borrow = difference >> 63;
+    }
+    for (; i < an; i++) {
+        difference = (uint64_t)a[i] - borrow;
+        r[i] = (uint32_t)difference;
+        borrow = difference >> 63;
+    }
+    return limbs_trim(r, an);
+}
+
+/* Stores the an + bn limbs of a * b in r, which must not overlap a or b. */
+void mag_mul_schoolbook(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    uint64_t carry, limb;
+    int i, j;
+    memset(r, 0, sizeof(uint32_t) * (an + bn));
+    for (i = 0; i < bn; i++) {
+        limb = b[i];
+        if (limb == 0)
+            continue;
+        carry = 0;
+        for (j = 0; j < an; j++) {
+            carry += a[j] * limb + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + an] = (uint32_t)carry;
+    }
+}
+
+void mag_mul(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn);
+
+/* Stores the an + bn limbs of a * b in r by Karatsuba's method, splitting
+ * both at m limbs: with a = a1 B^m + a0 and b = b1 B^m + b0, the middle term
+ * a1 b0 + a0 b1 is (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, so three products of
+ * half the size replace four.  Requires an >= bn > an / 2. */
+void mag_karatsuba(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    int m = an / 2, sa_size, sb_size, z_size;
+    uint32_t *sa, *sb, *z;
+    // a0 b0 and a1 b1 go straight to their places in r
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+    sa = scratch_limbs(an - m + 1);
+    sb = scratch_limbs((bn - m > m ? bn - m : m) + 1);
+    z = scratch_limbs(an + bn + 2);
+    sa_size = mag_add(sa, a + m, an - m, a, m);
+    if (bn - m >= m)
+        sb_size = mag_add(sb, b + m, bn - m, b, m);
+    else
+        sb_size = mag_add(sb, b, m, b + m, bn - m);
+    mag_mul(z, sa, sa_size, sb, sb_size);
+    z_size = limbs_trim(z, sa_size + sb_size);
+    z_size = mag_sub(z, z, z_size, r, limbs_trim(r, 2 * m));
+    z_size = mag_sub(z, z, z_size, r + 2 * m, limbs_trim(r + 2 * m, an + bn - 2 * m));
+    mag_add_into(r + m, an + bn - m, z, z_size);
+    free(sa);
+    free(sb);
+    free(z);
+}
+
+/* Stores the an + bn limbs of a * b in r, which must not overlap a or b. */
+void mag_mul(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    const uint32_t *swap;
+    uint32_t *product;
+    int i, n;
+    if (an < bn) {
+        swap = a, a = b, b = swap;
+        n = an, an = bn, bn = n;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        mag_mul_schoolbook(r, a, an, b, bn);
+    } else if (bn > an / 2) {
+        mag_karatsuba(r, a, an, b, bn);
+    } else {
+        // Splitting unbalanced operands in half would leave b1 empty, so a
+        // is instead multiplied by b in pieces of bn limbs
+        product = scratch_limbs(2 * bn);
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for (i = 0; i < an; i += bn) {
+            n = an - i < bn ? an - i : bn;
+            mag_mul(product, a + i, n, b, bn);
+            mag_add_into(r + i, an + bn - i, product, n + bn);
+        }
+        free(product);
+    }
+}
+
+/* Stores in q the an limbs of a divided by the single limb d, and returns
+ * the remainder.  q may be a. */
+uint32_t mag_divmod_limb(uint32_t *q, const uint32_t *a, int an, uint32_t d) {
+    uint64_t remainder = 0, current;
+    int i;
+    for (i = an - 1; i >= 0; i--) {
+        current = remainder << 32 | a[i];
+        q[i] = (uint32_t)(current / d);
+        remainder = current % d;
+    }
+    return remainder;
+}
+
+/* Stores in q the an - bn + 1 limbs of the quotient of a by b, and in r the
+ * bn limbs of the remainder, by Knuth's algorithm D.  Requires the trimmed
+ * sizes an >= bn >= 2. */
+void mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn) {
+    uint32_t *un, *vn;
+    uint64_t numerator, qhat, rhat, product, carry;
+    int64_t t, borrow;
+    int shift, i, j;
+    un = scratch_limbs(an + 1);
+    vn = scratch_limbs(bn);
+    // Shift both so that the top limb of the divisor has its high bit set,
+    // which makes each estimate qhat at most two too large
+    shift = __builtin_clz(b[bn - 1]);
+    for (i = bn - 1; i > 0; i--)
+        vn[i] = b[i] << shift | (uint32_t)((uint64_t)b[i - 1] >> (32 - shift));
+    vn[0] = b[0] << shift;
+    un[an] = (uint32_t)((uint64_t)a[an - 1] >> (32 - shift));
+    for (i = an - 1; i > 0; i--)
+        un[i] = a[i] << shift | (uint32_t)((uint64_t)a[i - 1] >> (32 - shift));
+    un[0] = a[0] << shift;
+    for (j = an - bn; j >= 0; j--) {
+        numerator = (uint64_t)un[j + bn] << 32 | un[j + bn - 1];
+        qhat = numerator / vn[bn - 1];
+        rhat = numerator % vn[bn - 1];
+        while (qhat >> 32 != 0 || qhat * vn[bn - 2] > (rhat << 32 | un[j + bn - 2])) {
+            qhat--;
+            rhat += vn[bn - 1];
+            if (rhat >> 32 != 0)
+                break;
+        }
+        // Subtract qhat times the divisor from the current window
+        borrow = 0;
+        for (i = 0; i < bn; i++) {
+            product = qhat * vn[i];
+            t = (int64_t)un[i + j] - borrow - (int64_t)(product & 0xFFFFFFFF);
+            un[i + j] = (uint32_t)t;
+            borrow = (int64_t)(product >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + bn] - borrow;
+        un[j + bn] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            // qhat was one too large, so add the divisor back
+            q[j]--;
+            carry = 0;
+            for (i = 0; i < bn; i++) {
+                carry += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            un[j + bn] += (uint32_t)carry;
+        }
+    }
+    for (i = 0; i < bn - 1; i++)
+        r[i] = un[i] >> shift | (uint32_t)((uint64_t)un[i + 1] << (32 - shift));
+    r[bn - 1] = un[bn - 1] >> shift;
+    free(un);
+    free(vn);
+}
+
+
+////////////////////////////////////////
+/////////////// INTEGERS ///////////////
+////////////////////////////////////////
+
+/* Stores the exact integer x in b, using the two limbs of buffer for the
+ * magnitude of a fixnum.  Zero has size 0. */
+void bignum_view(Value *x, struct Bignum *b, uint32_t *buffer) {
+    unsigned long magnitude;
+    if (x->type == BIGNUM_TYPE) {
+        *b = x->big;
+        return;
+    }
+    b->sign = x->i < 0 ? -1 : 1;
+    magnitude = x->i < 0 ? 0UL - (unsigned long)x->i : (unsigned long)x->i;
+    buffer[0] = (uint32_t)magnitude;
+    buffer[1] = (uint32_t)(magnitude >> 32);
+    b->limbs = buffer;
+    b->size = limbs_trim(buffer, 2);
+}
+
+/* Returns the integer with the given sign and the magnitude in the size
+ * limbs, which must be allocated with talloc: a fixnum if it fits in one. */
+Value *bignum_result(int sign, uint32_t *limbs, int size) {
+    Value *result;
+    unsigned long magnitude;
+    size = limbs_trim(limbs, size);
+    if (size <= 2) {
+        magnitude = size == 0 ? 0 : limbs[0];
+        if (size == 2)
+            magnitude |= (unsigned long)limbs[1] << 32;
+        if (magnitude <= LONG_MAX)
+            return makeInt(sign < 0 ? -(long)magnitude : (long)magnitude);
+        if (sign < 0 && magnitude == (unsigned long)LONG_MAX + 1)
+            return makeInt(LONG_MIN);
+    }
+    result = talloc(sizeof(Value));
+    result->type = BIGNUM_TYPE;
+    result->big.sign = sign;
+    result->big.size = size;
+    result->big.limbs = limbs;
+    return result;
+}
+
+/* Returns a + b, where b has the given sign in place of its own. */
+Value *bignum_add_signed(struct Bignum *a, struct Bignum *b, int b_sign) {
+    uint32_t *limbs;
+    int comparison;
+    if (a->size < b->size)
+        limbs = talloc(sizeof(uint32_t) * (b->size + 1));
+    else
+        limbs = talloc(sizeof(uint32_t) * (a->size + 1));
+    if (a->sign == b_sign) {
+        if (a->size < b->size)
+            return bignum_result(b_sign, limbs, mag_add(limbs, b->limbs, b->size, a->limbs, a->size));
+        return bignum_result(a->sign, limbs, mag_add(limbs, a->limbs, a->size, b->limbs, b->size));
+    }
+    comparison = mag_compare(a->limbs, a->size, b->limbs, b->size);
+    if (comparison < 0)
+        return bignum_result(b_sign, limbs, mag_sub(limbs, b->limbs, b->size, a->limbs, a->size));
+    return bignum_result(a->sign, limbs, mag_sub(limbs, a->limbs, a->size, b->limbs, b->size));
+}
+
+Value *bignum_add(Value *x, Value *y) {
+    struct Bignum a, b;
+    uint32_t a_buffer[2], b_buffer[2];
+    bignum_view(x, &a, a_buffer);
+    bignum_view(y, &b, b_buffer);
+    return bignum_add_signed(&a, &b, b.sign);
+}
+
+Value *bignum_sub(Value *x, Value *y) {
+    struct Bignum a, b;
+    uint32_t a_buffer[2], b_buffer[2];
+    bignum_view(x, &a, a_buffer);
+    bignum_view(y, &b, b_buffer);
+    return bignum_add_signed(&a, &b, -b.sign);
+}
+
+Value *bignum_mul(Value *x, Value *y) {
+    struct Bignum a, b;
+    uint32_t a_buffer[2], b_buffer[2], *limbs;
+    bignum_view(x, &a, a_buffer);
+    bignum_view(y, &b, b_buffer);
+    if (a.size == 0 || b.size == 0)
+        return makeInt(0);
+    limbs = talloc(sizeof(uint32_t) * (a.size + b.size));
+    mag_mul(limbs, a.limbs, a.size, b.limbs, b.size);
+    return bignum_result(a.sign * b.sign, limbs, a.size + b.size);
+}
+
+void bignum_divmod(Value *x, Value *y, Value **quotient, Value **remainder) {
+    struct Bignum a, b;
+    uint32_t a_buffer[2], b_buffer[2], *q, *r;
+    bignum_view(x, &a, a_buffer);
+    bignum_view(y, &b, b_buffer);
+    if (mag_compare(a.limbs, a.size, b.limbs, b.size) < 0) {
+        if (quotient != NULL)
+            *quotient = makeInt(0);
+        if (remainder != NULL)
+            *remainder = x;
+        return;
+    }
+    q = talloc(sizeof(uint32_t) * (a.size - b.size + 1));
+    r = talloc(sizeof(uint32_t) * b.size);
+    if (b.size == 1)
+        r[0] = mag_divmod_limb(q, a.limbs, a.size, b.limbs[0]);
+    else
+        mag_divmod(q, r, a.limbs, a.size, b.limbs, b.size);
+    if (quotient != NULL)
+        *quotient = bignum_result(a.sign * b.sign, q, a.size - b.size + 1);
+    if (remainder != NULL)
+        *remainder = bignum_result(a.sign, r, b.size);
+}
+
+Value *bignum_expt(Value *base, unsigned long exponent) {
+    Value *result = makeInt(1);
+    while (exponent != 0) {
+        if (exponent & 1)
+            result = bignum_mul(result, base);
+        exponent >>= 1;
+        if (exponent != 0)
+            base = bignum_mul(base, base);
+    }
+    return result;
+}
+
+int bignum_sign(Value *x) {
+    if (x->type == BIGNUM_TYPE)
+        return x->big.sign;
+    return (x->i > 0) - (x->i < 0);
+}
+
+int bignum_compare(Value *x, Value *y) {
+    struct Bignum a, b;
+    uint32_t a_buffer[2], b_buffer[2];
+    int x_sign = bignum_sign(x), y_sign = bignum_sign(y);
+    if (x_sign != y_sign)
+        return x_sign - y_sign;
+    bignum_view(x, &a, a_buffer);
+    bignum_view(y, &b, b_buffer);
+    if (x_sign < 0)
+        return mag_compare(b.limbs, b.size, a.limbs, a.size);
+    return mag_compare(a.limbs, a.size, b.limbs, b.size);
+}
+
+double bignum_to_double(Value *x) {
+    double d = 0;
+    int i;
+    if (x->type != BIGNUM_TYPE)
+        return (double)x->i;
+    for (i = x->big.size - 1; i >= 0; i--)
+        d = d * 4294967296.0 + x->big.limbs[i];
+    return x->big.sign * d;
+}
+
+Value *bignum_parse(const char *digits) {
+    uint32_t *limbs, chunk, scale;
+    uint64_t carry;
+    int sign = 1, length, size = 0, i, j, chunk_length;
+    if (*digits == '-' || *digits == '+') {
+        sign = *digits == '-' ? -1 : 1;
+        digits++;
+    }
+    length = strlen(digits);
+    limbs = talloc(sizeof(uint32_t) * (length / DECIMAL_LIMB_DIGITS + 2));
+    // The first chunk takes the digits left over from whole chunks
+    chunk_length = length % DECIMAL_LIMB_DIGITS;
+    if (chunk_length == 0)
+        chunk_length = DECIMAL_LIMB_DIGITS;
+    for (i = 0; i < length; i += chunk_length, chunk_length = DECIMAL_LIMB_DIGITS) {
+        chunk = 0;
+        scale = 1;
+        for (j = 0; j < chunk_length; j++) {
+            chunk = chunk * 10 + (digits[i + j] - '0');
+            scale *= 10;
+        }
+        carry = chunk;
+        for (j = 0; j < size; j++) {
+            carry += (uint64_t)limbs[j] * scale;
+            limbs[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0)
+            limbs[size++] = (uint32_t)carry;
+    }
+    return bignum_result(sign, limbs, size);
+}
+
+void bignum_print(Value *x, FILE *fd) {
+    uint32_t *magnitude, *chunks;
+    int size, count = 0, i;
+    if (x->type != BIGNUM_TYPE) {
+        fprintf(fd, "%ld", x->i);
+        return;
+    }
+    // Dividing repeatedly by the largest power of ten in a limb gives the
+    // decimal digits nine at a time, least significant first
+    size = x->big.size;
+    magnitude = scratch_limbs(size);
+    chunks = scratch_limbs(size * 2 + 1);
+    for (i = 0; i < size; i++)
+        magnitude[i] = x->big.limbs[i];
+    while (size > 0) {
+        chunks[count++] = mag_divmod_limb(magnitude, magnitude, size, DECIMAL_LIMB);
+        size = limbs_trim(magnitude, size);
+    }
+    if (x->big.sign < 0)
+        fputc('-', fd);
+    fprintf(fd, "%u", chunks[--count]);
+    while (count > 0)
+        fprintf(fd, "%09u", chunks[--count]);
+    free(magnitude);
+    free(chunks);
+}
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _BIGNUM
+#define _BIGNUM
+
+// Every function here takes exact integers, each either an INT_TYPE fixnum
+// or a BIGNUM_TYPE, and returns them normalized: a result which fits in a
+// fixnum is always an INT_TYPE, so a BIGNUM_TYPE is never equal to a fixnum.
+
+/* Returns the sum of x and y. */
+Value *bignum_add(Value *x, Value *y);
+
+/* Returns the difference of x and y. */
+Value *bignum_sub(Value *x, Value *y);
+
+/* Returns the product of x and y. */
+Value *bignum_mul(Value *x, Value *y);
+
+/* Divides x by the nonzero y, storing the quotient, truncated toward zero, in
+ * quotient and the remainder, which has the sign of x, in remainder.  Either
+ * pointer may be NULL if that result is not needed. */
+void bignum_divmod(Value *x, Value *y, Value **quotient, Value **remainder);
+
+/* Returns base raised to the power exponent, by repeated squaring. */
+Value *bignum_expt(Value *base, unsigned long exponent);
+
+/* Returns a negative number, zero or a positive number as x is less than,
+ * equal to or greater than y. */
+int bignum_compare(Value *x, Value *y);
+
+/* Returns -1, 0 or 1 as x is negative, zero or positive. */
+int bignum_sign(Value *x);
+
+/* Returns the double nearest x, or an infinity if x is out of range. */
+double bignum_to_double(Value *x);
+
+/* Returns the integer written in decimal in the string, which consists of
+ * an optional sign followed by one or more digits. */
+Value *bignum_parse(const char *digits);
+
+/* Prints x in decimal to the stream. */
+void bignum_print(Value *x, FILE *fd);
+
+#endif
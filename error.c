@@ -0,0 +1,107 @@
+/* error.c
+ *
+ * Errors in the tokenizer, parser and interpreter are raised rather than
+ * ending the process, so that a catch point (the top level of interpret, a
+ * guard form, or a C host) can recover from them and carry on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "interpreter.h"
+#include "error.h"
+#include "strlib.h"
+
+struct ErrorHandler *ERROR_HANDLERS = NULL;
+
+// Memory stream holding the message of the error being reported.
+FILE *ERROR_STREAM = NULL;
+char *ERROR_BUFFER = NULL;
+size_t ERROR_BUFFER_SIZE = 0;
+
+/* Returns the stream to which the message of an error is written before
+ * raise_error is called. */
+FILE *error_stream() {
+    if (ERROR_STREAM == NULL) {
+        ERROR_STREAM = open_memstream(&ERROR_BUFFER, &ERROR_BUFFER_SIZE);
+        if (ERROR_STREAM == NULL)
+            return stderr;
+    }
+    return ERROR_STREAM;
+}
+
+/* Raises an error object holding the message written to error_stream since
+ * the last error, without its final newline. */
+void raise_error(int status) {
+    char *message;
+    FILE *stream = error_stream();
+    if (stream == stderr) {
+        message = "";
+    } else {
+        fclose(stream);
+        ERROR_STREAM = NULL;
+        while (ERROR_BUFFER_SIZE > 0 && ERROR_BUFFER[ERROR_BUFFER_SIZE - 1] == '\n')
+            ERROR_BUFFER_SIZE--;
+        message = talloc(ERROR_BUFFER_SIZE + 1);
+        memcpy(message, ERROR_BUFFER, ERROR_BUFFER_SIZE);
+        message[ERROR_BUFFER_SIZE] = '\0';
+        free(ERROR_BUFFER);
+        ERROR_BUFFER = NULL;
+    }
+    raise_condition(makeError(makeString(message), makeNull(), status), 0);
+    exit(status);   // not reached: a non-continuable raise does not return
+}
+
+/* Raises the value to the innermost catch point or handler. */
+Value *raise_condition(Value *condition, int continuable) {
+    struct ErrorHandler *handler = ERROR_HANDLERS;
+    Value *result;
+    if (handler == NULL) {
+        report_condition(condition, stderr);
+        texit(condition_status(condition));
+    }
+    if (handler->procedure == NULL) {
+        handler->condition = condition;
+        longjmp(handler->env, 1);
+    }
+    ERROR_HANDLERS = handler->outer;
+    result = apply(handler->procedure, 1, &condition);
+    if (continuable) {
+        ERROR_HANDLERS = handler;
+        return result;
+    }
+    // The handler's own handlers remain in effect for the secondary error
+    fprintf(error_stream(), "Evaluation error: exception handler returned from non-continuable raise of: ");
+    display_to_fd(condition, error_stream());
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+/* Returns the exit status for an uncaught raise of the value: that of an
+ * error raised by the implementation, or 4 as for any evaluation error. */
+int condition_status(Value *condition) {
+    if (condition->type == ERROR_TYPE && condition->err.status != 0)
+        return condition->err.status;
+    return 4;
+}
+
+/* Prints the message of an uncaught raise of the value to the stream: the
+ * message of an error raised by the implementation as it stands, and that of
+ * an error raised by the error procedure followed by its irritants. */
+void report_condition(Value *condition, FILE *fd) {
+    if (condition->type != ERROR_TYPE) {
+        fprintf(fd, "Evaluation error: uncaught raise of: ");
+        display_to_fd(condition, fd);
+    } else if (condition->err.status != 0) {
+        fprintf(fd, "%s\n", string_cstr(condition->err.message));
+    } else if (condition->err.irritants->type == CONS_TYPE) {
+        fprintf(fd, "Evaluation error: %s: ", string_cstr(condition->err.message));
+        display_to_fd(condition->err.irritants, fd);
+    } else {
+        fprintf(fd, "Evaluation error: %s\n", string_cstr(condition->err.message));
+    }
+}
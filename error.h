@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include "value.h"
+
+#ifndef _ERROR
+#define _ERROR
+
+/* A point to which a raised value is delivered, linked innermost first from
+ * ERROR_HANDLERS.  A catch point (procedure NULL) receives the value in
+ * condition, and control returns to it by longjmp to env; a handler installed
+ * by with-exception-handler is instead called on the value, in the dynamic
+ * context of the raise.  A C host catches errors by pushing a catch point:
+ *
+ *     struct ErrorHandler handler = {.outer = ERROR_HANDLERS};
+ *     if (setjmp(handler.env) == 0) {
+ *         ERROR_HANDLERS = &handler;
+ *         ...
+ *         ERROR_HANDLERS = handler.outer;
+ *     } else {
+ *         ERROR_HANDLERS = handler.outer;
+ *         report_condition(handler.condition, stderr);
+ *     }
+ */
+struct ErrorHandler {
+    jmp_buf env;
+    Value *procedure;
+    Value *condition;
+    struct Continuation *continuations;    // active when it was pushed
+    struct ErrorHandler *outer;
+};
+
+extern struct ErrorHandler *ERROR_HANDLERS;
+
+/* Returns the stream to which the message of an error is written before
+ * raise_error is called. */
+__attribute__((cold)) FILE *error_stream();
+
+/* Raises an error object holding the message written to error_stream since
+ * the last error.  If no catch point is active, prints the message to stderr
+ * and exits with the given status. */
+__attribute__((cold, noreturn)) void raise_error(int status);
+
+/* Raises the value: delivers it to the innermost catch point, or calls the
+ * innermost handler on it with the handlers outside it in effect.  If the
+ * raise is continuable, returns what the handler returns; otherwise a handler
+ * returning is itself an error. */
+Value *raise_condition(Value *condition, int continuable);
+
+/* Returns the exit status for an uncaught raise of the value. */
+int condition_status(Value *condition);
+
+/* Prints the message of an uncaught raise of the value to the stream. */
+void report_condition(Value *condition, FILE *fd);
+
+#endif
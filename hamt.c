@@ -0,0 +1,281 @@
+/* hamt.c
+ *
+ * Persistent maps as hash array mapped tries, with the layout of CHAMP:
+ * keys and children are kept in separate arrays indexed by population
+ * count, so a node of n entries takes n slots rather than 32, and a lookup
+ * makes one indexed load per five bits of hash.  Keys are hashed as by
+ * equal? hash tables (see hashtable.c) and compared with equal_helper.
+ *
+ * Every update allocates new copies of the nodes on the path from the root,
+ * at most thirteen of them, and shares all others with the old trie.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "interpreter.h"
+#include "hashtable.h"
+#include "hamt.h"
+
+#define BITS 5
+#define MASK 31
+
+// A node at this shift or deeper has used up the hash, and is a collision
+// node.
+#define HASH_BITS 64
+
+/* Returns the slot of the hash at the given shift as a bit of a map. */
+uint32_t hamt_bit(unsigned long hash, int shift) {
+    return (uint32_t)1 << ((hash >> shift) & MASK);
+}
+
+/* Returns the index, among the entries of the map, of the entry for bit. */
+int hamt_index(uint32_t map, uint32_t bit) {
+    return __builtin_popcount(map & (bit - 1));
+}
+
+// The arrays of a node with no keys or no children, which are never
+// written, so that copying from them is always from a valid pointer.
+Value *NO_PAIRS[1];
+struct HamtNode *NO_CHILDREN[1];
+
+/* Returns a new node with room for count keys and the given number of
+ * children, whose maps are set but whose arrays are not filled. */
+struct HamtNode *hamt_node(uint32_t datamap, uint32_t nodemap, int count, int children) {
+    struct HamtNode *node = talloc(sizeof(struct HamtNode));
+    node->datamap = datamap;
+    node->nodemap = nodemap;
+    node->count = count;
+    node->pairs = count > 0 ? talloc(sizeof(Value *) * 2 * count) : NO_PAIRS;
+    node->children = children > 0 ? talloc(sizeof(struct HamtNode *) * children) : NO_CHILDREN;
+    return node;
+}
+
+struct HamtNode *hamt_empty() {
+    return hamt_node(0, 0, 0, 0);
+}
+
+/* Returns a copy of the node, which may then be changed. */
+struct HamtNode *hamt_copy(struct HamtNode *node) {
+    int children = __builtin_popcount(node->nodemap);
+    struct HamtNode *copy = hamt_node(node->datamap, node->nodemap, node->count, children);
+    memcpy(copy->pairs, node->pairs, sizeof(Value *) * 2 * node->count);
+    memcpy(copy->children, node->children, sizeof(struct HamtNode *) * children);
+    return copy;
+}
+
+/* Returns a copy of the node with the key and value inserted among its keys
+ * at index i, and bit added to its datamap, which is 0 for a collision
+ * node. */
+struct HamtNode *hamt_insert_pair(struct HamtNode *node, int i, uint32_t bit, Value *key, Value *value) {
+    int children = __builtin_popcount(node->nodemap);
+    struct HamtNode *copy = hamt_node(node->datamap | bit, node->nodemap, node->count + 1, children);
+    memcpy(copy->pairs, node->pairs, sizeof(Value *) * 2 * i);
+    copy->pairs[2 * i] = key;
+    copy->pairs[2 * i + 1] = value;
+    memcpy(copy->pairs + 2 * i + 2, node->pairs + 2 * i, sizeof(Value *) * 2 * (node->count - i));
+    memcpy(copy->children, node->children, sizeof(struct HamtNode *) * children);
+    return copy;
+}
+
+/* Returns a copy of the node without the key at index i, and with bit
+ * removed from its datamap. */
+struct HamtNode *hamt_remove_pair(struct HamtNode *node, int i, uint32_t bit) {
+    int children = __builtin_popcount(node->nodemap);
+    struct HamtNode *copy = hamt_node(node->datamap & ~bit, node->nodemap, node->count - 1, children);
+    memcpy(copy->pairs, node->pairs, sizeof(Value *) * 2 * i);
+    memcpy(copy->pairs + 2 * i, node->pairs + 2 * i + 2, sizeof(Value *) * 2 * (node->count - i - 1));
+    memcpy(copy->children, node->children, sizeof(struct HamtNode *) * children);
+    return copy;
+}
+
+/* Returns a copy of the node in which the key for bit, at index i among its
+ * keys, is replaced by the given child. */
+struct HamtNode *hamt_pair_to_child(struct HamtNode *node, int i, uint32_t bit, struct HamtNode *child) {
+    int children = __builtin_popcount(node->nodemap), j = hamt_index(node->nodemap, bit);
+    struct HamtNode *copy = hamt_node(node->datamap & ~bit, node->nodemap | bit, node->count - 1, children + 1);
+    memcpy(copy->pairs, node->pairs, sizeof(Value *) * 2 * i);
+    memcpy(copy->pairs + 2 * i, node->pairs + 2 * i + 2, sizeof(Value *) * 2 * (node->count - i - 1));
+    memcpy(copy->children, node->children, sizeof(struct HamtNode *) * j);
+    copy->children[j] = child;
+    memcpy(copy->children + j + 1, node->children + j, sizeof(struct HamtNode *) * (children - j));
+    return copy;
+}
+
+/* Returns a copy of the node in which the child for bit is replaced by the
+ * only key of that child. */
+struct HamtNode *hamt_child_to_pair(struct HamtNode *node, uint32_t bit, struct HamtNode *child) {
+    int children = __builtin_popcount(node->nodemap), j = hamt_index(node->nodemap, bit);
+    int i = hamt_index(node->datamap, bit);
+    struct HamtNode *copy = hamt_node(node->datamap | bit, node->nodemap & ~bit, node->count + 1, children - 1);
+    memcpy(copy->pairs, node->pairs, sizeof(Value *) * 2 * i);
+    copy->pairs[2 * i] = child->pairs[0];
+    copy->pairs[2 * i + 1] = child->pairs[1];
+    memcpy(copy->pairs + 2 * i + 2, node->pairs + 2 * i, sizeof(Value *) * 2 * (node->count - i));
+    memcpy(copy->children, node->children, sizeof(struct HamtNode *) * j);
+    memcpy(copy->children + j, node->children + j + 1, sizeof(struct HamtNode *) * (children - j - 1));
+    return copy;
+}
+
+/* Returns a new trie, rooted at the given shift, holding the two keys of
+ * distinct hashes, or of the same hash below its last bits. */
+struct HamtNode *hamt_merge(Value *key0, Value *value0, unsigned long hash0,
+        Value *key1, Value *value1, unsigned long hash1, int shift) {
+    struct HamtNode *node;
+    uint32_t bit0, bit1;
+    int first;
+    if (shift >= HASH_BITS) {
+        node = hamt_node(0, 0, 2, 0);
+        node->pairs[0] = key0;
+        node->pairs[1] = value0;
+        node->pairs[2] = key1;
+        node->pairs[3] = value1;
+        return node;
+    }
+    bit0 = hamt_bit(hash0, shift);
+    bit1 = hamt_bit(hash1, shift);
+    if (bit0 == bit1) {
+        node = hamt_node(0, bit0, 0, 1);
+        node->children[0] = hamt_merge(key0, value0, hash0, key1, value1, hash1, shift + BITS);
+        return node;
+    }
+    node = hamt_node(bit0 | bit1, 0, 2, 0);
+    first = bit0 < bit1 ? 0 : 1;
+    node->pairs[2 * first] = key0;
+    node->pairs[2 * first + 1] = value0;
+    node->pairs[2 - 2 * first] = key1;
+    node->pairs[3 - 2 * first] = value1;
+    return node;
+}
+
+Value *hamt_get(struct HamtNode *node, Value *key) {
+    unsigned long hash = hash_value(HASH_EQUAL, key);
+    uint32_t bit;
+    int shift, i;
+    for (shift = 0; shift < HASH_BITS; shift += BITS) {
+        bit = hamt_bit(hash, shift);
+        if (node->datamap & bit) {
+            i = hamt_index(node->datamap, bit);
+            return equal_helper(node->pairs[2 * i], key) ? node->pairs[2 * i + 1] : NULL;
+        }
+        if (!(node->nodemap & bit))
+            return NULL;
+        node = node->children[hamt_index(node->nodemap, bit)];
+    }
+    for (i = 0; i < node->count; i++)
+        if (equal_helper(node->pairs[2 * i], key))
+            return node->pairs[2 * i + 1];
+    return NULL;
+}
+
+/* Returns the trie at the given shift with the key, of the given hash,
+ * bound to the value. */
+struct HamtNode *hamt_set_helper(struct HamtNode *node, Value *key, unsigned long hash, Value *value, int shift, long *size) {
+    struct HamtNode *copy, *child;
+    uint32_t bit;
+    int i;
+    if (shift >= HASH_BITS) {
+        for (i = 0; i < node->count; i++) {
+            if (equal_helper(node->pairs[2 * i], key)) {
+                copy = hamt_copy(node);
+                copy->pairs[2 * i + 1] = value;
+                return copy;
+            }
+        }
+        (*size)++;
+        return hamt_insert_pair(node, node->count, 0, key, value);
+    }
+    bit = hamt_bit(hash, shift);
+    if (node->datamap & bit) {
+        i = hamt_index(node->datamap, bit);
+        if (equal_helper(node->pairs[2 * i], key)) {
+            copy = hamt_copy(node);
+            copy->pairs[2 * i + 1] = value;
+            return copy;
+        }
+        (*size)++;
+        child = hamt_merge(node->pairs[2 * i], node->pairs[2 * i + 1], hash_value(HASH_EQUAL, node->pairs[2 * i]),
+                key, value, hash, shift + BITS);
+        return hamt_pair_to_child(node, i, bit, child);
+    }
+    if (node->nodemap & bit) {
+        i = hamt_index(node->nodemap, bit);
+        child = hamt_set_helper(node->children[i], key, hash, value, shift + BITS, size);
+        copy = hamt_copy(node);
+        copy->children[i] = child;
+        return copy;
+    }
+    (*size)++;
+    return hamt_insert_pair(node, hamt_index(node->datamap, bit), bit, key, value);
+}
+
+struct HamtNode *hamt_set(struct HamtNode *root, Value *key, Value *value, long *size) {
+    return hamt_set_helper(root, key, hash_value(HASH_EQUAL, key), value, 0, size);
+}
+
+/* Returns the trie at the given shift without the key, of the given hash,
+ * or the node itself if the key is absent. */
+struct HamtNode *hamt_remove_helper(struct HamtNode *node, Value *key, unsigned long hash, int shift, long *size) {
+    struct HamtNode *child, *copy;
+    uint32_t bit;
+    int i;
+    if (shift >= HASH_BITS) {
+        for (i = 0; i < node->count; i++) {
+            if (equal_helper(node->pairs[2 * i], key)) {
+                (*size)--;
+                return hamt_remove_pair(node, i, 0);
+            }
+        }
+        return node;
+    }
+    bit = hamt_bit(hash, shift);
+    if (node->datamap & bit) {
+        i = hamt_index(node->datamap, bit);
+        if (!equal_helper(node->pairs[2 * i], key))
+            return node;
+        (*size)--;
+        return hamt_remove_pair(node, i, bit);
+    }
+    if (!(node->nodemap & bit))
+        return node;
+    i = hamt_index(node->nodemap, bit);
+    child = hamt_remove_helper(node->children[i], key, hash, shift + BITS, size);
+    if (child == node->children[i])
+        return node;
+    // A child left with a single key and no children of its own is folded
+    // into this node, so that every child holds at least two keys
+    if (child->count == 1 && child->nodemap == 0)
+        return hamt_child_to_pair(node, bit, child);
+    copy = hamt_copy(node);
+    copy->children[i] = child;
+    return copy;
+}
+
+struct HamtNode *hamt_remove(struct HamtNode *root, Value *key, long *size) {
+    return hamt_remove_helper(root, key, hash_value(HASH_EQUAL, key), 0, size);
+}
+
+Value *hamt_to_alist(struct HamtNode *node, Value *tail) {
+    int i;
+    for (i = __builtin_popcount(node->nodemap) - 1; i >= 0; i--)
+        tail = hamt_to_alist(node->children[i], tail);
+    for (i = node->count - 1; i >= 0; i--)
+        tail = cons(cons(node->pairs[2 * i], node->pairs[2 * i + 1]), tail);
+    return tail;
+}
+
+int hamt_included(struct HamtNode *first, struct HamtNode *second) {
+    Value *value;
+    int i;
+    for (i = 0; i < first->count; i++) {
+        value = hamt_get(second, first->pairs[2 * i]);
+        if (value == NULL || !equal_helper(first->pairs[2 * i + 1], value))
+            return 0;
+    }
+    for (i = 0; i < __builtin_popcount(first->nodemap); i++)
+        if (!hamt_included(first->children[i], second))
+            return 0;
+    return 1;
+}
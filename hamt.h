@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include "value.h"
+
+#ifndef _HAMT
+#define _HAMT
+
+// A node of a hash array mapped trie, keyed under equal?.  Each level
+// consumes five bits of the key's hash, which select one of 32 slots: a slot
+// holds either a key and its value, marked in datamap, or a child node one
+// level down, marked in nodemap, and only occupied slots are stored, in slot
+// order.  Below the last bits of the hash, a node simply lists the keys
+// whose hashes collide.  Nodes are never changed once built: an update
+// copies the path from the root to the slot changed and shares the rest.
+struct HamtNode {
+    uint32_t datamap;
+    uint32_t nodemap;
+    int count;                      // keys held here, not in children
+    Value **pairs;                  // count keys and values alternately
+    struct HamtNode **children;     // one per bit of nodemap
+};
+
+/* Returns a new node holding no keys. */
+struct HamtNode *hamt_empty();
+
+/* Returns the value of the key in the trie, or NULL if it has none. */
+Value *hamt_get(struct HamtNode *root, Value *key);
+
+/* Returns a trie like the given one but with the key bound to the value,
+ * adding 1 to *size if the key was absent. */
+struct HamtNode *hamt_set(struct HamtNode *root, Value *key, Value *value, long *size);
+
+/* Returns a trie like the given one but without the key, subtracting 1 from
+ * *size if the key was present. */
+struct HamtNode *hamt_remove(struct HamtNode *root, Value *key, long *size);
+
+/* Returns a new list of the (key . value) pairs in the trie, consed onto
+ * the front of tail. */
+Value *hamt_to_alist(struct HamtNode *root, Value *tail);
+
+/* Returns 1 if every key in the trie first is bound in the trie second to
+ * an equal? value, otherwise 0. */
+int hamt_included(struct HamtNode *first, struct HamtNode *second);
+
+#endif
@@ -0,0 +1,294 @@
+/* hashtable.c
+ *
+ * Hash tables for user code, keyed under eqv?, equal? or string=?.  Slots
+ * are kept in one array and probed linearly, so that a lookup which hits
+ * usually reads a single cache line; each slot holds the full hash of its
+ * key, so that keys are only compared, which for equal? may mean walking
+ * two structures, when their hashes match.
+ *
+ * A table grows when its live and deleted entries fill three quarters of
+ * it, rehashing into an array of twice the live entries or more, which
+ * drops the tombstones left by deletions.  Old arrays are left in the talloc
+ * arena, like every other value.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "interpreter.h"
+#include "hashtable.h"
+#include "pvector.h"
+#include "strlib.h"
+
+#define MIN_CAPACITY 8
+
+// Structures hashed under equal? contribute at most this many of their
+// elements to the hash, so that hashing a long list does not cost as much
+// as comparing it.
+#define EQUAL_HASH_BUDGET 32
+
+Value TOMBSTONE;
+
+/* Returns the bits of x mixed so that each affects all of the result, by the
+ * finalizer of splitmix64. */
+unsigned long hash_mix(unsigned long x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+/* Returns the FNV-1a hash of the string. */
+unsigned long hash_string(const char *s) {
+    unsigned long hash = 0xcbf29ce484222325UL;
+    for (; *s != '\0'; s++)
+        hash = (hash ^ (unsigned char)*s) * 0x100000001b3UL;
+    return hash;
+}
+
+/* Returns the FNV-1a hash of the n bytes, as hash_string for a C string. */
+unsigned long hash_bytes(const char *s, long n) {
+    unsigned long hash = 0xcbf29ce484222325UL;
+    long i;
+    for (i = 0; i < n; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3UL;
+    return hash;
+}
+
+/* Returns the hash of the bit pattern of the double. */
+unsigned long hash_double(double d) {
+    unsigned long bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return hash_mix(bits);
+}
+
+/* Returns the hash of the key under eqv?, which compares numbers and
+ * symbols by value and everything else by identity. */
+unsigned long hash_eqv(Value *key) {
+    unsigned long hash;
+    int i;
+    switch (key->type) {
+        case INT_TYPE:
+        case BOOL_TYPE:
+            return hash_mix(key->i + key->type);
+        case DOUBLE_TYPE:
+            return hash_double(key->d);
+        case BIGNUM_TYPE:
+            hash = key->big.sign;
+            for (i = 0; i < key->big.size; i++)
+                hash = hash_mix(hash + key->big.limbs[i]);
+            return hash;
+        case SYMBOL_TYPE:
+            return hash_string(key->s);
+        case NULL_TYPE:
+        case VOID_TYPE:
+        case UNSPECIFIED_TYPE:
+            return hash_mix(key->type);
+        case PRIMITIVE_TYPE:
+            return hash_mix((unsigned long)key->pr.pf);
+        default:
+            return hash_mix((unsigned long)key);
+    }
+}
+
+/* Returns the hash of the key under equal?, spending at most *budget of the
+ * elements of structures on it. */
+unsigned long hash_equal(Value *key, int *budget) {
+    unsigned long hash = key->type;
+    long i;
+    switch (key->type) {
+        case DOUBLE_TYPE:
+            // equal? compares doubles with ==, under which 0.0 is -0.0
+            return hash_double(key->d == 0.0 ? 0.0 : key->d);
+        case STR_TYPE:
+            return hash_mix(hash_bytes(string_chars(key), key->str.length));
+        case CONS_TYPE:
+            for (; key->type == CONS_TYPE && *budget > 0; key = cdr(key)) {
+                (*budget)--;
+                hash = hash_mix(hash + hash_equal(car(key), budget));
+            }
+            return hash;
+        case VECTOR_TYPE:
+            for (i = 0; i < key->vec.length && *budget > 0; i++) {
+                (*budget)--;
+                hash = hash_mix(hash + hash_equal(key->vec.items[i], budget));
+            }
+            return hash_mix(hash + key->vec.length);
+        case F64VECTOR_TYPE:
+            for (i = 0; i < key->vec.length && i < EQUAL_HASH_BUDGET; i++)
+                hash = hash_mix(hash + hash_double(key->vec.f64[i] == 0.0 ? 0.0 : key->vec.f64[i]));
+            return hash_mix(hash + key->vec.length);
+        case S64VECTOR_TYPE:
+            for (i = 0; i < key->vec.length && i < EQUAL_HASH_BUDGET; i++)
+                hash = hash_mix(hash + key->vec.s64[i]);
+            return hash_mix(hash + key->vec.length);
+        case MATRIX_TYPE:
+            return hash_mix(hash + key->mat.rows * 31 + key->mat.cols);
+        case PMAP_TYPE:
+            // Equal maps may hold their keys in different orders
+            return hash_mix(hash + key->pm.size);
+        case PVECTOR_TYPE:
+            return hash_mix(hash + key->pv->length);
+        case CLOSURE_TYPE:
+            // equal? compares their code by structure but their frames by
+            // identity
+            return hash_mix((unsigned long)key->cl.frame);
+        case CONTINUATION_TYPE:
+            return hash_mix((unsigned long)key->k);
+        default:
+            return hash_eqv(key);
+    }
+}
+
+unsigned long hash_value(enum hash_kind kind, Value *key) {
+    unsigned long hash;
+    int budget = EQUAL_HASH_BUDGET;
+    switch (kind) {
+        case HASH_EQUAL:
+            return hash_equal(key, &budget);
+        case HASH_STRING:
+            return hash_mix(hash_bytes(string_chars(key), key->str.length));
+        case HASH_ARGUMENTS:
+            hash = 0;
+            for (; key->type == CONS_TYPE; key = cdr(key)) {
+                budget = EQUAL_HASH_BUDGET;
+                hash = hash_mix(hash + hash_equal(car(key), &budget));
+            }
+            return hash;
+        default:
+            return hash_eqv(key);
+    }
+}
+
+/* Returns 1 if the keys are equivalent under the given kind. */
+int hash_keys_equal(enum hash_kind kind, Value *first, Value *second) {
+    switch (kind) {
+        case HASH_EQUAL:
+        case HASH_ARGUMENTS:
+            return equal_helper(first, second);
+        case HASH_STRING:
+            return string_equal(first, second);
+        default:
+            return eqv_helper(first, second);
+    }
+}
+
+/* Returns a new array of capacity unused slots. */
+struct HashEntry *hash_entries_new(long capacity) {
+    struct HashEntry *entries = talloc(sizeof(struct HashEntry) * capacity);
+    memset(entries, 0, sizeof(struct HashEntry) * capacity);
+    return entries;
+}
+
+struct HashTable *hash_table_new(enum hash_kind kind, long size_hint) {
+    struct HashTable *table = talloc(sizeof(struct HashTable));
+    long capacity = MIN_CAPACITY;
+    while (capacity * 3 < size_hint * 4)
+        capacity *= 2;
+    table->kind = kind;
+    table->size = 0;
+    table->tombstones = 0;
+    table->capacity = capacity;
+    table->entries = hash_entries_new(capacity);
+    return table;
+}
+
+/* Returns the slot holding the key, whose hash is given, or NULL if it is
+ * absent. */
+struct HashEntry *hash_table_find(struct HashTable *table, Value *key, unsigned long hash) {
+    unsigned long mask = table->capacity - 1, i;
+    struct HashEntry *entry;
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+        entry = &table->entries[i];
+        if (entry->key == NULL)
+            return NULL;
+        if (entry->key != &TOMBSTONE && entry->hash == hash
+                && hash_keys_equal(table->kind, entry->key, key))
+            return entry;
+    }
+}
+
+/* Moves the live entries into a new array with room for twice as many. */
+void hash_table_rehash(struct HashTable *table) {
+    struct HashEntry *old = table->entries;
+    long old_capacity = table->capacity, capacity = MIN_CAPACITY, i;
+    unsigned long mask, j;
+    while (capacity < table->size * 2 + 2)
+        capacity *= 2;
+    table->entries = hash_entries_new(capacity);
+    table->capacity = capacity;
+    table->tombstones = 0;
+    mask = capacity - 1;
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].key == NULL || old[i].key == &TOMBSTONE)
+            continue;
+        for (j = old[i].hash & mask; table->entries[j].key != NULL; j = (j + 1) & mask)
+            ;
+        table->entries[j] = old[i];
+    }
+}
+
+Value *hash_table_get(struct HashTable *table, Value *key) {
+    struct HashEntry *entry = hash_table_find(table, key, hash_value(table->kind, key));
+    return entry == NULL ? NULL : entry->value;
+}
+
+void hash_table_put(struct HashTable *table, Value *key, Value *value) {
+    unsigned long hash = hash_value(table->kind, key), mask, i;
+    struct HashEntry *entry, *free = NULL;
+    if ((table->size + table->tombstones + 1) * 4 > table->capacity * 3)
+        hash_table_rehash(table);
+    mask = table->capacity - 1;
+    // Find the key, remembering the first deleted slot on the way, which is
+    // reused if the key is absent
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+        entry = &table->entries[i];
+        if (entry->key == NULL)
+            break;
+        if (entry->key == &TOMBSTONE) {
+            if (free == NULL)
+                free = entry;
+        } else if (entry->hash == hash && hash_keys_equal(table->kind, entry->key, key)) {
+            entry->value = value;
+            return;
+        }
+    }
+    if (free != NULL) {
+        entry = free;
+        table->tombstones--;
+    }
+    entry->hash = hash;
+    entry->key = key;
+    entry->value = value;
+    table->size++;
+}
+
+int hash_table_remove(struct HashTable *table, Value *key) {
+    struct HashEntry *entry = hash_table_find(table, key, hash_value(table->kind, key));
+    if (entry == NULL)
+        return 0;
+    entry->key = &TOMBSTONE;
+    entry->value = NULL;
+    table->size--;
+    table->tombstones++;
+    return 1;
+}
+
+void hash_table_stats(struct HashTable *table, struct HashStats *stats) {
+    unsigned long mask = table->capacity - 1, i;
+    long probe, total = 0;
+    stats->max_probe = 0;
+    for (i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key == NULL || table->entries[i].key == &TOMBSTONE)
+            continue;
+        probe = ((i - table->entries[i].hash) & mask) + 1;
+        total += probe;
+        if (probe > stats->max_probe)
+            stats->max_probe = probe;
+    }
+    stats->load_factor = (double)table->size / table->capacity;
+    stats->average_probe = table->size > 0 ? (double)total / table->size : 0.0;
+}
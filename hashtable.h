@@ -0,0 +1,62 @@
+#include "value.h"
+
+#ifndef _HASHTABLE
+#define _HASHTABLE
+
+// The equivalence under which a table compares its keys.  Tables made with
+// eq? use HASH_EQV: this interpreter neither interns symbols nor caches
+// small numbers, so eq? is the same predicate as eqv?.  HASH_ARGUMENTS is
+// equal? on lists of arguments, as keyed by memoize, hashed with a budget
+// for each argument so that a long first argument does not leave the
+// others unhashed.
+enum hash_kind {HASH_EQV, HASH_EQUAL, HASH_STRING, HASH_ARGUMENTS};
+
+// A slot of a table.  key is NULL if the slot has never been used, and
+// &TOMBSTONE if its entry has been deleted.
+struct HashEntry {
+    unsigned long hash;
+    Value *key;
+    Value *value;
+};
+
+// An open-addressing hash table with linear probing: capacity is a power of
+// two, and an entry is found by scanning from the slot given by the low bits
+// of its hash up to the first unused slot.
+struct HashTable {
+    enum hash_kind kind;
+    long size;          // live entries
+    long tombstones;    // deleted entries still occupying slots
+    long capacity;
+    struct HashEntry *entries;
+};
+
+// Measurements of a table, for tuning.
+struct HashStats {
+    double load_factor;     // live entries per slot
+    double average_probe;   // mean slots examined to find a live entry
+    long max_probe;         // most slots examined to find a live entry
+};
+
+extern Value TOMBSTONE;
+
+/* Returns a new empty table with room for at least the given number of
+ * entries before it grows. */
+struct HashTable *hash_table_new(enum hash_kind kind, long size_hint);
+
+/* Returns the hash of the key under the given equivalence.  Keys of a
+ * HASH_STRING table must be strings. */
+unsigned long hash_value(enum hash_kind kind, Value *key);
+
+/* Returns the value of the key in the table, or NULL if it has none. */
+Value *hash_table_get(struct HashTable *table, Value *key);
+
+/* Sets the value of the key in the table, adding it if it is absent. */
+void hash_table_put(struct HashTable *table, Value *key, Value *value);
+
+/* Removes the key from the table.  Returns 1 if it was present, 0 if not. */
+int hash_table_remove(struct HashTable *table, Value *key);
+
+/* Stores measurements of the table in stats. */
+void hash_table_stats(struct HashTable *table, struct HashStats *stats);
+
+#endif
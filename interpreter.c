@@ -1,10 +1,46 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <setjmp.h>
+#include <alloca.h>
 #include "value.h"
 #include "talloc.h"
 #include "linkedlist.h"
+#include "error.h"
+#include "bignum.h"
+#include "simd.h"
+#include "matrix.h"
+#include "hashtable.h"
+#include "hamt.h"
+#include "pvector.h"
+#include "sort.h"
+#include "strlib.h"
+#include "tokenizer.h"
 
 
+// Bindings of the primitives, as (symbol . value) pairs hashed by name with
+// linear probing.  They lie outside every frame, below the top level, so that
+// their number does not slow the lookup of other symbols; in particular the
+// names of special forms, which are only recognized once their lookup fails.
+#define PRIMITIVE_TABLE_SIZE 1024
+Value *PRIMITIVE_TABLE[PRIMITIVE_TABLE_SIZE];
+
+/* Returns the slot of PRIMITIVE_TABLE holding the binding of name, or the
+ * empty slot where it would go. */
+Value **primitive_slot(char *name) {
+    unsigned long hash = 5381;
+    char *c;
+    for (c = name; *c != '\0'; c++)
+        hash = hash * 33 + (unsigned char)*c;
+    hash %= PRIMITIVE_TABLE_SIZE;
+    while (PRIMITIVE_TABLE[hash] != NULL && strcmp(car(PRIMITIVE_TABLE[hash])->s, name) != 0)
+        hash = (hash + 1) % PRIMITIVE_TABLE_SIZE;
+    return &PRIMITIVE_TABLE[hash];
+}
+
 /* Attempts to look up the symbol associated with the given Value* in the given
  * frame and its parents.  If the symbol is not found, returns NULL, otherwise
  * returns the associated value (without calling eval on it). */
@@ -12,8 +48,8 @@ Value *lookup_symbol(Value *expr, Frame *frame) {
     Value curr_frame, *value, *pair;
     Frame *current = frame;
     if (expr->type != SYMBOL_TYPE) {
-        fprintf(stderr, "Evaluation error: called lookup_symbol on value of type %d\n", expr->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: called lookup_symbol on value of type %d\n", expr->type);
+        raise_error(4);
     }
     while (current != NULL) {
         value = current->bindings;
@@ -27,7 +63,8 @@ Value *lookup_symbol(Value *expr, Frame *frame) {
         current = current->parent;
     }
     // if while loops end, never found matching symbol in frames
-    return NULL;
+    pair = *primitive_slot(expr->s);
+    return pair != NULL ? cdr(pair) : NULL;
 }
 
 void error_display_tree(char *name, Value *args) {
@@ -37,11 +74,22 @@ void error_display_tree(char *name, Value *args) {
     tmp_cons.type = CONS_TYPE;
     tmp_cons.c.car = &tmp_symbol;
     tmp_cons.c.cdr = args;
-    display_to_fd(&tmp_cons, stderr);
+    display_to_fd(&tmp_cons, error_stream());
     return;
 }
 
 Value *eval(Value *expr, Frame *frame);
+Value *apply(Value *function, int argc, Value **argv);
+Value *apply_record_procedure(Value *procedure, int argc, Value **argv);
+Value *eval_define_record_type(Value *args, Frame *frame);
+Value *apply_memo(Value *procedure, int argc, Value **argv);
+Value *eval_define_memoized(Value *args, Frame *frame);
+Value *eval_delay(Value *args, Frame *frame, int lazy);
+Value *eval_stream_cons(Value *args, Frame *frame);
+Value *apply_list(Value *function, Value *args);
+Value *single_value(char *context, Value *result);
+void catch_unwind(struct ErrorHandler *handler);
+extern struct Continuation *ACTIVE_CONTINUATIONS;
 
 
 ////////////////////////////////////////
@@ -55,9 +103,9 @@ Value *eval_begin(Value *args, Frame *frame) {
         current = cdr(current);
     }
     if (current->type != NULL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `begin`: bad form in arguments: ");
+        fprintf(error_stream(), "Evaluation error: built-in function `begin`: bad form in arguments: ");
         error_display_tree("begin", args);
-        texit(4);
+        raise_error(4);
     }
     if (result == NULL) {
         result = makeVoid();    // sequence of zero expressions
@@ -69,13 +117,13 @@ Value *eval_not(Value *args, Frame *frame) {
     Value *cond, *result;
     int argc = length(args);
     if (argc != 1) {
-        fprintf(stderr, "Evaluation error: built-in function `not`: expected 1 argument, received %d\n", argc);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `not`: expected 1 argument, received %d\n", argc);
+        raise_error(4);
     }
     cond = eval(car(args), frame);
     if (cond->type != BOOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `not`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `not`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
+        raise_error(4);
     }
     result = makeBool(!(cond->i));
     return result;
@@ -85,13 +133,13 @@ Value *eval_if(Value *args, Frame *frame) {
     Value *cond, *result;
     int argc = length(args);
     if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Evaluation error: built-in function `if`: expected 2 or 3 arguments, received %d\n", argc);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `if`: expected 2 or 3 arguments, received %d\n", argc);
+        raise_error(4);
     }
     cond = eval(car(args), frame);
     if (cond->type != BOOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `if`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `if`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
+        raise_error(4);
     }
     if (cond->i) {
         result = eval(car(cdr(args)), frame);
@@ -103,7 +151,9 @@ Value *eval_if(Value *args, Frame *frame) {
     return result;
 }
 
-Value *eval_cond(Value *args, Frame *frame) {
+/* Evaluates the clauses of a cond form, or of a form named name with the
+ * same clauses.  Returns NULL if no clause applies. */
+Value *cond_clauses(Value *args, Frame *frame, char *name) {
     Value *current = args, *cur_clause, *test;
     if (length(args) == 0)
         goto COND_ERROR_BAD_FORM;
@@ -123,20 +173,231 @@ Value *eval_cond(Value *args, Frame *frame) {
     }
     if (current->type != NULL_TYPE)
         goto COND_ERROR_BAD_FORM;
-    return makeVoid();
+    return NULL;
 COND_ERROR_BAD_FORM:
-    fprintf(stderr, "Evaluation error: built-in function `cond`: bad form in arguments: ");
-    error_display_tree("cond", args);
-    texit(4);
+    fprintf(error_stream(), "Evaluation error: built-in function `%s`: bad form in arguments: ", name);
+    error_display_tree(name, args);
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+Value *eval_cond(Value *args, Frame *frame) {
+    Value *result = cond_clauses(args, frame, "cond");
+    return result != NULL ? result : makeVoid();
+}
+
+/* The clauses of a case form indexed by datum, built the first time the form
+ * is evaluated.  Fixnum datums spanning a small range index an array
+ * directly; other datums are hashed. */
+struct CaseEntry {
+    Value *datum;
+    Value *body;
+    struct CaseEntry *next;
+};
+
+struct CaseTable {
+    int dense;
+    long min;                   // dense only: the datum of bodies[0]
+    long size;                  // length of bodies, or number of buckets
+    Value **bodies;             // dense only, NULL where no clause matches
+    struct CaseEntry **buckets; // hashed only
+    Value *else_body;           // NULL if there is no else clause
+};
+
+/* Returns 1 if the datum can be matched by eqv? against a key, and so is
+ * entered in the table; strings and lists never match. */
+int case_indexable(Value *datum) {
+    switch (datum->type) {
+        case INT_TYPE:
+        case BIGNUM_TYPE:
+        case DOUBLE_TYPE:
+        case BOOL_TYPE:
+        case SYMBOL_TYPE:
+        case NULL_TYPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Returns 1 if the key and the indexable datum are eqv?. */
+int case_eqv(Value *key, Value *datum) {
+    if (key->type != datum->type)
+        return 0;
+    switch (key->type) {
+        case INT_TYPE:
+        case BOOL_TYPE:
+            return key->i == datum->i;
+        case BIGNUM_TYPE:
+            return bignum_compare(key, datum) == 0;
+        case DOUBLE_TYPE:
+            return key->d == datum->d;
+        case SYMBOL_TYPE:
+            return strcmp(key->s, datum->s) == 0;
+        case NULL_TYPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+unsigned long case_hash(Value *value) {
+    unsigned long hash = 5381;
+    char *c;
+    int i;
+    switch (value->type) {
+        case INT_TYPE:
+        case BOOL_TYPE:
+            return (unsigned long)value->i * 2654435761UL + value->type;
+        case BIGNUM_TYPE:
+            hash = value->big.sign;
+            for (i = 0; i < value->big.size; i++)
+                hash = hash * 2654435761UL + value->big.limbs[i];
+            return hash;
+        case DOUBLE_TYPE:
+            memcpy(&hash, &value->d, sizeof(double) < sizeof(hash) ? sizeof(double) : sizeof(hash));
+            return hash ^ (hash >> 29);
+        case SYMBOL_TYPE:
+            for (c = value->s; *c != '\0'; c++)
+                hash = hash * 33 + (unsigned char)*c;
+            return hash;
+        default:
+            return value->type;
+    }
+}
+
+/* Builds the table for the given clauses of a case form.  A datum appearing
+ * in several clauses selects the first of them. */
+struct CaseTable *case_build(Value *clauses, Value *args) {
+    struct CaseTable *table = talloc(sizeof(struct CaseTable));
+    struct CaseEntry *entry;
+    Value *current, *clause, *datum;
+    long count = 0, min = 0, max = 0, i;
+    int all_int = 1;
+    table->else_body = NULL;
+    for (current = clauses; current->type == CONS_TYPE; current = cdr(current)) {
+        clause = car(current);
+        if (clause->type != CONS_TYPE || cdr(clause)->type != CONS_TYPE)
+            goto CASE_BAD_FORM;
+        if (car(clause)->type == SYMBOL_TYPE && strcmp(car(clause)->s, "else") == 0) {
+            if (cdr(current)->type != NULL_TYPE)
+                goto CASE_BAD_FORM;
+            table->else_body = cdr(clause);
+            break;
+        }
+        for (datum = car(clause); datum->type == CONS_TYPE; datum = cdr(datum)) {
+            if (!case_indexable(car(datum)))
+                continue;
+            if (car(datum)->type != INT_TYPE) {
+                all_int = 0;
+            } else if (count == 0 || car(datum)->i < min) {
+                min = car(datum)->i;
+            }
+            if (car(datum)->type == INT_TYPE && (count == 0 || car(datum)->i > max))
+                max = car(datum)->i;
+            count++;
+        }
+        if (datum->type != NULL_TYPE)
+            goto CASE_BAD_FORM;
+    }
+    if (current->type != NULL_TYPE && table->else_body == NULL)
+        goto CASE_BAD_FORM;
+    table->dense = all_int && count > 0 && (unsigned long)max - min < 2 * count + 16;
+    if (table->dense) {
+        table->min = min;
+        table->size = max - min + 1;
+        table->bodies = talloc(sizeof(Value *) * table->size);
+        for (i = 0; i < table->size; i++)
+            table->bodies[i] = NULL;
+    } else {
+        for (table->size = 8; table->size < 2 * count; table->size *= 2)
+            ;
+        table->buckets = talloc(sizeof(struct CaseEntry *) * table->size);
+        for (i = 0; i < table->size; i++)
+            table->buckets[i] = NULL;
+    }
+    for (current = clauses; current->type == CONS_TYPE && car(current)->type == CONS_TYPE
+            && cdr(car(current)) != table->else_body; current = cdr(current)) {
+        clause = car(current);
+        for (datum = car(clause); datum->type == CONS_TYPE; datum = cdr(datum)) {
+            if (!case_indexable(car(datum)))
+                continue;
+            if (table->dense) {
+                if (table->bodies[car(datum)->i - min] == NULL)
+                    table->bodies[car(datum)->i - min] = cdr(clause);
+                continue;
+            }
+            i = case_hash(car(datum)) & (table->size - 1);
+            for (entry = table->buckets[i]; entry != NULL; entry = entry->next)
+                if (case_eqv(car(datum), entry->datum))
+                    break;
+            if (entry != NULL)
+                continue;
+            entry = talloc(sizeof(struct CaseEntry));
+            entry->datum = car(datum);
+            entry->body = cdr(clause);
+            entry->next = table->buckets[i];
+            table->buckets[i] = entry;
+        }
+    }
+    return table;
+CASE_BAD_FORM:
+    fprintf(error_stream(), "Evaluation error: built-in function `case`: bad form in arguments: ");
+    error_display_tree("case", args);
+    raise_error(4);
     return NULL;    // will never return
 }
 
+/* Evaluates the key of the case form with the given arguments, and returns
+ * the body of the clause with a datum eqv? to it, the body of the else clause
+ * if there is none, or NULL if there is no else clause either.  The first
+ * evaluation inserts a pointer to the table for the form before the key in
+ * args, so later evaluations find it there. */
+Value *case_select(Value *args, Frame *frame) {
+    struct CaseTable *table;
+    struct CaseEntry *entry;
+    Value *key, *ptr;
+    if (args->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: built-in function `case`: bad form in arguments: ");
+        error_display_tree("case", args);
+        raise_error(4);
+    }
+    if (car(args)->type != PTR_TYPE) {
+        table = case_build(cdr(args), args);
+        ptr = talloc(sizeof(Value));
+        ptr->type = PTR_TYPE;
+        ptr->p = table;
+        args->c.cdr = cons(car(args), cdr(args));
+        args->c.car = ptr;
+    }
+    table = car(args)->p;
+    key = single_value("built-in function `case`", eval(car(cdr(args)), frame));
+    if (table->dense) {
+        // Keys below min wrap around to large offsets
+        if (key->type == INT_TYPE && (unsigned long)key->i - table->min < table->size
+                && table->bodies[key->i - table->min] != NULL)
+            return table->bodies[key->i - table->min];
+    } else {
+        for (entry = table->buckets[case_hash(key) & (table->size - 1)]; entry != NULL; entry = entry->next)
+            if (case_eqv(key, entry->datum))
+                return entry->body;
+    }
+    return table->else_body;
+}
+
+Value *eval_case(Value *args, Frame *frame) {
+    Value *body = case_select(args, frame);
+    if (body == NULL)
+        return makeVoid();
+    return eval_begin(body, frame);
+}
+
 Value *eval_when(Value *args, Frame *frame) {
     Value *cond, *result = NULL;
     cond = eval(car(args), frame);
     if (cond->type != BOOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `when`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `when`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
+        raise_error(4);
     }
     if (cond->i) {
         result = eval_begin(cdr(args), frame);
@@ -150,8 +411,8 @@ Value *eval_unless(Value *args, Frame *frame) {
     Value *cond, *current, *result = NULL;
     cond = eval(car(args), frame);
     if (cond->type != BOOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `unless`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `unless`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
+        raise_error(4);
     }
     if (!(cond->i)) {
         result = eval_begin(cdr(args), frame);
@@ -174,7 +435,7 @@ void letrec_eval_bindings_helper(Value *list, Frame *frame, int evaluate, int st
             while (binding->type == CONS_TYPE) {
                 cur_bind = car(binding);
                 if (strcmp(car(cur_bind)->s, car(cur_pair)->s) == 0) {
-                    cur_bind->c.cdr = evaluate ? eval(car(cdr(cur_pair)), frame) : cdr(cur_pair);
+                    cur_bind->c.cdr = evaluate ? single_value("built-in function `letrec`", eval(car(cdr(cur_pair)), frame)) : cdr(cur_pair);
                     goto FOUND_BINDING;
                 }
                 binding = cdr(binding);
@@ -182,8 +443,8 @@ void letrec_eval_bindings_helper(Value *list, Frame *frame, int evaluate, int st
             cur_frame = star ? cur_frame->parent : NULL;
         }
         // Should be imposible to get here, since matching binding should always be found
-        fprintf(stderr, "Evaluation error: built-in function `%s`: temporary binding for evaluated variable no longer found in frame: %s", star ? "letrec*" : "letrec", car(cur_pair)->s);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `%s`: temporary binding for evaluated variable no longer found in frame: %s", star ? "letrec*" : "letrec", car(cur_pair)->s);
+        raise_error(4);
 FOUND_BINDING:
         current = cdr(current);
     }
@@ -206,11 +467,11 @@ void letrec_eval_bindings(Value *pairs, Frame *frame, int star) {
     current = pairs;
     while (current->type == CONS_TYPE) {
         cur_pair = car(current);
-        evaluated = cons(car(cur_pair), eval(car(cdr(cur_pair)), frame));
+        evaluated = cons(car(cur_pair), single_value("built-in function `letrec`", eval(car(cdr(cur_pair)), frame)));
         if (cdr(evaluated)->type == UNSPECIFIED_TYPE) {
-            fprintf(stderr, "Evaluation error: built-in function `%s`: unbound variable ", star ? "letrec*" : "letrec");
-            display_to_fd(car(evaluated), stderr);
-            texit(4);
+            fprintf(error_stream(), "Evaluation error: built-in function `%s`: unbound variable ", star ? "letrec*" : "letrec");
+            display_to_fd(car(evaluated), error_stream());
+            raise_error(4);
         }
         eval_list = cons(evaluated, eval_list);
         current = cdr(current);
@@ -218,11 +479,14 @@ void letrec_eval_bindings(Value *pairs, Frame *frame, int star) {
     letrec_eval_bindings_helper(eval_list, frame, 0, star);
 }
 
-Value *let_helper(Value *args, Frame *frame, int star, int rec) {
-    Value *current, *current_pair, *result, *binding;
-    Frame *new_frame, *eval_frame;
+/* Builds the frame binding the variables of a let, let*, letrec or letrec*
+ * form whose arguments are args, and returns it; the body of the form is to be
+ * evaluated in the returned frame. */
+Frame *let_frame(Value *args, Frame *frame, int star, int rec) {
+    Value *current, *current_pair, *binding;
+    Frame *new_frame;
     char *name_possibilities[4] = {"let", "letrec", "let*", "letrec*"};
-    char *name = name_possibilities[(!star << 1) | (!rec)];
+    char *name = name_possibilities[(star << 1) | rec];
     if (length(args) < 2)
         goto LET_ERROR_BAD_FORM;
     new_frame = talloc(sizeof(Frame));
@@ -238,7 +502,7 @@ Value *let_helper(Value *args, Frame *frame, int star, int rec) {
         binding = new_frame->bindings;
         while (binding->type == CONS_TYPE) {
             if (strcmp(car(car(binding))->s, car(current_pair)->s) == 0) {
-                fprintf(stderr, "Evaluation error: built-in function `%s`: duplicate bound variable %s in form ", name, car(current_pair)->s);
+                fprintf(error_stream(), "Evaluation error: built-in function `%s`: duplicate bound variable %s in form ", name, car(current_pair)->s);
                 goto LET_ERROR_DISPLAY_TREE;
             }
             binding = cdr(binding);
@@ -246,7 +510,7 @@ Value *let_helper(Value *args, Frame *frame, int star, int rec) {
         new_frame->bindings = cons(
                 cons(
                     car(current_pair),
-                    rec ? makeUnspecified() : eval(car(cdr(current_pair)), frame)),
+                    rec ? makeUnspecified() : single_value("built-in function `let`", eval(car(cdr(current_pair)), frame))),
                 new_frame->bindings);
         if (star) {
             frame = new_frame;
@@ -260,18 +524,29 @@ Value *let_helper(Value *args, Frame *frame, int star, int rec) {
         goto LET_ERROR_BAD_FORM;
     if (rec)
         letrec_eval_bindings(car(args), new_frame, star);
-    current = cdr(args);    // current is now reused to evaluate expressions
+    return new_frame;
+LET_ERROR_BAD_FORM:
+    fprintf(error_stream(), "Evaluation error: built-in function `%s`: bad form in arguments: ", name);
+LET_ERROR_DISPLAY_TREE:
+    error_display_tree(name, args);
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+Value *eval_named_let(Value *args, Frame *frame);
+
+Value *let_helper(Value *args, Frame *frame, int star, int rec) {
+    Value *current, *result = NULL;
+    Frame *new_frame;
+    if (!star && !rec && args->type == CONS_TYPE && car(args)->type == SYMBOL_TYPE)
+        return eval_named_let(args, frame);
+    new_frame = let_frame(args, frame, star, rec);
+    current = cdr(args);
     while (current->type == CONS_TYPE) {
         result = eval(car(current), new_frame);
         current = cdr(current);
     }
     return result;
-LET_ERROR_BAD_FORM:
-    fprintf(stderr, "Evaluation error: built-in function `%s`: bad form in arguments: ", name);
-LET_ERROR_DISPLAY_TREE:
-    error_display_tree(name, args);
-    texit(4);
-    return NULL;    // will never return
 }
 
 Value *eval_let(Value *args, Frame *frame) {
@@ -293,8 +568,8 @@ Value *eval_letrec_star(Value *args, Frame *frame) {
 Value *eval_quote(Value *args, Frame *frame) {
     int argc = length(args);
     if (argc != 1) {
-        fprintf(stderr, "Evaluation error: built-in function `quote`: expected 1 argument, received %d\n", argc);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `quote`: expected 1 argument, received %d\n", argc);
+        raise_error(4);
     }
     return car(args);
 }
@@ -305,19 +580,42 @@ Value *eval_display(Value *args, Frame *frame) {
     char c;
     argc = length(args);
     if (argc != 1) {
-        fprintf(stderr, "Evaluation error: built-in function `display`: expected 1 argument, received %d\n", argc);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `display`: expected 1 argument, received %d\n", argc);
+        raise_error(4);
     }
-    val = eval(car(args), frame);
+    val = single_value("built-in function `display`", eval(car(args), frame));
     switch (val->type) {
         case INT_TYPE:
-            printf("%d", val->i);
+            printf("%ld", val->i);
+            break;
+        case BIGNUM_TYPE:
+            bignum_print(val, stdout);
+            break;
+        case F64VECTOR_TYPE:
+        case S64VECTOR_TYPE:
+            displayNumVector(val, stdout);
+            break;
+        case MATRIX_TYPE:
+            displayMatrix(val, stdout);
+            break;
+        case VECTOR_TYPE:
+            displayVector(val, stdout);
+            break;
+        case HASH_TABLE_TYPE:
+            printf("#<hash-table>");
+            break;
+        case PMAP_TYPE:
+        case PVECTOR_TYPE:
+            displayPersistent(val, stdout);
+            break;
+        case RECORD_TYPE:
+            printf("#<record %s>", val->rec->type->name);
             break;
         case DOUBLE_TYPE:
             printf("%lf", val->d);
             break;
         case STR_TYPE:
-            printf("%s", val->s);
+            string_write(val, stdout);
             break;
         case BOOL_TYPE:
             if (val->i == 0)
@@ -330,8 +628,8 @@ Value *eval_display(Value *args, Frame *frame) {
         case CLOSURE_TYPE:
             printf("#<procedure>");
         default:
-            fprintf(stderr, "Evaluation error: built-in function `display`: cannot display value of type %d\n", val->type);
-            texit(4);
+            fprintf(error_stream(), "Evaluation error: built-in function `display`: cannot display value of type %d\n", val->type);
+            raise_error(4);
     }
     result = makeVoid();
     return result;
@@ -340,9 +638,9 @@ Value *eval_display(Value *args, Frame *frame) {
 Value *eval_lambda(Value *args, Frame *frame) {
     Value *closure, *current, *next;
     if (length(args) < 2) {
-        fprintf(stderr, "Evaluation error: built-in function `lambda`: bad form in arguments: ");
+        fprintf(error_stream(), "Evaluation error: built-in function `lambda`: bad form in arguments: ");
         error_display_tree("lambda", args);
-        texit(4);
+        raise_error(4);
     }
     current = car(args);
     closure = talloc(sizeof(Value));
@@ -367,30 +665,35 @@ Value *eval_lambda(Value *args, Frame *frame) {
     }
     return closure;
 LAMBDA_BAD_PARAMETERS:
-    fprintf(stderr, "Evaluation error: built-in function `lambda`: bad form in parameters list: ");
+    fprintf(error_stream(), "Evaluation error: built-in function `lambda`: bad form in parameters list: ");
     error_display_tree("lambda", args);
-    texit(4);
+    raise_error(4);
     return NULL;    // will never return
 }
 
 Value *eval_define(Value *args, Frame *frame) {
     Value *var, *expr;
-    if (length(args) != 2) {
-        fprintf(stderr, "Evaluation error: built-in function `define`: bad form in arguments: ");
+    if (length(args) < 2) {
+        fprintf(error_stream(), "Evaluation error: built-in function `define`: bad form in arguments: ");
         error_display_tree("define", args);
-        texit(4);
+        raise_error(4);
     }
     var = car(args);
     expr = car(cdr(args));
     if (var->type == CONS_TYPE) {
-        expr = eval_lambda(cons(cdr(var), expr), frame);
+        // (define (name . params) body ...) is (define name (lambda params body ...))
+        expr = eval_lambda(cons(cdr(var), cdr(args)), frame);
         var = car(var);
+    } else if (length(args) != 2) {
+        fprintf(error_stream(), "Evaluation error: built-in function `define`: bad form in arguments: ");
+        error_display_tree("define", args);
+        raise_error(4);
     } else if (var->type != SYMBOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `define`: bad form in arguments: ");
+        fprintf(error_stream(), "Evaluation error: built-in function `define`: bad form in arguments: ");
         error_display_tree("define", args);
-        texit(4);
+        raise_error(4);
     }
-    frame->bindings = cons(cons(var, eval(expr, frame)), frame->bindings);
+    frame->bindings = cons(cons(var, single_value("built-in function `define`", eval(expr, frame))), frame->bindings);
     return makeVoid();
 }
 
@@ -399,30 +702,35 @@ Value *eval_set(Value *args, Frame *frame) {
     Frame *current = frame;
     int argc = length(args);
     if (argc != 2) {
-        fprintf(stderr, "Evaluation error: built-in function `set!`: expected 2 arguments, received %d\n", argc);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `set!`: expected 2 arguments, received %d\n", argc);
+        raise_error(4);
     }
     expr = car(args);
     if (expr->type != SYMBOL_TYPE) {
-        fprintf(stderr, "Evaluation error: built-in function `set!`: wrong type argument in position 1 (expected SYMBOL_TYPE): ");
-        display_to_fd(expr, stderr);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: built-in function `set!`: wrong type argument in position 1 (expected SYMBOL_TYPE): ");
+        display_to_fd(expr, error_stream());
+        raise_error(4);
     }
     while (current != NULL) {
         binding = current->bindings;
         while (binding->type == CONS_TYPE) {
             pair = car(binding);
             if (strcmp(car(pair)->s, expr->s) == 0) {
-                pair->c.cdr = eval(car(cdr(args)), frame);
+                pair->c.cdr = single_value("built-in function `set!`", eval(car(cdr(args)), frame));
                 return makeVoid();
             }
             binding = cdr(binding);
         }
         current = current->parent;
     }
-    fprintf(stderr, "Evaluation error: built-in function `set!`: unbound variable ");
-    display_to_fd(expr, stderr);
-    texit(4);
+    pair = *primitive_slot(expr->s);
+    if (pair != NULL) {
+        pair->c.cdr = single_value("built-in function `set!`", eval(car(cdr(args)), frame));
+        return makeVoid();
+    }
+    fprintf(error_stream(), "Evaluation error: built-in function `set!`: unbound variable ");
+    display_to_fd(expr, error_stream());
+    raise_error(4);
     return NULL;
 }
 
@@ -432,9 +740,9 @@ Value *logic_helper(Value *args, Frame *frame, int end_val) {
     while (current->type == CONS_TYPE) {
         cond = eval(car(current), frame);
         if (cond->type != BOOL_TYPE) {
-            fprintf(stderr, "Evaluation error: built-in function `and`: wrong type argument in position %d: ", arg_num);
-            display_to_fd(cond, stderr);
-            texit(4);
+            fprintf(error_stream(), "Evaluation error: built-in function `and`: wrong type argument in position %d: ", arg_num);
+            display_to_fd(cond, error_stream());
+            raise_error(4);
         }
         if (cond->i == end_val) {
             return cond;
@@ -455,463 +763,4585 @@ Value *eval_or(Value *args, Frame *frame) {
 
 
 ////////////////////////////////////////
-///////// PRIMITIVE FUNCTIONS //////////
+//////////////// LOOPS /////////////////
 ////////////////////////////////////////
 
-enum operation {
-    PLUS,
-    MINUS,
-    MULT,
+// A named let or do loop runs in a single frame whose bindings are updated in
+// place at each iteration, unless something in the loop could create a
+// closure (or an unqualified nested loop) capturing that frame, which would
+// then observe the updates.  In that case the loop falls back to a fresh frame
+// per iteration, with the same semantics but allocating as it goes.
+
+/* State of a loop running in a single frame. */
+struct Loop {
+    Value *name;    // name of a named let, or NULL for do
+    int count;      // number of loop variables
+    Value **pairs;  // (variable . value) binding of each variable in the frame
+    Value **next;   // values of the variables for the next iteration
 };
 
-Value *arith_helper(Value *result, Value *args, enum operation op) {
-    Value *cur_val, *current = args;
-    char names[3] = {'+', '-', '/'};
-    char name = names[op];
-    int arg_num = 1;
-    while (current->type == CONS_TYPE) {
-        cur_val = car(current);
-        switch (cur_val->type) {
-            case INT_TYPE:
-                if (result->type == INT_TYPE) {
-                    switch (op) {
-                        case PLUS:
-                            result->i += cur_val->i;
-                            break;
-                        case MINUS:
-                            result->i -= cur_val->i;
-                            break;
-                        case MULT:
-                            result->i *= cur_val->i;
-                            break;
-                    }
-                } else if (result->type == DOUBLE_TYPE) {
-                    switch (op) {
-                        case PLUS:
-                            result->d += (double)cur_val->i;
-                            break;
-                        case MINUS:
-                            result->d -= (double)cur_val->i;
-                            break;
-                        case MULT:
-                            result->d *= (double)cur_val->i;
-                            break;
-                    }
-                }
-                break;
-            case DOUBLE_TYPE:
-                if (result->type == INT_TYPE)
-                    result->d = (double)result->i;
-                result->type = DOUBLE_TYPE;
-                switch (op) {
-                    case PLUS:
-                        result->d += cur_val->d;
-                        break;
-                    case MINUS:
-                        result->d -= cur_val->d;
-                        break;
-                    case MULT:
-                        result->d *= cur_val->d;
-                        break;
-                }
-                break;
-            default:
-                fprintf(stderr, "Evaluation error: primitive function `%c`: wrong type argument in position %d: ", name, arg_num);
-                display_to_fd(cur_val, stderr);
-                texit(4);
-        }
-        current = cdr(current);
-        arg_num++;
-    }
-    return result;
-}
+// Returned by loop_tail_eval when the loop body made a call to the loop.
+Value LOOP_CONTINUE;
 
-Value *prim_add(Value *args) {
-    Value *result;
-    result = talloc(sizeof(Value));
-    result->type = INT_TYPE;
-    result->i = 0;
-    return arith_helper(result, args, PLUS);
-}
+// Number of continuations captured which may be re-entered.  A loop running
+// in place moves to a fresh frame after an iteration in which this changed,
+// so that re-entering the continuation finds the bindings it captured.
+unsigned long CONTINUATION_CAPTURES = 0;
 
-Value *prim_sub(Value *args) {
-    Value *result;
-    int argc = length(args);
-    result = talloc(sizeof(Value));
-    result->type = INT_TYPE;
-    result->i = 0;
-    switch (argc) {
-        case 0:
-            fprintf(stderr, "Evaluation error: primitive function `-`: wrong number of arguments\n");
-            texit(4);
-        case 1:
-            return arith_helper(result, args, MINUS);
-        default:
+int named_let_inplace_ok(Value *args);
+int do_inplace_ok(Value *args);
+int is_macro_name(Value *symbol);
+Frame *let_frame(Value *args, Frame *frame, int star, int rec);
+
+/* Returns 1 if the symbol occurs in the expression, outside of quoted data. */
+int occurs_in(Value *symbol, Value *expr) {
+    switch (expr->type) {
+        case SYMBOL_TYPE:
+            return strcmp(expr->s, symbol->s) == 0;
+        case CONS_TYPE:
             break;
+        default:
+            return 0;
+    }
+    if (car(expr)->type == SYMBOL_TYPE && strcmp(car(expr)->s, "quote") == 0)
+        return 0;
+    while (expr->type == CONS_TYPE) {
+        if (occurs_in(symbol, car(expr)))
+            return 1;
+        expr = cdr(expr);
     }
-    *result = *car(args);
-    return arith_helper(result, cdr(args), MINUS);
+    return occurs_in(symbol, expr);
 }
 
-Value *prim_mul(Value *args) {
-    Value *result = talloc(sizeof(Value));
-    result->type = INT_TYPE;
-    result->i = 1;
-    return arith_helper(result, args, MULT);
-}
+int loop_expr_ok(Value *expr, Value *name, int count, int tail);
 
-Value *prim_div(Value *args) {
-    Value *result, *divisor;
-    int argc = length(args);
-    if (argc != 2) {
-        fprintf(stderr, "Evaluation error: primitive function `/`: wrong number of arguments\n");
-        texit(4);
+/* Applies loop_expr_ok to each element of the list, only the last of which
+ * may be in tail position. */
+int loop_list_ok(Value *list, Value *name, int count, int tail) {
+    while (list->type == CONS_TYPE) {
+        if (!loop_expr_ok(car(list), name, count, tail && cdr(list)->type != CONS_TYPE))
+            return 0;
+        list = cdr(list);
     }
-    result = talloc(sizeof(Value));
-    *result = *car(args);
-    divisor = car(cdr(args));
-    if (result->type != INT_TYPE && result->type != DOUBLE_TYPE) {
-        fprintf(stderr, "Evaluation error: primitive function `/`: wrong type argument in position 1: ");
-        display_to_fd(result, stderr);
-        texit(4);
-    }
-    switch (divisor->type) {
-        case INT_TYPE:
-            if (result->type == INT_TYPE) {
-                if (result->i % divisor->i == 0) {
-                    result->i /= divisor->i;
-                    return result;
-                }
-                result->type = DOUBLE_TYPE;
-                result->d = (double)result->i;
-            }
-            divisor->d = (double)divisor->i;
-        case DOUBLE_TYPE:
-            if (result->type == INT_TYPE)
-                result->d = (double)result->i;
-            result->type = DOUBLE_TYPE;
-            result->d /= divisor->d;
-            break;
-        default:
-            fprintf(stderr, "Evaluation error: primitive function `/`: wrong type argument in position 2: ");
-            display_to_fd(divisor, stderr);
-            texit(4);
-    }
-    return result;
+    return 1;
 }
 
-Value *prim_mod(Value *args) {
-    Value *result, *first, *second;
-    if (length(args) != 2) {
-        fprintf(stderr, "Evaluation error: primitive function `modulo`: wrong number of arguments\n");
-        texit(4);
+/* Returns 1 if the expression can be evaluated by loop_tail_eval inside a loop
+ * named name (NULL for do) with count variables updated in place: the name is
+ * only called, in tail position (if tail is set) and with count arguments, and
+ * no closure can be created.  Tail positions are those loop_tail_eval
+ * handles: the branches of if, cond, when and unless, and the last expression
+ * of begin and of the body of let-family forms which do not rebind the name. */
+int loop_expr_ok(Value *expr, Value *name, int count, int tail) {
+    Value *head, *args, *current;
+    if (expr->type == SYMBOL_TYPE)
+        return name == NULL || strcmp(expr->s, name->s) != 0;
+    if (expr->type != CONS_TYPE)
+        return 1;
+    head = car(expr);
+    args = cdr(expr);
+    if (head->type != SYMBOL_TYPE)
+        return loop_list_ok(expr, name, count, 0);
+    if (name != NULL && strcmp(head->s, name->s) == 0)
+        return tail && length(args) == count && loop_list_ok(args, name, count, 0);
+    if (strcmp(head->s, "quote") == 0)
+        return 1;
+    if (strcmp(head->s, "lambda") == 0 || strcmp(head->s, "define") == 0
+            || strcmp(head->s, "define-syntax") == 0 || is_macro_name(head)
+            || strcmp(head->s, "delay") == 0 || strcmp(head->s, "delay-force") == 0
+            || strcmp(head->s, "stream-cons") == 0)
+        return 0;
+    if (args->type != CONS_TYPE)
+        return loop_list_ok(args, name, count, 0);
+    if (strcmp(head->s, "if") == 0) {
+        if (!loop_expr_ok(car(args), name, count, 0))
+            return 0;
+        for (current = cdr(args); current->type == CONS_TYPE; current = cdr(current))
+            if (!loop_expr_ok(car(current), name, count, tail))
+                return 0;
+        return 1;
     }
-    first = car(args);
-    second = car(cdr(args));
-    if (first->type != INT_TYPE) {
-        fprintf(stderr, "Evaluation error: primitive function `modulo`: wrong type argument in position 1: ");
-        display_to_fd(first, stderr);
-        texit(4);
+    if (strcmp(head->s, "cond") == 0) {
+        for (current = args; current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type != CONS_TYPE
+                    || !loop_expr_ok(car(car(current)), name, count, 0)
+                    || !loop_list_ok(cdr(car(current)), name, count, tail))
+                return 0;
+        return 1;
     }
-    if (second->type != INT_TYPE) {
-        fprintf(stderr, "Evaluation error: primitive function `modulo`: wrong type argument in position 2: ");
-        display_to_fd(second, stderr);
-        texit(4);
+    if (strcmp(head->s, "when") == 0 || strcmp(head->s, "unless") == 0)
+        return loop_expr_ok(car(args), name, count, 0) && loop_list_ok(cdr(args), name, count, tail);
+    if (strcmp(head->s, "case") == 0) {
+        // The key follows the cached table once the form has been evaluated
+        if (car(args)->type == PTR_TYPE)
+            args = cdr(args);
+        if (args->type != CONS_TYPE || !loop_expr_ok(car(args), name, count, 0))
+            return 0;
+        for (current = cdr(args); current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type != CONS_TYPE || !loop_list_ok(cdr(car(current)), name, count, tail))
+                return 0;
+        return 1;
     }
-    result = talloc(sizeof(Value));
-    result->type = INT_TYPE;
-    result->i = first->i % second->i;
-    return result;
-}
-
-enum comparison {
-    EQ,
-    GT,
-    LT,
-    GEQ,
-    LEQ,
-};
-
-Value *compare_helper(Value *args, enum comparison comp) {
-    Value *prev, *current, *cur_val;
-    int arg_num = 2;
-    if (length(args) <= 1)
-        return makeBool(1);
-    prev = car(args);   // should already be evaluated
-    current = cdr(args);
-    while (current->type == CONS_TYPE) {
-        cur_val = car(current);
-        switch (prev->type) {
-            case INT_TYPE:
-                switch (cur_val->type) {
-                    case INT_TYPE:
-                        switch (comp) {
-                            case EQ:
-                                if (prev->i != cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case GT:
-                                if (prev->i <= cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case LT:
-                                if (prev->i >= cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case GEQ:
-                                if (prev->i < cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case LEQ:
-                                if (prev->i > cur_val->i)
-                                    return makeBool(0);
-                                break;
-                        }
-                        break;
-                    case DOUBLE_TYPE:
-                        switch (comp) {
-                            case EQ:
-                                if (prev->d != cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case GT:
-                                if (prev->d <= cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case LT:
-                                if (prev->d >= cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case GEQ:
-                                if (prev->d < cur_val->i)
-                                    return makeBool(0);
-                                break;
-                            case LEQ:
-                                if (prev->d > cur_val->i)
-                                    return makeBool(0);
-                                break;
-                        }
-                        break;
-                    default:
-                        fprintf(stderr, "Evaluation error: primitive function `=`: wrong type argument in position %d: ", arg_num);
-                        display_to_fd(prev, stderr);
-                        texit(4);
-                }
-                break;
-            case DOUBLE_TYPE:
-                switch (cur_val->type) {
-                    case INT_TYPE:
-                        switch (comp) {
-                            case EQ:
-                                if (prev->i != cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case GT:
-                                if (prev->i <= cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case LT:
-                                if (prev->i >= cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case GEQ:
-                                if (prev->i < cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case LEQ:
-                                if (prev->i > cur_val->d)
-                                    return makeBool(0);
-                                break;
-                        }
-                        break;
-                    case DOUBLE_TYPE:
-                        switch (comp) {
-                            case EQ:
-                                if (prev->d != cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case GT:
-                                if (prev->d <= cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case LT:
-                                if (prev->d >= cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case GEQ:
-                                if (prev->d < cur_val->d)
-                                    return makeBool(0);
-                                break;
-                            case LEQ:
-                                if (prev->d > cur_val->d)
-                                    return makeBool(0);
-                                break;
-                        }
-                        break;
-                    default:
-                        fprintf(stderr, "Evaluation error: primitive function `=`: wrong type argument in position %d: ", arg_num);
-                        display_to_fd(prev, stderr);
-                        texit(4);
-                }
-                break;
-            default:
-                fprintf(stderr, "Evaluation error: primitive function `=`: wrong type argument in position 1: ");
-                display_to_fd(prev, stderr);
-                texit(4);
+    if (strcmp(head->s, "begin") == 0)
+        return loop_list_ok(args, name, count, tail);
+    if ((strcmp(head->s, "let") == 0 && car(args)->type == SYMBOL_TYPE)
+            || strcmp(head->s, "do") == 0) {
+        // A nested loop is fine if it runs in place itself, as long as it
+        // does not refer to this loop
+        if (name != NULL && occurs_in(name, expr))
+            return 0;
+        return strcmp(head->s, "do") == 0 ? do_inplace_ok(args) : named_let_inplace_ok(args);
+    }
+    if (strcmp(head->s, "let") == 0 || strcmp(head->s, "let*") == 0
+            || strcmp(head->s, "letrec") == 0 || strcmp(head->s, "letrec*") == 0) {
+        for (current = car(args); current->type == CONS_TYPE; current = cdr(current)) {
+            if (car(current)->type != CONS_TYPE || !loop_list_ok(car(current), name, count, 0))
+                return 0;
         }
-        arg_num++;
-        prev = current;
-        current = cdr(current);
+        return loop_list_ok(cdr(args), name, count, tail);
     }
-    return makeBool(1);
+    return loop_list_ok(args, name, count, 0);
 }
 
-Value *prim_eqnum(Value *args) {
-    return compare_helper(args, EQ);
-}
-
-Value *prim_gt(Value *args) {
-    return compare_helper(args, GT);
+/* Returns 1 if the named let with the given arguments may run in place. */
+int named_let_inplace_ok(Value *args) {
+    Value *current;
+    int count = 0;
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE)
+        return 0;
+    for (current = car(cdr(args)); current->type == CONS_TYPE; current = cdr(current)) {
+        if (car(current)->type != CONS_TYPE || !loop_list_ok(cdr(car(current)), NULL, 0, 0))
+            return 0;
+        count++;
+    }
+    return loop_list_ok(cdr(cdr(args)), car(args), count, 1);
 }
 
-Value *prim_lt(Value *args) {
-    return compare_helper(args, LT);
+/* Returns 1 if the do loop with the given arguments may run in place. */
+int do_inplace_ok(Value *args) {
+    Value *current;
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+        if (car(current)->type != CONS_TYPE || !loop_list_ok(cdr(car(current)), NULL, 0, 0))
+            return 0;
+    return loop_list_ok(cdr(args), NULL, 0, 0);
 }
 
-Value *prim_geq(Value *args) {
-    return compare_helper(args, GEQ);
+/* Evaluates an expression of the body of a loop running in place.  If it
+ * makes a call to the loop in tail position, stores the evaluated arguments
+ * in loop->next and returns &LOOP_CONTINUE; otherwise returns its value.
+ * Anything but a tail position form is passed to eval, which also reports
+ * malformed forms. */
+Value *loop_tail_eval(Value *expr, Frame *frame, struct Loop *loop) {
+    Value *head, *args, *current, *cond, *clause;
+    Frame *inner;
+    int i, argc;
+    if (expr->type != CONS_TYPE || car(expr)->type != SYMBOL_TYPE)
+        return eval(expr, frame);
+    head = car(expr);
+    args = cdr(expr);
+    if (loop->name != NULL && strcmp(head->s, loop->name->s) == 0) {
+        for (i = 0, current = args; i < loop->count; i++, current = cdr(current))
+            loop->next[i] = single_value("procedure call", eval(car(current), frame));
+        return &LOOP_CONTINUE;
+    }
+    if (lookup_symbol(head, frame) != NULL)
+        return eval(expr, frame);
+    if (strcmp(head->s, "if") == 0) {
+        argc = length(args);
+        if (argc < 2 || argc > 3)
+            return eval(expr, frame);
+        cond = eval(car(args), frame);
+        if (cond->type != BOOL_TYPE) {
+            fprintf(error_stream(), "Evaluation error: built-in function `if`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", BOOL_TYPE, cond->type);
+            raise_error(4);
+        }
+        if (cond->i)
+            return loop_tail_eval(car(cdr(args)), frame, loop);
+        if (argc == 2)
+            return makeVoid();
+        return loop_tail_eval(car(cdr(cdr(args))), frame, loop);
+    }
+    if (strcmp(head->s, "cond") == 0) {
+        for (current = args; current->type == CONS_TYPE; current = cdr(current)) {
+            clause = car(current);
+            if (clause->type != CONS_TYPE || cdr(clause)->type != CONS_TYPE)
+                return eval(expr, frame);
+            if (car(clause)->type != SYMBOL_TYPE || strcmp(car(clause)->s, "else") != 0) {
+                cond = eval(car(clause), frame);
+                if (cond->type != BOOL_TYPE)
+                    return eval(expr, frame);
+                if (!cond->i)
+                    continue;
+            }
+            for (clause = cdr(clause); cdr(clause)->type == CONS_TYPE; clause = cdr(clause))
+                eval(car(clause), frame);
+            return loop_tail_eval(car(clause), frame, loop);
+        }
+        return eval(expr, frame);
+    }
+    if (strcmp(head->s, "when") == 0 || strcmp(head->s, "unless") == 0) {
+        if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE)
+            return eval(expr, frame);
+        cond = eval(car(args), frame);
+        if (cond->type != BOOL_TYPE) {
+            fprintf(error_stream(), "Evaluation error: built-in function `%s`: expected type %d (BOOL_TYPE) as first argument, but received %d\n", head->s, BOOL_TYPE, cond->type);
+            raise_error(4);
+        }
+        if (cond->i != (head->s[0] == 'w'))
+            return makeVoid();
+        for (current = cdr(args); cdr(current)->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), frame);
+        return loop_tail_eval(car(current), frame, loop);
+    }
+    if (strcmp(head->s, "case") == 0) {
+        current = case_select(args, frame);
+        if (current == NULL)
+            return makeVoid();
+        for (; cdr(current)->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), frame);
+        return loop_tail_eval(car(current), frame, loop);
+    }
+    if (strcmp(head->s, "begin") == 0) {
+        if (args->type != CONS_TYPE)
+            return eval(expr, frame);
+        for (current = args; cdr(current)->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), frame);
+        return loop_tail_eval(car(current), frame, loop);
+    }
+    if ((strcmp(head->s, "let") == 0 || strcmp(head->s, "let*") == 0
+                || strcmp(head->s, "letrec") == 0 || strcmp(head->s, "letrec*") == 0)
+            && args->type == CONS_TYPE && car(args)->type != SYMBOL_TYPE) {
+        inner = let_frame(args, frame, head->s[strlen(head->s) - 1] == '*',
+                strncmp(head->s, "letrec", 6) == 0);
+        for (current = cdr(args); cdr(current)->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), inner);
+        return loop_tail_eval(car(current), inner, loop);
+    }
+    return eval(expr, frame);
 }
 
-Value *prim_leq(Value *args) {
-    return compare_helper(args, LEQ);
+/* Binds each (variable init ...) of the specs list in a new frame, with init
+ * evaluated in the given frame, filling in loop->pairs.  loop->next is left
+ * to the caller, which keeps it on its stack so that a re-entered
+ * continuation finds the values it had computed for the next iteration. */
+Frame *loop_frame(Value *specs, Frame *frame, struct Loop *loop, char *name) {
+    Value *current, *spec, *pair;
+    Frame *new_frame = talloc(sizeof(Frame));
+    int i;
+    new_frame->bindings = makeNull();
+    new_frame->parent = frame;
+    loop->count = length(specs);
+    loop->pairs = talloc(sizeof(Value *) * loop->count);
+    for (i = 0, current = specs; current->type == CONS_TYPE; i++, current = cdr(current)) {
+        spec = car(current);
+        if (spec->type != CONS_TYPE || car(spec)->type != SYMBOL_TYPE
+                || cdr(spec)->type != CONS_TYPE) {
+            fprintf(error_stream(), "Evaluation error: built-in function `%s`: bad form in variable specification: ", name);
+            display_to_fd(spec, error_stream());
+            raise_error(4);
+        }
+        pair = cons(car(spec), single_value(strcmp(name, "do") == 0 ? "built-in function `do`" : "built-in function `let`", eval(car(cdr(spec)), frame)));
+        new_frame->bindings = cons(pair, new_frame->bindings);
+        loop->pairs[i] = pair;
+    }
+    return new_frame;
 }
 
-Value *prim_null(Value *args) {
-    int argc = length(args);
-    if (argc != 1) {
-        fprintf(stderr, "Evaluation error: primitive function `null?`: expected 1 argument, received %d\n", argc);
-        texit(4);
+/* Returns a fresh frame for the next iteration of the loop, with new
+ * bindings of its variables, leaving the frame of the finished iteration to
+ * whatever captured it. */
+Frame *loop_renew_frame(Frame *frame, struct Loop *loop) {
+    Frame *new_frame = talloc(sizeof(Frame));
+    Value *pair, **pairs = talloc(sizeof(Value *) * loop->count);
+    int i;
+    new_frame->bindings = makeNull();
+    new_frame->parent = frame->parent;
+    for (i = 0; i < loop->count; i++) {
+        pair = cons(car(loop->pairs[i]), NULL);
+        new_frame->bindings = cons(pair, new_frame->bindings);
+        pairs[i] = pair;
     }
-    return makeBool(car(args)->type == NULL_TYPE);
+    // A re-entered continuation still holds the old array
+    loop->pairs = pairs;
+    return new_frame;
 }
 
-Value *prim_car(Value *args) {
-    Value *value;
-    int argc = length(args);
-    if (argc != 1) {
-        fprintf(stderr, "Evaluation error: primitive function `car`: expected 1 argument, received %d\n", argc);
-        texit(4);
+/* (let name ((var init) ...) body ...) binds name, within body, to a
+ * procedure of the variables with the given body, and calls it on the inits.
+ * Runs in place when the body only calls name in tail position. */
+Value *eval_named_let(Value *args, Frame *frame) {
+    Value *name, *body, *current, *params, *call_args, *closure, *result;
+    Frame *new_frame;
+    struct Loop loop;
+    unsigned long captures;
+    int i;
+    if (length(args) < 3 || car(cdr(args))->type == SYMBOL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: built-in function `let`: bad form in arguments: ");
+        error_display_tree("let", args);
+        raise_error(4);
     }
-    value = car(args);
-    if (value->type != CONS_TYPE) {
-        fprintf(stderr, "Evaluation error: primitive function `car`: wrong type argument in position 1 (expected CONS_TYPE): ");
-        display_to_fd(value, stderr);
-        texit(4);
+    name = car(args);
+    body = cdr(cdr(args));
+    loop.name = name;
+    new_frame = loop_frame(car(cdr(args)), frame, &loop, "let");
+    Value *next[loop.count + 1];
+    loop.next = next;
+    if (!named_let_inplace_ok(args)) {
+        params = makeNull();
+        call_args = makeNull();
+        for (i = loop.count - 1; i >= 0; i--) {
+            params = cons(car(loop.pairs[i]), params);
+            call_args = cons(cdr(loop.pairs[i]), call_args);
+        }
+        new_frame->bindings = makeNull();
+        closure = eval_lambda(cons(params, body), new_frame);
+        new_frame->bindings = cons(cons(name, closure), new_frame->bindings);
+        return apply_list(closure, call_args);
+    }
+    while (1) {
+        captures = CONTINUATION_CAPTURES;
+        for (current = body; cdr(current)->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), new_frame);
+        result = loop_tail_eval(car(current), new_frame, &loop);
+        if (result != &LOOP_CONTINUE)
+            return result;
+        if (captures != CONTINUATION_CAPTURES)
+            new_frame = loop_renew_frame(new_frame, &loop);
+        for (i = 0; i < loop.count; i++)
+            loop.pairs[i]->c.cdr = loop.next[i];
     }
-    return car(value);
 }
 
-Value *prim_cdr(Value *args) {
+/* (do ((var init step) ...) (test expr ...) command ...) binds each var to
+ * its init, then until test evaluates to #t, evaluates the commands and
+ * updates each var having a step to the value of its step.  Returns the value
+ * of the last expr, or void if there is none. */
+Value *eval_do(Value *args, Frame *frame) {
+    Value *current, *test, **steps;
+    Frame *loop_frame_ptr;
+    struct Loop loop;
+    unsigned long captures;
+    int i, inplace, first = 1;
+    if (length(args) < 2 || car(cdr(args))->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: built-in function `do`: bad form in arguments: ");
+        error_display_tree("do", args);
+        raise_error(4);
+    }
+    loop.name = NULL;
+    loop_frame_ptr = loop_frame(car(args), frame, &loop, "do");
+    Value *next[loop.count + 1];
+    loop.next = next;
+    steps = talloc(sizeof(Value *) * loop.count);
+    for (i = 0, current = car(args); i < loop.count; i++, current = cdr(current))
+        steps[i] = cdr(cdr(car(current)))->type == CONS_TYPE ? car(cdr(cdr(car(current)))) : NULL;
+    inplace = do_inplace_ok(args);
+    while (1) {
+        captures = CONTINUATION_CAPTURES;
+        test = eval(car(car(cdr(args))), loop_frame_ptr);
+        if (test->type != BOOL_TYPE) {
+            fprintf(error_stream(), "Evaluation error: built-in function `do`: expected test to return type %d (BOOL_TYPE), but received %d\n", BOOL_TYPE, test->type);
+            raise_error(4);
+        }
+        if (test->i)
+            return eval_begin(cdr(car(cdr(args))), loop_frame_ptr);
+        for (current = cdr(cdr(args)); current->type == CONS_TYPE; current = cdr(current))
+            eval(car(current), loop_frame_ptr);
+        for (i = 0; i < loop.count; i++)
+            loop.next[i] = steps[i] != NULL ? single_value("built-in function `do`", eval(steps[i], loop_frame_ptr)) : cdr(loop.pairs[i]);
+        if (!inplace && first) {
+            // Macro uses the first iteration reached are now expanded, and
+            // may have hidden nothing that captures the frame
+            inplace = do_inplace_ok(args);
+            first = 0;
+        }
+        // A closure or a continuation may have captured this iteration's
+        // frame
+        if (!inplace || captures != CONTINUATION_CAPTURES)
+            loop_frame_ptr = loop_renew_frame(loop_frame_ptr, &loop);
+        for (i = 0; i < loop.count; i++)
+            loop.pairs[i]->c.cdr = loop.next[i];
+    }
+}
+
+
+////////////////////////////////////////
+/////////////// MACROS /////////////////
+////////////////////////////////////////
+
+// A use of a macro is expanded the first time eval reaches it, and the
+// expansion is spliced into the parse tree in place of the use, so evaluating
+// the same code again runs the expansion directly, with no matching.  The
+// variables which binding forms in a template introduce are renamed at each
+// expansion so that they cannot capture variables of the same name at the
+// use site.
+
+/* A pattern variable bound by matching a syntax-rules pattern. */
+struct MacroBinding {
+    Value *name;
+    int depth;      // number of ellipses following the variable in the pattern
+    Value *value;   // the matched form, or for depth > 0 a list of matches
+    struct MacroBinding *next;
+};
+
+/* Names of every macro defined so far; the loop analysis treats their uses as
+ * forms it cannot see into, since they are expanded later. */
+Value *MACRO_NAMES = NULL;
+int MACRO_RENAME_COUNT = 0;
+
+int equal_helper(Value *first, Value *second);
+
+/* Returns 1 if the value is the symbol with the given name. */
+int symbol_named(Value *value, char *name) {
+    return value->type == SYMBOL_TYPE && strcmp(value->s, name) == 0;
+}
+
+/* Returns 1 if the symbol is in the given list of symbols. */
+int symbol_member(Value *symbol, Value *list) {
+    for (; list->type == CONS_TYPE; list = cdr(list))
+        if (strcmp(car(list)->s, symbol->s) == 0)
+            return 1;
+    return 0;
+}
+
+/* Returns 1 if the symbol names a macro. */
+int is_macro_name(Value *symbol) {
+    return MACRO_NAMES != NULL && symbol_member(symbol, MACRO_NAMES);
+}
+
+struct MacroBinding *macro_bind(Value *name, int depth, Value *value, struct MacroBinding *next) {
+    struct MacroBinding *binding = talloc(sizeof(struct MacroBinding));
+    binding->name = name;
+    binding->depth = depth;
+    binding->value = value;
+    binding->next = next;
+    return binding;
+}
+
+struct MacroBinding *macro_lookup(Value *symbol, struct MacroBinding *bindings) {
+    for (; bindings != NULL; bindings = bindings->next)
+        if (strcmp(bindings->name->s, symbol->s) == 0)
+            return bindings;
+    return NULL;
+}
+
+/* Returns 1 if the symbol occurs anywhere in the template, including inside
+ * quoted data. */
+int macro_mentions(Value *tmpl, Value *symbol) {
+    while (tmpl->type == CONS_TYPE) {
+        if (macro_mentions(car(tmpl), symbol))
+            return 1;
+        tmpl = cdr(tmpl);
+    }
+    return tmpl->type == SYMBOL_TYPE && strcmp(tmpl->s, symbol->s) == 0;
+}
+
+/* Conses onto acc a binding to the empty list for each pattern variable of the
+ * pattern, at the depth of ellipses it appears under. */
+struct MacroBinding *macro_pattern_vars(Value *pattern, Value *literals, int depth, struct MacroBinding *acc) {
+    while (pattern->type == CONS_TYPE) {
+        if (cdr(pattern)->type == CONS_TYPE && symbol_named(car(cdr(pattern)), "...")) {
+            acc = macro_pattern_vars(car(pattern), literals, depth + 1, acc);
+            pattern = cdr(cdr(pattern));
+        } else {
+            acc = macro_pattern_vars(car(pattern), literals, depth, acc);
+            pattern = cdr(pattern);
+        }
+    }
+    if (pattern->type == SYMBOL_TYPE && !symbol_named(pattern, "_")
+            && !symbol_member(pattern, literals))
+        acc = macro_bind(pattern, depth, makeNull(), acc);
+    return acc;
+}
+
+/* Matches the form against the syntax-rules pattern, consing the bindings of
+ * its pattern variables onto *bindings.  Returns 1 on a match. */
+int macro_match(Value *pattern, Value *form, Value *literals, struct MacroBinding **bindings) {
+    Value *rest, *current;
+    struct MacroBinding *vars, *inner, *var;
+    int n;
+    switch (pattern->type) {
+        case SYMBOL_TYPE:
+            if (symbol_member(pattern, literals))
+                return symbol_named(form, pattern->s);
+            if (!symbol_named(pattern, "_"))
+                *bindings = macro_bind(pattern, 0, form, *bindings);
+            return 1;
+        case CONS_TYPE:
+            break;
+        case NULL_TYPE:
+            return form->type == NULL_TYPE;
+        default:
+            return equal_helper(pattern, form);
+    }
+    if (cdr(pattern)->type != CONS_TYPE || !symbol_named(car(cdr(pattern)), "...")) {
+        return form->type == CONS_TYPE
+            && macro_match(car(pattern), car(form), literals, bindings)
+            && macro_match(cdr(pattern), cdr(form), literals, bindings);
+    }
+    // (p ... rest): p matches as many elements as rest leaves over, and each
+    // of its variables is bound to the list of its matches
+    rest = cdr(cdr(pattern));
+    n = 0;
+    for (current = form; current->type == CONS_TYPE; current = cdr(current))
+        n++;
+    for (current = rest; current->type == CONS_TYPE; current = cdr(current))
+        n--;
+    if (n < 0)
+        return 0;
+    vars = macro_pattern_vars(car(pattern), literals, 0, NULL);
+    for (; n > 0; n--) {
+        inner = NULL;
+        if (!macro_match(car(pattern), car(form), literals, &inner))
+            return 0;
+        for (var = vars; var != NULL; var = var->next)
+            var->value = cons(macro_lookup(var->name, inner)->value, var->value);
+        form = cdr(form);
+    }
+    for (var = vars; var != NULL; var = var->next)
+        *bindings = macro_bind(var->name, var->depth + 1, reverse(var->value), *bindings);
+    return macro_match(rest, form, literals, bindings);
+}
+
+/* Adds a fresh name for the symbol to renames, unless it is a pattern
+ * variable or already renamed. */
+struct MacroBinding *macro_rename(Value *symbol, struct MacroBinding *bindings, struct MacroBinding *renames) {
+    char buf[32];
+    Value *fresh;
+    if (symbol->type != SYMBOL_TYPE || symbol_named(symbol, "...")
+            || macro_lookup(symbol, bindings) != NULL || macro_lookup(symbol, renames) != NULL)
+        return renames;
+    // # is a delimiter for the tokenizer, so no source symbol looks like this
+    MACRO_RENAME_COUNT++;
+    snprintf(buf, sizeof(buf), "#%d", MACRO_RENAME_COUNT);
+    fresh = talloc(sizeof(Value));
+    fresh->type = SYMBOL_TYPE;
+    fresh->s = talloc(strlen(symbol->s) + strlen(buf) + 1);
+    strcpy(fresh->s, symbol->s);
+    strcat(fresh->s, buf);
+    return macro_bind(symbol, 0, fresh, renames);
+}
+
+/* Conses onto renames a fresh name for every symbol of the template which a
+ * lambda, let-family form (including named let) or do in the template binds,
+ * other than pattern variables. */
+struct MacroBinding *macro_template_binders(Value *tmpl, struct MacroBinding *bindings, struct MacroBinding *renames) {
+    Value *head, *args, *current;
+    if (tmpl->type != CONS_TYPE)
+        return renames;
+    head = car(tmpl);
+    args = cdr(tmpl);
+    if (symbol_named(head, "quote"))
+        return renames;
+    if (args->type == CONS_TYPE) {
+        if (symbol_named(head, "lambda")) {
+            for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+                renames = macro_rename(car(current), bindings, renames);
+            renames = macro_rename(current, bindings, renames);
+        } else if (symbol_named(head, "let") || symbol_named(head, "let*")
+                || symbol_named(head, "letrec") || symbol_named(head, "letrec*")
+                || symbol_named(head, "do")) {
+            current = car(args);
+            if (current->type == SYMBOL_TYPE && cdr(args)->type == CONS_TYPE) {
+                renames = macro_rename(current, bindings, renames);
+                current = car(cdr(args));
+            }
+            for (; current->type == CONS_TYPE; current = cdr(current))
+                if (car(current)->type == CONS_TYPE)
+                    renames = macro_rename(car(car(current)), bindings, renames);
+        }
+    }
+    for (current = tmpl; current->type == CONS_TYPE; current = cdr(current))
+        renames = macro_template_binders(car(current), bindings, renames);
+    return renames;
+}
+
+/* Returns a new form built from the template, with pattern variables replaced
+ * by their matches and renamed binders by their fresh names.  A subtemplate
+ * followed by an ellipsis is repeated once for each match of the pattern
+ * variables it contains, and (... ...) stands for a literal ellipsis. */
+Value *macro_instantiate(Value *tmpl, struct MacroBinding *bindings, struct MacroBinding *renames) {
+    Value *sub, *items, *tail, head;
+    struct MacroBinding *binding, *cursors, *inner, *cursor;
+    switch (tmpl->type) {
+        case SYMBOL_TYPE:
+            binding = macro_lookup(tmpl, bindings);
+            if (binding != NULL) {
+                if (binding->depth != 0) {
+                    fprintf(error_stream(), "Evaluation error: syntax-rules: pattern variable `%s` used without ellipsis\n", tmpl->s);
+                    raise_error(4);
+                }
+                return binding->value;
+            }
+            binding = macro_lookup(tmpl, renames);
+            return binding != NULL ? binding->value : tmpl;
+        case CONS_TYPE:
+            break;
+        default:
+            return tmpl;
+    }
+    if (symbol_named(car(tmpl), "...") && cdr(tmpl)->type == CONS_TYPE)
+        return car(cdr(tmpl));
+    if (cdr(tmpl)->type != CONS_TYPE || !symbol_named(car(cdr(tmpl)), "..."))
+        return cons(macro_instantiate(car(tmpl), bindings, renames),
+                macro_instantiate(cdr(tmpl), bindings, renames));
+    // Repeat sub over the matches of its variables which are under ellipses
+    sub = car(tmpl);
+    cursors = NULL;
+    for (binding = bindings; binding != NULL; binding = binding->next)
+        if (binding->depth > 0 && macro_mentions(sub, binding->name)
+                && macro_lookup(binding->name, cursors) == NULL)
+            cursors = macro_bind(binding->name, binding->depth - 1, binding->value, cursors);
+    if (cursors == NULL) {
+        fprintf(error_stream(), "Evaluation error: syntax-rules: no pattern variable to repeat before ellipsis in template: ");
+        display_to_fd(tmpl, error_stream());
+        raise_error(4);
+    }
+    head.c.cdr = NULL;
+    items = &head;
+    while (1) {
+        inner = bindings;
+        for (cursor = cursors; cursor != NULL; cursor = cursor->next) {
+            if (cursor->value->type != CONS_TYPE)
+                goto MACRO_REPEAT_DONE;
+            inner = macro_bind(cursor->name, cursor->depth, car(cursor->value), inner);
+            cursor->value = cdr(cursor->value);
+        }
+        items->c.cdr = cons(macro_instantiate(sub, inner, renames), NULL);
+        items = items->c.cdr;
+    }
+MACRO_REPEAT_DONE:
+    tail = macro_instantiate(cdr(cdr(tmpl)), bindings, renames);
+    items->c.cdr = tail;
+    return head.c.cdr;
+}
+
+/* (define-syntax name (syntax-rules (literal ...) (pattern template) ...))
+ * binds name to a macro in the current frame. */
+Value *eval_define_syntax(Value *args, Frame *frame) {
+    Value *spec, *current, *macro;
+    if (length(args) != 2 || car(args)->type != SYMBOL_TYPE)
+        goto DEFINE_SYNTAX_BAD_FORM;
+    spec = car(cdr(args));
+    if (spec->type != CONS_TYPE || !symbol_named(car(spec), "syntax-rules")
+            || length(spec) < 2)
+        goto DEFINE_SYNTAX_BAD_FORM;
+    for (current = car(cdr(spec)); current->type == CONS_TYPE; current = cdr(current))
+        if (car(current)->type != SYMBOL_TYPE)
+            goto DEFINE_SYNTAX_BAD_FORM;
+    if (current->type != NULL_TYPE)
+        goto DEFINE_SYNTAX_BAD_FORM;
+    for (current = cdr(cdr(spec)); current->type == CONS_TYPE; current = cdr(current))
+        if (car(current)->type != CONS_TYPE || car(car(current))->type != CONS_TYPE
+                || length(car(current)) != 2)
+            goto DEFINE_SYNTAX_BAD_FORM;
+    if (current->type != NULL_TYPE)
+        goto DEFINE_SYNTAX_BAD_FORM;
+    macro = talloc(sizeof(Value));
+    macro->type = MACRO_TYPE;
+    macro->mac.literals = car(cdr(spec));
+    macro->mac.rules = cdr(cdr(spec));
+    frame->bindings = cons(cons(car(args), macro), frame->bindings);
+    MACRO_NAMES = cons(car(args), MACRO_NAMES == NULL ? makeNull() : MACRO_NAMES);
+    return makeVoid();
+DEFINE_SYNTAX_BAD_FORM:
+    fprintf(error_stream(), "Evaluation error: built-in function `define-syntax`: bad form in arguments: ");
+    error_display_tree("define-syntax", args);
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+/* Expands the use of the macro by its first matching rule and splices the
+ * expansion into the parse tree in place of the use.  Returns expr, which
+ * now holds the expansion. */
+Value *expand_macro(Value *expr, Value *macro) {
+    Value *rule, *expansion;
+    struct MacroBinding *bindings;
+    for (rule = macro->mac.rules; rule->type == CONS_TYPE; rule = cdr(rule)) {
+        bindings = NULL;
+        // The keyword position of the pattern is ignored
+        if (macro_match(cdr(car(car(rule))), cdr(expr), macro->mac.literals, &bindings)) {
+            expansion = macro_instantiate(car(cdr(car(rule))), bindings,
+                    macro_template_binders(car(cdr(car(rule))), bindings, NULL));
+            *expr = *expansion;
+            return expr;
+        }
+    }
+    fprintf(error_stream(), "Evaluation error: no syntax rule matches: ");
+    display_to_fd(expr, error_stream());
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+
+////////////////////////////////////////
+///////// PRIMITIVE FUNCTIONS //////////
+////////////////////////////////////////
+
+enum operation {
+    PLUS,
+    MINUS,
+    MULT,
+};
+
+/* Stores the operation applied to the fixnums x and y in result.  Returns 1
+ * if it overflowed, in which case result holds the wrapped value. */
+int fixnum_overflow(enum operation op, long x, long y, long *result) {
+    switch (op) {
+        case PLUS:
+            return __builtin_add_overflow(x, y, result);
+        case MINUS:
+            return __builtin_sub_overflow(x, y, result);
+        case MULT:
+            return __builtin_mul_overflow(x, y, result);
+        default:
+            *result = 0;
+            return 1;
+    }
+}
+
+/* Returns 1 if the value is a number. */
+int is_number(Value *value) {
+    return value->type == INT_TYPE || value->type == DOUBLE_TYPE || value->type == BIGNUM_TYPE;
+}
+
+/* Returns 1 if the value is an exact integer, a fixnum or a bignum. */
+int is_exact_integer(Value *value) {
+    return value->type == INT_TYPE || value->type == BIGNUM_TYPE;
+}
+
+/* Returns the number as a double. */
+double number_to_double(Value *value) {
+    switch (value->type) {
+        case INT_TYPE:
+            return (double)value->i;
+        case BIGNUM_TYPE:
+            return bignum_to_double(value);
+        default:
+            return value->d;
+    }
+}
+
+/* Combines result with argv[start] through argv[argc - 1] in turn by the
+ * operation, moving to a bignum when a fixnum operation overflows and
+ * converting result to a double once a double is seen. */
+Value *arith_helper(Value *result, int argc, Value **argv, int start, enum operation op) {
+    Value *cur_val;
+    char names[3] = {'+', '-', '*'};
+    char name = names[op];
+    double x;
+    long n;
+    int i;
+    for (i = start; i < argc; i++) {
+        cur_val = argv[i];
+        switch (cur_val->type) {
+            case INT_TYPE:
+            case BIGNUM_TYPE:
+                if (result->type == INT_TYPE && cur_val->type == INT_TYPE
+                        && !fixnum_overflow(op, result->i, cur_val->i, &n)) {
+                    result->i = n;
+                    break;
+                }
+                if (result->type != DOUBLE_TYPE) {
+                    // The bignum functions return a new value, which result
+                    // takes over
+                    switch (op) {
+                        case PLUS:
+                            *result = *bignum_add(result, cur_val);
+                            break;
+                        case MINUS:
+                            *result = *bignum_sub(result, cur_val);
+                            break;
+                        case MULT:
+                            *result = *bignum_mul(result, cur_val);
+                            break;
+                    }
+                    break;
+                }
+                x = number_to_double(cur_val);
+                switch (op) {
+                    case PLUS:
+                        result->d += x;
+                        break;
+                    case MINUS:
+                        result->d -= x;
+                        break;
+                    case MULT:
+                        result->d *= x;
+                        break;
+                }
+                break;
+            case DOUBLE_TYPE:
+                result->d = number_to_double(result);
+                result->type = DOUBLE_TYPE;
+                switch (op) {
+                    case PLUS:
+                        result->d += cur_val->d;
+                        break;
+                    case MINUS:
+                        result->d -= cur_val->d;
+                        break;
+                    case MULT:
+                        result->d *= cur_val->d;
+                        break;
+                }
+                break;
+            default:
+                fprintf(error_stream(), "Evaluation error: primitive function `%c`: wrong type argument in position %d: ", name, i + 1);
+                display_to_fd(cur_val, error_stream());
+                raise_error(4);
+        }
+    }
+    return result;
+}
+
+Value *prim_add(int argc, Value **argv) {
+    long n;
+    if (argc == 2 && argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE
+            && !__builtin_add_overflow(argv[0]->i, argv[1]->i, &n))
+        return makeInt(n);
+    return arith_helper(makeInt(0), argc, argv, 0, PLUS);
+}
+
+Value *prim_sub(int argc, Value **argv) {
+    Value *result;
+    long n;
+    if (argc == 2 && argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE
+            && !__builtin_sub_overflow(argv[0]->i, argv[1]->i, &n))
+        return makeInt(n);
+    result = makeInt(0);
+    if (argc == 1)
+        return arith_helper(result, argc, argv, 0, MINUS);
+    // Adding the first argument to 0 checks its type
+    arith_helper(result, 1, argv, 0, PLUS);
+    return arith_helper(result, argc, argv, 1, MINUS);
+}
+
+Value *prim_mul(int argc, Value **argv) {
+    long n;
+    if (argc == 2 && argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE
+            && !__builtin_mul_overflow(argv[0]->i, argv[1]->i, &n))
+        return makeInt(n);
+    return arith_helper(makeInt(1), argc, argv, 0, MULT);
+}
+
+Value *prim_div(int argc, Value **argv) {
+    Value *quotient, *remainder;
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (!is_number(argv[i])) {
+            fprintf(error_stream(), "Evaluation error: primitive function `/`: wrong type argument in position %d: ", i + 1);
+            display_to_fd(argv[i], error_stream());
+            raise_error(4);
+        }
+    }
+    if (is_exact_integer(argv[0]) && is_exact_integer(argv[1])) {
+        if (argv[1]->type == INT_TYPE && argv[1]->i == 0) {
+            fprintf(error_stream(), "Evaluation error: primitive function `/`: division by zero\n");
+            raise_error(4);
+        }
+        // The quotient LONG_MIN / -1 overflows, and its remainder traps
+        if (argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE
+                && (argv[1]->i != -1 || argv[0]->i != LONG_MIN)) {
+            if (argv[0]->i % argv[1]->i == 0)
+                return makeInt(argv[0]->i / argv[1]->i);
+        } else {
+            bignum_divmod(argv[0], argv[1], &quotient, &remainder);
+            if (remainder->type == INT_TYPE && remainder->i == 0)
+                return quotient;
+        }
+    }
+    // There are no exact rationals, so an inexact quotient is a double
+    return makeDouble(number_to_double(argv[0]) / number_to_double(argv[1]));
+}
+
+/* Divides argv[0] by argv[1], which must both be exact integers, for the
+ * named primitive, storing the quotient, truncated toward zero, in quotient
+ * and the remainder in remainder.  Either pointer may be NULL. */
+void integer_divide(char *name, Value **argv, Value **quotient, Value **remainder) {
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (!is_exact_integer(argv[i])) {
+            fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d: ", name, i + 1);
+            display_to_fd(argv[i], error_stream());
+            raise_error(4);
+        }
+    }
+    if (argv[1]->type == INT_TYPE && argv[1]->i == 0) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: division by zero\n", name);
+        raise_error(4);
+    }
+    // The quotient LONG_MIN / -1 is a bignum, and the C remainder traps
+    if (argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE
+            && (argv[1]->i != -1 || argv[0]->i != LONG_MIN)) {
+        if (quotient != NULL)
+            *quotient = makeInt(argv[0]->i / argv[1]->i);
+        if (remainder != NULL)
+            *remainder = makeInt(argv[0]->i % argv[1]->i);
+        return;
+    }
+    bignum_divmod(argv[0], argv[1], quotient, remainder);
+}
+
+Value *prim_quotient(int argc, Value **argv) {
+    Value *quotient;
+    integer_divide("quotient", argv, &quotient, NULL);
+    return quotient;
+}
+
+Value *prim_remainder(int argc, Value **argv) {
+    Value *remainder;
+    integer_divide("remainder", argv, NULL, &remainder);
+    return remainder;
+}
+
+/* Returns the remainder of flooring division, which has the sign of the
+ * divisor, unlike that of remainder. */
+Value *prim_mod(int argc, Value **argv) {
+    Value *remainder;
+    integer_divide("modulo", argv, NULL, &remainder);
+    if (bignum_sign(remainder) * bignum_sign(argv[1]) < 0) {
+        if (remainder->type == INT_TYPE && argv[1]->type == INT_TYPE)
+            return makeInt(remainder->i + argv[1]->i);
+        return bignum_add(remainder, argv[1]);
+    }
+    return remainder;
+}
+
+Value *prim_expt(int argc, Value **argv) {
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (!is_number(argv[i])) {
+            fprintf(error_stream(), "Evaluation error: primitive function `expt`: wrong type argument in position %d: ", i + 1);
+            display_to_fd(argv[i], error_stream());
+            raise_error(4);
+        }
+    }
+    if (is_exact_integer(argv[0]) && argv[1]->type == INT_TYPE && argv[1]->i >= 0)
+        return bignum_expt(argv[0], argv[1]->i);
+    return makeDouble(pow(number_to_double(argv[0]), number_to_double(argv[1])));
+}
+
+enum comparison {
+    EQ,
+    GT,
+    LT,
+    GEQ,
+    LEQ,
+};
+
+/* Returns whether the two numbers satisfy the comparison, comparing as
+ * integers when both are exact integers and as doubles otherwise. */
+int compare_numbers(Value *first, Value *second, enum comparison comp) {
+    double x, y;
+    int order;
+    if (first->type == INT_TYPE && second->type == INT_TYPE) {
+        switch (comp) {
+            case EQ:
+                return first->i == second->i;
+            case GT:
+                return first->i > second->i;
+            case LT:
+                return first->i < second->i;
+            case GEQ:
+                return first->i >= second->i;
+            case LEQ:
+                return first->i <= second->i;
+        }
+    }
+    if (is_exact_integer(first) && is_exact_integer(second)) {
+        order = bignum_compare(first, second);
+        switch (comp) {
+            case EQ:
+                return order == 0;
+            case GT:
+                return order > 0;
+            case LT:
+                return order < 0;
+            case GEQ:
+                return order >= 0;
+            case LEQ:
+                return order <= 0;
+        }
+    }
+    x = number_to_double(first);
+    y = number_to_double(second);
+    switch (comp) {
+        case EQ:
+            return x == y;
+        case GT:
+            return x > y;
+        case LT:
+            return x < y;
+        case GEQ:
+            return x >= y;
+        case LEQ:
+            return x <= y;
+    }
+    return 0;
+}
+
+Value *compare_helper(int argc, Value **argv, enum comparison comp) {
+    char *names[5] = {"=", ">", "<", ">=", "<="};
+    int i;
+    if (argc == 2 && argv[0]->type == INT_TYPE && argv[1]->type == INT_TYPE)
+        return makeBool(compare_numbers(argv[0], argv[1], comp));
+    for (i = 0; i < argc; i++) {
+        if (!is_number(argv[i])) {
+            fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d: ", names[comp], i + 1);
+            display_to_fd(argv[i], error_stream());
+            raise_error(4);
+        }
+        if (i > 0 && !compare_numbers(argv[i - 1], argv[i], comp))
+            return makeBool(0);
+    }
+    return makeBool(1);
+}
+
+Value *prim_eqnum(int argc, Value **argv) {
+    return compare_helper(argc, argv, EQ);
+}
+
+Value *prim_gt(int argc, Value **argv) {
+    return compare_helper(argc, argv, GT);
+}
+
+Value *prim_lt(int argc, Value **argv) {
+    return compare_helper(argc, argv, LT);
+}
+
+Value *prim_geq(int argc, Value **argv) {
+    return compare_helper(argc, argv, GEQ);
+}
+
+Value *prim_leq(int argc, Value **argv) {
+    return compare_helper(argc, argv, LEQ);
+}
+
+Value *prim_null(int argc, Value **argv) {
+    return makeBool(argv[0]->type == NULL_TYPE);
+}
+
+Value *prim_car(int argc, Value **argv) {
+    if (argv[0]->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `car`: wrong type argument in position 1 (expected CONS_TYPE): ");
+        display_to_fd(argv[0], error_stream());
+        raise_error(4);
+    }
+    return car(argv[0]);
+}
+
+Value *prim_cdr(int argc, Value **argv) {
+    if (argv[0]->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `cdr`: wrong type argument in position 1 (expected CONS_TYPE): ");
+        display_to_fd(argv[0], error_stream());
+        raise_error(4);
+    }
+    return cdr(argv[0]);
+}
+
+Value *prim_cons(int argc, Value **argv) {
+    return cons(argv[0], argv[1]);
+}
+
+// Advanced by every change to an existing pair, so that what is remembered
+// about a list, such as its hidden index below, can tell whether it still
+// holds.
+long LIST_EPOCH = 0;
+
+/* Exits with an error unless the argument to the named primitive is a
+ * pair. */
+void check_pair(char *name, Value *value) {
+    if (value->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 1 (expected CONS_TYPE): ", name);
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+Value *prim_set_car(int argc, Value **argv) {
+    check_pair("set-car!", argv[0]);
+    argv[0]->c.car = argv[1];
+    LIST_EPOCH++;
+    return makeVoid();
+}
+
+Value *prim_set_cdr(int argc, Value **argv) {
+    check_pair("set-cdr!", argv[0]);
+    argv[0]->c.cdr = argv[1];
+    LIST_EPOCH++;
+    return makeVoid();
+}
+
+/* Returns a new list of the values in the array, ending in tail. */
+Value *array_to_list(int argc, Value **argv, Value *tail) {
+    int i;
+    for (i = argc - 1; i >= 0; i--)
+        tail = cons(argv[i], tail);
+    return tail;
+}
+
+Value *prim_list(int argc, Value **argv) {
+    return array_to_list(argc, argv, makeNull());
+}
+
+Value *prim_append(int argc, Value **argv) {
+    Value head, *tail, *current_list;
+    int i;
+    if (argc == 0)
+        return makeNull();
+    head.c.cdr = NULL;
+    tail = &head;
+    for (i = 0; i < argc - 1; i++) {
+        for (current_list = argv[i]; current_list->type == CONS_TYPE; current_list = cdr(current_list)) {
+            tail->c.cdr = cons(car(current_list), NULL);
+            tail = tail->c.cdr;
+        }
+        if (current_list->type != NULL_TYPE) {
+            fprintf(error_stream(), "Evaluation error: primitive function `append`: wrong type argument in position %d: ", i + 1);
+            display_to_fd(current_list, error_stream());
+            raise_error(4);
+        }
+    }
+    // The last argument is shared rather than copied
+    tail->c.cdr = argv[argc - 1];
+    return head.c.cdr;
+}
+
+// equal? walks its arguments with an explicit stack of the pairs of values
+// still to compare, so that deep structures do not exhaust the C stack.  A
+// task whose index is not negative stands for the elements of two vectors,
+// records or persistent vectors from that index on, so a long vector takes
+// one task rather than one per element.
+
+#define EQUAL_STACK_SIZE 64
+
+struct EqualTask {
+    Value *first;
+    Value *second;
+    long i;
+};
+
+struct EqualStack {
+    struct EqualTask *tasks;
+    long top;
+    long capacity;
+};
+
+void equal_push(struct EqualStack *stack, Value *first, Value *second, long i) {
+    struct EqualTask *tasks;
+    if (stack->top == stack->capacity) {
+        tasks = talloc(sizeof(struct EqualTask) * stack->capacity * 2);
+        memcpy(tasks, stack->tasks, sizeof(struct EqualTask) * stack->capacity);
+        stack->tasks = tasks;
+        stack->capacity *= 2;
+    }
+    stack->tasks[stack->top].first = first;
+    stack->tasks[stack->top].second = second;
+    stack->tasks[stack->top].i = i;
+    stack->top++;
+}
+
+/* Returns the number of elements of the vector, record or persistent vector
+ * compared by an indexed task. */
+long equal_element_count(Value *value) {
+    if (value->type == VECTOR_TYPE)
+        return value->vec.length;
+    if (value->type == RECORD_TYPE)
+        return value->rec->type->field_count;
+    return value->pv->length;
+}
+
+Value *equal_element(Value *value, long i) {
+    if (value->type == VECTOR_TYPE)
+        return value->vec.items[i];
+    if (value->type == RECORD_TYPE)
+        return value->rec->fields[i];
+    return pvector_ref(value->pv, i);
+}
+
+/* Compares the values as equal? does, without the cache of equal_helper. */
+int equal_structure(Value *first, Value *second) {
+    struct EqualTask local[EQUAL_STACK_SIZE], task;
+    struct EqualStack stack = {local, 0, EQUAL_STACK_SIZE};
+    long i;
+    while (1) {
+        // Values which are the same object are equal whatever they hold
+        if (first != second) {
+            if (first->type != second->type)
+                return 0;
+            switch (first->type) {
+                case INT_TYPE:
+                case BOOL_TYPE:
+                    if (first->i != second->i)
+                        return 0;
+                    break;
+                case DOUBLE_TYPE:
+                    if (first->d != second->d)
+                        return 0;
+                    break;
+                case BIGNUM_TYPE:
+                    if (bignum_compare(first, second) != 0)
+                        return 0;
+                    break;
+                case F64VECTOR_TYPE:
+                case S64VECTOR_TYPE:
+                    if (first->vec.length != second->vec.length)
+                        return 0;
+                    for (i = 0; i < first->vec.length; i++) {
+                        if (first->type == F64VECTOR_TYPE ? first->vec.f64[i] != second->vec.f64[i]
+                                : first->vec.s64[i] != second->vec.s64[i])
+                            return 0;
+                    }
+                    break;
+                case MATRIX_TYPE:
+                    if (first->mat.rows != second->mat.rows || first->mat.cols != second->mat.cols)
+                        return 0;
+                    for (i = 0; i < first->mat.rows * first->mat.cols; i++)
+                        if (first->mat.elements[i] != second->mat.elements[i])
+                            return 0;
+                    break;
+                case STR_TYPE:
+                    if (!string_equal(first, second))
+                        return 0;
+                    break;
+                case SYMBOL_TYPE:
+                    if (strcmp(first->s, second->s) != 0)
+                        return 0;
+                    break;
+                case NULL_TYPE:
+                    break;
+                case CONS_TYPE:
+                    equal_push(&stack, cdr(first), cdr(second), -1);
+                    first = car(first);
+                    second = car(second);
+                    continue;
+                case VECTOR_TYPE:
+                case PVECTOR_TYPE:
+                    if (equal_element_count(first) != equal_element_count(second))
+                        return 0;
+                    if (equal_element_count(first) > 0)
+                        equal_push(&stack, first, second, 0);
+                    break;
+                case RECORD_TYPE:
+                    // Records are compared field by field, as vectors are
+                    if (first->rec->type != second->rec->type)
+                        return 0;
+                    if (equal_element_count(first) > 0)
+                        equal_push(&stack, first, second, 0);
+                    break;
+                case CLOSURE_TYPE:
+                    // Closures made by the same lambda share their code, so
+                    // only those from different lambdas are walked
+                    if (first->cl.frame != second->cl.frame)
+                        return 0;
+                    equal_push(&stack, first->cl.functionCode, second->cl.functionCode, -1);
+                    first = first->cl.paramNames;
+                    second = second->cl.paramNames;
+                    continue;
+                case PRIMITIVE_TYPE:
+                    if (first->pr.pf != second->pr.pf)
+                        return 0;
+                    break;
+                case CONTINUATION_TYPE:
+                    if (first->k != second->k)
+                        return 0;
+                    break;
+                case HASH_TABLE_TYPE:
+                    if (first->ht != second->ht)
+                        return 0;
+                    break;
+                case MEMO_TYPE:
+                    if (first->memo != second->memo)
+                        return 0;
+                    break;
+                case PROMISE_TYPE:
+                    if (first->promise != second->promise)
+                        return 0;
+                    break;
+                case RECORD_DESCRIPTOR_TYPE:
+                    if (first->rtd != second->rtd)
+                        return 0;
+                    break;
+                case RECORD_PROCEDURE_TYPE:
+                    if (first->rp.kind != second->rp.kind || first->rp.type != second->rp.type
+                            || first->rp.index != second->rp.index || first->rp.arg_fields != second->rp.arg_fields)
+                        return 0;
+                    break;
+                case PMAP_TYPE:
+                    if (first->pm.size != second->pm.size || !hamt_included(first->pm.root, second->pm.root))
+                        return 0;
+                    break;
+                default:
+                    fprintf(error_stream(), "Evaluation error: primitive function `equal?`: unexpected value of type %d\n", first->type);
+                    raise_error(4);
+            }
+        }
+        if (stack.top == 0)
+            return 1;
+        task = stack.tasks[--stack.top];
+        if (task.i < 0) {
+            first = task.first;
+            second = task.second;
+        } else {
+            // Leave the task for the rest of the elements in place
+            if (task.i + 1 < equal_element_count(task.first)) {
+                stack.tasks[stack.top].i++;
+                stack.top++;
+            }
+            first = equal_element(task.first, task.i);
+            second = equal_element(task.second, task.i);
+        }
+    }
+}
+
+// equal_helper also remembers, for each of a few recently compared lists of
+// EQUAL_CACHE_MIN_SIZE values or more, a hash of its whole structure and the
+// last list found equal to it, as of LIST_EPOCH.  Lists of numbers, strings,
+// symbols, booleans and pairs only change through set-car! and set-cdr!,
+// which advance the epoch, so while it stands two such lists whose hashes
+// differ are unequal, and a list is still equal to the list found equal to
+// it: comparing the same two large trees again takes no walk at all.  A list
+// is hashed the second time it is compared, so lists compared once cost only
+// the lookup.
+
+#define EQUAL_CACHE_SLOTS 64
+#define EQUAL_CACHE_MIN_SIZE 256
+
+enum equal_cache_state {EQUAL_SEEN, EQUAL_HASHED, EQUAL_UNHASHABLE};
+
+struct EqualCacheEntry {
+    Value *list;
+    long epoch;
+    enum equal_cache_state state;
+    unsigned long hash;
+    Value *equal_to;
+};
+
+struct EqualCacheEntry EQUAL_CACHE[EQUAL_CACHE_SLOTS];
+
+/* Stores in *hash a hash of the whole structure of the value, which is the
+ * same for values which are equal?, and returns the number of pairs and
+ * atoms in it, or -1 if it holds anything but numbers, strings, symbols,
+ * booleans and pairs. */
+long equal_structure_hash(Value *value, unsigned long *hash) {
+    struct EqualTask local[EQUAL_STACK_SIZE];
+    struct EqualStack stack = {local, 0, EQUAL_STACK_SIZE};
+    unsigned long h = 0xcbf29ce484222325UL;
+    long size = 0;
+    while (1) {
+        size++;
+        switch (value->type) {
+            case CONS_TYPE:
+                // Pairs are hashed in preorder, marked so that the shape of
+                // the tree counts as well as its atoms
+                h = (h ^ CONS_TYPE) * 0x100000001b3UL;
+                equal_push(&stack, cdr(value), NULL, -1);
+                value = car(value);
+                continue;
+            case INT_TYPE:
+            case DOUBLE_TYPE:
+            case BIGNUM_TYPE:
+            case STR_TYPE:
+            case SYMBOL_TYPE:
+            case BOOL_TYPE:
+            case NULL_TYPE:
+                h = (h ^ hash_value(HASH_EQUAL, value)) * 0x100000001b3UL;
+                break;
+            default:
+                return -1;
+        }
+        if (stack.top == 0)
+            break;
+        value = stack.tasks[--stack.top].first;
+    }
+    *hash = h;
+    return size;
+}
+
+/* Returns the cache entry for the list, counting this comparison of it. */
+struct EqualCacheEntry *equal_cache_entry(Value *list) {
+    struct EqualCacheEntry *entry = &EQUAL_CACHE[((unsigned long)list >> 4) % EQUAL_CACHE_SLOTS];
+    long size;
+    if (entry->list != list || entry->epoch != LIST_EPOCH) {
+        entry->list = list;
+        entry->epoch = LIST_EPOCH;
+        entry->state = EQUAL_SEEN;
+        entry->equal_to = NULL;
+    } else if (entry->state == EQUAL_SEEN) {
+        size = equal_structure_hash(list, &entry->hash);
+        entry->state = size >= EQUAL_CACHE_MIN_SIZE ? EQUAL_HASHED : EQUAL_UNHASHABLE;
+    }
+    return entry;
+}
+
+int equal_helper(Value *first, Value *second) {
+    struct EqualCacheEntry *first_entry, *second_entry;
+    int equal;
+    if (first == second)
+        return 1;
+    if (first->type != CONS_TYPE || second->type != CONS_TYPE)
+        return equal_structure(first, second);
+    first_entry = equal_cache_entry(first);
+    second_entry = equal_cache_entry(second);
+    if (first_entry == second_entry || first_entry->state != EQUAL_HASHED || second_entry->state != EQUAL_HASHED)
+        return equal_structure(first, second);
+    if (first_entry->hash != second_entry->hash)
+        return 0;
+    if (first_entry->equal_to == second || second_entry->equal_to == first)
+        return 1;
+    equal = equal_structure(first, second);
+    // The comparison cannot have changed either list, but may have reused
+    // their entries for lists within them
+    if (equal && first_entry->list == first && second_entry->list == second) {
+        first_entry->equal_to = second;
+        second_entry->equal_to = first;
+    }
+    return equal;
+}
+
+Value *prim_equal(int argc, Value **argv) {
+    return makeBool(equal_helper(argv[0], argv[1]));
+}
+
+/* Numbers, symbols and the empty list are compared by value, since they are
+ * neither interned nor cached, and other values by identity; doubles are
+ * the same if their bits are, as R7RS has (eqv? 0.0 -0.0) false. */
+int eqv_helper(Value *first, Value *second) {
+    if (first->type != second->type)
+        return 0;
+    switch (first->type) {
+        case INT_TYPE:
+        case BOOL_TYPE:
+            return (first->i == second->i);
+        case DOUBLE_TYPE:
+            return memcmp(&first->d, &second->d, sizeof(double)) == 0;
+        case BIGNUM_TYPE:
+            return bignum_compare(first, second) == 0;
+        case SYMBOL_TYPE:
+            return !strcmp(first->s, second->s);
+        case NULL_TYPE:
+        case VOID_TYPE:
+        case UNSPECIFIED_TYPE:
+            return 1;
+        case PRIMITIVE_TYPE:
+            return (first->pr.pf == second->pr.pf);
+        default:
+            return first == second;
+    }
+}
+
+/* eq? is bound to this too: without interning there is nothing cheaper it
+ * could compare. */
+Value *prim_eqv(int argc, Value **argv) {
+    return makeBool(eqv_helper(argv[0], argv[1]));
+}
+
+/* (string=? s1 s2 s3 ...) */
+Value *prim_string_eq(int argc, Value **argv) {
+    int i;
+    for (i = 0; i < argc; i++) {
+        if (argv[i]->type != STR_TYPE) {
+            fprintf(error_stream(), "Evaluation error: primitive function `string=?`: wrong type argument in position %d: ", i + 1);
+            display_to_fd(argv[i], error_stream());
+            raise_error(4);
+        }
+    }
+    for (i = 1; i < argc; i++)
+        if (!string_equal(argv[i - 1], argv[i]))
+            return makeBool(0);
+    return makeBool(1);
+}
+
+Value *prim_number(int argc, Value **argv) {
+    return makeBool(is_number(argv[0]));
+}
+
+Value *prim_integer(int argc, Value **argv) {
+    return makeBool(is_exact_integer(argv[0])
+            || (argv[0]->type == DOUBLE_TYPE && argv[0]->d == (long)argv[0]->d));
+}
+
+Value *prim_exact_integer(int argc, Value **argv) {
+    return makeBool(is_exact_integer(argv[0]));
+}
+
+Value *prim_flonum(int argc, Value **argv) {
+    return makeBool(argv[0]->type == DOUBLE_TYPE);
+}
+
+/* (current-jiffy) returns the number of microseconds since an arbitrary
+ * point, from a clock which never goes backwards, for timing programs. */
+Value *prim_current_jiffy(int argc, Value **argv) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return makeInt(now.tv_sec * 1000000L + now.tv_nsec / 1000);
+}
+
+Value *prim_jiffies_per_second(int argc, Value **argv) {
+    return makeInt(1000000);
+}
+
+
+////////////////////////////////////////
+/////// HIGHER-ORDER PRIMITIVES ////////
+////////////////////////////////////////
+
+/* Applies the predicate to the value and returns whether it returned #t.
+ * Exits with an error naming the calling primitive if the result is not a
+ * boolean, as for the test of an if. */
+int apply_predicate(char *name, Value *pred, Value *value) {
+    Value *result = apply(pred, 1, &value);
+    if (result->type != BOOL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: expected predicate to return type %d (BOOL_TYPE), but received %d\n", name, BOOL_TYPE, result->type);
+        raise_error(4);
+    }
+    return result->i;
+}
+
+/* Exits with an error if the value which ended a list argument is not the
+ * empty list. */
+void check_list_end(char *name, Value *end, int arg_num) {
+    if (end->type != NULL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected list): ", name, arg_num);
+        display_to_fd(end, error_stream());
+        raise_error(4);
+    }
+}
+
+/* (map f list1 list2 ...) applies f to the corresponding elements of the
+ * lists, stopping at the end of the shortest, and returns the results in a
+ * new list built front to back. */
+Value *prim_map(int argc, Value **argv) {
+    Value head, *tail, *lists[argc - 1], *call_argv[argc - 1];
+    int i;
+    for (i = 1; i < argc; i++)
+        lists[i - 1] = argv[i];
+    head.c.cdr = NULL;
+    tail = &head;
+    while (1) {
+        for (i = 0; i < argc - 1; i++) {
+            if (lists[i]->type != CONS_TYPE) {
+                check_list_end("map", lists[i], i + 2);
+                tail->c.cdr = makeNull();
+                return head.c.cdr;
+            }
+            call_argv[i] = car(lists[i]);
+            lists[i] = cdr(lists[i]);
+        }
+        tail->c.cdr = cons(single_value("primitive function `map`", apply(argv[0], argc - 1, call_argv)), NULL);
+        tail = tail->c.cdr;
+    }
+}
+
+/* (filter pred list) returns a new list of the elements of list for which
+ * pred returns #t, in order. */
+Value *prim_filter(int argc, Value **argv) {
+    Value head, *tail, *current;
+    head.c.cdr = NULL;
+    tail = &head;
+    for (current = argv[1]; current->type == CONS_TYPE; current = cdr(current)) {
+        if (apply_predicate("filter", argv[0], car(current))) {
+            tail->c.cdr = cons(car(current), NULL);
+            tail = tail->c.cdr;
+        }
+    }
+    check_list_end("filter", current, 2);
+    tail->c.cdr = makeNull();
+    return head.c.cdr;
+}
+
+/* (fold kons knil list1 list2 ...) calls (kons e1 e2 ... acc) on the
+ * corresponding elements of the lists from left to right, where acc is knil
+ * for the first call and the result of the previous call afterwards, and
+ * returns the final acc. */
+Value *prim_fold(int argc, Value **argv) {
+    Value *acc = argv[1], *lists[argc - 2], *call_argv[argc - 1];
+    int i;
+    for (i = 2; i < argc; i++)
+        lists[i - 2] = argv[i];
+    while (1) {
+        for (i = 0; i < argc - 2; i++) {
+            if (lists[i]->type != CONS_TYPE) {
+                check_list_end("fold", lists[i], i + 3);
+                return acc;
+            }
+            call_argv[i] = car(lists[i]);
+            lists[i] = cdr(lists[i]);
+        }
+        call_argv[argc - 2] = acc;
+        acc = single_value("primitive function `fold`", apply(argv[0], argc - 1, call_argv));
+    }
+}
+
+#define PIPELINE_MAX_STAGES 8
+
+enum pipeline_op {
+    PIPELINE_MAP,
+    PIPELINE_FILTER,
+    PIPELINE_FOLD,
+};
+
+/* Reads the stages of the arguments of a pipeline call into ops and funcs,
+ * and the initial value of an outermost fold into acc.  Returns the number
+ * of stages, and stores the index of the list argument in list. */
+int pipeline_stages(Value **argv, enum pipeline_op *ops, Value **funcs, Value **acc, int *list) {
+    Value *current;
+    int n = 0, i, next = 1;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current)) {
+        if (strcmp(car(current)->s, "map") == 0)
+            ops[n] = PIPELINE_MAP;
+        else if (strcmp(car(current)->s, "filter") == 0)
+            ops[n] = PIPELINE_FILTER;
+        else
+            ops[n] = PIPELINE_FOLD;
+        n++;
+    }
+    for (i = 0; i < n; i++) {
+        funcs[i] = argv[next++];
+        if (i == 0 && ops[0] == PIPELINE_FOLD)
+            *acc = argv[next++];
+    }
+    *list = next;
+    return n;
+}
+
+/* Passes each element through every stage of the pipeline before reading
+ * the next. */
+Value *pipeline_fused(int argc, Value **argv) {
+    enum pipeline_op ops[PIPELINE_MAX_STAGES];
+    Value *funcs[PIPELINE_MAX_STAGES], *current, *value, *acc = NULL, *pair[2], head, *tail;
+    int n, i, next;
+    n = pipeline_stages(argv, ops, funcs, &acc, &next);
+    head.c.cdr = NULL;
+    tail = &head;
+    for (current = argv[next]; current->type == CONS_TYPE; current = cdr(current)) {
+        value = car(current);
+        for (i = n - 1; i > 0; i--) {
+            if (ops[i] == PIPELINE_MAP)
+                value = single_value("primitive function `pipeline`", apply(funcs[i], 1, &value));
+            else if (!apply_predicate("filter", funcs[i], value))
+                goto PIPELINE_NEXT;
+        }
+        switch (ops[0]) {
+            case PIPELINE_MAP:
+                tail->c.cdr = cons(single_value("primitive function `pipeline`", apply(funcs[0], 1, &value)), NULL);
+                tail = tail->c.cdr;
+                break;
+            case PIPELINE_FILTER:
+                if (apply_predicate("filter", funcs[0], value)) {
+                    tail->c.cdr = cons(value, NULL);
+                    tail = tail->c.cdr;
+                }
+                break;
+            case PIPELINE_FOLD:
+                pair[0] = value;
+                pair[1] = acc;
+                acc = single_value("primitive function `pipeline`", apply(funcs[0], 2, pair));
+                break;
+        }
+PIPELINE_NEXT:
+        ;
+    }
+    check_list_end(ops[n - 1] == PIPELINE_MAP ? "map" : "filter", current, 2);
+    if (ops[0] == PIPELINE_FOLD)
+        return acc;
+    tail->c.cdr = makeNull();
+    return head.c.cdr;
+}
+
+/* Calls map, filter or fold for each stage of the pipeline in turn, from
+ * the innermost, as the expression it replaced would. */
+Value *pipeline_unfused(int argc, Value **argv) {
+    enum pipeline_op ops[PIPELINE_MAX_STAGES];
+    Value *funcs[PIPELINE_MAX_STAGES], *acc = NULL, *result, *call_argv[3];
+    int n, i, next;
+    n = pipeline_stages(argv, ops, funcs, &acc, &next);
+    result = argv[next];
+    for (i = n - 1; i >= 0; i--) {
+        call_argv[0] = funcs[i];
+        if (ops[i] == PIPELINE_FOLD) {
+            call_argv[1] = acc;
+            call_argv[2] = result;
+            result = prim_fold(3, call_argv);
+        } else {
+            call_argv[1] = result;
+            result = ops[i] == PIPELINE_MAP ? prim_map(2, call_argv) : prim_filter(2, call_argv);
+        }
+    }
+    return result;
+}
+
+/* Never bound to a name; the optimizer substitutes calls to it for nested
+ * single-list map, filter and fold calls, such as (fold k z (map f (filter p
+ * xs))), whose procedures it has proven to be free of side effects.  Called
+ * as (pipeline '(fold map filter) k z f p xs): the quoted list names the
+ * stages from outermost to innermost, followed by the procedure of each stage
+ * (and the initial value after the procedure of an outermost fold), in the
+ * order the original expression evaluated them, followed by the list.  Each
+ * element passes through every stage before the next element is read, so no
+ * intermediate list is built.
+ *
+ * Fusing changes which error is raised first when more than one stage, or
+ * the list, is in error, so if the fused pipeline raises anything, the
+ * stages are run again one after another to raise the error the unfused
+ * expression would.  Being free of side effects, they can be run twice. */
+Value *prim_pipeline(int argc, Value **argv) {
+    struct ErrorHandler handler;
+    Value *result;
+    handler.procedure = NULL;
+    handler.continuations = ACTIVE_CONTINUATIONS;
+    handler.outer = ERROR_HANDLERS;
+    if (setjmp(handler.env) == 0) {
+        ERROR_HANDLERS = &handler;
+        result = pipeline_fused(argc, argv);
+        ERROR_HANDLERS = handler.outer;
+        return result;
+    }
+    catch_unwind(&handler);
+    return pipeline_unfused(argc, argv);
+}
+
+/* Returns a PRIMITIVE_TYPE value for the fused map/filter/fold pipeline, with
+ * at most max_stages stages, stored in max_stages. */
+Value *pipeline_primitive(int *max_stages) {
+    *max_stages = PIPELINE_MAX_STAGES;
+    return makePrimitive("pipeline", prim_pipeline, 3, -1);
+}
+
+
+////////////////////////////////////////
+///////////// LIST LIBRARY /////////////
+////////////////////////////////////////
+
+// Each of these walks its lists in a loop and builds any result front to
+// back through a tail pointer, so none of them uses C stack in proportion
+// to the length of a list.
+
+/* (for-each f list1 list2 ...) applies f to the corresponding elements of
+ * the lists in order, stopping at the end of the shortest. */
+Value *prim_for_each(int argc, Value **argv) {
+    Value *lists[argc - 1], *call_argv[argc - 1];
+    int i;
+    for (i = 1; i < argc; i++)
+        lists[i - 1] = argv[i];
+    while (1) {
+        for (i = 0; i < argc - 1; i++) {
+            if (lists[i]->type != CONS_TYPE) {
+                check_list_end("for-each", lists[i], i + 2);
+                return makeVoid();
+            }
+            call_argv[i] = car(lists[i]);
+            lists[i] = cdr(lists[i]);
+        }
+        apply(argv[0], argc - 1, call_argv);
+    }
+}
+
+Value *prim_length(int argc, Value **argv) {
+    Value *current;
+    long length = 0;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        length++;
+    check_list_end("length", current, 1);
+    return makeInt(length);
+}
+
+Value *prim_reverse(int argc, Value **argv) {
+    Value *current, *result = makeNull();
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        result = cons(car(current), result);
+    check_list_end("reverse", current, 1);
+    return result;
+}
+
+/* Returns what remains of the list after its first k elements, exiting
+ * with an error if k is not an index into the list, or also not its length
+ * unless allow_end. */
+Value *list_drop(char *name, Value *list, Value *k, int allow_end) {
+    long i;
+    if (k->type != INT_TYPE || k->i < 0) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 2: ", name);
+        display_to_fd(k, error_stream());
+        raise_error(4);
+    }
+    for (i = 0; i < k->i && list->type == CONS_TYPE; i++)
+        list = cdr(list);
+    if (i < k->i || (!allow_end && list->type != CONS_TYPE)) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: index %ld out of range\n", name, k->i);
+        raise_error(4);
+    }
+    return list;
+}
+
+/* (list-tail list k) */
+Value *prim_list_tail(int argc, Value **argv) {
+    return list_drop("list-tail", argv[0], argv[1], 1);
+}
+
+/* (list-ref list k) */
+Value *prim_list_ref(int argc, Value **argv) {
+    return car(list_drop("list-ref", argv[0], argv[1], 0));
+}
+
+// memv, member, assv and assoc, and the eq? forms bound to them, remember
+// the last list they searched in each of a few slots.  A proper list searched
+// LIST_INDEX_MIN_SEARCHES times in a row in the same way, with no pair
+// changed meanwhile, gets a hash table from each key to its first match, so
+// that legacy code looking up many keys in one long association list takes
+// constant time per lookup after the first few.  Under equal?, only lists
+// whose keys are built of numbers, strings, symbols, booleans and pairs are
+// indexed, since equal? compares other values in ways their hashes do not
+// follow, or which may change without any pair changing.
+
+#define LIST_INDEX_SLOTS 16
+#define LIST_INDEX_MIN_SEARCHES 8
+#define LIST_INDEX_MIN_LENGTH 32
+
+// The searches of one list in one way, and the index built for them, if any.
+struct ListIndex {
+    Value *list;
+    int kind;                   // 2 * alist + equal, as for list_search
+    long epoch;                 // LIST_EPOCH when the list was first searched
+    long searches;
+    struct HashTable *table;    // NULL until built, or if not indexable
+};
+
+struct ListIndex LIST_INDEXES[LIST_INDEX_SLOTS];
+
+/* Returns 1 if the key hashes under equal? as equal? compares it, and can
+ * only change if some pair changes, otherwise 0. */
+int list_index_key_ok(Value *key) {
+    for (; key->type == CONS_TYPE; key = cdr(key))
+        if (!list_index_key_ok(car(key)))
+            return 0;
+    switch (key->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case BIGNUM_TYPE:
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+        case NULL_TYPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Returns a new table from each key in the list to what a search for it
+ * returns: the pair at its first occurrence, or if alist, the first element
+ * with that key.  Returns NULL if the list is short, not proper, or not of
+ * keys which can be indexed. */
+struct HashTable *list_index_build(Value *list, int alist, int equal) {
+    struct HashTable *table = hash_table_new(equal ? HASH_EQUAL : HASH_EQV, 0);
+    Value *current, *key;
+    long length = 0;
+    for (current = list; current->type == CONS_TYPE; current = cdr(current)) {
+        key = car(current);
+        if (alist) {
+            if (key->type != CONS_TYPE)
+                return NULL;
+            key = car(key);
+        }
+        if (equal && !list_index_key_ok(key))
+            return NULL;
+        if (hash_table_get(table, key) == NULL)
+            hash_table_put(table, key, alist ? car(current) : current);
+        length++;
+    }
+    if (current->type != NULL_TYPE || length < LIST_INDEX_MIN_LENGTH)
+        return NULL;
+    return table;
+}
+
+/* Counts a search of the list in the given way, and returns its index,
+ * building it if this is the search which earns it one, or NULL if it has
+ * none. */
+struct HashTable *list_index(Value *list, int alist, int equal) {
+    struct ListIndex *slot = &LIST_INDEXES[((unsigned long)list >> 4) % LIST_INDEX_SLOTS];
+    int kind = 2 * alist + equal;
+    if (slot->list != list || slot->kind != kind || slot->epoch != LIST_EPOCH) {
+        slot->list = list;
+        slot->kind = kind;
+        slot->epoch = LIST_EPOCH;
+        slot->searches = 0;
+        slot->table = NULL;
+    }
+    slot->searches++;
+    if (slot->searches == LIST_INDEX_MIN_SEARCHES)
+        slot->table = list_index_build(list, alist, equal);
+    return slot->table;
+}
+
+/* Returns the first pair of the list whose car matches x, or #f if there is
+ * none; if alist, the elements of the list must be pairs, and their cars are
+ * matched instead, and the matching element is returned.  Elements are
+ * matched with the compare procedure if it is not NULL, called as (compare x
+ * element), and otherwise by equal? if equal or else by eqv?. */
+Value *list_search(char *name, Value *x, Value *list, int alist, int equal, Value *compare) {
+    Value *current, *element, *call_argv[2], *result;
+    struct HashTable *index;
+    if (compare == NULL && list->type == CONS_TYPE) {
+        index = list_index(list, alist, equal);
+        if (index != NULL) {
+            result = hash_table_get(index, x);
+            return result != NULL ? result : makeBool(0);
+        }
+    }
+    call_argv[0] = x;
+    for (current = list; current->type == CONS_TYPE; current = cdr(current)) {
+        element = car(current);
+        if (alist) {
+            if (element->type != CONS_TYPE) {
+                fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 2 (expected association list): ", name);
+                display_to_fd(list, error_stream());
+                raise_error(4);
+            }
+            element = car(element);
+        }
+        if (compare != NULL) {
+            call_argv[1] = element;
+            result = apply(compare, 2, call_argv);
+            if (result->type != BOOL_TYPE) {
+                fprintf(error_stream(), "Evaluation error: primitive function `%s`: expected predicate to return type %d (BOOL_TYPE), but received %d\n", name, BOOL_TYPE, result->type);
+                raise_error(4);
+            }
+            if (result->i)
+                break;
+        } else if (equal ? equal_helper(x, element) : eqv_helper(x, element)) {
+            break;
+        }
+    }
+    if (current->type == CONS_TYPE)
+        return alist ? car(current) : current;
+    check_list_end(name, current, 2);
+    return makeBool(0);
+}
+
+/* memq is bound to this too, as eq? is to eqv?. */
+Value *prim_memv(int argc, Value **argv) {
+    return list_search("memv", argv[0], argv[1], 0, 0, NULL);
+}
+
+/* (member x list [compare]) */
+Value *prim_member(int argc, Value **argv) {
+    return list_search("member", argv[0], argv[1], 0, 1, argc == 3 ? argv[2] : NULL);
+}
+
+/* assq is bound to this too, as eq? is to eqv?. */
+Value *prim_assv(int argc, Value **argv) {
+    return list_search("assv", argv[0], argv[1], 1, 0, NULL);
+}
+
+/* (assoc x alist [compare]) */
+Value *prim_assoc(int argc, Value **argv) {
+    return list_search("assoc", argv[0], argv[1], 1, 1, argc == 3 ? argv[2] : NULL);
+}
+
+
+////////////////////////////////////////
+///////// UNCHECKED PRIMITIVES /////////
+////////////////////////////////////////
+
+// These are never bound to a name.  The optimizer substitutes them for calls
+// to the generic arithmetic and comparison primitives with exactly two
+// arguments which it has proven to both be INT_TYPE or both be DOUBLE_TYPE,
+// so they do not check their number.  Fixnum arithmetic which overflows
+// gives a bignum, so an argument proven a fixnum is only one unless some
+// operation producing it overflowed: the fixnum primitives check the types
+// of their arguments, which costs next to nothing, and hand the rare bignum
+// to the generic primitive.
+
+Value *prim_fx_add(int argc, Value **argv) {
+    long n;
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE
+            || __builtin_add_overflow(argv[0]->i, argv[1]->i, &n))
+        return prim_add(argc, argv);
+    return makeInt(n);
+}
+
+Value *prim_fx_sub(int argc, Value **argv) {
+    long n;
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE
+            || __builtin_sub_overflow(argv[0]->i, argv[1]->i, &n))
+        return prim_sub(argc, argv);
+    return makeInt(n);
+}
+
+Value *prim_fx_mul(int argc, Value **argv) {
+    long n;
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE
+            || __builtin_mul_overflow(argv[0]->i, argv[1]->i, &n))
+        return prim_mul(argc, argv);
+    return makeInt(n);
+}
+
+Value *prim_fx_eq(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE)
+        return prim_eqnum(argc, argv);
+    return makeBool(argv[0]->i == argv[1]->i);
+}
+
+Value *prim_fx_lt(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE)
+        return prim_lt(argc, argv);
+    return makeBool(argv[0]->i < argv[1]->i);
+}
+
+Value *prim_fx_gt(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE)
+        return prim_gt(argc, argv);
+    return makeBool(argv[0]->i > argv[1]->i);
+}
+
+Value *prim_fx_leq(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE)
+        return prim_leq(argc, argv);
+    return makeBool(argv[0]->i <= argv[1]->i);
+}
+
+Value *prim_fx_geq(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE)
+        return prim_geq(argc, argv);
+    return makeBool(argv[0]->i >= argv[1]->i);
+}
+
+Value *prim_fl_add(int argc, Value **argv) {
+    return makeDouble(argv[0]->d + argv[1]->d);
+}
+
+Value *prim_fl_sub(int argc, Value **argv) {
+    return makeDouble(argv[0]->d - argv[1]->d);
+}
+
+Value *prim_fl_mul(int argc, Value **argv) {
+    return makeDouble(argv[0]->d * argv[1]->d);
+}
+
+Value *prim_fl_div(int argc, Value **argv) {
+    return makeDouble(argv[0]->d / argv[1]->d);
+}
+
+Value *prim_fl_eq(int argc, Value **argv) {
+    return makeBool(argv[0]->d == argv[1]->d);
+}
+
+Value *prim_fl_lt(int argc, Value **argv) {
+    return makeBool(argv[0]->d < argv[1]->d);
+}
+
+Value *prim_fl_gt(int argc, Value **argv) {
+    return makeBool(argv[0]->d > argv[1]->d);
+}
+
+Value *prim_fl_leq(int argc, Value **argv) {
+    return makeBool(argv[0]->d <= argv[1]->d);
+}
+
+Value *prim_fl_geq(int argc, Value **argv) {
+    return makeBool(argv[0]->d >= argv[1]->d);
+}
+
+struct unchecked_entry {
+    char *name;
+    valueType type;
+    Value *(*function)(int, Value **);
+};
+
+struct unchecked_entry UNCHECKED_PRIMITIVES[] = {
+    {"+", INT_TYPE, prim_fx_add},
+    {"-", INT_TYPE, prim_fx_sub},
+    {"*", INT_TYPE, prim_fx_mul},
+    {"=", INT_TYPE, prim_fx_eq},
+    {"<", INT_TYPE, prim_fx_lt},
+    {">", INT_TYPE, prim_fx_gt},
+    {"<=", INT_TYPE, prim_fx_leq},
+    {">=", INT_TYPE, prim_fx_geq},
+    {"+", DOUBLE_TYPE, prim_fl_add},
+    {"-", DOUBLE_TYPE, prim_fl_sub},
+    {"*", DOUBLE_TYPE, prim_fl_mul},
+    {"/", DOUBLE_TYPE, prim_fl_div},
+    {"=", DOUBLE_TYPE, prim_fl_eq},
+    {"<", DOUBLE_TYPE, prim_fl_lt},
+    {">", DOUBLE_TYPE, prim_fl_gt},
+    {"<=", DOUBLE_TYPE, prim_fl_leq},
+    {">=", DOUBLE_TYPE, prim_fl_geq},
+};
+
+/* Returns a PRIMITIVE_TYPE value computing the two-argument form of the named
+ * arithmetic or comparison primitive on arguments which are both of the given
+ * type, without checking them.  Returns NULL if there is no such primitive. */
+Value *unchecked_primitive(char *name, valueType type) {
+    int i, n = sizeof(UNCHECKED_PRIMITIVES) / sizeof(struct unchecked_entry);
+    for (i = 0; i < n; i++) {
+        if (UNCHECKED_PRIMITIVES[i].type == type && strcmp(UNCHECKED_PRIMITIVES[i].name, name) == 0) {
+            return makePrimitive(UNCHECKED_PRIMITIVES[i].name, UNCHECKED_PRIMITIVES[i].function, 2, 2);
+        }
+    }
+    return NULL;
+}
+
+
+////////////////////////////////////////
+/////////// NUMERIC VECTORS ////////////
+////////////////////////////////////////
+
+// SRFI 4 f64vectors and s64vectors hold their elements unboxed in one array,
+// so that arithmetic on them runs in tight loops rather than through
+// apply and arith_helper once per element: on f64vectors in the SIMD
+// kernels of simd.c, and on s64vectors in plain loops, which must check
+// each operation for overflow.  Each primitive below is written once for
+// both, taking the vector type and its own name, and bound under two names.
+
+/* Returns the name of the type of vector, for error messages. */
+char *vector_type_name(valueType type) {
+    if (type == VECTOR_TYPE)
+        return "vector";
+    return type == F64VECTOR_TYPE ? "f64vector" : "s64vector";
+}
+
+/* Exits with an error reporting the argument in the given position. */
+void vector_argument_error(char *name, Value *value, int position) {
+    fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d: ", name, position);
+    display_to_fd(value, error_stream());
+    raise_error(4);
+}
+
+/* Exits with an error unless the argument is a vector of the given type. */
+void check_vector(char *name, Value *value, valueType type, int position) {
+    if (value->type != type) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected %s): ", name, position, vector_type_name(type));
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Returns the index, exiting with an error unless it is a fixnum within the
+ * bounds of the vector. */
+long check_vector_index(char *name, Value *vector, Value *index, int position) {
+    if (index->type != INT_TYPE || index->i < 0 || index->i >= vector->vec.length) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: index out of range in position %d: ", name, position);
+        display_to_fd(index, error_stream());
+        raise_error(4);
+    }
+    return index->i;
+}
+
+/* Stores the number as element i of the vector and returns 1, or returns 0
+ * if the vector cannot hold it: an f64vector holds any number, converted to
+ * a double, and an s64vector only fixnums. */
+int vector_store(Value *vector, long i, Value *value) {
+    if (vector->type == F64VECTOR_TYPE && is_number(value)) {
+        vector->vec.f64[i] = number_to_double(value);
+        return 1;
+    }
+    if (vector->type == S64VECTOR_TYPE && value->type == INT_TYPE) {
+        vector->vec.s64[i] = value->i;
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns element i of the vector as a new number. */
+Value *vector_load(Value *vector, long i) {
+    if (vector->type == F64VECTOR_TYPE)
+        return makeDouble(vector->vec.f64[i]);
+    return makeInt(vector->vec.s64[i]);
+}
+
+/* Exits with an error if an s64vector operation overflowed. */
+void check_vector_overflow(char *name, int overflow) {
+    if (overflow) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: result out of range of an s64vector element\n", name);
+        raise_error(4);
+    }
+}
+
+/* (make-f64vector k [fill]) */
+Value *make_vector_helper(char *name, valueType type, int argc, Value **argv) {
+    Value *vector;
+    long i;
+    if (argv[0]->type != INT_TYPE || argv[0]->i < 0)
+        vector_argument_error(name, argv[0], 1);
+    vector = makeNumVector(type, argv[0]->i);
+    if (argc == 1) {
+        // Zero bits are 0.0 and 0 alike
+        memset(vector->vec.f64, 0, sizeof(double) * vector->vec.length);
+        return vector;
+    }
+    for (i = 0; i < vector->vec.length; i++)
+        if (!vector_store(vector, i, argv[1]))
+            vector_argument_error(name, argv[1], 2);
+    return vector;
+}
+
+/* (f64vector x ...) */
+Value *vector_helper(char *name, valueType type, int argc, Value **argv) {
+    Value *vector = makeNumVector(type, argc);
+    int i;
+    for (i = 0; i < argc; i++)
+        if (!vector_store(vector, i, argv[i]))
+            vector_argument_error(name, argv[i], i + 1);
+    return vector;
+}
+
+/* (f64vector-length vector) */
+Value *vector_length_helper(char *name, valueType type, Value **argv) {
+    check_vector(name, argv[0], type, 1);
+    return makeInt(argv[0]->vec.length);
+}
+
+/* (f64vector-ref vector k) */
+Value *vector_ref_helper(char *name, valueType type, Value **argv) {
+    check_vector(name, argv[0], type, 1);
+    return vector_load(argv[0], check_vector_index(name, argv[0], argv[1], 2));
+}
+
+/* (f64vector-set! vector k x) */
+Value *vector_set_helper(char *name, valueType type, Value **argv) {
+    long i;
+    check_vector(name, argv[0], type, 1);
+    i = check_vector_index(name, argv[0], argv[1], 2);
+    if (!vector_store(argv[0], i, argv[2]))
+        vector_argument_error(name, argv[2], 3);
+    return makeVoid();
+}
+
+/* (f64vector->list vector) */
+Value *vector_to_list_helper(char *name, valueType type, Value **argv) {
+    Value *list = makeNull();
+    long i;
+    check_vector(name, argv[0], type, 1);
+    for (i = argv[0]->vec.length - 1; i >= 0; i--)
+        list = cons(vector_load(argv[0], i), list);
+    return list;
+}
+
+/* (list->f64vector list) */
+Value *list_to_vector_helper(char *name, valueType type, Value **argv) {
+    Value *vector, *current;
+    long length = 0, i;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        length++;
+    check_list_end(name, current, 1);
+    vector = makeNumVector(type, length);
+    for (i = 0, current = argv[0]; i < length; i++, current = cdr(current))
+        if (!vector_store(vector, i, car(current)))
+            vector_argument_error(name, car(current), 1);
+    return vector;
+}
+
+/* Returns a new vector of the elementwise sums or products of the first n
+ * elements of the vectors a and b. */
+Value *vector_arith(char *name, Value *a, Value *b, long n, enum operation op) {
+    Value *result = makeNumVector(a->type, n);
+    long i;
+    if (a->type == F64VECTOR_TYPE) {
+        if (op == PLUS)
+            f64_add(result->vec.f64, a->vec.f64, b->vec.f64, n);
+        else
+            f64_mul(result->vec.f64, a->vec.f64, b->vec.f64, n);
+        return result;
+    }
+    for (i = 0; i < n; i++)
+        check_vector_overflow(name, fixnum_overflow(op, a->vec.s64[i], b->vec.s64[i], &result->vec.s64[i]));
+    return result;
+}
+
+/* (f64vector-add a b) and (f64vector-mul a b), on vectors of equal length */
+Value *vector_arith_helper(char *name, valueType type, Value **argv, enum operation op) {
+    check_vector(name, argv[0], type, 1);
+    check_vector(name, argv[1], type, 2);
+    if (argv[0]->vec.length != argv[1]->vec.length) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: vectors of different lengths %ld and %ld\n", name, argv[0]->vec.length, argv[1]->vec.length);
+        raise_error(4);
+    }
+    return vector_arith(name, argv[0], argv[1], argv[0]->vec.length, op);
+}
+
+/* (f64vector-scale vector x) */
+Value *vector_scale_helper(char *name, valueType type, Value **argv) {
+    Value *vector = argv[0], *result;
+    long i;
+    check_vector(name, vector, type, 1);
+    result = makeNumVector(type, vector->vec.length);
+    if (type == F64VECTOR_TYPE) {
+        if (!is_number(argv[1]))
+            vector_argument_error(name, argv[1], 2);
+        f64_scale(result->vec.f64, vector->vec.f64, number_to_double(argv[1]), vector->vec.length);
+        return result;
+    }
+    if (argv[1]->type != INT_TYPE)
+        vector_argument_error(name, argv[1], 2);
+    for (i = 0; i < vector->vec.length; i++)
+        check_vector_overflow(name, __builtin_mul_overflow(vector->vec.s64[i], argv[1]->i, &result->vec.s64[i]));
+    return result;
+}
+
+/* Returns the exact sum of the products a[i] * b[i] of the n elements, or
+ * of the a[i] if b is NULL, carrying on in bignums while it does not fit in
+ * a fixnum. */
+Value *s64_sum(long *a, long *b, long n) {
+    Value *big = NULL, *term;
+    long acc = 0, product, sum, i;
+    int overflow = 0;
+    for (i = 0; i < n; i++) {
+        if (b == NULL)
+            product = a[i];
+        else
+            overflow = __builtin_mul_overflow(a[i], b[i], &product);
+        if (big == NULL && !overflow && !__builtin_add_overflow(acc, product, &sum)) {
+            acc = sum;
+            continue;
+        }
+        if (big == NULL)
+            big = makeInt(acc);
+        term = overflow ? bignum_mul(makeInt(a[i]), makeInt(b[i])) : makeInt(product);
+        big = bignum_add(big, term);
+        if (big->type == INT_TYPE) {
+            acc = big->i;
+            big = NULL;
+        }
+    }
+    return big != NULL ? big : makeInt(acc);
+}
+
+/* (f64vector-sum vector) */
+Value *vector_sum_helper(char *name, valueType type, Value **argv) {
+    Value *vector = argv[0];
+    check_vector(name, vector, type, 1);
+    if (type == F64VECTOR_TYPE)
+        return makeDouble(f64_sum(vector->vec.f64, vector->vec.length));
+    return s64_sum(vector->vec.s64, NULL, vector->vec.length);
+}
+
+/* (f64vector-dot a b), on vectors of equal length */
+Value *vector_dot_helper(char *name, valueType type, Value **argv) {
+    Value *a = argv[0], *b = argv[1];
+    check_vector(name, a, type, 1);
+    check_vector(name, b, type, 2);
+    if (a->vec.length != b->vec.length) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: vectors of different lengths %ld and %ld\n", name, a->vec.length, b->vec.length);
+        raise_error(4);
+    }
+    if (type == F64VECTOR_TYPE)
+        return makeDouble(f64_dot(a->vec.f64, b->vec.f64, a->vec.length));
+    return s64_sum(a->vec.s64, b->vec.s64, a->vec.length);
+}
+
+/* (f64vector-min vector) and (f64vector-max vector), on a nonempty vector */
+Value *vector_extremum_helper(char *name, valueType type, Value **argv, enum comparison comp) {
+    Value *vector = argv[0];
+    long extremum, i;
+    check_vector(name, vector, type, 1);
+    if (vector->vec.length == 0) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: empty vector\n", name);
+        raise_error(4);
+    }
+    if (type == F64VECTOR_TYPE) {
+        if (comp == LT)
+            return makeDouble(f64_min(vector->vec.f64, vector->vec.length));
+        return makeDouble(f64_max(vector->vec.f64, vector->vec.length));
+    }
+    extremum = vector->vec.s64[0];
+    for (i = 1; i < vector->vec.length; i++) {
+        if (comp == LT ? vector->vec.s64[i] < extremum : vector->vec.s64[i] > extremum)
+            extremum = vector->vec.s64[i];
+    }
+    return makeInt(extremum);
+}
+
+/* (f64vector-map proc vector1 vector2 ...) applies proc to the corresponding
+ * elements of the vectors, stopping at the end of the shortest, and returns
+ * the results in a new vector of the same type.  Mapping the primitive + or
+ * * over two vectors runs the elementwise kernel instead. */
+Value *vector_map_helper(char *name, valueType type, int argc, Value **argv) {
+    Value *result, *value, *call_argv[argc - 1];
+    long length, i;
+    int j;
+    for (j = 1; j < argc; j++)
+        check_vector(name, argv[j], type, j + 1);
+    length = argv[1]->vec.length;
+    for (j = 2; j < argc; j++)
+        if (argv[j]->vec.length < length)
+            length = argv[j]->vec.length;
+    if (argc == 3 && argv[0]->type == PRIMITIVE_TYPE) {
+        if (argv[0]->pr.pf == prim_add)
+            return vector_arith(name, argv[1], argv[2], length, PLUS);
+        if (argv[0]->pr.pf == prim_mul)
+            return vector_arith(name, argv[1], argv[2], length, MULT);
+    }
+    result = makeNumVector(type, length);
+    for (i = 0; i < length; i++) {
+        for (j = 1; j < argc; j++)
+            call_argv[j - 1] = vector_load(argv[j], i);
+        value = apply(argv[0], argc - 1, call_argv);
+        if (!vector_store(result, i, value)) {
+            fprintf(error_stream(), "Evaluation error: primitive function `%s`: procedure returned a value which an %s cannot hold: ", name, vector_type_name(type));
+            display_to_fd(value, error_stream());
+            raise_error(4);
+        }
+    }
+    return result;
+}
+
+Value *prim_make_f64vector(int argc, Value **argv) {
+    return make_vector_helper("make-f64vector", F64VECTOR_TYPE, argc, argv);
+}
+
+Value *prim_f64vector(int argc, Value **argv) {
+    return vector_helper("f64vector", F64VECTOR_TYPE, argc, argv);
+}
+
+Value *prim_f64vector_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == F64VECTOR_TYPE);
+}
+
+Value *prim_f64vector_length(int argc, Value **argv) {
+    return vector_length_helper("f64vector-length", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_ref(int argc, Value **argv) {
+    return vector_ref_helper("f64vector-ref", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_set(int argc, Value **argv) {
+    return vector_set_helper("f64vector-set!", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_to_list(int argc, Value **argv) {
+    return vector_to_list_helper("f64vector->list", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_list_to_f64vector(int argc, Value **argv) {
+    return list_to_vector_helper("list->f64vector", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_add(int argc, Value **argv) {
+    return vector_arith_helper("f64vector-add", F64VECTOR_TYPE, argv, PLUS);
+}
+
+Value *prim_f64vector_mul(int argc, Value **argv) {
+    return vector_arith_helper("f64vector-mul", F64VECTOR_TYPE, argv, MULT);
+}
+
+Value *prim_f64vector_scale(int argc, Value **argv) {
+    return vector_scale_helper("f64vector-scale", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_dot(int argc, Value **argv) {
+    return vector_dot_helper("f64vector-dot", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_sum(int argc, Value **argv) {
+    return vector_sum_helper("f64vector-sum", F64VECTOR_TYPE, argv);
+}
+
+Value *prim_f64vector_min(int argc, Value **argv) {
+    return vector_extremum_helper("f64vector-min", F64VECTOR_TYPE, argv, LT);
+}
+
+Value *prim_f64vector_max(int argc, Value **argv) {
+    return vector_extremum_helper("f64vector-max", F64VECTOR_TYPE, argv, GT);
+}
+
+Value *prim_f64vector_map(int argc, Value **argv) {
+    return vector_map_helper("f64vector-map", F64VECTOR_TYPE, argc, argv);
+}
+
+Value *prim_make_s64vector(int argc, Value **argv) {
+    return make_vector_helper("make-s64vector", S64VECTOR_TYPE, argc, argv);
+}
+
+Value *prim_s64vector(int argc, Value **argv) {
+    return vector_helper("s64vector", S64VECTOR_TYPE, argc, argv);
+}
+
+Value *prim_s64vector_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == S64VECTOR_TYPE);
+}
+
+Value *prim_s64vector_length(int argc, Value **argv) {
+    return vector_length_helper("s64vector-length", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_ref(int argc, Value **argv) {
+    return vector_ref_helper("s64vector-ref", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_set(int argc, Value **argv) {
+    return vector_set_helper("s64vector-set!", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_to_list(int argc, Value **argv) {
+    return vector_to_list_helper("s64vector->list", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_list_to_s64vector(int argc, Value **argv) {
+    return list_to_vector_helper("list->s64vector", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_add(int argc, Value **argv) {
+    return vector_arith_helper("s64vector-add", S64VECTOR_TYPE, argv, PLUS);
+}
+
+Value *prim_s64vector_mul(int argc, Value **argv) {
+    return vector_arith_helper("s64vector-mul", S64VECTOR_TYPE, argv, MULT);
+}
+
+Value *prim_s64vector_scale(int argc, Value **argv) {
+    return vector_scale_helper("s64vector-scale", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_dot(int argc, Value **argv) {
+    return vector_dot_helper("s64vector-dot", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_sum(int argc, Value **argv) {
+    return vector_sum_helper("s64vector-sum", S64VECTOR_TYPE, argv);
+}
+
+Value *prim_s64vector_min(int argc, Value **argv) {
+    return vector_extremum_helper("s64vector-min", S64VECTOR_TYPE, argv, LT);
+}
+
+Value *prim_s64vector_max(int argc, Value **argv) {
+    return vector_extremum_helper("s64vector-max", S64VECTOR_TYPE, argv, GT);
+}
+
+Value *prim_s64vector_map(int argc, Value **argv) {
+    return vector_map_helper("s64vector-map", S64VECTOR_TYPE, argc, argv);
+}
+
+
+////////////////////////////////////////
+/////////////// VECTORS ////////////////
+////////////////////////////////////////
+
+// Vectors of any values, held in one array so that indexing is a single
+// load.  They share struct NumVector and its checks with the numeric
+// vectors above.
+
+/* Returns the end of the range of the vector given by the optional start and
+ * end arguments at argv[first], and stores its start, exiting with an error
+ * unless 0 <= start <= end <= length. */
+long check_vector_range(char *name, Value *vector, int argc, Value **argv, int first, long *start) {
+    long end = vector->vec.length;
+    *start = 0;
+    if (argc > first) {
+        if (argv[first]->type != INT_TYPE || argv[first]->i < 0 || argv[first]->i > end)
+            vector_argument_error(name, argv[first], first + 1);
+        *start = argv[first]->i;
+    }
+    if (argc > first + 1) {
+        if (argv[first + 1]->type != INT_TYPE || argv[first + 1]->i < *start || argv[first + 1]->i > end)
+            vector_argument_error(name, argv[first + 1], first + 2);
+        end = argv[first + 1]->i;
+    }
+    return end;
+}
+
+/* (make-vector k [fill]) */
+Value *prim_make_vector(int argc, Value **argv) {
+    Value *vector, *fill;
+    long i;
+    if (argv[0]->type != INT_TYPE || argv[0]->i < 0)
+        vector_argument_error("make-vector", argv[0], 1);
+    fill = argc == 2 ? argv[1] : makeUnspecified();
+    vector = makeVector(argv[0]->i);
+    for (i = 0; i < vector->vec.length; i++)
+        vector->vec.items[i] = fill;
+    return vector;
+}
+
+/* (vector x ...) */
+Value *prim_vector(int argc, Value **argv) {
+    Value *vector = makeVector(argc);
+    memcpy(vector->vec.items, argv, sizeof(Value *) * argc);
+    return vector;
+}
+
+Value *prim_vector_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == VECTOR_TYPE);
+}
+
+Value *prim_vector_length(int argc, Value **argv) {
+    check_vector("vector-length", argv[0], VECTOR_TYPE, 1);
+    return makeInt(argv[0]->vec.length);
+}
+
+/* (vector-ref vector k) */
+Value *prim_vector_ref(int argc, Value **argv) {
+    check_vector("vector-ref", argv[0], VECTOR_TYPE, 1);
+    return argv[0]->vec.items[check_vector_index("vector-ref", argv[0], argv[1], 2)];
+}
+
+/* (vector-set! vector k x) */
+Value *prim_vector_set(int argc, Value **argv) {
+    check_vector("vector-set!", argv[0], VECTOR_TYPE, 1);
+    argv[0]->vec.items[check_vector_index("vector-set!", argv[0], argv[1], 2)] = argv[2];
+    return makeVoid();
+}
+
+/* (vector->list vector [start [end]]) */
+Value *prim_vector_to_list(int argc, Value **argv) {
+    Value *list = makeNull();
+    long start, i;
+    check_vector("vector->list", argv[0], VECTOR_TYPE, 1);
+    for (i = check_vector_range("vector->list", argv[0], argc, argv, 1, &start) - 1; i >= start; i--)
+        list = cons(argv[0]->vec.items[i], list);
+    return list;
+}
+
+/* (list->vector list) */
+Value *prim_list_to_vector(int argc, Value **argv) {
+    Value *vector, *current;
+    long length = 0, i;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        length++;
+    check_list_end("list->vector", current, 1);
+    vector = makeVector(length);
+    for (i = 0, current = argv[0]; i < length; i++, current = cdr(current))
+        vector->vec.items[i] = car(current);
+    return vector;
+}
+
+/* (vector-fill! vector x [start [end]]) */
+Value *prim_vector_fill(int argc, Value **argv) {
+    long start, end, i;
+    check_vector("vector-fill!", argv[0], VECTOR_TYPE, 1);
+    end = check_vector_range("vector-fill!", argv[0], argc, argv, 2, &start);
+    for (i = start; i < end; i++)
+        argv[0]->vec.items[i] = argv[1];
+    return makeVoid();
+}
+
+
+////////////////////////////////////////
+/////////////// STRINGS ////////////////
+////////////////////////////////////////
+
+// Strings know their length, so string-length is a load, and substrings
+// share the characters of the string they are taken from; see strlib.c.
+
+/* Exits with an error unless the argument is a string. */
+void check_string(char *name, Value *value, int position) {
+    if (value->type != STR_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected string): ", name, position);
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Returns the index given by the argument, exiting with an error unless it
+ * is a fixnum from lo to hi. */
+long check_string_index(char *name, Value *index, long lo, long hi, int position) {
+    if (index->type != INT_TYPE || index->i < lo || index->i > hi)
+        vector_argument_error(name, index, position);
+    return index->i;
+}
+
+Value *prim_string_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == STR_TYPE);
+}
+
+Value *prim_string_length(int argc, Value **argv) {
+    check_string("string-length", argv[0], 1);
+    return makeInt(argv[0]->str.length);
+}
+
+/* (substring string start [end]) */
+Value *prim_substring(int argc, Value **argv) {
+    long start, end;
+    check_string("substring", argv[0], 1);
+    start = check_string_index("substring", argv[1], 0, argv[0]->str.length, 2);
+    end = argc == 3 ? check_string_index("substring", argv[2], start, argv[0]->str.length, 3) : argv[0]->str.length;
+    return string_slice(argv[0], start, end);
+}
+
+/* (string-append string ...) */
+Value *prim_string_append(int argc, Value **argv) {
+    int i;
+    for (i = 0; i < argc; i++)
+        check_string("string-append", argv[i], i + 1);
+    return string_concat(argc, argv);
+}
+
+/* (string-search pattern string [start]) returns the index of the first
+ * occurrence of the pattern in the string at or after start, or #f. */
+Value *prim_string_search(int argc, Value **argv) {
+    long start = 0, found;
+    check_string("string-search", argv[0], 1);
+    check_string("string-search", argv[1], 2);
+    if (argc == 3)
+        start = check_string_index("string-search", argv[2], 0, argv[1]->str.length, 3);
+    found = string_search(argv[0], argv[1], start);
+    return found < 0 ? makeBool(0) : makeInt(found);
+}
+
+/* (string-split string delimiter) returns the list of the substrings of the
+ * string between occurrences of the delimiter, including empty ones. */
+Value *prim_string_split(int argc, Value **argv) {
+    Value *fields = makeNull();
+    long start = 0, found;
+    check_string("string-split", argv[0], 1);
+    check_string("string-split", argv[1], 2);
+    if (argv[1]->str.length == 0)
+        vector_argument_error("string-split", argv[1], 2);
+    while ((found = string_search(argv[1], argv[0], start)) >= 0) {
+        fields = cons(string_slice(argv[0], start, found), fields);
+        start = found + argv[1]->str.length;
+    }
+    fields = cons(string_slice(argv[0], start, argv[0]->str.length), fields);
+    return reverse(fields);
+}
+
+/* (string->number string) returns the number written in the string, or #f
+ * if it is not one. */
+Value *prim_string_to_number(int argc, Value **argv) {
+    Value *number;
+    char *chars;
+    check_string("string->number", argv[0], 1);
+    chars = string_cstr(argv[0]);
+    if ((long)strlen(chars) != argv[0]->str.length)
+        return makeBool(0);
+    number = parse_number(chars);
+    return number == NULL ? makeBool(0) : number;
+}
+
+/* (number->string z) returns the number written as display writes it. */
+Value *prim_number_to_string(int argc, Value **argv) {
+    Value *string;
+    // Room for any double written in full with %lf
+    char buf[512], *chars;
+    size_t size;
+    FILE *fd;
+    switch (argv[0]->type) {
+        case INT_TYPE:
+            return string_copy(buf, snprintf(buf, sizeof(buf), "%ld", argv[0]->i));
+        case DOUBLE_TYPE:
+            return string_copy(buf, snprintf(buf, sizeof(buf), "%lf", argv[0]->d));
+        case BIGNUM_TYPE:
+            fd = open_memstream(&chars, &size);
+            bignum_print(argv[0], fd);
+            fclose(fd);
+            string = string_copy(chars, size);
+            free(chars);
+            return string;
+        default:
+            vector_argument_error("number->string", argv[0], 1);
+            return NULL;
+    }
+}
+
+
+////////////////////////////////////////
+/////////////// SORTING ////////////////
+////////////////////////////////////////
+
+// A sort copies the elements of its list or vector into an array, sorts the
+// array with sort_values, and copies them back out, so an ordering which
+// raises an error leaves the sequence as it was.  < and > on elements which
+// are all fixnums or all flonums are compared directly in C, which also lets
+// large sorts use several threads; any other ordering is called with apply.
+
+#define SORT_LIST 1
+#define SORT_VECTOR 2
+
+// An ordering procedure, and the name of the primitive calling it.
+struct SortProcedure {
+    char *name;
+    Value *less;
+};
+
+int sort_fixnum_less(Value *a, Value *b, void *context) {
+    return a->i < b->i;
+}
+
+int sort_fixnum_greater(Value *a, Value *b, void *context) {
+    return a->i > b->i;
+}
+
+int sort_flonum_less(Value *a, Value *b, void *context) {
+    return a->d < b->d;
+}
+
+int sort_flonum_greater(Value *a, Value *b, void *context) {
+    return a->d > b->d;
+}
+
+/* Applies the ordering procedure in context to a and b, exiting with an
+ * error if it returns other than a boolean. */
+int sort_procedure_less(Value *a, Value *b, void *context) {
+    struct SortProcedure *procedure = context;
+    Value *argv[2], *result;
+    argv[0] = a;
+    argv[1] = b;
+    result = apply(procedure->less, 2, argv);
+    if (result->type != BOOL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: expected predicate to return type %d (BOOL_TYPE), but received %d\n", procedure->name, BOOL_TYPE, result->type);
+        raise_error(4);
+    }
+    return result->i;
+}
+
+/* Returns the C ordering equivalent to the procedure less on the n values
+ * in items, or NULL if there is none. */
+sort_less sort_native_ordering(Value *less, Value **items, long n) {
+    long i;
+    if (n == 0 || less->type != PRIMITIVE_TYPE || (less->pr.pf != prim_lt && less->pr.pf != prim_gt))
+        return NULL;
+    for (i = 1; i < n && items[i]->type == items[0]->type; i++)
+        ;
+    if (i < n)
+        return NULL;
+    if (items[0]->type == INT_TYPE)
+        return less->pr.pf == prim_lt ? sort_fixnum_less : sort_fixnum_greater;
+    if (items[0]->type == DOUBLE_TYPE)
+        return less->pr.pf == prim_lt ? sort_flonum_less : sort_flonum_greater;
+    return NULL;
+}
+
+/* Sorts the list or vector sequence, an argument in the given position of
+ * the named primitive which may be of the kinds in accepts, by the
+ * procedure less.  Returns a new sequence of the same kind, or if in_place
+ * stores the elements back into the sequence and returns it. */
+Value *sort_helper(char *name, Value *sequence, Value *less, int position, int accepts, int in_place) {
+    struct SortProcedure procedure;
+    Value **items, **buffer, *current, *result;
+    sort_less native;
+    long n = 0, i;
+    if ((accepts & SORT_VECTOR) && sequence->type == VECTOR_TYPE) {
+        n = sequence->vec.length;
+        items = talloc(sizeof(Value *) * (n + 1));
+        memcpy(items, sequence->vec.items, sizeof(Value *) * n);
+    } else if ((accepts & SORT_LIST) && (sequence->type == CONS_TYPE || sequence->type == NULL_TYPE)) {
+        for (current = sequence; current->type == CONS_TYPE; current = cdr(current))
+            n++;
+        check_list_end(name, current, position);
+        items = talloc(sizeof(Value *) * (n + 1));
+        for (i = 0, current = sequence; i < n; i++, current = cdr(current))
+            items[i] = car(current);
+    } else {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected %s): ", name, position,
+                accepts == SORT_LIST ? "list" : accepts == SORT_VECTOR ? "vector" : "list or vector");
+        display_to_fd(sequence, error_stream());
+        raise_error(4);
+    }
+    buffer = talloc(sizeof(Value *) * (n + 1));
+    native = sort_native_ordering(less, items, n);
+    if (native != NULL) {
+        sort_values(items, n, buffer, native, NULL, 1);
+    } else {
+        procedure.name = name;
+        procedure.less = less;
+        sort_values(items, n, buffer, sort_procedure_less, &procedure, 0);
+    }
+    if (sequence->type == VECTOR_TYPE) {
+        result = in_place ? sequence : makeVector(n);
+        memcpy(result->vec.items, items, sizeof(Value *) * n);
+        return result;
+    }
+    if (in_place) {
+        for (i = 0, current = sequence; i < n; i++, current = cdr(current))
+            current->c.car = items[i];
+        LIST_EPOCH++;
+        return sequence;
+    }
+    result = makeNull();
+    for (i = n - 1; i >= 0; i--)
+        result = cons(items[i], result);
+    return result;
+}
+
+/* (sort sequence less) returns a new list or vector of the elements of the
+ * list or vector sequence sorted by less, stably. */
+Value *prim_sort(int argc, Value **argv) {
+    return sort_helper("sort", argv[0], argv[1], 1, SORT_LIST | SORT_VECTOR, 0);
+}
+
+/* (sort! sequence less) sorts the list or vector sequence in place, by
+ * storing its elements back in sorted order, and returns it. */
+Value *prim_sort_bang(int argc, Value **argv) {
+    return sort_helper("sort!", argv[0], argv[1], 1, SORT_LIST | SORT_VECTOR, 1);
+}
+
+/* (list-sort less list) */
+Value *prim_list_sort(int argc, Value **argv) {
+    return sort_helper("list-sort", argv[1], argv[0], 2, SORT_LIST, 0);
+}
+
+/* (vector-sort less vector) */
+Value *prim_vector_sort(int argc, Value **argv) {
+    return sort_helper("vector-sort", argv[1], argv[0], 2, SORT_VECTOR, 0);
+}
+
+
+////////////////////////////////////////
+////////////// MATRICES ////////////////
+////////////////////////////////////////
+
+// Dense matrices of doubles, multiplied and transposed by matrix.c.
+
+/* Exits with an error unless the argument is a matrix. */
+void check_matrix(char *name, Value *value, int position) {
+    if (value->type != MATRIX_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected matrix): ", name, position);
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Returns the offset of element (i, j) of the matrix, exiting with an error
+ * unless the indices in the given positions are fixnums within its bounds. */
+long check_matrix_index(char *name, Value *matrix, Value *i, Value *j, int position) {
+    if (i->type != INT_TYPE || i->i < 0 || i->i >= matrix->mat.rows) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: index out of range in position %d: ", name, position);
+        display_to_fd(i, error_stream());
+        raise_error(4);
+    }
+    if (j->type != INT_TYPE || j->i < 0 || j->i >= matrix->mat.cols) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: index out of range in position %d: ", name, position + 1);
+        display_to_fd(j, error_stream());
+        raise_error(4);
+    }
+    return i->i * matrix->mat.cols + j->i;
+}
+
+/* (make-matrix rows cols [fill]) returns a new matrix whose elements are
+ * fill, or 0.0. */
+Value *prim_make_matrix(int argc, Value **argv) {
+    Value *matrix;
+    double fill = 0.0;
+    long i;
+    for (i = 0; i < 2; i++)
+        if (argv[i]->type != INT_TYPE || argv[i]->i < 0)
+            vector_argument_error("make-matrix", argv[i], i + 1);
+    if (argc == 3) {
+        if (!is_number(argv[2]))
+            vector_argument_error("make-matrix", argv[2], 3);
+        fill = number_to_double(argv[2]);
+    }
+    matrix = makeMatrix(argv[0]->i, argv[1]->i);
+    for (i = 0; i < matrix->mat.rows * matrix->mat.cols; i++)
+        matrix->mat.elements[i] = fill;
+    return matrix;
+}
+
+/* (list->matrix rows) returns a new matrix from a list of its rows, each a
+ * list of numbers, all of the same length. */
+Value *prim_list_to_matrix(int argc, Value **argv) {
+    Value *matrix, *row, *current;
+    long rows = 0, cols = -1, i = 0, j;
+    for (row = argv[0]; row->type == CONS_TYPE; row = cdr(row)) {
+        for (j = 0, current = car(row); current->type == CONS_TYPE; current = cdr(current))
+            j++;
+        if (current->type != NULL_TYPE || (cols >= 0 && j != cols)) {
+            fprintf(error_stream(), "Evaluation error: primitive function `list->matrix`: row %ld is not a list of %ld numbers: ", rows, cols >= 0 ? cols : j);
+            display_to_fd(car(row), error_stream());
+            raise_error(4);
+        }
+        cols = j;
+        rows++;
+    }
+    check_list_end("list->matrix", row, 1);
+    matrix = makeMatrix(rows, cols >= 0 ? cols : 0);
+    for (row = argv[0]; row->type == CONS_TYPE; row = cdr(row)) {
+        for (current = car(row); current->type == CONS_TYPE; current = cdr(current)) {
+            if (!is_number(car(current)))
+                vector_argument_error("list->matrix", car(current), 1);
+            matrix->mat.elements[i++] = number_to_double(car(current));
+        }
+    }
+    return matrix;
+}
+
+/* (matrix->list matrix) returns a new list of the rows of the matrix. */
+Value *prim_matrix_to_list(int argc, Value **argv) {
+    Value *matrix = argv[0], *rows = makeNull(), *row;
+    long i, j;
+    check_matrix("matrix->list", matrix, 1);
+    for (i = matrix->mat.rows - 1; i >= 0; i--) {
+        row = makeNull();
+        for (j = matrix->mat.cols - 1; j >= 0; j--)
+            row = cons(makeDouble(matrix->mat.elements[i * matrix->mat.cols + j]), row);
+        rows = cons(row, rows);
+    }
+    return rows;
+}
+
+Value *prim_matrix_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == MATRIX_TYPE);
+}
+
+Value *prim_matrix_rows(int argc, Value **argv) {
+    check_matrix("matrix-rows", argv[0], 1);
+    return makeInt(argv[0]->mat.rows);
+}
+
+Value *prim_matrix_cols(int argc, Value **argv) {
+    check_matrix("matrix-cols", argv[0], 1);
+    return makeInt(argv[0]->mat.cols);
+}
+
+/* (matrix-ref matrix i j) */
+Value *prim_matrix_ref(int argc, Value **argv) {
+    check_matrix("matrix-ref", argv[0], 1);
+    return makeDouble(argv[0]->mat.elements[check_matrix_index("matrix-ref", argv[0], argv[1], argv[2], 2)]);
+}
+
+/* (matrix-set! matrix i j x) */
+Value *prim_matrix_set(int argc, Value **argv) {
+    long offset;
+    check_matrix("matrix-set!", argv[0], 1);
+    offset = check_matrix_index("matrix-set!", argv[0], argv[1], argv[2], 2);
+    if (!is_number(argv[3]))
+        vector_argument_error("matrix-set!", argv[3], 4);
+    argv[0]->mat.elements[offset] = number_to_double(argv[3]);
+    return makeVoid();
+}
+
+Value *prim_matrix_transpose(int argc, Value **argv) {
+    Value *matrix = argv[0], *result;
+    check_matrix("matrix-transpose", matrix, 1);
+    result = makeMatrix(matrix->mat.cols, matrix->mat.rows);
+    matrix_transpose(result->mat.elements, matrix->mat.elements, matrix->mat.rows, matrix->mat.cols);
+    return result;
+}
+
+/* (matrix-multiply a b) returns the product of an n by m and an m by p
+ * matrix. */
+Value *prim_matrix_multiply(int argc, Value **argv) {
+    Value *a = argv[0], *b = argv[1], *result;
+    check_matrix("matrix-multiply", a, 1);
+    check_matrix("matrix-multiply", b, 2);
+    if (a->mat.cols != b->mat.rows) {
+        fprintf(error_stream(), "Evaluation error: primitive function `matrix-multiply`: cannot multiply a %ldx%ld matrix by a %ldx%ld matrix\n", a->mat.rows, a->mat.cols, b->mat.rows, b->mat.cols);
+        raise_error(4);
+    }
+    result = makeMatrix(a->mat.rows, b->mat.cols);
+    matrix_multiply(result->mat.elements, a->mat.elements, b->mat.elements, a->mat.rows, a->mat.cols, b->mat.cols);
+    return result;
+}
+
+////////////////////////////////////////
+///////////// HASH TABLES //////////////
+////////////////////////////////////////
+
+// SRFI 69 hash tables, over the open-addressing tables of hashtable.c.  The
+// procedures which take a table check its keys, so that hashtable.c need
+// not raise errors.
+
+/* Exits with an error unless the argument is a hash table. */
+void check_hash_table(char *name, Value *value, int position) {
+    if (value->type != HASH_TABLE_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected hash table): ", name, position);
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Exits with an error unless the key can be hashed by the table, which
+ * given the argument in position 1, is in position 2. */
+void check_hash_key(char *name, Value *table, Value *key) {
+    check_hash_table(name, table, 1);
+    if (table->ht->kind == HASH_STRING && key->type != STR_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 2 (expected string): ", name);
+        display_to_fd(key, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Exits with an error reporting that the key is not in the table. */
+void missing_key_error(char *name, Value *key) {
+    fprintf(error_stream(), "Evaluation error: primitive function `%s`: no value for key: ", name);
+    display_to_fd(key, error_stream());
+    raise_error(4);
+}
+
+/* (make-hash-table [equivalence [size]]) returns a new table whose keys are
+ * compared by eq?, eqv?, equal? (the default) or string=?, with room for
+ * size entries before it grows. */
+Value *prim_make_hash_table(int argc, Value **argv) {
+    Value *table;
+    enum hash_kind kind = HASH_EQUAL;
+    long size_hint = 0;
+    if (argc > 0) {
+        if (argv[0]->type != PRIMITIVE_TYPE)
+            vector_argument_error("make-hash-table", argv[0], 1);
+        if (argv[0]->pr.pf == prim_eqv)
+            kind = HASH_EQV;
+        else if (argv[0]->pr.pf == prim_string_eq)
+            kind = HASH_STRING;
+        else if (argv[0]->pr.pf != prim_equal)
+            vector_argument_error("make-hash-table", argv[0], 1);
+    }
+    if (argc > 1) {
+        if (argv[1]->type != INT_TYPE || argv[1]->i < 0)
+            vector_argument_error("make-hash-table", argv[1], 2);
+        size_hint = argv[1]->i;
+    }
+    table = talloc(sizeof(Value));
+    table->type = HASH_TABLE_TYPE;
+    table->ht = hash_table_new(kind, size_hint);
+    return table;
+}
+
+Value *prim_hash_table_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == HASH_TABLE_TYPE);
+}
+
+/* (hash-table-ref table key [failure]) returns the value of the key, or the
+ * result of calling the thunk failure if it has none. */
+Value *prim_hash_table_ref(int argc, Value **argv) {
     Value *value;
-    int argc = length(args);
-    if (argc != 1) {
-        fprintf(stderr, "Evaluation error: primitive function `cdr`: expected 1 argument, received %d\n", argc);
-        texit(4);
+    check_hash_key("hash-table-ref", argv[0], argv[1]);
+    value = hash_table_get(argv[0]->ht, argv[1]);
+    if (value != NULL)
+        return value;
+    if (argc == 3)
+        return apply(argv[2], 0, NULL);
+    missing_key_error("hash-table-ref", argv[1]);
+    return NULL;
+}
+
+/* (hash-table-ref/default table key default) */
+Value *prim_hash_table_ref_default(int argc, Value **argv) {
+    Value *value;
+    check_hash_key("hash-table-ref/default", argv[0], argv[1]);
+    value = hash_table_get(argv[0]->ht, argv[1]);
+    return value != NULL ? value : argv[2];
+}
+
+/* (hash-table-set! table key value) */
+Value *prim_hash_table_set(int argc, Value **argv) {
+    check_hash_key("hash-table-set!", argv[0], argv[1]);
+    hash_table_put(argv[0]->ht, argv[1], argv[2]);
+    return makeVoid();
+}
+
+/* (hash-table-delete! table key) */
+Value *prim_hash_table_delete(int argc, Value **argv) {
+    check_hash_key("hash-table-delete!", argv[0], argv[1]);
+    hash_table_remove(argv[0]->ht, argv[1]);
+    return makeVoid();
+}
+
+/* (hash-table-contains? table key) */
+Value *prim_hash_table_contains(int argc, Value **argv) {
+    check_hash_key("hash-table-contains?", argv[0], argv[1]);
+    return makeBool(hash_table_get(argv[0]->ht, argv[1]) != NULL);
+}
+
+/* (hash-table-update! table key proc [failure]) sets the value of the key to
+ * the result of calling proc on its value, or on the result of calling the
+ * thunk failure if it has none. */
+Value *prim_hash_table_update(int argc, Value **argv) {
+    Value *value;
+    check_hash_key("hash-table-update!", argv[0], argv[1]);
+    value = hash_table_get(argv[0]->ht, argv[1]);
+    if (value == NULL) {
+        if (argc < 4)
+            missing_key_error("hash-table-update!", argv[1]);
+        value = apply(argv[3], 0, NULL);
+    }
+    // proc may change the table, so the key is looked up again to store
+    hash_table_put(argv[0]->ht, argv[1], single_value("primitive function `hash-table-update!`", apply(argv[2], 1, &value)));
+    return makeVoid();
+}
+
+/* (hash-table-update!/default table key proc default) */
+Value *prim_hash_table_update_default(int argc, Value **argv) {
+    Value *value;
+    check_hash_key("hash-table-update!/default", argv[0], argv[1]);
+    value = hash_table_get(argv[0]->ht, argv[1]);
+    if (value == NULL)
+        value = argv[3];
+    hash_table_put(argv[0]->ht, argv[1], single_value("primitive function `hash-table-update!/default`", apply(argv[2], 1, &value)));
+    return makeVoid();
+}
+
+Value *prim_hash_table_size(int argc, Value **argv) {
+    check_hash_table("hash-table-size", argv[0], 1);
+    return makeInt(argv[0]->ht->size);
+}
+
+/* Returns a new list of the keys, the values or the (key . value) pairs of
+ * the table, as part is 0, 1 or 2. */
+Value *hash_table_list(char *name, Value *table, int part) {
+    struct HashEntry *entry;
+    Value *list = makeNull();
+    long i;
+    check_hash_table(name, table, 1);
+    for (i = table->ht->capacity - 1; i >= 0; i--) {
+        entry = &table->ht->entries[i];
+        if (entry->key == NULL || entry->key == &TOMBSTONE)
+            continue;
+        if (part == 0)
+            list = cons(entry->key, list);
+        else if (part == 1)
+            list = cons(entry->value, list);
+        else
+            list = cons(cons(entry->key, entry->value), list);
+    }
+    return list;
+}
+
+Value *prim_hash_table_keys(int argc, Value **argv) {
+    return hash_table_list("hash-table-keys", argv[0], 0);
+}
+
+Value *prim_hash_table_values(int argc, Value **argv) {
+    return hash_table_list("hash-table-values", argv[0], 1);
+}
+
+Value *prim_hash_table_to_alist(int argc, Value **argv) {
+    return hash_table_list("hash-table->alist", argv[0], 2);
+}
+
+/* (hash-table-walk table proc) calls proc on each key and its value.  The
+ * entries are taken from a list made first, so that proc may change the
+ * table. */
+Value *prim_hash_table_walk(int argc, Value **argv) {
+    Value *current, *args[2];
+    for (current = hash_table_list("hash-table-walk", argv[0], 2); current->type == CONS_TYPE; current = cdr(current)) {
+        args[0] = car(car(current));
+        args[1] = cdr(car(current));
+        apply(argv[1], 2, args);
+    }
+    return makeVoid();
+}
+
+/* (hash-table-fold table kons knil) returns the result of calling kons on
+ * each key, its value and the result for the entries before it, starting
+ * from knil. */
+Value *prim_hash_table_fold(int argc, Value **argv) {
+    Value *current, *args[3];
+    args[2] = argv[2];
+    for (current = hash_table_list("hash-table-fold", argv[0], 2); current->type == CONS_TYPE; current = cdr(current)) {
+        args[0] = car(car(current));
+        args[1] = cdr(car(current));
+        args[2] = single_value("primitive function `hash-table-fold`", apply(argv[1], 3, args));
+    }
+    return args[2];
+}
+
+/* (hash-table-stats table) returns an association list of the number of
+ * entries, slots and deleted entries of the table, its load factor, and the
+ * mean and greatest number of slots probed to find an entry. */
+Value *prim_hash_table_stats(int argc, Value **argv) {
+    struct HashStats stats;
+    struct HashTable *table;
+    char *names[] = {"size", "capacity", "tombstones", "load-factor",
+        "average-probe", "max-probe"};
+    Value *values[6], *list = makeNull(), *name;
+    int i;
+    check_hash_table("hash-table-stats", argv[0], 1);
+    table = argv[0]->ht;
+    hash_table_stats(table, &stats);
+    values[0] = makeInt(table->size);
+    values[1] = makeInt(table->capacity);
+    values[2] = makeInt(table->tombstones);
+    values[3] = makeDouble(stats.load_factor);
+    values[4] = makeDouble(stats.average_probe);
+    values[5] = makeInt(stats.max_probe);
+    for (i = 5; i >= 0; i--) {
+        name = talloc(sizeof(Value));
+        name->type = SYMBOL_TYPE;
+        name->s = names[i];
+        list = cons(cons(name, values[i]), list);
+    }
+    return list;
+}
+
+
+////////////////////////////////////////
+/////// PERSISTENT COLLECTIONS /////////
+////////////////////////////////////////
+
+// Immutable maps, keyed under equal?, and vectors, which are updated by
+// making new ones sharing all but a few small nodes with the old, so that
+// functional code need not copy a whole collection to change it.  See
+// hamt.c and pvector.c.
+
+/* Returns a new PMAP_TYPE value of the given trie and size. */
+Value *make_pmap(struct HamtNode *root, long size) {
+    Value *map = talloc(sizeof(Value));
+    map->type = PMAP_TYPE;
+    map->pm.root = root;
+    map->pm.size = size;
+    return map;
+}
+
+/* Returns a new PVECTOR_TYPE value of the given vector. */
+Value *make_pvector(struct PVector *vector) {
+    Value *value = talloc(sizeof(Value));
+    value->type = PVECTOR_TYPE;
+    value->pv = vector;
+    return value;
+}
+
+/* Exits with an error unless the argument is of the given type, a pmap or a
+ * pvector. */
+void check_persistent(char *name, Value *value, valueType type, int position) {
+    if (value->type != type) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected %s): ", name, position, type == PMAP_TYPE ? "pmap" : "pvector");
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* (pmap key value ...) returns a new map of the keys to the values. */
+Value *prim_pmap(int argc, Value **argv) {
+    struct HamtNode *root = hamt_empty();
+    long size = 0;
+    int i;
+    if (argc % 2 != 0) {
+        fprintf(error_stream(), "Evaluation error: primitive function `pmap`: expected keys and values in pairs, received %d arguments\n", argc);
+        raise_error(4);
+    }
+    for (i = 0; i < argc; i += 2)
+        root = hamt_set(root, argv[i], argv[i + 1], &size);
+    return make_pmap(root, size);
+}
+
+Value *prim_pmap_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == PMAP_TYPE);
+}
+
+Value *prim_pmap_size(int argc, Value **argv) {
+    check_persistent("pmap-size", argv[0], PMAP_TYPE, 1);
+    return makeInt(argv[0]->pm.size);
+}
+
+/* (pmap-ref map key [failure]) returns the value of the key, or the result of
+ * calling the thunk failure if it has none. */
+Value *prim_pmap_ref(int argc, Value **argv) {
+    Value *value;
+    check_persistent("pmap-ref", argv[0], PMAP_TYPE, 1);
+    value = hamt_get(argv[0]->pm.root, argv[1]);
+    if (value != NULL)
+        return value;
+    if (argc == 3)
+        return apply(argv[2], 0, NULL);
+    missing_key_error("pmap-ref", argv[1]);
+    return NULL;
+}
+
+/* (pmap-ref/default map key default) */
+Value *prim_pmap_ref_default(int argc, Value **argv) {
+    Value *value;
+    check_persistent("pmap-ref/default", argv[0], PMAP_TYPE, 1);
+    value = hamt_get(argv[0]->pm.root, argv[1]);
+    return value != NULL ? value : argv[2];
+}
+
+Value *prim_pmap_contains(int argc, Value **argv) {
+    check_persistent("pmap-contains?", argv[0], PMAP_TYPE, 1);
+    return makeBool(hamt_get(argv[0]->pm.root, argv[1]) != NULL);
+}
+
+/* (pmap-set map key value) returns a new map like map but with the key bound
+ * to the value. */
+Value *prim_pmap_set(int argc, Value **argv) {
+    struct HamtNode *root;
+    long size;
+    check_persistent("pmap-set", argv[0], PMAP_TYPE, 1);
+    size = argv[0]->pm.size;
+    root = hamt_set(argv[0]->pm.root, argv[1], argv[2], &size);
+    return make_pmap(root, size);
+}
+
+/* (pmap-delete map key) returns a new map like map but without the key. */
+Value *prim_pmap_delete(int argc, Value **argv) {
+    long size;
+    struct HamtNode *root;
+    check_persistent("pmap-delete", argv[0], PMAP_TYPE, 1);
+    size = argv[0]->pm.size;
+    root = hamt_remove(argv[0]->pm.root, argv[1], &size);
+    return root == argv[0]->pm.root ? argv[0] : make_pmap(root, size);
+}
+
+Value *prim_pmap_to_alist(int argc, Value **argv) {
+    check_persistent("pmap->alist", argv[0], PMAP_TYPE, 1);
+    return hamt_to_alist(argv[0]->pm.root, makeNull());
+}
+
+/* (alist->pmap alist) returns a new map of the pairs of the association
+ * list, in which earlier keys take precedence, as for assoc. */
+Value *prim_alist_to_pmap(int argc, Value **argv) {
+    struct HamtNode *root = hamt_empty();
+    Value *current;
+    long size = 0;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current)) {
+        if (car(current)->type != CONS_TYPE)
+            vector_argument_error("alist->pmap", argv[0], 1);
+        if (hamt_get(root, car(car(current))) == NULL)
+            root = hamt_set(root, car(car(current)), cdr(car(current)), &size);
+    }
+    check_list_end("alist->pmap", current, 1);
+    return make_pmap(root, size);
+}
+
+/* (pmap-fold map kons knil) returns the result of calling kons on each key,
+ * its value and the result for the keys before it, starting from knil. */
+Value *prim_pmap_fold(int argc, Value **argv) {
+    Value *current, *args[3];
+    check_persistent("pmap-fold", argv[0], PMAP_TYPE, 1);
+    args[2] = argv[2];
+    for (current = hamt_to_alist(argv[0]->pm.root, makeNull()); current->type == CONS_TYPE; current = cdr(current)) {
+        args[0] = car(car(current));
+        args[1] = cdr(car(current));
+        args[2] = single_value("primitive function `pmap-fold`", apply(argv[1], 3, args));
+    }
+    return args[2];
+}
+
+/* (pvector x ...) */
+Value *prim_pvector(int argc, Value **argv) {
+    struct PVector *vector = pvector_empty();
+    int i;
+    for (i = 0; i < argc; i++)
+        vector = pvector_push(vector, argv[i]);
+    return make_pvector(vector);
+}
+
+Value *prim_pvector_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == PVECTOR_TYPE);
+}
+
+Value *prim_pvector_length(int argc, Value **argv) {
+    check_persistent("pvector-length", argv[0], PVECTOR_TYPE, 1);
+    return makeInt(argv[0]->pv->length);
+}
+
+/* Returns the index, exiting with an error unless it is a fixnum within the
+ * bounds of the persistent vector. */
+long check_pvector_index(char *name, Value *vector, Value *index, int position) {
+    if (index->type != INT_TYPE || index->i < 0 || index->i >= vector->pv->length) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: index out of range in position %d: ", name, position);
+        display_to_fd(index, error_stream());
+        raise_error(4);
+    }
+    return index->i;
+}
+
+/* (pvector-ref vector k) */
+Value *prim_pvector_ref(int argc, Value **argv) {
+    check_persistent("pvector-ref", argv[0], PVECTOR_TYPE, 1);
+    return pvector_ref(argv[0]->pv, check_pvector_index("pvector-ref", argv[0], argv[1], 2));
+}
+
+/* (pvector-set vector k x) returns a new vector like vector but with element
+ * k set to x. */
+Value *prim_pvector_set(int argc, Value **argv) {
+    check_persistent("pvector-set", argv[0], PVECTOR_TYPE, 1);
+    return make_pvector(pvector_set(argv[0]->pv, check_pvector_index("pvector-set", argv[0], argv[1], 2), argv[2]));
+}
+
+/* (pvector-push vector x) returns a new vector of the elements of vector
+ * followed by x. */
+Value *prim_pvector_push(int argc, Value **argv) {
+    check_persistent("pvector-push", argv[0], PVECTOR_TYPE, 1);
+    return make_pvector(pvector_push(argv[0]->pv, argv[1]));
+}
+
+/* (pvector-pop vector) returns a new vector of all but the last element of
+ * the nonempty vector. */
+Value *prim_pvector_pop(int argc, Value **argv) {
+    check_persistent("pvector-pop", argv[0], PVECTOR_TYPE, 1);
+    if (argv[0]->pv->length == 0) {
+        fprintf(error_stream(), "Evaluation error: primitive function `pvector-pop`: empty vector\n");
+        raise_error(4);
+    }
+    return make_pvector(pvector_pop(argv[0]->pv));
+}
+
+/* (pvector-append vector ...) returns a new vector of the elements of the
+ * vectors in turn, sharing the nodes of the first. */
+Value *prim_pvector_append(int argc, Value **argv) {
+    struct PVector *vector = pvector_empty();
+    long j;
+    int i;
+    for (i = 0; i < argc; i++) {
+        check_persistent("pvector-append", argv[i], PVECTOR_TYPE, i + 1);
+        if (i == 0) {
+            vector = argv[0]->pv;
+            continue;
+        }
+        for (j = 0; j < argv[i]->pv->length; j++)
+            vector = pvector_push(vector, pvector_ref(argv[i]->pv, j));
+    }
+    return make_pvector(vector);
+}
+
+Value *prim_pvector_to_list(int argc, Value **argv) {
+    Value *list = makeNull();
+    long i;
+    check_persistent("pvector->list", argv[0], PVECTOR_TYPE, 1);
+    for (i = argv[0]->pv->length - 1; i >= 0; i--)
+        list = cons(pvector_ref(argv[0]->pv, i), list);
+    return list;
+}
+
+Value *prim_list_to_pvector(int argc, Value **argv) {
+    struct PVector *vector = pvector_empty();
+    Value *current;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        vector = pvector_push(vector, car(current));
+    check_list_end("list->pvector", current, 1);
+    return make_pvector(vector);
+}
+
+
+////////////////////////////////////////
+/////////////// RECORDS ////////////////
+////////////////////////////////////////
+
+// R7RS define-record-type, as a derived form over the procedural layer of
+// SRFI 99: make-record-type, record-constructor, record-predicate,
+// record-accessor and record-modifier.  The procedures they return are
+// RECORD_PROCEDURE_TYPE values, which apply calls directly like primitives;
+// the index of an accessor's field is checked when the accessor is made,
+// so a call checks only the type of its argument before loading the field.
+
+/* Returns a new symbol of the given name, which is not copied. */
+Value *record_symbol(char *name) {
+    Value *symbol = talloc(sizeof(Value));
+    symbol->type = SYMBOL_TYPE;
+    symbol->s = name;
+    return symbol;
+}
+
+/* Returns 1 if the list is a proper list of symbols, otherwise 0. */
+int is_symbol_list(Value *list) {
+    for (; list->type == CONS_TYPE; list = cdr(list))
+        if (car(list)->type != SYMBOL_TYPE)
+            return 0;
+    return list->type == NULL_TYPE;
+}
+
+/* Returns the definitions for which
+ *     (define-record-type type (constructor field ...) predicate
+ *       (field accessor [modifier]) ...)
+ * stands: a begin defining the type with make-record-type and each
+ * procedure with the corresponding procedure of the type.  The constructor
+ * or predicate may be #f if it is not wanted.  Returns NULL if the form is
+ * malformed. */
+Value *expand_define_record_type(Value *args) {
+    Value *type, *constructor, *predicate, *spec, *fields = makeNull(), *body = makeNull(), *current;
+    Value *quote = record_symbol("quote"), *define = record_symbol("define");
+    if (length(args) < 3 || car(args)->type != SYMBOL_TYPE)
+        return NULL;
+    type = car(args);
+    constructor = car(cdr(args));
+    predicate = car(cdr(cdr(args)));
+    if (!(constructor->type == BOOL_TYPE && !constructor->i)
+            && (constructor->type != CONS_TYPE || !is_symbol_list(constructor)))
+        return NULL;
+    if (!(predicate->type == BOOL_TYPE && !predicate->i) && predicate->type != SYMBOL_TYPE)
+        return NULL;
+    for (current = cdr(cdr(cdr(args))); current->type == CONS_TYPE; current = cdr(current)) {
+        spec = car(current);
+        if (spec->type != CONS_TYPE || !is_symbol_list(spec) || length(spec) < 2 || length(spec) > 3)
+            return NULL;
+        fields = cons(car(spec), fields);
+        body = cons(list(3, define, car(cdr(spec)),
+                    list(3, record_symbol("record-accessor"), type, list(2, quote, car(spec)))), body);
+        if (cdr(cdr(spec))->type == CONS_TYPE)
+            body = cons(list(3, define, car(cdr(cdr(spec))),
+                        list(3, record_symbol("record-modifier"), type, list(2, quote, car(spec)))), body);
+    }
+    if (current->type != NULL_TYPE)
+        return NULL;
+    body = reverse(body);
+    if (predicate->type == SYMBOL_TYPE)
+        body = cons(list(3, define, predicate, list(2, record_symbol("record-predicate"), type)), body);
+    if (constructor->type == CONS_TYPE)
+        body = cons(list(3, define, car(constructor),
+                    list(3, record_symbol("record-constructor"), type, list(2, quote, cdr(constructor)))), body);
+    body = cons(list(3, define, type,
+                list(3, record_symbol("make-record-type"), list(2, quote, type), list(2, quote, reverse(fields)))), body);
+    return cons(record_symbol("begin"), body);
+}
+
+/* The optimizer expands define-record-type forms in the program ahead of
+ * time; this handles those produced by macros. */
+Value *eval_define_record_type(Value *args, Frame *frame) {
+    Value *expansion = expand_define_record_type(args);
+    if (expansion == NULL) {
+        fprintf(error_stream(), "Evaluation error: built-in function `define-record-type`: bad form in arguments: ");
+        error_display_tree("define-record-type", args);
+        raise_error(4);
+    }
+    return eval(expansion, frame);
+}
+
+/* Exits with an error unless the argument is a record type. */
+void check_record_type(char *name, Value *value) {
+    if (value->type != RECORD_DESCRIPTOR_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 1 (expected record type): ", name);
+        display_to_fd(value, error_stream());
+        raise_error(4);
+    }
+}
+
+/* Returns the index of the named field of the record type, exiting with an
+ * error if it has none. */
+int record_field_index(char *name, struct RecordType *type, Value *field) {
+    int i;
+    if (field->type == SYMBOL_TYPE)
+        for (i = 0; i < type->field_count; i++)
+            if (strcmp(type->field_names[i]->s, field->s) == 0)
+                return i;
+    fprintf(error_stream(), "Evaluation error: primitive function `%s`: record type %s has no field ", name, type->name);
+    display_to_fd(field, error_stream());
+    raise_error(4);
+    return -1;
+}
+
+/* Returns a new record procedure of the given kind. */
+Value *make_record_procedure(enum recordProcedureKind kind, struct RecordType *type, int index) {
+    Value *procedure = talloc(sizeof(Value));
+    procedure->type = RECORD_PROCEDURE_TYPE;
+    procedure->rp.kind = kind;
+    procedure->rp.type = type;
+    procedure->rp.index = index;
+    procedure->rp.arg_fields = NULL;
+    return procedure;
+}
+
+/* (make-record-type name fields) returns a new record type of the given name
+ * and list of field names.  A name written <name> is shown as name. */
+Value *prim_make_record_type(int argc, Value **argv) {
+    struct RecordType *type;
+    Value *value, *current;
+    long name_length;
+    int i;
+    if (argv[0]->type != SYMBOL_TYPE)
+        vector_argument_error("make-record-type", argv[0], 1);
+    if (!is_symbol_list(argv[1]))
+        vector_argument_error("make-record-type", argv[1], 2);
+    type = talloc(sizeof(struct RecordType));
+    name_length = strlen(argv[0]->s);
+    type->name = talloc(name_length + 1);
+    if (name_length > 2 && argv[0]->s[0] == '<' && argv[0]->s[name_length - 1] == '>') {
+        memcpy(type->name, argv[0]->s + 1, name_length - 2);
+        type->name[name_length - 2] = '\0';
+    } else {
+        strcpy(type->name, argv[0]->s);
+    }
+    type->field_count = length(argv[1]);
+    type->field_names = talloc(sizeof(Value *) * (type->field_count > 0 ? type->field_count : 1));
+    for (i = 0, current = argv[1]; i < type->field_count; i++, current = cdr(current)) {
+        type->field_names[i] = car(current);
+        if (record_field_index("make-record-type", type, car(current)) != i) {
+            fprintf(error_stream(), "Evaluation error: primitive function `make-record-type`: duplicate field %s\n", car(current)->s);
+            raise_error(4);
+        }
+    }
+    value = talloc(sizeof(Value));
+    value->type = RECORD_DESCRIPTOR_TYPE;
+    value->rtd = type;
+    return value;
+}
+
+/* (record-constructor type fields) returns a procedure taking the values of
+ * the listed fields, in order, and returning a new record whose other
+ * fields are unspecified. */
+Value *prim_record_constructor(int argc, Value **argv) {
+    Value *procedure, *current;
+    int i;
+    check_record_type("record-constructor", argv[0]);
+    if (!is_symbol_list(argv[1]))
+        vector_argument_error("record-constructor", argv[1], 2);
+    procedure = make_record_procedure(RECORD_CONSTRUCTOR, argv[0]->rtd, length(argv[1]));
+    procedure->rp.arg_fields = talloc(sizeof(int) * (procedure->rp.index > 0 ? procedure->rp.index : 1));
+    for (i = 0, current = argv[1]; i < procedure->rp.index; i++, current = cdr(current))
+        procedure->rp.arg_fields[i] = record_field_index("record-constructor", argv[0]->rtd, car(current));
+    return procedure;
+}
+
+Value *prim_record_predicate(int argc, Value **argv) {
+    check_record_type("record-predicate", argv[0]);
+    return make_record_procedure(RECORD_PREDICATE, argv[0]->rtd, 0);
+}
+
+/* (record-accessor type field) */
+Value *prim_record_accessor(int argc, Value **argv) {
+    check_record_type("record-accessor", argv[0]);
+    return make_record_procedure(RECORD_ACCESSOR, argv[0]->rtd,
+            record_field_index("record-accessor", argv[0]->rtd, argv[1]));
+}
+
+/* (record-modifier type field) */
+Value *prim_record_modifier(int argc, Value **argv) {
+    check_record_type("record-modifier", argv[0]);
+    return make_record_procedure(RECORD_MODIFIER, argv[0]->rtd,
+            record_field_index("record-modifier", argv[0]->rtd, argv[1]));
+}
+
+Value *prim_record_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == RECORD_TYPE);
+}
+
+/* Exits with an error reporting a call to a record procedure with the
+ * wrong number of arguments. */
+void record_arity_error(Value *procedure, int expected, int argc) {
+    fprintf(error_stream(), "Evaluation error: %s of record type %s: expected %d argument%s, received %d\n",
+            procedure->rp.kind == RECORD_CONSTRUCTOR ? "constructor" : procedure->rp.kind == RECORD_PREDICATE ? "predicate"
+            : procedure->rp.kind == RECORD_ACCESSOR ? "accessor" : "modifier",
+            procedure->rp.type->name, expected, expected == 1 ? "" : "s", argc);
+    raise_error(4);
+}
+
+/* Applies the record procedure to the argc arguments in argv. */
+Value *apply_record_procedure(Value *procedure, int argc, Value **argv) {
+    struct RecordType *type = procedure->rp.type;
+    Value *record, *unspecified;
+    int i;
+    switch (procedure->rp.kind) {
+        case RECORD_CONSTRUCTOR:
+            if (argc != procedure->rp.index)
+                record_arity_error(procedure, procedure->rp.index, argc);
+            record = talloc(sizeof(Value));
+            record->type = RECORD_TYPE;
+            record->rec = talloc(sizeof(struct Record) + sizeof(Value *) * type->field_count);
+            record->rec->type = type;
+            if (argc < type->field_count) {
+                unspecified = makeUnspecified();
+                for (i = 0; i < type->field_count; i++)
+                    record->rec->fields[i] = unspecified;
+            }
+            for (i = 0; i < argc; i++)
+                record->rec->fields[procedure->rp.arg_fields[i]] = argv[i];
+            return record;
+        case RECORD_PREDICATE:
+            if (argc != 1)
+                record_arity_error(procedure, 1, argc);
+            return makeBool(argv[0]->type == RECORD_TYPE && argv[0]->rec->type == type);
+        default:
+            if (argc != (procedure->rp.kind == RECORD_ACCESSOR ? 1 : 2))
+                record_arity_error(procedure, procedure->rp.kind == RECORD_ACCESSOR ? 1 : 2, argc);
+            if (argv[0]->type != RECORD_TYPE || argv[0]->rec->type != type) {
+                fprintf(error_stream(), "Evaluation error: %s of field %s of record type %s: wrong type argument in position 1: ",
+                        procedure->rp.kind == RECORD_ACCESSOR ? "accessor" : "modifier",
+                        type->field_names[procedure->rp.index]->s, type->name);
+                display_to_fd(argv[0], error_stream());
+                raise_error(4);
+            }
+            if (procedure->rp.kind == RECORD_ACCESSOR)
+                return argv[0]->rec->fields[procedure->rp.index];
+            argv[0]->rec->fields[procedure->rp.index] = argv[1];
+            return makeVoid();
+    }
+}
+
+
+////////////////////////////////////////
+///////////// MEMOIZATION //////////////
+////////////////////////////////////////
+
+// (memoize procedure [limit]) returns a MEMO_TYPE procedure which caches the
+// result of each call of the procedure in a hash table keyed on the list of
+// its arguments under equal?, so that a recursion defined with
+// define-memoized computes each subproblem once.  Given a limit, the least
+// recently used entry is dropped once there are more.  The arguments are
+// not copied: a list or vector changed after a call is hashed as it was.
+
+/* Moves the entry to the newest end of the order of use. */
+void memo_touch(struct Memo *memo, struct MemoEntry *entry) {
+    if (memo->newest == entry)
+        return;
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else if (memo->oldest == entry)
+        memo->oldest = entry->newer;
+    entry->older = memo->newest;
+    entry->newer = NULL;
+    if (memo->newest != NULL)
+        memo->newest->newer = entry;
+    memo->newest = entry;
+    if (memo->oldest == NULL)
+        memo->oldest = entry;
+}
+
+/* Stores the result for the arguments as the newest entry, dropping the
+ * oldest if that takes the cache over its limit. */
+void memo_store(struct Memo *memo, Value *arguments, Value *result) {
+    struct MemoEntry *entry = talloc(sizeof(struct MemoEntry));
+    Value *handle = talloc(sizeof(Value));
+    entry->arguments = arguments;
+    entry->result = result;
+    entry->newer = NULL;
+    entry->older = NULL;
+    memo_touch(memo, entry);
+    handle->type = PTR_TYPE;
+    handle->p = entry;
+    hash_table_put(memo->table, arguments, handle);
+    if (memo->limit > 0 && memo->table->size > memo->limit) {
+        entry = memo->oldest;
+        memo->oldest = entry->newer;
+        memo->oldest->older = NULL;
+        hash_table_remove(memo->table, entry->arguments);
     }
-    value = car(args);
-    if (value->type != CONS_TYPE) {
-        fprintf(stderr, "Evaluation error: primitive function `cdr`: wrong type argument in position 1 (expected CONS_TYPE): ");
-        display_to_fd(value, stderr);
-        texit(4);
+}
+
+Value *apply_memo(Value *procedure, int argc, Value **argv) {
+    struct Memo *memo = procedure->memo;
+    struct MemoEntry *entry;
+    Value *arguments = array_to_list(argc, argv, makeNull()), *handle, *result;
+    handle = hash_table_get(memo->table, arguments);
+    if (handle != NULL) {
+        entry = handle->p;
+        memo->hits++;
+        memo_touch(memo, entry);
+        return entry->result;
+    }
+    memo->misses++;
+    result = single_value("memoized procedure", apply(memo->procedure, argc, argv));
+    // A recursive call may have stored a result for the same arguments
+    handle = hash_table_get(memo->table, arguments);
+    if (handle != NULL) {
+        entry = handle->p;
+        entry->result = result;
+        memo_touch(memo, entry);
+    } else {
+        memo_store(memo, arguments, result);
     }
-    return cdr(value);
+    return result;
 }
 
-Value *prim_cons(Value *args) {
-    int argc = length(args);
-    if (argc != 2) {
-        fprintf(stderr, "Evaluation error: primitive function `cons`: expected 2 arguments, received %d\n", argc);
-        texit(4);
+/* (memoize procedure [limit]) */
+Value *prim_memoize(int argc, Value **argv) {
+    Value *procedure;
+    struct Memo *memo;
+    switch (argv[0]->type) {
+        case CLOSURE_TYPE:
+        case PRIMITIVE_TYPE:
+        case CONTINUATION_TYPE:
+        case RECORD_PROCEDURE_TYPE:
+        case MEMO_TYPE:
+            break;
+        default:
+            vector_argument_error("memoize", argv[0], 1);
     }
-    return cons(car(args), car(cdr(args)));
+    if (argc == 2 && (argv[1]->type != INT_TYPE || argv[1]->i <= 0))
+        vector_argument_error("memoize", argv[1], 2);
+    memo = talloc(sizeof(struct Memo));
+    memo->procedure = argv[0];
+    memo->table = hash_table_new(HASH_ARGUMENTS, 0);
+    memo->limit = argc == 2 ? argv[1]->i : 0;
+    memo->hits = 0;
+    memo->misses = 0;
+    memo->newest = NULL;
+    memo->oldest = NULL;
+    procedure = talloc(sizeof(Value));
+    procedure->type = MEMO_TYPE;
+    procedure->memo = memo;
+    return procedure;
 }
 
-Value *prim_list(Value *args) {
-    return args;
+/* (memoize-stats procedure) returns an alist of the hits and misses of the
+ * memoized procedure, the number of results it holds, and its limit, or #f
+ * if it has none. */
+Value *prim_memoize_stats(int argc, Value **argv) {
+    struct Memo *memo;
+    char *names[] = {"hits", "misses", "size", "limit"};
+    Value *values[4], *list = makeNull(), *name;
+    int i;
+    if (argv[0]->type != MEMO_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `memoize-stats`: wrong type argument in position 1 (expected memoized procedure): ");
+        display_to_fd(argv[0], error_stream());
+        raise_error(4);
+    }
+    memo = argv[0]->memo;
+    values[0] = makeInt(memo->hits);
+    values[1] = makeInt(memo->misses);
+    values[2] = makeInt(memo->table->size);
+    values[3] = memo->limit > 0 ? makeInt(memo->limit) : makeBool(0);
+    for (i = 3; i >= 0; i--) {
+        name = talloc(sizeof(Value));
+        name->type = SYMBOL_TYPE;
+        name->s = names[i];
+        list = cons(cons(name, values[i]), list);
+    }
+    return list;
 }
 
-Value *prim_append(Value *args) {
-    Value head, *tail, *current, *current_list = NULL;
-    int arg_num = 1;
-    head.c.cdr = NULL;
-    tail = &head;
-    current = args;
-    while (current->type == CONS_TYPE) {
-        current_list = car(current);
-        while (current_list->type == CONS_TYPE) {
-            tail->c.cdr = cons(car(current_list), NULL);
-            tail = tail->c.cdr;
-            current_list = cdr(current_list);
+/* Returns the definition for which
+ *     (define-memoized (name formal ...) body ...)
+ * stands, (define name (memoize (lambda (formal ...) body ...))), or NULL if
+ * the form is malformed. */
+Value *expand_define_memoized(Value *args) {
+    if (args->type != CONS_TYPE || car(args)->type != CONS_TYPE || car(car(args))->type != SYMBOL_TYPE
+            || cdr(args)->type != CONS_TYPE)
+        return NULL;
+    return list(3, record_symbol("define"), car(car(args)),
+            list(2, record_symbol("memoize"),
+                cons(record_symbol("lambda"), cons(cdr(car(args)), cdr(args)))));
+}
+
+/* The optimizer expands define-memoized forms in the program ahead of time;
+ * this handles those produced by macros. */
+Value *eval_define_memoized(Value *args, Frame *frame) {
+    Value *expansion = expand_define_memoized(args);
+    if (expansion == NULL) {
+        fprintf(error_stream(), "Evaluation error: built-in function `define-memoized`: bad form in arguments: ");
+        error_display_tree("define-memoized", args);
+        raise_error(4);
+    }
+    return eval(expansion, frame);
+}
+
+
+////////////////////////////////////////
+/////////// LAZY EVALUATION ////////////
+////////////////////////////////////////
+
+// Promises as in R7RS, with the iterative forcing of SRFI 45: a promise made
+// by delay-force stands for the promise its expression returns, so force
+// takes that promise's state as its own and carries on in a loop rather than
+// forcing it recursively, and a chain of delay-forces of any length runs in
+// constant stack.  A promise drops its expression once done.
+//
+// Streams are SRFI 41's: a stream is a promise of either the empty list or
+// a pair of a promise of its first element and the stream of the rest.
+// stream-map, stream-filter and stream-take are native promises, whose step
+// is called in place of evaluating an expression, so stream-filter skips
+// any run of rejected elements in a loop.
+
+/* Returns a new promise whose state is done with the value. */
+Value *make_done_promise(Value *value) {
+    Value *promise = talloc(sizeof(Value));
+    promise->type = PROMISE_TYPE;
+    promise->promise = talloc(sizeof(struct Promise));
+    promise->promise->done = 1;
+    promise->promise->lazy = 0;
+    promise->promise->value = value;
+    promise->promise->frame = NULL;
+    promise->promise->step = NULL;
+    return promise;
+}
+
+/* Returns a new promise of the value of the expression in the frame, or if
+ * lazy, of the value of the promise it returns. */
+Value *make_delayed_promise(Value *expr, Frame *frame, int lazy) {
+    Value *promise = make_done_promise(expr);
+    promise->promise->done = 0;
+    promise->promise->lazy = lazy;
+    promise->promise->frame = frame;
+    return promise;
+}
+
+/* Returns a new promise of the value of the promise step returns given the
+ * state. */
+Value *make_native_promise(Value *(*step)(Value *), Value *state) {
+    Value *promise = make_done_promise(state);
+    promise->promise->done = 0;
+    promise->promise->lazy = 1;
+    promise->promise->step = step;
+    return promise;
+}
+
+/* Returns the value of the promise, forcing it if it is not yet done. */
+Value *force_promise(Value *promise) {
+    struct Promise *state;
+    Value *result;
+    while (!promise->promise->done) {
+        state = promise->promise;
+        result = state->step != NULL ? state->step(state->value) : eval(state->value, state->frame);
+        result = single_value("built-in function `force`", result);
+        // Forcing the promise from its own expression may have finished it
+        if (state->done)
+            break;
+        if (!state->lazy) {
+            state->done = 1;
+            state->value = result;
+            state->frame = NULL;
+            break;
         }
-        if (current_list->type != NULL_TYPE && cdr(current)->type != NULL_TYPE) {
-            fprintf(stderr, "Evaluation error: primitive function `append`: wrong type argument in position %d: ", arg_num);
-            display_to_fd(current_list, stderr);
-            texit(4);
+        if (result->type != PROMISE_TYPE) {
+            fprintf(error_stream(), "Evaluation error: built-in function `delay-force`: expression did not return a promise: ");
+            display_to_fd(result, error_stream());
+            raise_error(4);
         }
-        current = cdr(current);
-        arg_num++;
+        *state = *result->promise;
+        result->promise = state;
     }
-    tail->c.cdr = current_list ? current_list : makeNull();
-    return  head.c.cdr;
+    return promise->promise->value;
 }
 
-int equal_helper(Value *first, Value *second) {
-    int equal = -1;
-    if (first->type != second->type)
-        return 0;
-    switch (first->type) {
-        case INT_TYPE:
-        case BOOL_TYPE:
-            return (first->i == second->i);
-        case DOUBLE_TYPE:
-            return (first->d == second->d);
-        case STR_TYPE:
-        case SYMBOL_TYPE:
-            return !strcmp(first->s, second->s);
-        case CONS_TYPE:
-            equal = 1;
-            while (first->type == CONS_TYPE && second->type == CONS_TYPE) {
-                equal &= equal_helper(car(first), car(second));
-                if (!equal)
-                    return equal;
-                first = cdr(first);
-                second = cdr(second);
-            }
-            return equal_helper(first, second); // first/second should usually be NULL_TYPE
-        case NULL_TYPE:
-            return 1;
-        case CLOSURE_TYPE:
-            equal = 1;
-            equal &= equal_helper(first->cl.paramNames, second->cl.paramNames);
-            equal &= equal_helper(first->cl.functionCode, second->cl.functionCode);
-            equal &= (first->cl.frame == second->cl.frame);
-            return equal;
-        case PRIMITIVE_TYPE:
-            return (first->pf == second->pf);
-        default:
-            fprintf(stderr, "Evaluation error: primitive function `equal?`: unexpected value of type %d\n", first->type);
-            texit(4);
+/* (delay expr) and (delay-force expr) */
+Value *eval_delay(Value *args, Frame *frame, int lazy) {
+    if (length(args) != 1) {
+        fprintf(error_stream(), "Evaluation error: built-in function `%s`: bad form in arguments: ", lazy ? "delay-force" : "delay");
+        error_display_tree(lazy ? "delay-force" : "delay", args);
+        raise_error(4);
     }
-    return equal;
+    return make_delayed_promise(car(args), frame, lazy);
 }
 
-Value *prim_equal(Value *args) {
-    int argc = length(args);
-    if (argc != 2) {
-        fprintf(stderr, "Evaluation error: built-in function `equal?`: expected 2 arguments, received %d\n", argc);
-        texit(4);
+/* (stream-cons expr stream-expr) returns a stream whose first element is
+ * the value of expr and whose rest is the value of stream-expr, neither of
+ * which is evaluated until it is needed. */
+Value *eval_stream_cons(Value *args, Frame *frame) {
+    if (length(args) != 2) {
+        fprintf(error_stream(), "Evaluation error: built-in function `stream-cons`: bad form in arguments: ");
+        error_display_tree("stream-cons", args);
+        raise_error(4);
+    }
+    return make_done_promise(cons(make_delayed_promise(car(args), frame, 0),
+                make_delayed_promise(car(cdr(args)), frame, 1)));
+}
+
+Value *prim_force(int argc, Value **argv) {
+    return argv[0]->type == PROMISE_TYPE ? force_promise(argv[0]) : argv[0];
+}
+
+Value *prim_make_promise(int argc, Value **argv) {
+    return argv[0]->type == PROMISE_TYPE ? argv[0] : make_done_promise(argv[0]);
+}
+
+Value *prim_promise_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == PROMISE_TYPE);
+}
+
+/* Returns the forced value of the stream, the empty list or a pair,
+ * exiting with an error if it is not a stream. */
+Value *force_stream(char *name, Value *stream, int position) {
+    Value *value;
+    if (stream->type == PROMISE_TYPE) {
+        value = force_promise(stream);
+        if (value->type == NULL_TYPE || value->type == CONS_TYPE)
+            return value;
+    }
+    fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position %d (expected stream): ", name, position);
+    display_to_fd(stream, error_stream());
+    raise_error(4);
+    return NULL;
+}
+
+/* Returns the forced value of the stream, exiting with an error unless it
+ * is a pair. */
+Value *force_stream_pair(char *name, Value *stream) {
+    Value *value = force_stream(name, stream, 1);
+    if (value->type != CONS_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: empty stream\n", name);
+        raise_error(4);
+    }
+    return value;
+}
+
+Value *prim_stream_null_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == PROMISE_TYPE && force_promise(argv[0])->type == NULL_TYPE);
+}
+
+Value *prim_stream_pair_p(int argc, Value **argv) {
+    return makeBool(argv[0]->type == PROMISE_TYPE && force_promise(argv[0])->type == CONS_TYPE);
+}
+
+Value *prim_stream_car(int argc, Value **argv) {
+    return force_promise(car(force_stream_pair("stream-car", argv[0])));
+}
+
+Value *prim_stream_cdr(int argc, Value **argv) {
+    return cdr(force_stream_pair("stream-cdr", argv[0]));
+}
+
+/* The step of (stream-map proc stream ...), whose state is the list of proc
+ * and the streams. */
+Value *stream_map_step(Value *state) {
+    Value **argv, *rests = makeNull(), *current, *value;
+    int argc = length(cdr(state)), i = 0;
+    argv = talloc(sizeof(Value *) * argc);
+    for (current = cdr(state); current->type == CONS_TYPE; current = cdr(current)) {
+        value = force_stream("stream-map", car(current), i + 2);
+        if (value->type == NULL_TYPE)
+            return make_done_promise(makeNull());
+        argv[i++] = force_promise(car(value));
+        rests = cons(cdr(value), rests);
+    }
+    value = single_value("primitive function `stream-map`", apply(car(state), argc, argv));
+    return make_done_promise(cons(make_done_promise(value),
+                make_native_promise(stream_map_step, cons(car(state), reverse(rests)))));
+}
+
+/* The step of (stream-filter pred stream), whose state is the pair of pred
+ * and the stream. */
+Value *stream_filter_step(Value *state) {
+    Value *stream = cdr(state), *value, *element;
+    while ((value = force_stream("stream-filter", stream, 2))->type == CONS_TYPE) {
+        element = force_promise(car(value));
+        if (apply_predicate("stream-filter", car(state), element))
+            return make_done_promise(cons(car(value),
+                        make_native_promise(stream_filter_step, cons(car(state), cdr(value)))));
+        stream = cdr(value);
+    }
+    return make_done_promise(makeNull());
+}
+
+/* The step of (stream-take n stream), whose state is the pair of n and the
+ * stream. */
+Value *stream_take_step(Value *state) {
+    Value *value;
+    if (car(state)->i == 0)
+        return make_done_promise(makeNull());
+    value = force_stream("stream-take", cdr(state), 2);
+    if (value->type == NULL_TYPE)
+        return make_done_promise(makeNull());
+    return make_done_promise(cons(car(value),
+                make_native_promise(stream_take_step, cons(makeInt(car(state)->i - 1), cdr(value)))));
+}
+
+/* (stream-map proc stream ...) */
+Value *prim_stream_map(int argc, Value **argv) {
+    return make_native_promise(stream_map_step, array_to_list(argc, argv, makeNull()));
+}
+
+/* (stream-filter pred stream) */
+Value *prim_stream_filter(int argc, Value **argv) {
+    return make_native_promise(stream_filter_step, cons(argv[0], argv[1]));
+}
+
+/* (stream-take n stream) */
+Value *prim_stream_take(int argc, Value **argv) {
+    if (argv[0]->type != INT_TYPE || argv[0]->i < 0)
+        vector_argument_error("stream-take", argv[0], 1);
+    return make_native_promise(stream_take_step, cons(argv[0], argv[1]));
+}
+
+/* (stream->list [n] stream) returns the list of the elements of the
+ * stream, or of at most the first n of them. */
+Value *prim_stream_to_list(int argc, Value **argv) {
+    Value *stream = argv[argc - 1], *list = makeNull(), *value;
+    long n = -1;
+    if (argc == 2) {
+        if (argv[0]->type != INT_TYPE || argv[0]->i < 0)
+            vector_argument_error("stream->list", argv[0], 1);
+        n = argv[0]->i;
+    }
+    for (; n != 0; n--) {
+        value = force_stream("stream->list", stream, argc);
+        if (value->type == NULL_TYPE)
+            break;
+        list = cons(force_promise(car(value)), list);
+        stream = cdr(value);
+    }
+    return reverse(list);
+}
+
+/* (list->stream list) */
+Value *prim_list_to_stream(int argc, Value **argv) {
+    Value *stream = make_done_promise(makeNull()), *reversed = makeNull(), *current;
+    for (current = argv[0]; current->type == CONS_TYPE; current = cdr(current))
+        reversed = cons(car(current), reversed);
+    check_list_end("list->stream", current, 1);
+    for (; reversed->type == CONS_TYPE; reversed = cdr(reversed))
+        stream = make_done_promise(cons(make_done_promise(car(reversed)), stream));
+    return stream;
+}
+
+
+////////////////////////////////////////
+/////////// MULTIPLE VALUES ////////////
+////////////////////////////////////////
+
+// (values v ...) with other than one argument stores its arguments in a
+// fixed-size buffer and returns MULTIPLE_VALUES, which the forms receiving
+// values recognize and read the buffer back for.  Passing a few values
+// therefore allocates nothing; only more than VALUES_BUFFER_SIZE values are
+// copied to the heap.  The buffer is per thread, and is overwritten by the
+// next values call, so receivers copy the values out before evaluating
+// anything else.
+
+#define VALUES_BUFFER_SIZE 16
+
+Value MULTIPLE_VALUES = {.type = VALUES_TYPE};
+_Thread_local Value *VALUES_BUFFER[VALUES_BUFFER_SIZE];
+_Thread_local Value **VALUES_OVERFLOW = NULL;
+_Thread_local int VALUES_COUNT = 0;
+
+Value *prim_values(int argc, Value **argv) {
+    int i;
+    if (argc == 1)
+        return argv[0];
+    VALUES_OVERFLOW = NULL;
+    if (argc > VALUES_BUFFER_SIZE)
+        VALUES_OVERFLOW = talloc(sizeof(Value *) * argc);
+    for (i = 0; i < argc; i++)
+        (VALUES_OVERFLOW != NULL ? VALUES_OVERFLOW : VALUES_BUFFER)[i] = argv[i];
+    VALUES_COUNT = argc;
+    return &MULTIPLE_VALUES;
+}
+
+/* Returns the result of an expression whose value is stored or passed on,
+ * raising an error if it is other than one value. */
+Value *single_value(char *context, Value *result) {
+    if (result != &MULTIPLE_VALUES)
+        return result;
+    fprintf(error_stream(), "Evaluation error: %s: expected 1 value, but received %d\n", context, VALUES_COUNT);
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+/* Returns the number of values in the result of an expression. */
+int values_count(Value *result) {
+    return result == &MULTIPLE_VALUES ? VALUES_COUNT : 1;
+}
+
+/* Copies the values in the result of an expression into argv, which must
+ * have room for values_count(result) of them. */
+void values_copy(Value *result, Value **argv) {
+    int i;
+    if (result != &MULTIPLE_VALUES) {
+        argv[0] = result;
+        return;
+    }
+    for (i = 0; i < VALUES_COUNT; i++)
+        argv[i] = (VALUES_OVERFLOW != NULL ? VALUES_OVERFLOW : VALUES_BUFFER)[i];
+}
+
+/* Displays each value in the result of a top-level form, other than void. */
+void display_values(Value *result) {
+    int i, count = values_count(result);
+    Value *values[count + 1];
+    values_copy(result, values);
+    for (i = 0; i < count; i++)
+        if (values[i]->type != VOID_TYPE)
+            display(values[i]);
+}
+
+/* (call-with-values producer consumer) calls consumer on the values returned
+ * by calling producer with no arguments. */
+Value *prim_call_with_values(int argc, Value **argv) {
+    Value *result = apply(argv[0], 0, NULL);
+    int count = values_count(result);
+    Value *values[count + 1];
+    values_copy(result, values);
+    return apply(argv[1], count, values);
+}
+
+/* Returns 1 if formals is a list of symbols, possibly improper, or a lone
+ * symbol. */
+int formals_ok(Value *formals) {
+    while (formals->type == CONS_TYPE) {
+        if (car(formals)->type != SYMBOL_TYPE)
+            return 0;
+        formals = cdr(formals);
+    }
+    return formals->type == SYMBOL_TYPE || formals->type == NULL_TYPE;
+}
+
+/* Binds formals, as checked by formals_ok, to the argc values in argv in the
+ * given frame; a symbol ending the formals is bound to a list of the values
+ * left over.  Returns 0 if the number of values does not fit the formals. */
+int bind_formals(Value *formals, int argc, Value **argv, Frame *frame) {
+    int i = 0;
+    while (formals->type == CONS_TYPE) {
+        if (i == argc)
+            return 0;
+        frame->bindings = cons(cons(car(formals), argv[i]), frame->bindings);
+        formals = cdr(formals);
+        i++;
+    }
+    if (formals->type == SYMBOL_TYPE) {
+        frame->bindings = cons(cons(formals, array_to_list(argc - i, argv + i, makeNull())), frame->bindings);
+        return 1;
+    }
+    return i == argc;
+}
+
+/* Evaluates the expression and binds formals to its values in the frame,
+ * evaluating the expression itself in expr_frame. */
+void receive_values(char *name, Value *formals, Value *expr, Frame *expr_frame, Frame *frame) {
+    Value *result = eval(expr, expr_frame);
+    int count = values_count(result);
+    Value *values[count + 1];
+    values_copy(result, values);
+    if (!bind_formals(formals, count, values, frame)) {
+        fprintf(error_stream(), "Evaluation error: built-in function `%s`: received %d values for formals: ", name, count);
+        display_to_fd(formals, error_stream());
+        raise_error(4);
+    }
+}
+
+/* (let-values ((formals expr) ...) body ...) binds each formals to the values
+ * of its expr, all evaluated in the enclosing environment; with star set,
+ * as let*-values, each expr sees the bindings before it. */
+Value *eval_let_values(Value *args, Frame *frame, int star) {
+    Value *current, *binding;
+    Frame *new_frame;
+    char *name = star ? "let*-values" : "let-values";
+    if (length(args) < 2)
+        goto LET_VALUES_BAD_FORM;
+    new_frame = talloc(sizeof(Frame));
+    new_frame->bindings = makeNull();
+    new_frame->parent = frame;
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current)) {
+        binding = car(current);
+        if (binding->type != CONS_TYPE || length(binding) != 2 || !formals_ok(car(binding)))
+            goto LET_VALUES_BAD_FORM;
+        receive_values(name, car(binding), car(cdr(binding)), star ? new_frame : frame, new_frame);
+    }
+    if (current->type != NULL_TYPE)
+        goto LET_VALUES_BAD_FORM;
+    return eval_begin(cdr(args), new_frame);
+LET_VALUES_BAD_FORM:
+    fprintf(error_stream(), "Evaluation error: built-in function `%s`: bad form in arguments: ", name);
+    error_display_tree(name, args);
+    raise_error(4);
+    return NULL;    // will never return
+}
+
+/* (receive formals expr body ...) binds formals to the values of expr. */
+Value *eval_receive(Value *args, Frame *frame) {
+    Frame *new_frame;
+    if (length(args) < 3 || !formals_ok(car(args))) {
+        fprintf(error_stream(), "Evaluation error: built-in function `receive`: bad form in arguments: ");
+        error_display_tree("receive", args);
+        raise_error(4);
+    }
+    new_frame = talloc(sizeof(Frame));
+    new_frame->bindings = makeNull();
+    new_frame->parent = frame;
+    receive_values("receive", car(args), car(cdr(args)), frame, new_frame);
+    return eval_begin(cdr(cdr(args)), new_frame);
+}
+
+
+////////////////////////////////////////
+//////////// CONTINUATIONS /////////////
+////////////////////////////////////////
+
+// A continuation holds a jmp_buf set by the call/cc which created it.  Until
+// that call/cc returns, invoking the continuation is an escape: it longjmps
+// straight back, unwinding eval and apply at no further cost.  call/ec makes
+// only such escape continuations.  call/cc also copies the C stack between
+// its frame and interpret's, so that its continuation can be re-entered after
+// it has returned: the stack is first extended past the copied region, the
+// copy is written back over it, and the longjmp proceeds as before.  This
+// assumes a stack growing towards lower addresses.  The optimizer turns
+// call/cc into call/ec wherever the continuation cannot outlive the call, so
+// the copy is only made where it may be needed.
+
+struct Continuation {
+    jmp_buf env;
+    int active;                 // 1 until its call/cc has returned
+    struct Continuation *outer; // the next enclosing active continuation
+    char *stack_low;            // start of the copied stack, NULL for call/ec
+    char *stack;
+    size_t stack_size;
+    Value *result;
+    struct ErrorHandler *handlers;  // ERROR_HANDLERS when it was created
+};
+
+// The end of the stack copied by call/cc, set by interpret.
+char *STACK_BASE = NULL;
+
+// Innermost active continuation, linked through outer.
+struct Continuation *ACTIVE_CONTINUATIONS = NULL;
+
+// The continuation being resumed.  The stack cannot be relied upon while it
+// is being overwritten.
+struct Continuation *RESUMING = NULL;
+
+/* Copies the stack above the frame of this function, which includes the
+ * frame of its caller, up to STACK_BASE. */
+__attribute__((noinline)) void continuation_save_stack(struct Continuation *k) {
+    k->stack_low = __builtin_frame_address(0);
+    k->stack_size = STACK_BASE - k->stack_low;
+    k->stack = talloc(k->stack_size);
+    memcpy(k->stack, k->stack_low, k->stack_size);
+}
+
+/* Writes the stack copied for RESUMING back in place and jumps to it. */
+__attribute__((noinline)) void continuation_restore_stack() {
+    char *here = __builtin_frame_address(0);
+    volatile char *below;
+    // Keep this frame, and memcpy's, clear of the region being written
+    if (here > RESUMING->stack_low - 1024) {
+        below = alloca(here - RESUMING->stack_low + 1024);
+        below[0] = 0;
+    }
+    memcpy(RESUMING->stack_low, RESUMING->stack, RESUMING->stack_size);
+    longjmp(RESUMING->env, 1);
+}
+
+/* Returns from the call/cc or call/ec which created the continuation with
+ * the given values. */
+void continuation_throw(struct Continuation *k, int argc, Value **argv) {
+    struct Continuation *current;
+    k->result = prim_values(argc, argv);
+    RESUMING = k;
+    if (k->active) {
+        // Every continuation created inside k's call is unwound
+        for (current = ACTIVE_CONTINUATIONS; current != k; current = current->outer)
+            current->active = 0;
+        longjmp(k->env, 1);
+    }
+    if (k->stack_low == NULL) {
+        fprintf(error_stream(), "Evaluation error: escape continuation called after its call/ec returned\n");
+        raise_error(4);
+    }
+    // The restored stack is inside the calls of the continuations which were
+    // active when k was created
+    for (current = ACTIVE_CONTINUATIONS; current != NULL; current = current->outer)
+        current->active = 0;
+    for (current = k->outer; current != NULL; current = current->outer)
+        current->active = 1;
+    continuation_restore_stack();
+}
+
+/* Calls f with a continuation returning from this call.  With full set the
+ * continuation can also be re-entered after this call has returned. */
+Value *call_with_continuation(Value *f, int full) {
+    struct Continuation *k = talloc(sizeof(struct Continuation));
+    Value *k_val = talloc(sizeof(Value)), *result;
+    k_val->type = CONTINUATION_TYPE;
+    k_val->k = k;
+    k->stack_low = NULL;
+    k->outer = ACTIVE_CONTINUATIONS;
+    k->active = 1;
+    k->handlers = ERROR_HANDLERS;
+    ACTIVE_CONTINUATIONS = k;
+    if (setjmp(k->env) != 0) {
+        k = RESUMING;
+        ACTIVE_CONTINUATIONS = k->outer;
+        ERROR_HANDLERS = k->handlers;
+        k->active = 0;
+        return k->result;
+    }
+    if (full) {
+        CONTINUATION_CAPTURES++;
+        continuation_save_stack(k);
+    }
+    result = apply(f, 1, &k_val);
+    ACTIVE_CONTINUATIONS = k->outer;
+    k->active = 0;
+    return result;
+}
+
+Value *prim_call_cc(int argc, Value **argv) {
+    return call_with_continuation(argv[0], 1);
+}
+
+Value *prim_call_ec(int argc, Value **argv) {
+    return call_with_continuation(argv[0], 0);
+}
+
+/* Returns a PRIMITIVE_TYPE value for call/ec. */
+Value *escape_primitive() {
+    return makePrimitive("call/ec", prim_call_ec, 1, 1);
+}
+
+
+////////////////////////////////////////
+//////////////// ERRORS ////////////////
+////////////////////////////////////////
+
+// Errors are raised through the chain of catch points and handlers of
+// error.c.  A catch point is pushed by guard and around each top-level form,
+// and a handler by with-exception-handler; both live in the C frame of the
+// form which pushed them, and so are popped by any continuation escaping it.
+
+/* Pops the catch point to which control has just returned, and deactivates
+ * the continuations created since it was pushed. */
+void catch_unwind(struct ErrorHandler *handler) {
+    struct Continuation *current;
+    ERROR_HANDLERS = handler->outer;
+    for (current = ACTIVE_CONTINUATIONS; current != NULL && current != handler->continuations;
+            current = current->outer)
+        current->active = 0;
+    ACTIVE_CONTINUATIONS = handler->continuations;
+}
+
+/* (guard (var clause ...) body ...) evaluates body.  If it raises a value,
+ * binds var to it and evaluates the clauses as those of a cond, in the
+ * environment of the guard form; if none applies, the value is raised again
+ * from there. */
+__attribute__((noinline)) Value *eval_guard(Value *args, Frame *frame) {
+    struct ErrorHandler handler;
+    Value *result;
+    Frame *new_frame;
+    if (length(args) < 2 || car(args)->type != CONS_TYPE || car(car(args))->type != SYMBOL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: built-in function `guard`: bad form in arguments: ");
+        error_display_tree("guard", args);
+        raise_error(4);
+    }
+    handler.procedure = NULL;
+    handler.continuations = ACTIVE_CONTINUATIONS;
+    handler.outer = ERROR_HANDLERS;
+    if (setjmp(handler.env) == 0) {
+        ERROR_HANDLERS = &handler;
+        result = eval_begin(cdr(args), frame);
+        ERROR_HANDLERS = handler.outer;
+        return result;
+    }
+    catch_unwind(&handler);
+    new_frame = talloc(sizeof(Frame));
+    new_frame->bindings = cons(cons(car(car(args)), handler.condition), makeNull());
+    new_frame->parent = frame;
+    result = cond_clauses(cdr(car(args)), new_frame, "guard");
+    if (result == NULL)
+        return raise_condition(handler.condition, 1);
+    return result;
+}
+
+/* (with-exception-handler handler thunk) calls thunk with handler installed
+ * as the current exception handler. */
+Value *prim_with_exception_handler(int argc, Value **argv) {
+    struct ErrorHandler handler;
+    Value *result;
+    handler.procedure = argv[0];
+    handler.continuations = ACTIVE_CONTINUATIONS;
+    handler.outer = ERROR_HANDLERS;
+    ERROR_HANDLERS = &handler;
+    result = apply(argv[1], 0, NULL);
+    ERROR_HANDLERS = handler.outer;
+    return result;
+}
+
+Value *prim_error(int argc, Value **argv) {
+    if (argv[0]->type != STR_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `error`: wrong type argument in position 1 (expected STR_TYPE): ");
+        display_to_fd(argv[0], error_stream());
+        raise_error(4);
+    }
+    return raise_condition(makeError(argv[0], array_to_list(argc - 1, argv + 1, makeNull()), 0), 0);
+}
+
+Value *prim_raise(int argc, Value **argv) {
+    return raise_condition(argv[0], 0);
+}
+
+Value *prim_raise_continuable(int argc, Value **argv) {
+    return raise_condition(argv[0], 1);
+}
+
+Value *prim_error_object(int argc, Value **argv) {
+    return makeBool(argv[0]->type == ERROR_TYPE);
+}
+
+/* Checks that the argument of the named accessor is an error object. */
+void check_error_object(char *name, Value *value) {
+    if (value->type != ERROR_TYPE) {
+        fprintf(error_stream(), "Evaluation error: primitive function `%s`: wrong type argument in position 1 (expected ERROR_TYPE): ", name);
+        display_to_fd(value, error_stream());
+        raise_error(4);
     }
-    return makeBool(equal_helper(car(args), car(cdr(args))));
+}
+
+Value *prim_error_object_message(int argc, Value **argv) {
+    check_error_object("error-object-message", argv[0]);
+    return argv[0]->err.message;
+}
+
+Value *prim_error_object_irritants(int argc, Value **argv) {
+    check_error_object("error-object-irritants", argv[0]);
+    return argv[0]->err.irritants;
 }
 
 
@@ -919,85 +5349,107 @@ Value *prim_equal(Value *args) {
 ///////// EVALUATION FUNCTIONS /////////
 ////////////////////////////////////////
 
-Value *apply(Value *function, Value *args) {
-    Value *result, *curr_param, *curr_arg;
+/* Applies the function to the argc arguments in argv.  The number of
+ * arguments to a primitive is checked here against its arity, and the
+ * arguments to a closure are bound directly from the array. */
+Value *apply(Value *function, int argc, Value **argv) {
+    Value *result, *curr_arg;
     Frame *new_frame;
     if (function->type == PRIMITIVE_TYPE) {
-        return function->pf(args);
+        if (argc < function->pr.min_args || (function->pr.max_args >= 0 && argc > function->pr.max_args))
+            goto APPLY_WRONG_NUMBER_ARGS_PRIMITIVE;
+        return function->pr.pf(argc, argv);
+    } else if (function->type == RECORD_PROCEDURE_TYPE) {
+        return apply_record_procedure(function, argc, argv);
+    } else if (function->type == MEMO_TYPE) {
+        return apply_memo(function, argc, argv);
+    } else if (function->type == CONTINUATION_TYPE) {
+        continuation_throw(function->k, argc, argv);
     } else if (function->type != CLOSURE_TYPE) {
-        fprintf(stderr, "Evaluation error: wrong type to apply: expected type %d (CLOSURE_TYPE), received type %d\n", CLOSURE_TYPE, function->type);
-        texit(4);
+        fprintf(error_stream(), "Evaluation error: wrong type to apply: expected type %d (CLOSURE_TYPE), received type %d\n", CLOSURE_TYPE, function->type);
+        raise_error(4);
     }
     new_frame = talloc(sizeof(Frame));
     new_frame->bindings = makeNull();
     new_frame->parent = function->cl.frame;
-    curr_param = function->cl.paramNames;
-    curr_arg = args;
-    if (curr_param->type == SYMBOL_TYPE) {
-        new_frame->bindings = cons(cons(curr_param, curr_arg), new_frame->bindings);
-    } else {
-        while (curr_param->type == CONS_TYPE) {
-            if (curr_arg->type != CONS_TYPE) {
-                goto APPLY_WRONG_NUMBER_ARGS;
-            }
-            // lambda assures that parameters list is well-formed
-            new_frame->bindings = cons(cons(car(curr_param), car(curr_arg)), new_frame->bindings);
-            curr_param = cdr(curr_param);
-            curr_arg = cdr(curr_arg);
-        }
-        if (curr_arg->type != NULL_TYPE)
-            goto APPLY_WRONG_NUMBER_ARGS;
-    }
-    curr_arg = function->cl.functionCode;  // reuse curr_arg, now for body code
+    // lambda assures that parameters list is well-formed
+    if (!bind_formals(function->cl.paramNames, argc, argv, new_frame))
+        goto APPLY_WRONG_NUMBER_ARGS;
+    curr_arg = function->cl.functionCode;
     while (curr_arg->type == CONS_TYPE) {
         result = eval(car(curr_arg), new_frame);
         curr_arg = cdr(curr_arg);
     }
     // lambda assures that body code is a list with at least one element
     return result;
+APPLY_WRONG_NUMBER_ARGS_PRIMITIVE:
+    fprintf(error_stream(), "Evaluation error: primitive function `%s`: ", function->pr.name);
+    if (function->pr.min_args == function->pr.max_args)
+        fprintf(error_stream(), "expected %d argument%s", function->pr.min_args, function->pr.min_args == 1 ? "" : "s");
+    else if (function->pr.max_args < 0)
+        fprintf(error_stream(), "expected at least %d argument%s", function->pr.min_args, function->pr.min_args == 1 ? "" : "s");
+    else
+        fprintf(error_stream(), "expected %d to %d arguments", function->pr.min_args, function->pr.max_args);
+    fprintf(error_stream(), ", received %d\n", argc);
+    raise_error(4);
 APPLY_WRONG_NUMBER_ARGS:
-    fprintf(stderr, "Evaluation error: possibly wrong number of arguments to apply\n");
-    fprintf(stderr, "Expected: ");
-    display_to_fd(function->cl.paramNames, stderr);
-    fprintf(stderr, "Received: ");
-    display_to_fd(args, stderr);
-    texit(4);
+    fprintf(error_stream(), "Evaluation error: possibly wrong number of arguments to apply\n");
+    fprintf(error_stream(), "Expected: ");
+    display_to_fd(function->cl.paramNames, error_stream());
+    fprintf(error_stream(), "Received: ");
+    display_to_fd(array_to_list(argc, argv, makeNull()), error_stream());
+    raise_error(4);
     return NULL;    // will never return
 }
 
-void bind_primitive(char *name, Value *(*function)(Value *), Frame *frame){
-    Value *name_val, *func_val;
+/* Applies the function to the values in the list args. */
+Value *apply_list(Value *function, Value *args) {
+    Value *argv[length(args) + 1];
+    int argc = 0;
+    for (; args->type == CONS_TYPE; args = cdr(args))
+        argv[argc++] = car(args);
+    return apply(function, argc, argv);
+}
+
+/* Binds the name to the value among the builtins, returning the symbol of
+ * the name. */
+Value *bind_value(char *name, Value *value) {
+    Value *name_val, **slot = primitive_slot(name);
+    static int count = 0;
+    if (*slot == NULL && ++count == PRIMITIVE_TABLE_SIZE) {
+        fprintf(stderr, "Evaluation error: too many primitives for PRIMITIVE_TABLE_SIZE\n");
+        texit(4);
+    }
     name_val = talloc(sizeof(Value));
     name_val->type = SYMBOL_TYPE;
-    name_val->s = talloc(sizeof(name));
+    name_val->s = talloc(strlen(name) + 1);
     strcpy(name_val->s, name);
-    func_val = talloc(sizeof(Value));
-    func_val->type = PRIMITIVE_TYPE;
-    func_val->pf = function;
-    frame->bindings = cons(cons(name_val, func_val), frame->bindings);
+    *slot = cons(name_val, value);
+    return name_val;
 }
 
-Value *eval_all(Value *exprs, Frame *frame) {
-    Value *current, *tail, head;
-    switch (exprs->type) {
-        case CONS_TYPE:
-            break;
-        case NULL_TYPE:
-            return exprs;
-        default:
-            fprintf(stderr, "Evaluation error: expected CONS_TYPE or NULL_TYPE in eval_all, received type %d\n", exprs->type);
-            texit(4);
-    }
-    head.c.cdr = NULL;
-    tail = &head;
-    current = exprs;
-    while (current->type != NULL_TYPE) {
-        tail->c.cdr = cons(eval(car(current), frame), NULL);
-        tail = tail->c.cdr;
-        current = cdr(current);
+void bind_primitive(char *name, Value *(*function)(int, Value **), int min_args, int max_args) {
+    Value *name_val = bind_value(name, NULL);
+    (*primitive_slot(name))->c.cdr = makePrimitive(name_val->s, function, min_args, max_args);
+}
+
+/* Evaluates the argument expressions of a call from left to right into an
+ * array on the stack and applies the function to them, so no argument list
+ * is allocated. */
+Value *eval_call(Value *function, Value *exprs, Frame *frame) {
+    Value *current;
+    int argc = 0, i;
+    for (current = exprs; current->type == CONS_TYPE; current = cdr(current))
+        argc++;
+    if (current->type != NULL_TYPE) {
+        fprintf(error_stream(), "Evaluation error: bad form in arguments of call: ");
+        display_to_fd(exprs, error_stream());
+        raise_error(4);
     }
-    tail->c.cdr = current;
-    return head.c.cdr;
+    Value *argv[argc + 1];
+    for (i = 0, current = exprs; i < argc; i++, current = cdr(current))
+        argv[i] = single_value("procedure call", eval(car(current), frame));
+    return apply(function, argc, argv);
 }
 
 Value *eval(Value *expr, Frame *frame) {
@@ -1005,24 +5457,28 @@ Value *eval(Value *expr, Frame *frame) {
     switch (expr->type) {
         case INT_TYPE:
         case DOUBLE_TYPE:
+        case BIGNUM_TYPE:
         case STR_TYPE:
         case PTR_TYPE:
         case BOOL_TYPE:
+        case VECTOR_TYPE:
             return expr;
         case CONS_TYPE:
             first = car(expr);
             args = cdr(expr);
             switch (first->type) {
                 case CONS_TYPE:
-                    return apply(eval(first, frame), eval_all(args, frame));
+                    return eval_call(eval(first, frame), args, frame);
                 case SYMBOL_TYPE:
                     result = lookup_symbol(first, frame);
+                    if (result != NULL && result->type == MACRO_TYPE)
+                        return eval(expand_macro(expr, result), frame);
                     if (result != NULL)
-                        return apply(eval(result, frame), eval_all(args, frame));
+                        return eval_call(eval(result, frame), args, frame);
                     break;
                 default:
                     // should be CLOSURE_TYPE; if not, apply will catch it
-                    return apply(eval(first, frame), eval_all(args, frame));
+                    return eval_call(eval(first, frame), args, frame);
             }
             // Here, first was SYMBOL_TYPE and was not found by lookup_symbol
             switch (first->s[0]) {
@@ -1037,18 +5493,34 @@ Value *eval(Value *expr, Frame *frame) {
                 case 'c':
                     if (strcmp(first->s, "cond") == 0)
                         return eval_cond(args, frame);
+                    else if (strcmp(first->s, "case") == 0)
+                        return eval_case(args, frame);
                     break;
                 case 'd':
                     if (strcmp(first->s, "display") == 0)
                         return eval_display(args, frame);
                     else if (strcmp(first->s, "define") == 0)
                         return eval_define(args, frame);
+                    else if (strcmp(first->s, "define-syntax") == 0)
+                        return eval_define_syntax(args, frame);
+                    else if (strcmp(first->s, "define-record-type") == 0)
+                        return eval_define_record_type(args, frame);
+                    else if (strcmp(first->s, "define-memoized") == 0)
+                        return eval_define_memoized(args, frame);
+                    else if (strcmp(first->s, "delay") == 0)
+                        return eval_delay(args, frame, 0);
+                    else if (strcmp(first->s, "delay-force") == 0)
+                        return eval_delay(args, frame, 1);
+                    else if (strcmp(first->s, "do") == 0)
+                        return eval_do(args, frame);
                     break;
                 case 'e':
                     break;
                 case 'f':
                     break;
                 case 'g':
+                    if (strcmp(first->s, "guard") == 0)
+                        return eval_guard(args, frame);
                     break;
                 case 'h':
                     break;
@@ -1071,6 +5543,10 @@ Value *eval(Value *expr, Frame *frame) {
                         return eval_letrec_star(args, frame);
                     else if (strcmp(first->s, "lambda") == 0)
                         return eval_lambda(args, frame);
+                    else if (strcmp(first->s, "let-values") == 0)
+                        return eval_let_values(args, frame, 0);
+                    else if (strcmp(first->s, "let*-values") == 0)
+                        return eval_let_values(args, frame, 1);
                     break;
                 case 'm':
                     break;
@@ -1089,10 +5565,14 @@ Value *eval(Value *expr, Frame *frame) {
                         return eval_quote(args, frame);
                     break;
                 case 'r':
+                    if (strcmp(first->s, "receive") == 0)
+                        return eval_receive(args, frame);
                     break;
                 case 's':
                     if (strcmp(first->s, "set!") == 0)
                         return eval_set(args, frame);
+                    else if (strcmp(first->s, "stream-cons") == 0)
+                        return eval_stream_cons(args, frame);
                     break;
                 case 't':
                     break;
@@ -1115,56 +5595,247 @@ Value *eval(Value *expr, Frame *frame) {
                 default:
                     break;
             }
-            fprintf(stderr, "Evaluation error: unrecognized function: %s\n", first->s);
-            texit(4);
+            fprintf(error_stream(), "Evaluation error: unrecognized function: %s\n", first->s);
+            raise_error(4);
             break;
         case SYMBOL_TYPE:
             result = lookup_symbol(expr, frame);
             if (result == NULL) {
-                fprintf(stderr, "Evaluation error: unknown symbol: %s\n", expr->s);
-                texit(4);
+                fprintf(error_stream(), "Evaluation error: unknown symbol: %s\n", expr->s);
+                raise_error(4);
+            }
+            if (result->type == MACRO_TYPE) {
+                fprintf(error_stream(), "Evaluation error: syntax keyword used as a variable: %s\n", expr->s);
+                raise_error(4);
             }
             return result;
         case CLOSURE_TYPE:
         case PRIMITIVE_TYPE:
+        case CONTINUATION_TYPE:
+        case RECORD_PROCEDURE_TYPE:
+        case MEMO_TYPE:
+        case PROMISE_TYPE:
         case UNSPECIFIED_TYPE:
+        case ERROR_TYPE:
             return expr;
         default:
-            fprintf(stderr, "Evaluation error: unexpected value of type %d\n", expr->type);
-            texit(4);
+            fprintf(error_stream(), "Evaluation error: unexpected value of type %d\n", expr->type);
+            raise_error(4);
     }
     return result;  // should always return before this
 }
 
-void interpret(Value *tree) {
+// Exit status of the last top-level form to raise an uncaught error.  Not a
+// local of interpret, which a re-entered continuation would restore.
+int INTERPRET_STATUS = 0;
+
+int interpret(Value *tree) {
     Value *result, *current = tree;
+    struct ErrorHandler handler;
     Frame frame;
     Value null_value;
+    STACK_BASE = __builtin_frame_address(0);
     null_value.type = NULL_TYPE;
     frame.bindings = &null_value;
     frame.parent = NULL;
-    bind_primitive("car", prim_car, &frame);
-    bind_primitive("cdr", prim_cdr, &frame);
-    bind_primitive("cons", prim_cons, &frame);
-    bind_primitive("+", prim_add, &frame);
-    bind_primitive("-", prim_sub, &frame);
-    bind_primitive("*", prim_mul, &frame);
-    bind_primitive("/", prim_div, &frame);
-    bind_primitive("modulo", prim_mod, &frame);
-    bind_primitive("=", prim_eqnum, &frame);
-    bind_primitive(">", prim_gt, &frame);
-    bind_primitive("<", prim_lt, &frame);
-    bind_primitive(">=", prim_geq, &frame);
-    bind_primitive("<=", prim_leq, &frame);
-    bind_primitive("null?", prim_null, &frame);
-    bind_primitive("list", prim_list, &frame);
-    bind_primitive("append", prim_append, &frame);
-    bind_primitive("equal?", prim_equal, &frame);
+    bind_primitive("car", prim_car, 1, 1);
+    bind_primitive("cdr", prim_cdr, 1, 1);
+    bind_primitive("cons", prim_cons, 2, 2);
+    bind_primitive("set-car!", prim_set_car, 2, 2);
+    bind_primitive("set-cdr!", prim_set_cdr, 2, 2);
+    bind_primitive("+", prim_add, 0, -1);
+    bind_primitive("-", prim_sub, 1, -1);
+    bind_primitive("*", prim_mul, 0, -1);
+    bind_primitive("/", prim_div, 2, 2);
+    bind_primitive("modulo", prim_mod, 2, 2);
+    bind_primitive("quotient", prim_quotient, 2, 2);
+    bind_primitive("remainder", prim_remainder, 2, 2);
+    bind_primitive("expt", prim_expt, 2, 2);
+    bind_primitive("=", prim_eqnum, 0, -1);
+    bind_primitive(">", prim_gt, 0, -1);
+    bind_primitive("<", prim_lt, 0, -1);
+    bind_primitive(">=", prim_geq, 0, -1);
+    bind_primitive("<=", prim_leq, 0, -1);
+    bind_primitive("null?", prim_null, 1, 1);
+    bind_primitive("list", prim_list, 0, -1);
+    bind_primitive("append", prim_append, 0, -1);
+    bind_primitive("equal?", prim_equal, 2, 2);
+    bind_primitive("eqv?", prim_eqv, 2, 2);
+    bind_primitive("eq?", prim_eqv, 2, 2);
+    bind_primitive("string=?", prim_string_eq, 1, -1);
+    bind_primitive("number?", prim_number, 1, 1);
+    bind_primitive("integer?", prim_integer, 1, 1);
+    bind_primitive("exact-integer?", prim_exact_integer, 1, 1);
+    bind_primitive("flonum?", prim_flonum, 1, 1);
+    bind_primitive("current-jiffy", prim_current_jiffy, 0, 0);
+    bind_primitive("jiffies-per-second", prim_jiffies_per_second, 0, 0);
+    bind_primitive("map", prim_map, 2, -1);
+    bind_primitive("filter", prim_filter, 2, 2);
+    bind_primitive("fold", prim_fold, 3, -1);
+    bind_primitive("for-each", prim_for_each, 2, -1);
+    bind_primitive("length", prim_length, 1, 1);
+    bind_primitive("reverse", prim_reverse, 1, 1);
+    bind_primitive("list-tail", prim_list_tail, 2, 2);
+    bind_primitive("list-ref", prim_list_ref, 2, 2);
+    bind_primitive("memq", prim_memv, 2, 2);
+    bind_primitive("memv", prim_memv, 2, 2);
+    bind_primitive("member", prim_member, 2, 3);
+    bind_primitive("assq", prim_assv, 2, 2);
+    bind_primitive("assv", prim_assv, 2, 2);
+    bind_primitive("assoc", prim_assoc, 2, 3);
+    bind_primitive("sort", prim_sort, 2, 2);
+    bind_primitive("sort!", prim_sort_bang, 2, 2);
+    bind_primitive("list-sort", prim_list_sort, 2, 2);
+    bind_primitive("vector-sort", prim_vector_sort, 2, 2);
+    bind_primitive("values", prim_values, 0, -1);
+    bind_primitive("call-with-values", prim_call_with_values, 2, 2);
+    bind_primitive("call-with-current-continuation", prim_call_cc, 1, 1);
+    bind_primitive("call/cc", prim_call_cc, 1, 1);
+    bind_primitive("call-with-escape-continuation", prim_call_ec, 1, 1);
+    bind_primitive("call/ec", prim_call_ec, 1, 1);
+    bind_primitive("with-exception-handler", prim_with_exception_handler, 2, 2);
+    bind_primitive("error", prim_error, 1, -1);
+    bind_primitive("raise", prim_raise, 1, 1);
+    bind_primitive("raise-continuable", prim_raise_continuable, 1, 1);
+    bind_primitive("error-object?", prim_error_object, 1, 1);
+    bind_primitive("error-object-message", prim_error_object_message, 1, 1);
+    bind_primitive("error-object-irritants", prim_error_object_irritants, 1, 1);
+    bind_primitive("make-f64vector", prim_make_f64vector, 1, 2);
+    bind_primitive("f64vector", prim_f64vector, 0, -1);
+    bind_primitive("f64vector?", prim_f64vector_p, 1, 1);
+    bind_primitive("f64vector-length", prim_f64vector_length, 1, 1);
+    bind_primitive("f64vector-ref", prim_f64vector_ref, 2, 2);
+    bind_primitive("f64vector-set!", prim_f64vector_set, 3, 3);
+    bind_primitive("f64vector->list", prim_f64vector_to_list, 1, 1);
+    bind_primitive("list->f64vector", prim_list_to_f64vector, 1, 1);
+    bind_primitive("f64vector-add", prim_f64vector_add, 2, 2);
+    bind_primitive("f64vector-mul", prim_f64vector_mul, 2, 2);
+    bind_primitive("f64vector-scale", prim_f64vector_scale, 2, 2);
+    bind_primitive("f64vector-dot", prim_f64vector_dot, 2, 2);
+    bind_primitive("f64vector-sum", prim_f64vector_sum, 1, 1);
+    bind_primitive("f64vector-min", prim_f64vector_min, 1, 1);
+    bind_primitive("f64vector-max", prim_f64vector_max, 1, 1);
+    bind_primitive("f64vector-map", prim_f64vector_map, 2, -1);
+    bind_primitive("make-s64vector", prim_make_s64vector, 1, 2);
+    bind_primitive("s64vector", prim_s64vector, 0, -1);
+    bind_primitive("s64vector?", prim_s64vector_p, 1, 1);
+    bind_primitive("s64vector-length", prim_s64vector_length, 1, 1);
+    bind_primitive("s64vector-ref", prim_s64vector_ref, 2, 2);
+    bind_primitive("s64vector-set!", prim_s64vector_set, 3, 3);
+    bind_primitive("s64vector->list", prim_s64vector_to_list, 1, 1);
+    bind_primitive("list->s64vector", prim_list_to_s64vector, 1, 1);
+    bind_primitive("s64vector-add", prim_s64vector_add, 2, 2);
+    bind_primitive("s64vector-mul", prim_s64vector_mul, 2, 2);
+    bind_primitive("s64vector-scale", prim_s64vector_scale, 2, 2);
+    bind_primitive("s64vector-dot", prim_s64vector_dot, 2, 2);
+    bind_primitive("s64vector-sum", prim_s64vector_sum, 1, 1);
+    bind_primitive("s64vector-min", prim_s64vector_min, 1, 1);
+    bind_primitive("s64vector-max", prim_s64vector_max, 1, 1);
+    bind_primitive("s64vector-map", prim_s64vector_map, 2, -1);
+    bind_primitive("make-vector", prim_make_vector, 1, 2);
+    bind_primitive("vector", prim_vector, 0, -1);
+    bind_primitive("vector?", prim_vector_p, 1, 1);
+    bind_primitive("vector-length", prim_vector_length, 1, 1);
+    bind_primitive("vector-ref", prim_vector_ref, 2, 2);
+    bind_primitive("vector-set!", prim_vector_set, 3, 3);
+    bind_primitive("vector->list", prim_vector_to_list, 1, 3);
+    bind_primitive("list->vector", prim_list_to_vector, 1, 1);
+    bind_primitive("vector-fill!", prim_vector_fill, 2, 4);
+    bind_primitive("string?", prim_string_p, 1, 1);
+    bind_primitive("string-length", prim_string_length, 1, 1);
+    bind_primitive("substring", prim_substring, 2, 3);
+    bind_primitive("string-append", prim_string_append, 0, -1);
+    bind_primitive("string-search", prim_string_search, 2, 3);
+    bind_primitive("string-split", prim_string_split, 2, 2);
+    bind_primitive("string->number", prim_string_to_number, 1, 1);
+    bind_primitive("number->string", prim_number_to_string, 1, 1);
+    bind_primitive("make-hash-table", prim_make_hash_table, 0, 2);
+    bind_primitive("hash-table?", prim_hash_table_p, 1, 1);
+    bind_primitive("hash-table-ref", prim_hash_table_ref, 2, 3);
+    bind_primitive("hash-table-ref/default", prim_hash_table_ref_default, 3, 3);
+    bind_primitive("hash-table-set!", prim_hash_table_set, 3, 3);
+    bind_primitive("hash-table-delete!", prim_hash_table_delete, 2, 2);
+    bind_primitive("hash-table-contains?", prim_hash_table_contains, 2, 2);
+    bind_primitive("hash-table-update!", prim_hash_table_update, 3, 4);
+    bind_primitive("hash-table-update!/default", prim_hash_table_update_default, 4, 4);
+    bind_primitive("hash-table-size", prim_hash_table_size, 1, 1);
+    bind_primitive("hash-table-keys", prim_hash_table_keys, 1, 1);
+    bind_primitive("hash-table-values", prim_hash_table_values, 1, 1);
+    bind_primitive("hash-table->alist", prim_hash_table_to_alist, 1, 1);
+    bind_primitive("hash-table-walk", prim_hash_table_walk, 2, 2);
+    bind_primitive("hash-table-fold", prim_hash_table_fold, 3, 3);
+    bind_primitive("hash-table-stats", prim_hash_table_stats, 1, 1);
+    bind_primitive("memoize", prim_memoize, 1, 2);
+    bind_primitive("memoize-stats", prim_memoize_stats, 1, 1);
+    bind_primitive("force", prim_force, 1, 1);
+    bind_primitive("make-promise", prim_make_promise, 1, 1);
+    bind_primitive("promise?", prim_promise_p, 1, 1);
+    bind_primitive("stream?", prim_promise_p, 1, 1);
+    bind_primitive("stream-null?", prim_stream_null_p, 1, 1);
+    bind_primitive("stream-pair?", prim_stream_pair_p, 1, 1);
+    bind_primitive("stream-car", prim_stream_car, 1, 1);
+    bind_primitive("stream-cdr", prim_stream_cdr, 1, 1);
+    bind_primitive("stream-map", prim_stream_map, 2, -1);
+    bind_primitive("stream-filter", prim_stream_filter, 2, 2);
+    bind_primitive("stream-take", prim_stream_take, 2, 2);
+    bind_primitive("stream->list", prim_stream_to_list, 1, 2);
+    bind_primitive("list->stream", prim_list_to_stream, 1, 1);
+    bind_value("stream-null", make_done_promise(makeNull()));
+    bind_primitive("pmap", prim_pmap, 0, -1);
+    bind_primitive("pmap?", prim_pmap_p, 1, 1);
+    bind_primitive("pmap-size", prim_pmap_size, 1, 1);
+    bind_primitive("pmap-ref", prim_pmap_ref, 2, 3);
+    bind_primitive("pmap-ref/default", prim_pmap_ref_default, 3, 3);
+    bind_primitive("pmap-contains?", prim_pmap_contains, 2, 2);
+    bind_primitive("pmap-set", prim_pmap_set, 3, 3);
+    bind_primitive("pmap-delete", prim_pmap_delete, 2, 2);
+    bind_primitive("pmap->alist", prim_pmap_to_alist, 1, 1);
+    bind_primitive("alist->pmap", prim_alist_to_pmap, 1, 1);
+    bind_primitive("pmap-fold", prim_pmap_fold, 3, 3);
+    bind_primitive("pvector", prim_pvector, 0, -1);
+    bind_primitive("pvector?", prim_pvector_p, 1, 1);
+    bind_primitive("pvector-length", prim_pvector_length, 1, 1);
+    bind_primitive("pvector-ref", prim_pvector_ref, 2, 2);
+    bind_primitive("pvector-set", prim_pvector_set, 3, 3);
+    bind_primitive("pvector-push", prim_pvector_push, 2, 2);
+    bind_primitive("pvector-pop", prim_pvector_pop, 1, 1);
+    bind_primitive("pvector-append", prim_pvector_append, 0, -1);
+    bind_primitive("pvector->list", prim_pvector_to_list, 1, 1);
+    bind_primitive("list->pvector", prim_list_to_pvector, 1, 1);
+    bind_primitive("make-record-type", prim_make_record_type, 2, 2);
+    bind_primitive("record-constructor", prim_record_constructor, 2, 2);
+    bind_primitive("record-predicate", prim_record_predicate, 1, 1);
+    bind_primitive("record-accessor", prim_record_accessor, 2, 2);
+    bind_primitive("record-modifier", prim_record_modifier, 2, 2);
+    bind_primitive("record?", prim_record_p, 1, 1);
+    bind_primitive("make-matrix", prim_make_matrix, 2, 3);
+    bind_primitive("list->matrix", prim_list_to_matrix, 1, 1);
+    bind_primitive("matrix->list", prim_matrix_to_list, 1, 1);
+    bind_primitive("matrix?", prim_matrix_p, 1, 1);
+    bind_primitive("matrix-rows", prim_matrix_rows, 1, 1);
+    bind_primitive("matrix-cols", prim_matrix_cols, 1, 1);
+    bind_primitive("matrix-ref", prim_matrix_ref, 3, 3);
+    bind_primitive("matrix-set!", prim_matrix_set, 4, 4);
+    bind_primitive("matrix-transpose", prim_matrix_transpose, 1, 1);
+    bind_primitive("matrix-multiply", prim_matrix_multiply, 2, 2);
+    INTERPRET_STATUS = 0;
+    handler.procedure = NULL;
     while (current->type == CONS_TYPE) {
-        result = eval(car(current), &frame);
-        if (result->type != VOID_TYPE)
-            display(result);
+        // An error in one top-level form is reported, and the next one runs
+        handler.continuations = ACTIVE_CONTINUATIONS;
+        handler.outer = ERROR_HANDLERS;
+        if (setjmp(handler.env) == 0) {
+            ERROR_HANDLERS = &handler;
+            result = eval(car(current), &frame);
+            display_values(result);
+            ERROR_HANDLERS = handler.outer;
+        } else {
+            catch_unwind(&handler);
+            report_condition(handler.condition, stderr);
+            INTERPRET_STATUS = condition_status(handler.condition);
+        }
         current = cdr(current);
     }
+    return INTERPRET_STATUS;
 }
 
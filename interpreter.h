@@ -1,8 +1,44 @@
 #ifndef _INTERPRETER
 #define _INTERPRETER
 
-void interpret(Value *tree);
+/* Evaluates each top-level form of the tree in turn, displaying its value.
+ * A form raising an uncaught error is reported on stderr and evaluation
+ * continues with the next form.  Returns 0 if no form did so, otherwise the
+ * exit status of the last error. */
+int interpret(Value *tree);
 Value *eval(Value *expr, Frame *frame);
 
+/* Returns 1 if the values are the same under eqv?, otherwise 0. */
+int eqv_helper(Value *first, Value *second);
+
+/* Returns 1 if the values are the same under equal?, otherwise 0. */
+int equal_helper(Value *first, Value *second);
+
+/* Applies the function to the argc arguments in argv. */
+Value *apply(Value *function, int argc, Value **argv);
+
+/* Returns the begin form of definitions for which a define-record-type form
+ * with the given arguments stands, or NULL if it is malformed. */
+Value *expand_define_record_type(Value *args);
+
+/* Returns the definition for which a define-memoized form with the given
+ * arguments stands, or NULL if it is malformed. */
+Value *expand_define_memoized(Value *args);
+
+/* Returns a PRIMITIVE_TYPE value computing the two-argument form of the named
+ * arithmetic or comparison primitive on arguments which are both of the given
+ * type, without checking them.  Returns NULL if there is no such primitive. */
+Value *unchecked_primitive(char *name, valueType type);
+
+/* Returns a PRIMITIVE_TYPE value running a fused pipeline of single-list map,
+ * filter and fold stages over a list without building intermediate lists,
+ * and stores the maximum number of stages it supports in max_stages.  See
+ * prim_pipeline for its arguments. */
+Value *pipeline_primitive(int *max_stages);
+
+/* Returns a PRIMITIVE_TYPE value for call/ec, which the optimizer substitutes
+ * for call/cc where the continuation cannot be used after the call returns. */
+Value *escape_primitive();
+
 #endif
 
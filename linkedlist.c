@@ -4,6 +4,11 @@
 #include <stdarg.h>
 #include "linkedlist.h"
 #include "talloc.h"
+#include "error.h"
+#include "bignum.h"
+#include "hamt.h"
+#include "pvector.h"
+#include "strlib.h"
 
 
 /* Create a new NULL_TYPE value node. */
@@ -20,11 +25,41 @@ Value *makeVoid() {
     return new;
 }
 
-/* Create a new BOOL_TYPE value node. */
+// The two BOOL_TYPE value nodes, shared by every caller of makeBool.
+Value TRUE_VALUE = {.type = BOOL_TYPE, .i = 1};
+Value FALSE_VALUE = {.type = BOOL_TYPE, .i = 0};
+
+/* Returns the BOOL_TYPE value node for the given boolean value.  Comparisons
+ * make a boolean at every call, so these are shared rather than allocated,
+ * and must not be modified. */
 Value *makeBool(int boolean) {
+    return boolean ? &TRUE_VALUE : &FALSE_VALUE;
+}
+
+/* Create a new INT_TYPE value node with the given integer value. */
+Value *makeInt(long i) {
+    Value *new = talloc(sizeof(Value));
+    new->type = INT_TYPE;
+    new->i = i;
+    return new;
+}
+
+/* Create a new DOUBLE_TYPE value node with the given double value. */
+Value *makeDouble(double d) {
+    Value *new = talloc(sizeof(Value));
+    new->type = DOUBLE_TYPE;
+    new->d = d;
+    return new;
+}
+
+/* Create a new PRIMITIVE_TYPE value node for the given function. */
+Value *makePrimitive(char *name, Value *(*pf)(int, Value **), int min_args, int max_args) {
     Value *new = talloc(sizeof(Value));
-    new->type = BOOL_TYPE;
-    new->i = boolean;
+    new->type = PRIMITIVE_TYPE;
+    new->pr.pf = pf;
+    new->pr.name = name;
+    new->pr.min_args = min_args;
+    new->pr.max_args = max_args;
     return new;
 }
 
@@ -35,6 +70,54 @@ Value *makeUnspecified() {
     return new;
 }
 
+/* Create a new STR_TYPE value node holding the given string, which is not
+ * copied. */
+Value *makeString(char *s) {
+    return string_new(s, strlen(s));
+}
+
+/* Create a new ERROR_TYPE value node. */
+Value *makeError(Value *message, Value *irritants, int status) {
+    Value *new = talloc(sizeof(Value));
+    new->type = ERROR_TYPE;
+    new->err.message = message;
+    new->err.irritants = irritants;
+    new->err.status = status;
+    return new;
+}
+
+/* Create a new F64VECTOR_TYPE or S64VECTOR_TYPE value node with room for the
+ * given number of elements, which are not initialized. */
+Value *makeNumVector(valueType type, long length) {
+    Value *new = talloc(sizeof(Value));
+    new->type = type;
+    new->vec.length = length;
+    // Both kinds of element take eight bytes; talloc(0) could give NULL
+    new->vec.f64 = talloc(sizeof(double) * (length > 0 ? length : 1));
+    return new;
+}
+
+/* Create a new VECTOR_TYPE value node with room for the given number of
+ * elements, which are not initialized. */
+Value *makeVector(long length) {
+    Value *new = talloc(sizeof(Value));
+    new->type = VECTOR_TYPE;
+    new->vec.length = length;
+    new->vec.items = talloc(sizeof(Value *) * (length > 0 ? length : 1));
+    return new;
+}
+
+/* Create a new MATRIX_TYPE value node of the given dimensions, whose
+ * elements are not initialized. */
+Value *makeMatrix(long rows, long cols) {
+    Value *new = talloc(sizeof(Value));
+    new->type = MATRIX_TYPE;
+    new->mat.rows = rows;
+    new->mat.cols = cols;
+    new->mat.elements = talloc(sizeof(double) * (rows * cols > 0 ? rows * cols : 1));
+    return new;
+}
+
 /* Create a new CONS_TYPE value node. */
 Value *cons(Value *newCar, Value *newCdr) {
     Value *new = talloc(sizeof(Value));
@@ -44,6 +127,37 @@ Value *cons(Value *newCar, Value *newCdr) {
     return new;
 }
 
+/* Print an f64vector or s64vector in its external representation, such as
+ * #f64(1.000000 2.500000), without a trailing newline. */
+void displayNumVector(Value *vector, FILE *fd) {
+    long i;
+    fprintf(fd, vector->type == F64VECTOR_TYPE ? "#f64(" : "#s64(");
+    for (i = 0; i < vector->vec.length; i++) {
+        if (i > 0)
+            fprintf(fd, " ");
+        if (vector->type == F64VECTOR_TYPE)
+            fprintf(fd, "%lf", vector->vec.f64[i]);
+        else
+            fprintf(fd, "%ld", vector->vec.s64[i]);
+    }
+    fprintf(fd, ")");
+}
+
+/* Print a matrix as #matrix followed by the list of its rows, such as
+ * #matrix((1.000000 2.000000) (3.000000 4.000000)), without a trailing
+ * newline. */
+void displayMatrix(Value *matrix, FILE *fd) {
+    long i, j;
+    fprintf(fd, "#matrix(");
+    for (i = 0; i < matrix->mat.rows; i++) {
+        fprintf(fd, i > 0 ? " (" : "(");
+        for (j = 0; j < matrix->mat.cols; j++)
+            fprintf(fd, j > 0 ? " %lf" : "%lf", matrix->mat.elements[i * matrix->mat.cols + j]);
+        fprintf(fd, ")");
+    }
+    fprintf(fd, ")");
+}
+
 struct format_info {
     int first_in_list, leading_space, is_list;
 };
@@ -76,16 +190,20 @@ int displayHelper(Value *list, struct format_info *info, FILE *fd) {
     }
     switch(list->type) {
         case INT_TYPE:
-            fprintf(fd, "%d", list->i);
+            fprintf(fd, "%ld", list->i);
             rax = 1;
             break;
         case DOUBLE_TYPE:
             fprintf(fd, "%lf", list->d);
             rax = 1;
             break;
+        case BIGNUM_TYPE:
+            bignum_print(list, fd);
+            rax = 1;
+            break;
         case STR_TYPE:
             fprintf(fd, "\"");
-            fprintf(fd, "%s", list->s);
+            string_write(list, fd);
             fprintf(fd, "\"");
             rax = 1;
             break;
@@ -96,6 +214,14 @@ int displayHelper(Value *list, struct format_info *info, FILE *fd) {
             cdr_info.first_in_list = 0;
             cdr_info.leading_space = displayHelper(list->c.car, &car_info, fd);
             cdr_info.is_list = 1;
+            // The rest of the list is printed in this loop rather than by
+            // recursion on each cdr, so long lists do not exhaust the C stack
+            while (list->c.cdr->type == CONS_TYPE) {
+                list = list->c.cdr;
+                if (cdr_info.leading_space)
+                    fprintf(fd, " ");
+                cdr_info.leading_space = displayHelper(list->c.car, &car_info, fd);
+            }
             rax = displayHelper(list->c.cdr, &cdr_info, fd);
             break;
         case NULL_TYPE:
@@ -129,6 +255,10 @@ int displayHelper(Value *list, struct format_info *info, FILE *fd) {
             rax = 0;
             break;
         case CLOSURE_TYPE:
+        case PRIMITIVE_TYPE:
+        case CONTINUATION_TYPE:
+        case RECORD_PROCEDURE_TYPE:
+        case MEMO_TYPE:
             fprintf(fd, "#<procedure>");
             rax = 1;
             break;
@@ -136,6 +266,44 @@ int displayHelper(Value *list, struct format_info *info, FILE *fd) {
             fprintf(fd, "#<unspecified>");
             rax = 1;
             break;
+        case ERROR_TYPE:
+            fprintf(fd, "#<error-object>");
+            rax = 1;
+            break;
+        case HASH_TABLE_TYPE:
+            fprintf(fd, "#<hash-table>");
+            rax = 1;
+            break;
+        case PROMISE_TYPE:
+            fprintf(fd, "#<promise>");
+            rax = 1;
+            break;
+        case RECORD_TYPE:
+            fprintf(fd, "#<record %s>", list->rec->type->name);
+            rax = 1;
+            break;
+        case RECORD_DESCRIPTOR_TYPE:
+            fprintf(fd, "#<record-type %s>", list->rtd->name);
+            rax = 1;
+            break;
+        case F64VECTOR_TYPE:
+        case S64VECTOR_TYPE:
+            displayNumVector(list, fd);
+            rax = 1;
+            break;
+        case MATRIX_TYPE:
+            displayMatrix(list, fd);
+            rax = 1;
+            break;
+        case VECTOR_TYPE:
+            displayVector(list, fd);
+            rax = 1;
+            break;
+        case PMAP_TYPE:
+        case PVECTOR_TYPE:
+            displayPersistent(list, fd);
+            rax = 1;
+            break;
         default:
             fprintf(stderr, "WARNING: Value type %d should not be printable\n", list->type);
     }
@@ -152,6 +320,39 @@ int displayHelper(Value *list, struct format_info *info, FILE *fd) {
     return rax;
 }
 
+/* Print a vector in its external representation, such as #(1 "two" (3)),
+ * without a trailing newline. */
+void displayVector(Value *vector, FILE *fd) {
+    struct format_info info = {1, 0, 0};
+    long i;
+    fprintf(fd, "#(");
+    for (i = 0; i < vector->vec.length; i++) {
+        // The space is printed here, as displayHelper omits it before ()
+        if (i > 0)
+            fprintf(fd, " ");
+        displayHelper(vector->vec.items[i], &info, fd);
+    }
+    fprintf(fd, ")");
+}
+
+/* Print a persistent map as #pmap followed by the list of its (key . value)
+ * pairs, or a persistent vector as #pvector followed by the list of its
+ * elements, without a trailing newline. */
+void displayPersistent(Value *collection, FILE *fd) {
+    struct format_info info = {1, 0, 0};
+    Value *list = makeNull();
+    long i;
+    if (collection->type == PMAP_TYPE) {
+        fprintf(fd, "#pmap");
+        list = hamt_to_alist(collection->pm.root, list);
+    } else {
+        fprintf(fd, "#pvector");
+        for (i = collection->pv->length - 1; i >= 0; i--)
+            list = cons(pvector_ref(collection->pv, i), list);
+    }
+    displayHelper(list, &info, fd);
+}
+
 /* Display the contents of the linked list to the given file descriptor in some
  * kind of readable format. */
 void display_to_fd(Value *list, FILE *fd) {
@@ -185,9 +386,9 @@ Value *reverse(Value *list) {
         new = newh;
     }
     if (current->type != NULL_TYPE) {
-        fprintf(stderr, "ERROR: In procedure reverse: Wrong type argument: ");
-        display_to_fd(list, stderr);
-        texit(1);
+        fprintf(error_stream(), "ERROR: In procedure reverse: Wrong type argument: ");
+        display_to_fd(list, error_stream());
+        raise_error(1);
     }
     return new;
 }
@@ -229,36 +430,35 @@ int length(Value *value) {
         assert(current != NULL);
     }
     if (current->type != NULL_TYPE) {
-        fprintf(stderr, "ERROR: In procedure length: Wrong type argument: ");
-        display_to_fd(value, stderr);
-        texit(1);
+        fprintf(error_stream(), "ERROR: In procedure length: Wrong type argument: ");
+        display_to_fd(value, error_stream());
+        raise_error(1);
     }
     return len;
 }
 
 /* Duplicates a list by creating new cons cells for each entry, but preserving
  * the original car values.  Does not duplicate the final NULL_TYPE list.
- * Returns a pointer to the head of the new list.  If the cdr of the head is
- * NULL_TYPE, then updates the value at tail to be the address of head, which
- * is the last non-NULL_TYPE cons cell in the list. */
+ * Returns a pointer to the head of the new list.  If the list is not empty,
+ * then updates the value at tail to be the address of the last cons cell of
+ * the new list.  The cells are linked front to back in a loop, so long lists
+ * do not exhaust the C stack. */
 Value *duplicateList(Value *list, Value **tail) {
-    Value *new;
+    Value head, *last = &head;
     assert(list != NULL);
-    new->type = CONS_TYPE;
-    switch (list->type) {
-        case CONS_TYPE:
-            new = talloc(sizeof(Value));
-            new->c.car = list->c.car;
-            new->c.cdr = duplicateList(list->c.cdr, tail);
-            if (new->c.cdr->type == NULL_TYPE)
-                *tail = list;
-            break;
-        case NULL_TYPE:
-            return list;
-        default:
-            assert(list->type == CONS_TYPE || list->type == NULL_TYPE);
+    while (list->type == CONS_TYPE) {
+        last->c.cdr = talloc(sizeof(Value));
+        last = last->c.cdr;
+        last->type = CONS_TYPE;
+        last->c.car = list->c.car;
+        list = list->c.cdr;
+        assert(list != NULL);
     }
-    return new;
+    assert(list->type == NULL_TYPE);
+    last->c.cdr = list;
+    if (last != &head)
+        *tail = last;
+    return head.c.cdr;
 }
 
 /* Takes an integer indicating the total number of lists given as arguments.
@@ -10,15 +10,63 @@ Value *makeNull();
 /* Creates a new VOID_TYPE value node. */
 Value *makeVoid();
 
-/* Create a new BOOL_TYPE value node with the given boolean value. */
+/* Returns the BOOL_TYPE value node for the given boolean value, which is
+ * shared and must not be modified. */
 Value *makeBool(int boolean);
 
+/* Create a new INT_TYPE value node with the given integer value. */
+Value *makeInt(long i);
+
+/* Create a new DOUBLE_TYPE value node with the given double value. */
+Value *makeDouble(double d);
+
+/* Create a new PRIMITIVE_TYPE value node for the given function, which
+ * accepts from min_args to max_args arguments (-1 for no upper bound). */
+Value *makePrimitive(char *name, Value *(*pf)(int, Value **), int min_args, int max_args);
+
 /* Create a new UNSPECIFIED_TYPE value node. */
 Value *makeUnspecified();
 
+/* Create a new STR_TYPE value node holding the given string, which is not
+ * copied. */
+Value *makeString(char *s);
+
+/* Create a new ERROR_TYPE value node. */
+Value *makeError(Value *message, Value *irritants, int status);
+
+/* Create a new F64VECTOR_TYPE or S64VECTOR_TYPE value node with room for the
+ * given number of elements, which are not initialized. */
+Value *makeNumVector(valueType type, long length);
+
+/* Create a new VECTOR_TYPE value node with room for the given number of
+ * elements, which are not initialized. */
+Value *makeVector(long length);
+
+/* Create a new MATRIX_TYPE value node of the given dimensions, whose
+ * elements are not initialized. */
+Value *makeMatrix(long rows, long cols);
+
 /* Create a new CONS_TYPE value node. */
 Value *cons(Value *newCar, Value *newCdr);
 
+/* Print an f64vector or s64vector in its external representation, such as
+ * #f64(1.000000 2.500000), without a trailing newline. */
+void displayNumVector(Value *vector, FILE *fd);
+
+/* Print a vector in its external representation, such as #(1 "two" (3)),
+ * without a trailing newline. */
+void displayVector(Value *vector, FILE *fd);
+
+/* Print a persistent map as #pmap followed by the list of its (key . value)
+ * pairs, or a persistent vector as #pvector followed by the list of its
+ * elements, without a trailing newline. */
+void displayPersistent(Value *collection, FILE *fd);
+
+/* Print a matrix as #matrix followed by the list of its rows, such as
+ * #matrix((1.000000 2.000000) (3.000000 4.000000)), without a trailing
+ * newline. */
+void displayMatrix(Value *matrix, FILE *fd);
+
 /* Display the contents of the linked list to the given file descriptor in some
  * kind of readable format. */
 void display_to_fd(Value *list, FILE *fd);
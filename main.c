@@ -1,17 +1,55 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tokenizer.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "interpreter.h"
+#include "optimizer.h"
+#include "simd.h"
+#include "matrix.h"
+#include "sort.h"
 
-int main() {
+/* Sets the optimizer and runtime flags from the command line.  Exits with
+ * status 1 on an unrecognized option. */
+void parse_options(int argc, char *argv[]) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-fno-inline") == 0) {
+            INLINE_ENABLED = 0;
+        } else if (strcmp(argv[i], "-fno-type-inference") == 0) {
+            TYPE_INFERENCE_ENABLED = 0;
+        } else if (strcmp(argv[i], "-fno-deforestation") == 0) {
+            DEFORESTATION_ENABLED = 0;
+        } else if (strcmp(argv[i], "-fno-escape-analysis") == 0) {
+            ESCAPE_ANALYSIS_ENABLED = 0;
+        } else if (strcmp(argv[i], "-fno-simd") == 0) {
+            SIMD_ENABLED = 0;
+        } else if (strcmp(argv[i], "-finline-report") == 0) {
+            INLINE_REPORT = 1;
+        } else if (strncmp(argv[i], "-finline-limit=", strlen("-finline-limit=")) == 0) {
+            INLINE_SIZE_LIMIT = atoi(argv[i] + strlen("-finline-limit="));
+        } else if (strncmp(argv[i], "-fmatrix-threads=", strlen("-fmatrix-threads=")) == 0) {
+            MATRIX_THREADS = atoi(argv[i] + strlen("-fmatrix-threads="));
+        } else if (strncmp(argv[i], "-fsort-threads=", strlen("-fsort-threads=")) == 0) {
+            SORT_THREADS = atoi(argv[i] + strlen("-fsort-threads="));
+        } else {
+            fprintf(stderr, "Usage: %s [-fno-inline] [-fno-type-inference] [-fno-deforestation] [-fno-escape-analysis] [-fno-simd] [-finline-report] [-finline-limit=N] [-fmatrix-threads=N] [-fsort-threads=N] < program.scm\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
 
+    parse_options(argc, argv);
     Value *list = tokenize();
     Value *tree = parse(list);
-    interpret(tree);
+    tree = optimize(tree);
+    int status = interpret(tree);
 
     tfree();
-    return 0;
+    return status;
 }
@@ -0,0 +1,120 @@
+/* matrix.c
+ *
+ * Dense matrix multiplication and transposition over row-major arrays of
+ * doubles.  The product is blocked so that a block of b is reused from the
+ * cache for every row of a before moving on, with the innermost work done by
+ * the f64_vecmat_add kernel of simd.c, and large products are split by rows
+ * across threads.  Nothing here allocates with talloc, which is not thread
+ * safe, or raises errors: the interpreter checks the arguments first.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "simd.h"
+#include "matrix.h"
+
+// The block of b multiplied at a time is BLOCK_DEPTH rows of BLOCK_COLS
+// doubles, 128 KiB, which leaves room in a typical L2 cache for the rows of
+// a and c in use alongside it.
+#define BLOCK_DEPTH 128
+#define BLOCK_COLS 128
+
+// Products of fewer multiplications than this are not worth the cost of
+// starting threads.
+#define THREAD_THRESHOLD (128L * 128 * 128)
+
+#define MAX_THREADS 64
+
+int MATRIX_THREADS = 0;
+
+// The rows of the product computed by one thread.
+struct MultiplyTask {
+    double *c;
+    const double *a;
+    const double *b;
+    long m;
+    long p;
+    long first_row;
+    long end_row;
+};
+
+/* Computes the rows of the product given by the task, block by block. */
+void multiply_rows(struct MultiplyTask *task) {
+    long i, k, j, depth, width;
+    for (k = 0; k < task->m; k += BLOCK_DEPTH) {
+        depth = task->m - k < BLOCK_DEPTH ? task->m - k : BLOCK_DEPTH;
+        for (j = 0; j < task->p; j += BLOCK_COLS) {
+            width = task->p - j < BLOCK_COLS ? task->p - j : BLOCK_COLS;
+            for (i = task->first_row; i < task->end_row; i++)
+                f64_vecmat_add(task->c + i * task->p + j, task->a + i * task->m + k,
+                        task->b + k * task->p + j, task->p, depth, width);
+        }
+    }
+}
+
+void *multiply_thread(void *task) {
+    multiply_rows(task);
+    return NULL;
+}
+
+/* Returns the number of threads to use for a product of n rows and the
+ * given number of multiplications. */
+int multiply_thread_count(long n, long multiplications) {
+    long threads = MATRIX_THREADS;
+    if (multiplications < THREAD_THRESHOLD)
+        return 1;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if (threads > n)
+        threads = n;
+    return threads < 1 ? 1 : threads;
+}
+
+void matrix_multiply(double *c, const double *a, const double *b, long n, long m, long p) {
+    struct MultiplyTask tasks[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS];
+    int count, t;
+    memset(c, 0, sizeof(double) * n * p);
+    count = multiply_thread_count(n, n * m * p);
+    // The kernels must be chosen before the threads race to do it
+    simd_init();
+    for (t = 0; t < count; t++) {
+        tasks[t].c = c;
+        tasks[t].a = a;
+        tasks[t].b = b;
+        tasks[t].m = m;
+        tasks[t].p = p;
+        tasks[t].first_row = n * t / count;
+        tasks[t].end_row = n * (t + 1) / count;
+    }
+    // The calling thread takes the first share; a share whose thread cannot
+    // be started is done by the calling thread as well
+    for (t = 1; t < count; t++)
+        started[t] = pthread_create(&threads[t], NULL, multiply_thread, &tasks[t]) == 0;
+    multiply_rows(&tasks[0]);
+    for (t = 1; t < count; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            multiply_rows(&tasks[t]);
+    }
+}
+
+void matrix_transpose(double *t, const double *a, long n, long m) {
+    long i, j, ii, jj, i_end, j_end;
+    // Tiles keep both the rows read and the rows written in the cache
+    for (ii = 0; ii < n; ii += 32) {
+        i_end = ii + 32 < n ? ii + 32 : n;
+        for (jj = 0; jj < m; jj += 32) {
+            j_end = jj + 32 < m ? jj + 32 : m;
+            for (i = ii; i < i_end; i++)
+                for (j = jj; j < j_end; j++)
+                    t[j * n + i] = a[i * m + j];
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef _MATRIX
+#define _MATRIX
+
+/* The number of threads across which a large matrix product is split, or 0
+ * for one per online CPU. */
+extern int MATRIX_THREADS;
+
+/* Stores in c the n by p product of the n by m matrix a and the m by p
+ * matrix b, all of doubles in row-major order.  Each element is summed in
+ * order of the inner index, exactly as the naive triple loop does, so the
+ * result does not depend on the blocking or the number of threads.  c must
+ * not overlap a or b. */
+void matrix_multiply(double *c, const double *a, const double *b, long n, long m, long p);
+
+/* Stores in t the m by n transpose of the n by m matrix a, in row-major
+ * order.  t must not overlap a. */
+void matrix_transpose(double *t, const double *a, long n, long m);
+
+#endif
@@ -0,0 +1,1387 @@
+/* optimizer.c
+ *
+ * Source-to-source passes over the parse tree, run between parse() and
+ * interpret().  Every pass must leave the meaning of the program unchanged;
+ * when a pass cannot prove that a rewrite is safe, it leaves the tree alone.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "interpreter.h"
+#include "optimizer.h"
+
+int INLINE_ENABLED = 1;
+int INLINE_REPORT = 0;
+int INLINE_SIZE_LIMIT = 16;
+int TYPE_INFERENCE_ENABLED = 1;
+int DEFORESTATION_ENABLED = 1;
+int ESCAPE_ANALYSIS_ENABLED = 1;
+
+/* A top-level procedure whose body may be substituted at its call sites. */
+struct InlineCandidate {
+    Value *name;
+    Value *params;
+    Value *body;
+    Value *free_symbols;    // every symbol in body other than the parameters
+    struct InlineCandidate *next;
+};
+
+/* Every symbol which is the target of a define or set! anywhere in the
+ * program, with repetition.  A symbol in neither list always refers to its
+ * builtin meaning unless lexically shadowed. */
+Value *DEFINED_SYMBOLS = NULL;
+Value *ASSIGNED_SYMBOLS = NULL;
+
+/* Every name defined by define-syntax anywhere in the program.  Macro uses
+ * are only expanded at run time, so the passes leave them, and define-syntax
+ * forms, untouched. */
+Value *SYNTAX_KEYWORDS = NULL;
+
+struct InlineCandidate *INLINE_CANDIDATES = NULL;
+int INLINE_FORM_NUMBER = 0;
+int INLINE_SITE_COUNT = 0;
+int FRESH_SYMBOL_COUNT = 0;
+
+
+////////////////////////////////////////
+/////////// TREE UTILITIES /////////////
+////////////////////////////////////////
+
+/* Returns 1 if the given value is a symbol with the given name, otherwise 0. */
+int symbol_is(Value *value, char *name) {
+    return value->type == SYMBOL_TYPE && strcmp(value->s, name) == 0;
+}
+
+/* Returns a new SYMBOL_TYPE value holding a copy of the given name. */
+Value *make_symbol_value(char *name) {
+    Value *val = talloc(sizeof(Value));
+    val->type = SYMBOL_TYPE;
+    val->s = talloc(strlen(name) + 1);
+    strcpy(val->s, name);
+    return val;
+}
+
+/* Returns a new symbol derived from the given one which cannot collide with
+ * any symbol in the source program, since # is a delimiter for the tokenizer. */
+Value *fresh_symbol(Value *base) {
+    char buf[32];
+    Value *val;
+    FRESH_SYMBOL_COUNT++;
+    snprintf(buf, sizeof(buf), "#%d", FRESH_SYMBOL_COUNT);
+    val = talloc(sizeof(Value));
+    val->type = SYMBOL_TYPE;
+    val->s = talloc(strlen(base->s) + strlen(buf) + 1);
+    strcpy(val->s, base->s);
+    strcat(val->s, buf);
+    return val;
+}
+
+/* Returns 1 if the symbol occurs in the given list of symbols, otherwise 0.
+ * The list may be improper, as in the parameter list of a variadic lambda, or
+ * even a lone symbol. */
+int symbol_in_list(Value *symbol, Value *list) {
+    while (list->type == CONS_TYPE) {
+        if (car(list)->type == SYMBOL_TYPE && strcmp(car(list)->s, symbol->s) == 0)
+            return 1;
+        list = cdr(list);
+    }
+    return list->type == SYMBOL_TYPE && strcmp(list->s, symbol->s) == 0;
+}
+
+/* Returns the given scope extended with every symbol in the given (possibly
+ * improper) parameter list. */
+Value *scope_add(Value *params, Value *scope) {
+    while (params->type == CONS_TYPE) {
+        if (car(params)->type == SYMBOL_TYPE)
+            scope = cons(car(params), scope);
+        params = cdr(params);
+    }
+    if (params->type == SYMBOL_TYPE)
+        scope = cons(params, scope);
+    return scope;
+}
+
+/* Returns 1 if the expression is a literal which evaluates to itself. */
+int is_literal(Value *expr) {
+    switch (expr->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case BIGNUM_TYPE:
+        case STR_TYPE:
+        case BOOL_TYPE:
+        case VECTOR_TYPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Returns 1 if the given form is a let, let*, letrec or letrec*. */
+int is_let_form(Value *head) {
+    return symbol_is(head, "let") || symbol_is(head, "let*")
+        || symbol_is(head, "letrec") || symbol_is(head, "letrec*");
+}
+
+/* Conses onto acc the target of every (form target ...) in the expression,
+ * outside of quoted data.  For a (define (name . params) ...) the target is
+ * the name. */
+Value *collect_targets(Value *expr, char *form, Value *acc) {
+    Value *target;
+    if (expr->type != CONS_TYPE)
+        return acc;
+    if (symbol_is(car(expr), "quote"))
+        return acc;
+    if (symbol_is(car(expr), form) && cdr(expr)->type == CONS_TYPE) {
+        target = car(cdr(expr));
+        if (target->type == CONS_TYPE)
+            target = car(target);
+        if (target->type == SYMBOL_TYPE)
+            acc = cons(target, acc);
+    }
+    while (expr->type == CONS_TYPE) {
+        acc = collect_targets(car(expr), form, acc);
+        expr = cdr(expr);
+    }
+    return acc;
+}
+
+/* Returns 1 if the expression is a define-syntax form or a use of a macro. */
+int is_syntax_form(Value *expr) {
+    return expr->type == CONS_TYPE && car(expr)->type == SYMBOL_TYPE
+        && (symbol_is(car(expr), "define-syntax")
+            || symbol_in_list(car(expr), SYNTAX_KEYWORDS));
+}
+
+Value *collect_symbols(Value *expr, Value *acc);
+
+/* Conses onto acc every symbol in each define-syntax form and macro use in
+ * the expression.  An expansion may define or assign any symbol its use or
+ * its template mentions. */
+Value *collect_syntax_symbols(Value *expr, Value *acc) {
+    if (expr->type != CONS_TYPE || symbol_is(car(expr), "quote"))
+        return acc;
+    if (is_syntax_form(expr))
+        return collect_symbols(expr, acc);
+    while (expr->type == CONS_TYPE) {
+        acc = collect_syntax_symbols(car(expr), acc);
+        expr = cdr(expr);
+    }
+    return acc;
+}
+
+/* Counts the occurrences of the symbol in the expression, outside of quoted
+ * data. */
+int count_symbol(Value *expr, Value *symbol) {
+    int count = 0;
+    switch (expr->type) {
+        case SYMBOL_TYPE:
+            return strcmp(expr->s, symbol->s) == 0;
+        case CONS_TYPE:
+            break;
+        default:
+            return 0;
+    }
+    if (symbol_is(car(expr), "quote"))
+        return 0;
+    while (expr->type == CONS_TYPE) {
+        count += count_symbol(car(expr), symbol);
+        expr = cdr(expr);
+    }
+    return count + count_symbol(expr, symbol);
+}
+
+/* Returns the length of the list, or -1 if it is improper.  Unlike length,
+ * accepts any value, since the tree may hold malformed forms which only fail
+ * when evaluated. */
+int list_length(Value *list) {
+    int n = 0;
+    for (; list->type == CONS_TYPE; list = cdr(list))
+        n++;
+    return list->type == NULL_TYPE ? n : -1;
+}
+
+/* Returns 1 if the given form is a let-values, let*-values or receive. */
+int is_values_form(Value *head) {
+    return symbol_is(head, "let-values") || symbol_is(head, "let*-values")
+        || symbol_is(head, "receive");
+}
+
+/* Returns the list of variables bound by a let-values, let*-values or
+ * receive form, including internal definitions of its body. */
+Value *values_form_binders(Value *expr) {
+    Value *args = cdr(expr), *binders, *current;
+    if (symbol_is(car(expr), "receive"))
+        return scope_add(car(args), collect_targets(cdr(cdr(args)), "define", makeNull()));
+    binders = collect_targets(cdr(args), "define", makeNull());
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+        if (car(current)->type == CONS_TYPE)
+            binders = scope_add(car(car(current)), binders);
+    return binders;
+}
+
+/* Counts the number of atoms in the expression. */
+int tree_size(Value *expr) {
+    int size = 0;
+    if (expr->type != CONS_TYPE)
+        return 1;
+    while (expr->type == CONS_TYPE) {
+        size += tree_size(car(expr));
+        expr = cdr(expr);
+    }
+    return size + (expr->type == NULL_TYPE ? 0 : 1);
+}
+
+/* Conses onto acc every symbol in the expression, outside of quoted data. */
+Value *collect_symbols(Value *expr, Value *acc) {
+    switch (expr->type) {
+        case SYMBOL_TYPE:
+            return symbol_in_list(expr, acc) ? acc : cons(expr, acc);
+        case CONS_TYPE:
+            break;
+        default:
+            return acc;
+    }
+    if (symbol_is(car(expr), "quote"))
+        return collect_symbols(car(expr), acc);
+    while (expr->type == CONS_TYPE) {
+        acc = collect_symbols(car(expr), acc);
+        expr = cdr(expr);
+    }
+    return collect_symbols(expr, acc);
+}
+
+
+////////////////////////////////////////
+////////////// INLINING ////////////////
+////////////////////////////////////////
+
+/* Returns 1 if the body contains no form that could bind or assign a variable
+ * in the frame of the call site or capture that frame once the body has been
+ * substituted there; let forms are allowed since their binders are renamed. */
+int inline_body_allowed(Value *expr) {
+    Value *head, *current;
+    if (expr->type != CONS_TYPE)
+        return 1;
+    head = car(expr);
+    if (symbol_is(head, "quote"))
+        return 1;
+    if (is_syntax_form(expr))
+        return 0;
+    if (symbol_is(head, "define") || symbol_is(head, "set!")
+            || symbol_is(head, "lambda") || symbol_is(head, "do")
+            || is_values_form(head) || symbol_is(head, "guard")
+            || symbol_is(head, "delay") || symbol_is(head, "delay-force")
+            || symbol_is(head, "stream-cons"))
+        return 0;
+    if (is_let_form(head)) {
+        // Named let is not renamed by inline_subst_let
+        if (cdr(expr)->type != CONS_TYPE)
+            return 0;
+        for (current = car(cdr(expr)); current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type != CONS_TYPE || car(car(current))->type != SYMBOL_TYPE)
+                return 0;
+        if (current->type != NULL_TYPE)
+            return 0;
+    }
+    while (expr->type == CONS_TYPE) {
+        if (!inline_body_allowed(car(expr)))
+            return 0;
+        expr = cdr(expr);
+    }
+    return 1;
+}
+
+Value *inline_subst(Value *expr, Value *map);
+
+/* If the top-level form defines a procedure which may be inlined, returns a
+ * new candidate for it, otherwise returns NULL.  The procedure must be defined
+ * exactly once in the program, never be the target of a set!, take a fixed
+ * number of arguments, not refer to itself, and have a small body. */
+struct InlineCandidate *inline_candidate(Value *form) {
+    Value *args, *name, *params, *body;
+    struct InlineCandidate *candidate;
+    if (form->type != CONS_TYPE || !symbol_is(car(form), "define"))
+        return NULL;
+    args = cdr(form);
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE)
+        return NULL;
+    name = car(args);
+    if (name->type == CONS_TYPE) {
+        params = cdr(name);
+        name = car(name);
+        body = cdr(args);
+    } else if (cdr(cdr(args))->type == NULL_TYPE
+            && car(cdr(args))->type == CONS_TYPE
+            && symbol_is(car(car(cdr(args))), "lambda")
+            && cdr(car(cdr(args)))->type == CONS_TYPE) {
+        params = car(cdr(car(cdr(args))));
+        body = cdr(cdr(car(cdr(args))));
+    } else {
+        return NULL;
+    }
+    if (name->type != SYMBOL_TYPE || body->type != CONS_TYPE)
+        return NULL;
+    if (count_symbol(DEFINED_SYMBOLS, name) != 1 || count_symbol(ASSIGNED_SYMBOLS, name) != 0)
+        return NULL;
+    args = params;
+    while (args->type == CONS_TYPE) {
+        if (car(args)->type != SYMBOL_TYPE)
+            return NULL;
+        args = cdr(args);
+    }
+    if (args->type != NULL_TYPE)
+        return NULL;
+    if (cdr(body)->type == NULL_TYPE)
+        body = car(body);
+    else
+        body = cons(make_symbol_value("begin"), body);
+    if (!inline_body_allowed(body) || count_symbol(body, name) != 0
+            || tree_size(body) > INLINE_SIZE_LIMIT)
+        return NULL;
+    candidate = talloc(sizeof(struct InlineCandidate));
+    candidate->name = name;
+    candidate->params = params;
+    // Renaming the binders of let forms up front keeps them out of the free
+    // symbols, so that they never block inlining at a call site
+    candidate->body = inline_subst(body, makeNull());
+    candidate->free_symbols = makeNull();
+    args = collect_symbols(candidate->body, makeNull());
+    while (args->type == CONS_TYPE) {
+        if (!symbol_in_list(car(args), params))
+            candidate->free_symbols = cons(car(args), candidate->free_symbols);
+        args = cdr(args);
+    }
+    candidate->next = NULL;
+    return candidate;
+}
+
+/* Copies a let-family form, renaming each of its binders to a fresh symbol so
+ * that it cannot capture a variable substituted from the call site. */
+Value *inline_subst_let(Value *expr, Value *map) {
+    Value *head = car(expr), *current, *pair, *renamed, *bindings, *inner_map;
+    int rec = symbol_is(head, "letrec") || symbol_is(head, "letrec*");
+    int star = symbol_is(head, "let*");
+    inner_map = map;
+    if (rec) {
+        current = car(cdr(expr));
+        while (current->type == CONS_TYPE) {
+            pair = car(current);
+            inner_map = cons(cons(car(pair), fresh_symbol(car(pair))), inner_map);
+            current = cdr(current);
+        }
+    }
+    bindings = makeNull();
+    current = car(cdr(expr));
+    while (current->type == CONS_TYPE) {
+        pair = car(current);
+        if (rec) {
+            renamed = inline_subst(car(pair), inner_map);
+        } else {
+            renamed = fresh_symbol(car(pair));
+            inner_map = cons(cons(car(pair), renamed), inner_map);
+        }
+        bindings = cons(cons(renamed,
+                    inline_subst(cdr(pair), (rec || star) ? inner_map : map)),
+                bindings);
+        current = cdr(current);
+    }
+    return cons(head, cons(reverse(bindings), inline_subst(cdr(cdr(expr)), inner_map)));
+}
+
+/* Returns a copy of the case form with the map applied to its key and the
+ * bodies of its clauses, but not to its datums. */
+Value *inline_subst_case(Value *expr, Value *map) {
+    Value *clauses = makeNull(), *current;
+    for (current = cdr(cdr(expr)); current->type == CONS_TYPE; current = cdr(current)) {
+        if (car(current)->type == CONS_TYPE)
+            clauses = cons(cons(car(car(current)), inline_subst(cdr(car(current)), map)), clauses);
+        else
+            clauses = cons(car(current), clauses);
+    }
+    return cons(car(expr), cons(inline_subst(car(cdr(expr)), map), reverse(clauses)));
+}
+
+/* Returns a copy of the expression with every symbol bound in the map (an
+ * association list of symbols to expressions) replaced. */
+Value *inline_subst(Value *expr, Value *map) {
+    Value *current;
+    switch (expr->type) {
+        case SYMBOL_TYPE:
+            current = map;
+            while (current->type == CONS_TYPE) {
+                if (strcmp(car(car(current))->s, expr->s) == 0)
+                    return cdr(car(current));
+                current = cdr(current);
+            }
+            return expr;
+        case CONS_TYPE:
+            break;
+        default:
+            return expr;
+    }
+    if (symbol_is(car(expr), "quote"))
+        return expr;
+    if (is_let_form(car(expr)))
+        return inline_subst_let(expr, map);
+    if (symbol_is(car(expr), "case") && cdr(expr)->type == CONS_TYPE)
+        return inline_subst_case(expr, map);
+    return cons(inline_subst(car(expr), map), inline_subst(cdr(expr), map));
+}
+
+/* Substitutes the body of the candidate for the call expression.  Literal
+ * arguments are substituted directly, as are variables which are never the
+ * target of a set! when every argument is atomic (so nothing, neither another
+ * argument nor a procedure the body calls, can change a variable before the
+ * body reads it); all other arguments are bound to fresh names by a let,
+ * preserving their left-to-right evaluation. */
+Value *inline_call(struct InlineCandidate *candidate, Value *expr) {
+    Value *param, *arg, *current, *map, *bindings, *renamed, *body;
+    int all_atomic = 1;
+    current = cdr(expr);
+    while (current->type == CONS_TYPE) {
+        if (!is_literal(car(current)) && car(current)->type != SYMBOL_TYPE)
+            all_atomic = 0;
+        current = cdr(current);
+    }
+    map = makeNull();
+    bindings = makeNull();
+    param = candidate->params;
+    arg = cdr(expr);
+    while (param->type == CONS_TYPE) {
+        if (is_literal(car(arg)) || (all_atomic && car(arg)->type == SYMBOL_TYPE
+                    && count_symbol(ASSIGNED_SYMBOLS, car(arg)) == 0)) {
+            map = cons(cons(car(param), car(arg)), map);
+        } else {
+            renamed = fresh_symbol(car(param));
+            map = cons(cons(car(param), renamed), map);
+            bindings = cons(list(2, renamed, car(arg)), bindings);
+        }
+        param = cdr(param);
+        arg = cdr(arg);
+    }
+    body = inline_subst(candidate->body, map);
+    if (bindings->type == NULL_TYPE)
+        return body;
+    return list(3, make_symbol_value("let"), reverse(bindings), body);
+}
+
+/* Returns the candidate the call expression may be replaced by, or NULL. */
+struct InlineCandidate *inline_lookup(Value *expr, Value *scope) {
+    struct InlineCandidate *candidate;
+    Value *current, *head = car(expr);
+    if (head->type != SYMBOL_TYPE || symbol_in_list(head, scope))
+        return NULL;
+    for (candidate = INLINE_CANDIDATES; candidate != NULL; candidate = candidate->next) {
+        if (strcmp(candidate->name->s, head->s) != 0)
+            continue;
+        current = candidate->free_symbols;
+        while (current->type == CONS_TYPE) {
+            if (symbol_in_list(car(current), scope))
+                return NULL;
+            current = cdr(current);
+        }
+        if (list_length(cdr(expr)) != list_length(candidate->params))
+            return NULL;
+        return candidate;
+    }
+    return NULL;
+}
+
+Value *inline_walk(Value *expr, Value *scope);
+
+/* Walks each element of the list in place. */
+void inline_walk_list(Value *list, Value *scope) {
+    while (list->type == CONS_TYPE) {
+        list->c.car = inline_walk(car(list), scope);
+        list = cdr(list);
+    }
+}
+
+/* Inlines every eligible call in the expression, given the list of symbols
+ * lexically bound around it.  Returns the (possibly replaced) expression. */
+Value *inline_walk(Value *expr, Value *scope) {
+    Value *head, *args, *current, *inner_scope;
+    struct InlineCandidate *candidate;
+    if (expr->type != CONS_TYPE || is_syntax_form(expr))
+        return expr;
+    head = car(expr);
+    args = cdr(expr);
+    if (head->type == SYMBOL_TYPE && !symbol_in_list(head, scope)
+            && args->type == CONS_TYPE) {
+        // Binding forms bring their variables, and any internal definitions
+        // of their bodies, into scope.  Extra names only make this pass more
+        // conservative, so all of them cover the whole form.
+        if (symbol_is(head, "quote")) {
+            return expr;
+        } else if (symbol_is(head, "lambda")) {
+            inner_scope = scope_add(car(args), collect_targets(cdr(args), "define", scope));
+            inline_walk_list(cdr(args), inner_scope);
+            return expr;
+        } else if (symbol_is(head, "define") && car(args)->type == CONS_TYPE) {
+            inner_scope = scope_add(cdr(car(args)), collect_targets(cdr(args), "define", scope));
+            inline_walk_list(cdr(args), inner_scope);
+            return expr;
+        } else if (is_let_form(head) || symbol_is(head, "do")) {
+            if (car(args)->type == SYMBOL_TYPE) {
+                // Named let
+                scope = cons(car(args), scope);
+                args = cdr(args);
+                if (args->type != CONS_TYPE)
+                    return expr;
+            }
+            inner_scope = collect_targets(cdr(args), "define", scope);
+            current = car(args);
+            while (current->type == CONS_TYPE) {
+                if (car(current)->type == CONS_TYPE)
+                    inner_scope = scope_add(list(1, car(car(current))), inner_scope);
+                current = cdr(current);
+            }
+            current = car(args);
+            while (current->type == CONS_TYPE) {
+                if (car(current)->type == CONS_TYPE)
+                    inline_walk_list(cdr(car(current)), inner_scope);
+                current = cdr(current);
+            }
+            if (symbol_is(head, "do")) {
+                // The test clause is not a call either
+                if (cdr(args)->type != CONS_TYPE)
+                    return expr;
+                inline_walk_list(car(cdr(args)), inner_scope);
+                args = cdr(args);
+            }
+            inline_walk_list(cdr(args), inner_scope);
+            return expr;
+        } else if (symbol_is(head, "cond")) {
+            // Clauses are not calls; only their elements are expressions
+            for (current = args; current->type == CONS_TYPE; current = cdr(current))
+                inline_walk_list(car(current), scope);
+            return expr;
+        } else if (is_values_form(head)) {
+            // As for let, every variable covers the whole form
+            inner_scope = append(2, values_form_binders(expr), scope);
+            if (!symbol_is(head, "receive")) {
+                for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+                    if (car(current)->type == CONS_TYPE)
+                        inline_walk_list(cdr(car(current)), inner_scope);
+            }
+            inline_walk_list(cdr(args), inner_scope);
+            return expr;
+        } else if (symbol_is(head, "case")) {
+            // Only the key and the clause bodies are expressions
+            args->c.car = inline_walk(car(args), scope);
+            for (current = cdr(args); current->type == CONS_TYPE; current = cdr(current))
+                if (car(current)->type == CONS_TYPE)
+                    inline_walk_list(cdr(car(current)), scope);
+            return expr;
+        } else if (symbol_is(head, "guard") && car(args)->type == CONS_TYPE) {
+            // The variable is only bound in the clauses
+            inner_scope = scope_add(car(car(args)), scope);
+            for (current = cdr(car(args)); current->type == CONS_TYPE; current = cdr(current))
+                inline_walk_list(car(current), inner_scope);
+            inline_walk_list(cdr(args), scope);
+            return expr;
+        }
+    }
+    inline_walk_list(expr, scope);
+    candidate = inline_lookup(expr, scope);
+    if (candidate == NULL)
+        return expr;
+    INLINE_SITE_COUNT++;
+    if (INLINE_REPORT)
+        fprintf(stderr, "inline: call to `%s` inlined in top-level form %d\n",
+                candidate->name->s, INLINE_FORM_NUMBER);
+    return inline_call(candidate, expr);
+}
+
+/* Replaces calls to small top-level procedures by their bodies.  Forms are
+ * visited in program order, so a procedure is only inlined into forms which
+ * follow its definition, and into the bodies of procedures defined later. */
+Value *inline_procedures(Value *tree) {
+    Value *current;
+    struct InlineCandidate *candidate;
+    current = tree;
+    while (current->type == CONS_TYPE) {
+        INLINE_FORM_NUMBER++;
+        current->c.car = inline_walk(car(current), makeNull());
+        candidate = inline_candidate(car(current));
+        if (candidate != NULL) {
+            candidate->next = INLINE_CANDIDATES;
+            INLINE_CANDIDATES = candidate;
+        }
+        current = cdr(current);
+    }
+    if (INLINE_REPORT)
+        fprintf(stderr, "inline: %d call sites inlined\n", INLINE_SITE_COUNT);
+    return tree;
+}
+
+
+////////////////////////////////////////
+/////////// TYPE INFERENCE /////////////
+////////////////////////////////////////
+
+// What the type inference pass has proven about the value of an expression.
+enum inferred_type {
+    TYPE_UNKNOWN,
+    TYPE_FIXNUM,    // INT_TYPE, unless fixnum arithmetic overflowed to a bignum
+    TYPE_FLONUM,    // always DOUBLE_TYPE
+    TYPE_BOOLEAN,   // always BOOL_TYPE
+};
+
+/* The proven types of the variables lexically bound around an expression.
+ * Every bound variable has an entry, even if nothing is known about it, since
+ * a binding shadows any builtin of the same name. */
+struct TypeEnv {
+    Value *name;
+    enum inferred_type type;
+    struct TypeEnv *next;
+};
+
+struct TypeEnv *type_env_add(Value *name, enum inferred_type type, struct TypeEnv *env) {
+    struct TypeEnv *new = talloc(sizeof(struct TypeEnv));
+    new->name = name;
+    new->type = type;
+    new->next = env;
+    return new;
+}
+
+/* Adds every symbol in the (possibly improper) list to the environment with
+ * an unknown type. */
+struct TypeEnv *type_env_add_unknown(Value *params, struct TypeEnv *env) {
+    while (params->type == CONS_TYPE) {
+        if (car(params)->type == SYMBOL_TYPE)
+            env = type_env_add(car(params), TYPE_UNKNOWN, env);
+        params = cdr(params);
+    }
+    if (params->type == SYMBOL_TYPE)
+        env = type_env_add(params, TYPE_UNKNOWN, env);
+    return env;
+}
+
+/* Returns the innermost entry for the symbol, or NULL if it is not bound. */
+struct TypeEnv *type_env_lookup(Value *symbol, struct TypeEnv *env) {
+    while (env != NULL) {
+        if (strcmp(env->name->s, symbol->s) == 0)
+            return env;
+        env = env->next;
+    }
+    return NULL;
+}
+
+/* Returns 1 if the symbol always refers to its builtin meaning here: it is not
+ * lexically bound, and is never defined or assigned anywhere in the program. */
+int is_builtin(Value *symbol, struct TypeEnv *env) {
+    return symbol->type == SYMBOL_TYPE && type_env_lookup(symbol, env) == NULL
+        && count_symbol(DEFINED_SYMBOLS, symbol) == 0
+        && count_symbol(ASSIGNED_SYMBOLS, symbol) == 0;
+}
+
+/* Returns the environment holding when the test expression has evaluated to
+ * #t: variables checked by exact-integer? or flonum?, alone or in an and,
+ * have the corresponding type.  Variables which are ever assigned are left
+ * alone, since they could change between the test and their use. */
+struct TypeEnv *type_guards(Value *test, struct TypeEnv *env) {
+    Value *head, *var;
+    if (test->type != CONS_TYPE || !is_builtin(car(test), env))
+        return env;
+    head = car(test);
+    if (symbol_is(head, "and")) {
+        for (test = cdr(test); test->type == CONS_TYPE; test = cdr(test))
+            env = type_guards(car(test), env);
+        return env;
+    }
+    if (cdr(test)->type != CONS_TYPE || cdr(cdr(test))->type != NULL_TYPE)
+        return env;
+    var = car(cdr(test));
+    if (var->type != SYMBOL_TYPE || count_symbol(ASSIGNED_SYMBOLS, var) != 0)
+        return env;
+    if (symbol_is(head, "exact-integer?"))
+        return type_env_add(var, TYPE_FIXNUM, env);
+    if (symbol_is(head, "flonum?"))
+        return type_env_add(var, TYPE_FLONUM, env);
+    return env;
+}
+
+// While nonzero, type_walk only infers types and leaves the tree unchanged.
+int TYPE_DRY_RUN = 0;
+
+/* Returns the type of a value which is of either type. */
+enum inferred_type type_join(enum inferred_type first, enum inferred_type second) {
+    return first == second ? first : TYPE_UNKNOWN;
+}
+
+Value *type_walk(Value *expr, struct TypeEnv *env, enum inferred_type *type);
+
+/* Walks each expression of the body in place, and returns the type of the
+ * last one. */
+enum inferred_type type_walk_body(Value *body, struct TypeEnv *env) {
+    enum inferred_type type = TYPE_UNKNOWN;
+    while (body->type == CONS_TYPE) {
+        body->c.car = type_walk(car(body), env, &type);
+        body = cdr(body);
+    }
+    return type;
+}
+
+/* Walks a let, let*, letrec, letrec* or named let form in place and returns
+ * the type of its body.  Variables of let and let* take the type of their
+ * initial expression unless they are ever assigned; the other forms may
+ * rebind their variables, so nothing is known about them. */
+enum inferred_type type_walk_let(Value *expr, struct TypeEnv *env) {
+    Value *args = cdr(expr), *name = NULL, *current, *pair;
+    struct TypeEnv *inner = env;
+    enum inferred_type init_type;
+    int rec = symbol_is(car(expr), "letrec") || symbol_is(car(expr), "letrec*");
+    int star = symbol_is(car(expr), "let*");
+    if (car(args)->type == SYMBOL_TYPE) {
+        name = car(args);
+        args = cdr(args);
+        if (args->type != CONS_TYPE)
+            return TYPE_UNKNOWN;
+        rec = 1;
+    }
+    if (rec) {
+        if (name != NULL)
+            inner = type_env_add(name, TYPE_UNKNOWN, inner);
+        for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type == CONS_TYPE)
+                inner = type_env_add_unknown(list(1, car(car(current))), inner);
+    }
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current)) {
+        pair = car(current);
+        if (pair->type != CONS_TYPE || car(pair)->type != SYMBOL_TYPE
+                || cdr(pair)->type != CONS_TYPE)
+            return TYPE_UNKNOWN;
+        init_type = TYPE_UNKNOWN;
+        // Initial expressions of named let are evaluated outside of its scope
+        pair->c.cdr->c.car = type_walk(car(cdr(pair)),
+                (rec && name == NULL) || star ? inner : env, &init_type);
+        if (!rec) {
+            if (count_symbol(ASSIGNED_SYMBOLS, car(pair)) != 0)
+                init_type = TYPE_UNKNOWN;
+            inner = type_env_add(car(pair), init_type, inner);
+        }
+    }
+    inner = type_env_add_unknown(collect_targets(cdr(args), "define", makeNull()), inner);
+    return type_walk_body(cdr(args), inner);
+}
+
+/* Walks a do form in place and returns the type of its result.  A variable
+ * starts with the type of its initial expression, and keeps it if its step
+ * has that type assuming every variable has its current type; this is
+ * repeated, without rewriting, until no variable loses its type. */
+enum inferred_type type_walk_do(Value *expr, struct TypeEnv *env) {
+    Value *args = cdr(expr), *current, *spec;
+    struct TypeEnv *inner;
+    enum inferred_type *types, step_type;
+    int i, count, changed;
+    count = 0;
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current)) {
+        spec = car(current);
+        if (spec->type != CONS_TYPE || car(spec)->type != SYMBOL_TYPE
+                || cdr(spec)->type != CONS_TYPE)
+            return TYPE_UNKNOWN;
+        count++;
+    }
+    if (cdr(args)->type != CONS_TYPE || car(cdr(args))->type != CONS_TYPE)
+        return TYPE_UNKNOWN;
+    types = talloc(sizeof(enum inferred_type) * (count + 1));
+    for (i = 0, current = car(args); i < count; i++, current = cdr(current)) {
+        spec = car(current);
+        spec->c.cdr->c.car = type_walk(car(cdr(spec)), env, &types[i]);
+        if (count_symbol(ASSIGNED_SYMBOLS, car(spec)) != 0)
+            types[i] = TYPE_UNKNOWN;
+    }
+    do {
+        changed = 0;
+        inner = env;
+        for (i = 0, current = car(args); i < count; i++, current = cdr(current))
+            inner = type_env_add(car(car(current)), types[i], inner);
+        inner = type_env_add_unknown(collect_targets(cdr(args), "define", makeNull()), inner);
+        TYPE_DRY_RUN++;
+        for (i = 0, current = car(args); i < count; i++, current = cdr(current)) {
+            spec = cdr(cdr(car(current)));
+            if (spec->type != CONS_TYPE || types[i] == TYPE_UNKNOWN)
+                continue;
+            type_walk(car(spec), inner, &step_type);
+            if (step_type != types[i]) {
+                types[i] = TYPE_UNKNOWN;
+                changed = 1;
+            }
+        }
+        TYPE_DRY_RUN--;
+    } while (changed);
+    for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+        type_walk_body(cdr(cdr(car(current))), inner);
+    type_walk_body(cdr(cdr(args)), inner);
+    car(cdr(args))->c.car = type_walk(car(car(cdr(args))), inner, &step_type);
+    return type_walk_body(cdr(car(cdr(args))), inner);
+}
+
+/* Returns the type of the result of a call to the named builtin with
+ * arguments of the given types. */
+enum inferred_type type_of_call(Value *head, enum inferred_type *arg_types, int argc) {
+    int i, all_fixnum = 1, all_number = 1, any_flonum = 0;
+    char *comparisons[] = {"=", "<", ">", "<=", ">=", "not", "null?", "equal?",
+        "number?", "integer?", "exact-integer?", "flonum?", "f64vector?",
+        "s64vector?", "matrix?", "vector?", "eq?", "eqv?", "string=?",
+        "hash-table?", "hash-table-contains?", "pmap?", "pmap-contains?",
+        "pvector?", "record?", "string?", "promise?", "stream?",
+        "stream-null?", "stream-pair?"};
+    char *flonum_results[] = {"f64vector-ref", "f64vector-sum", "f64vector-dot",
+        "f64vector-min", "f64vector-max"};
+    char *fixnum_results[] = {"f64vector-length", "s64vector-length",
+        "s64vector-ref", "s64vector-min", "s64vector-max", "matrix-rows",
+        "matrix-cols", "current-jiffy", "vector-length", "hash-table-size",
+        "pmap-size", "pvector-length", "length", "string-length"};
+    for (i = 0; i < sizeof(comparisons) / sizeof(char *); i++)
+        if (symbol_is(head, comparisons[i]))
+            return TYPE_BOOLEAN;
+    for (i = 0; i < sizeof(flonum_results) / sizeof(char *); i++)
+        if (symbol_is(head, flonum_results[i]))
+            return TYPE_FLONUM;
+    for (i = 0; i < sizeof(fixnum_results) / sizeof(char *); i++)
+        if (symbol_is(head, fixnum_results[i]))
+            return TYPE_FIXNUM;
+    for (i = 0; i < argc; i++) {
+        all_fixnum &= arg_types[i] == TYPE_FIXNUM;
+        any_flonum |= arg_types[i] == TYPE_FLONUM;
+        all_number &= arg_types[i] == TYPE_FIXNUM || arg_types[i] == TYPE_FLONUM;
+    }
+    if (symbol_is(head, "+") || symbol_is(head, "-") || symbol_is(head, "*")) {
+        if (all_fixnum)
+            return TYPE_FIXNUM;
+        if (all_number && any_flonum)
+            return TYPE_FLONUM;
+    } else if (symbol_is(head, "/")) {
+        if (all_number && argc == 2 && arg_types[0] == TYPE_FLONUM)
+            return TYPE_FLONUM;
+    }
+    return TYPE_UNKNOWN;
+}
+
+/* Infers the type of the expression, storing it in type, and rewrites in
+ * place every two-argument arithmetic or comparison call whose arguments are
+ * proven to be both fixnums or both flonums to call the unchecked primitive
+ * directly.  Returns the (possibly replaced) expression. */
+Value *type_walk(Value *expr, struct TypeEnv *env, enum inferred_type *type) {
+    Value *head, *args, *current, *primitive;
+    struct TypeEnv *entry, *inner;
+    enum inferred_type then_type, else_type, arg_types[2];
+    int argc;
+    *type = TYPE_UNKNOWN;
+    switch (expr->type) {
+        case INT_TYPE:
+            *type = TYPE_FIXNUM;
+            return expr;
+        case DOUBLE_TYPE:
+            *type = TYPE_FLONUM;
+            return expr;
+        case BOOL_TYPE:
+            *type = TYPE_BOOLEAN;
+            return expr;
+        case SYMBOL_TYPE:
+            entry = type_env_lookup(expr, env);
+            if (entry != NULL)
+                *type = entry->type;
+            return expr;
+        case CONS_TYPE:
+            if (is_syntax_form(expr))
+                return expr;
+            break;
+        default:
+            return expr;
+    }
+    head = car(expr);
+    args = cdr(expr);
+    if (head->type == SYMBOL_TYPE && type_env_lookup(head, env) == NULL
+            && args->type == CONS_TYPE) {
+        if (symbol_is(head, "quote")) {
+            return expr;
+        } else if (symbol_is(head, "lambda")) {
+            inner = type_env_add_unknown(car(args), env);
+            inner = type_env_add_unknown(collect_targets(cdr(args), "define", makeNull()), inner);
+            type_walk_body(cdr(args), inner);
+            return expr;
+        } else if (symbol_is(head, "define")) {
+            inner = env;
+            if (car(args)->type == CONS_TYPE) {
+                inner = type_env_add_unknown(cdr(car(args)), inner);
+                inner = type_env_add_unknown(collect_targets(cdr(args), "define", makeNull()), inner);
+            }
+            type_walk_body(cdr(args), inner);
+            return expr;
+        } else if (is_let_form(head)) {
+            *type = type_walk_let(expr, env);
+            return expr;
+        } else if (symbol_is(head, "do")) {
+            *type = type_walk_do(expr, env);
+            return expr;
+        } else if (symbol_is(head, "if")) {
+            args->c.car = type_walk(car(args), env, &then_type);
+            if (cdr(args)->type != CONS_TYPE)
+                return expr;
+            current = cdr(args);
+            current->c.car = type_walk(car(current), type_guards(car(args), env), &then_type);
+            if (cdr(current)->type != CONS_TYPE)
+                return expr;
+            current = cdr(current);
+            current->c.car = type_walk(car(current), env, &else_type);
+            *type = type_join(then_type, else_type);
+            return expr;
+        } else if (symbol_is(head, "cond")) {
+            then_type = TYPE_UNKNOWN;
+            for (current = args; current->type == CONS_TYPE; current = cdr(current)) {
+                if (car(current)->type != CONS_TYPE)
+                    return expr;
+                if (symbol_is(car(car(current)), "else")) {
+                    else_type = type_walk_body(cdr(car(current)), env);
+                    *type = current == args ? else_type : type_join(then_type, else_type);
+                    return expr;
+                }
+                car(current)->c.car = type_walk(car(car(current)), env, &else_type);
+                else_type = type_walk_body(cdr(car(current)), type_guards(car(car(current)), env));
+                then_type = current == args ? else_type : type_join(then_type, else_type);
+            }
+            return expr;
+        } else if (is_values_form(head)) {
+            inner = type_env_add_unknown(values_form_binders(expr), env);
+            if (!symbol_is(head, "receive")) {
+                for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+                    if (car(current)->type == CONS_TYPE)
+                        type_walk_body(cdr(car(current)), inner);
+            }
+            *type = type_walk_body(cdr(args), inner);
+            return expr;
+        } else if (symbol_is(head, "case")) {
+            args->c.car = type_walk(car(args), env, &then_type);
+            for (current = cdr(args); current->type == CONS_TYPE; current = cdr(current))
+                if (car(current)->type == CONS_TYPE)
+                    type_walk_body(cdr(car(current)), env);
+            return expr;
+        } else if (symbol_is(head, "guard") && car(args)->type == CONS_TYPE) {
+            inner = type_env_add_unknown(car(car(args)), env);
+            for (current = cdr(car(args)); current->type == CONS_TYPE; current = cdr(current))
+                type_walk_body(car(current), inner);
+            type_walk_body(cdr(args), env);
+            return expr;
+        } else if (symbol_is(head, "when")) {
+            args->c.car = type_walk(car(args), env, &then_type);
+            type_walk_body(cdr(args), type_guards(car(args), env));
+            return expr;
+        } else if (symbol_is(head, "and")) {
+            // Each argument is only evaluated if all of the preceding ones
+            // evaluated to #t
+            inner = env;
+            for (current = args; current->type == CONS_TYPE; current = cdr(current)) {
+                current->c.car = type_walk(car(current), inner, &then_type);
+                inner = type_guards(car(current), inner);
+            }
+            *type = TYPE_BOOLEAN;
+            return expr;
+        } else if (symbol_is(head, "or")) {
+            type_walk_body(args, env);
+            *type = TYPE_BOOLEAN;
+            return expr;
+        } else if (symbol_is(head, "begin")) {
+            *type = type_walk_body(args, env);
+            return expr;
+        }
+    }
+    if (head->type == CONS_TYPE)
+        expr->c.car = type_walk(head, env, &then_type);
+    argc = 0;
+    for (current = args; current->type == CONS_TYPE; current = cdr(current)) {
+        current->c.car = type_walk(car(current), env, &then_type);
+        if (argc < 2)
+            arg_types[argc] = then_type;
+        argc++;
+    }
+    if (!is_builtin(head, env))
+        return expr;
+    if (argc <= 2)
+        *type = type_of_call(head, arg_types, argc);
+    else if (symbol_is(head, "=") || symbol_is(head, "<") || symbol_is(head, ">")
+            || symbol_is(head, "<=") || symbol_is(head, ">="))
+        *type = TYPE_BOOLEAN;
+    if (argc == 2 && arg_types[0] == arg_types[1]) {
+        primitive = NULL;
+        if (arg_types[0] == TYPE_FIXNUM)
+            primitive = unchecked_primitive(head->s, INT_TYPE);
+        else if (arg_types[0] == TYPE_FLONUM)
+            primitive = unchecked_primitive(head->s, DOUBLE_TYPE);
+        if (primitive != NULL && !TYPE_DRY_RUN)
+            expr->c.car = primitive;
+    }
+    return expr;
+}
+
+/* Rewrites arithmetic and comparisons on operands of proven type to call
+ * unchecked primitives, in every top-level form. */
+Value *infer_types(Value *tree) {
+    Value *current;
+    enum inferred_type type;
+    for (current = tree; current->type == CONS_TYPE; current = cdr(current))
+        current->c.car = type_walk(car(current), NULL, &type);
+    return tree;
+}
+
+
+////////////////////////////////////////
+//////////// DEFORESTATION /////////////
+////////////////////////////////////////
+
+// Builtin procedures which neither have side effects nor call procedures.
+// Many of them raise errors, which the pipeline primitive raises in the
+// order of the unfused expression.
+char *PURE_PRIMITIVES[] = {
+    "car", "cdr", "cons", "+", "-", "*", "/", "modulo", "quotient",
+    "remainder", "expt", "=", ">", "<", ">=", "<=", "null?", "list", "append",
+    "equal?", "eqv?", "eq?", "string=?", "number?", "integer?",
+    "exact-integer?", "flonum?", "values", "pmap", "pmap?", "pmap-size",
+    "pmap-ref/default", "pmap-contains?", "pmap-set", "pmap-delete",
+    "pvector", "pvector?", "pvector-length", "pvector-ref", "pvector-set",
+    "pvector-push", "pvector-pop", "length", "reverse", "list-tail", "list-ref",
+    "memq", "memv", "assq", "assv", "string?", "string-length", "substring",
+    "string-append", "string-search", "string-split", "string->number",
+    "number->string", "make-promise", "promise?", "stream?",
+};
+
+// Special forms which have no side effects beyond those of their
+// subexpressions.
+char *PURE_FORMS[] = {
+    "if", "when", "unless", "and", "or", "begin", "not",
+};
+
+/* Returns 1 if the symbol is one of the given names and refers to its builtin
+ * meaning here. */
+int is_builtin_in(Value *symbol, char **names, int count, struct TypeEnv *env) {
+    int i;
+    if (!is_builtin(symbol, env))
+        return 0;
+    for (i = 0; i < count; i++)
+        if (strcmp(symbol->s, names[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* Returns the environment inside a lambda, procedure define, let-family or do
+ * form, in which every variable it binds, including internal definitions of
+ * its body, has an unknown type. */
+struct TypeEnv *binding_form_scope(Value *expr, struct TypeEnv *env) {
+    Value *head = car(expr), *args = cdr(expr), *current;
+    if (symbol_is(head, "lambda")) {
+        env = type_env_add_unknown(car(args), env);
+    } else if (symbol_is(head, "define")) {
+        if (car(args)->type == CONS_TYPE)
+            env = type_env_add_unknown(cdr(car(args)), env);
+    } else {
+        if (car(args)->type == SYMBOL_TYPE) {
+            env = type_env_add(car(args), TYPE_UNKNOWN, env);
+            args = cdr(args);
+            if (args->type != CONS_TYPE)
+                return env;
+        }
+        for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type == CONS_TYPE)
+                env = type_env_add_unknown(list(1, car(car(current))), env);
+    }
+    return type_env_add_unknown(collect_targets(cdr(args), "define", makeNull()), env);
+}
+
+int is_pure_expr(Value *expr, struct TypeEnv *env);
+
+/* Returns 1 if every element of the list is a pure expression. */
+int is_pure_list(Value *list, struct TypeEnv *env) {
+    for (; list->type == CONS_TYPE; list = cdr(list))
+        if (!is_pure_expr(car(list), env))
+            return 0;
+    return 1;
+}
+
+/* Returns 1 if evaluating the expression can have no side effect: it only
+ * refers to variables, calls pure builtin procedures, creates closures, and
+ * uses special forms without side effects of their own. */
+int is_pure_expr(Value *expr, struct TypeEnv *env) {
+    Value *head, *args, *current;
+    struct TypeEnv *inner;
+    if (expr->type != CONS_TYPE)
+        return 1;
+    head = car(expr);
+    args = cdr(expr);
+    if (head->type != SYMBOL_TYPE || type_env_lookup(head, env) != NULL)
+        return 0;
+    if (symbol_is(head, "quote") || symbol_is(head, "lambda"))
+        return 1;
+    if (is_builtin_in(head, PURE_PRIMITIVES, sizeof(PURE_PRIMITIVES) / sizeof(char *), env))
+        return is_pure_list(args, env);
+    if (is_builtin_in(head, PURE_FORMS, sizeof(PURE_FORMS) / sizeof(char *), env))
+        return is_pure_list(args, env);
+    if (symbol_is(head, "cond")) {
+        for (current = args; current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type != CONS_TYPE || !is_pure_list(car(current), env))
+                return 0;
+        return 1;
+    }
+    if (is_let_form(head) && args->type == CONS_TYPE && car(args)->type != SYMBOL_TYPE) {
+        inner = binding_form_scope(expr, env);
+        for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+            if (car(current)->type != CONS_TYPE || !is_pure_list(cdr(car(current)), inner))
+                return 0;
+        return is_pure_list(cdr(args), inner);
+    }
+    return 0;
+}
+
+/* Returns 1 if the expression evaluates to a procedure which has no side
+ * effects when called: a pure builtin, or a lambda with a pure body. */
+int is_pure_procedure(Value *expr, struct TypeEnv *env) {
+    if (expr->type == SYMBOL_TYPE)
+        return is_builtin_in(expr, PURE_PRIMITIVES, sizeof(PURE_PRIMITIVES) / sizeof(char *), env);
+    if (expr->type != CONS_TYPE || !symbol_is(car(expr), "lambda")
+            || type_env_lookup(car(expr), env) != NULL
+            || cdr(expr)->type != CONS_TYPE)
+        return 0;
+    return is_pure_list(cdr(cdr(expr)), binding_form_scope(expr, env));
+}
+
+/* If the expression is a composition of at least two single-list map,
+ * filter and fold calls whose procedures are pure, with fold only outermost,
+ * returns the equivalent call to the pipeline primitive.  Otherwise returns
+ * NULL. */
+Value *fuse_pipeline(Value *expr, struct TypeEnv *env) {
+    Value *ops, *fargs, *current, *head, *next, *init;
+    int n = 0, max_stages, argc;
+    Value *primitive = pipeline_primitive(&max_stages);
+    ops = makeNull();
+    fargs = makeNull();
+    current = expr;
+    while (n < max_stages && current->type == CONS_TYPE) {
+        head = car(current);
+        if (!is_builtin(head, env))
+            break;
+        argc = list_length(cdr(current));
+        init = NULL;
+        if (symbol_is(head, "fold") && n == 0 && argc == 3) {
+            init = car(cdr(cdr(current)));
+            next = car(cdr(cdr(cdr(current))));
+        } else if ((symbol_is(head, "map") || symbol_is(head, "filter")) && argc == 2) {
+            next = car(cdr(cdr(current)));
+        } else {
+            break;
+        }
+        if (!is_pure_procedure(car(cdr(current)), env))
+            break;
+        fargs = cons(car(cdr(current)), fargs);
+        if (init != NULL)
+            fargs = cons(init, fargs);
+        ops = cons(head, ops);
+        current = next;
+        n++;
+    }
+    if (n < 2)
+        return NULL;
+    return cons(primitive,
+            cons(list(2, make_symbol_value("quote"), reverse(ops)),
+                append(2, reverse(fargs), list(1, current))));
+}
+
+Value *scope_walk(Value *expr, struct TypeEnv *env, Value *(*rewrite)(Value *, struct TypeEnv *));
+
+/* Walks each element of the list in place. */
+void scope_walk_list(Value *list, struct TypeEnv *env, Value *(*rewrite)(Value *, struct TypeEnv *)) {
+    for (; list->type == CONS_TYPE; list = cdr(list))
+        list->c.car = scope_walk(car(list), env, rewrite);
+}
+
+/* Applies rewrite to every expression in the tree, outermost first, with the
+ * environment in which it is evaluated; rewrite returns a replacement, whose
+ * subexpressions are walked in turn, or NULL to keep the expression.  Quoted
+ * data, define-syntax forms and macro uses are left alone.  Returns the
+ * (possibly replaced) expression. */
+Value *scope_walk(Value *expr, struct TypeEnv *env, Value *(*rewrite)(Value *, struct TypeEnv *)) {
+    Value *head, *args, *current, *rewritten;
+    struct TypeEnv *inner;
+    if (expr->type != CONS_TYPE || is_syntax_form(expr))
+        return expr;
+    rewritten = rewrite(expr, env);
+    if (rewritten != NULL)
+        expr = rewritten;
+    head = car(expr);
+    args = cdr(expr);
+    if (head->type == SYMBOL_TYPE && type_env_lookup(head, env) == NULL
+            && args->type == CONS_TYPE) {
+        if (symbol_is(head, "quote")) {
+            return expr;
+        } else if (symbol_is(head, "lambda") || (symbol_is(head, "define")
+                    && car(args)->type == CONS_TYPE)) {
+            scope_walk_list(cdr(args), binding_form_scope(expr, env), rewrite);
+            return expr;
+        } else if (is_let_form(head) || symbol_is(head, "do")) {
+            inner = binding_form_scope(expr, env);
+            if (car(args)->type == SYMBOL_TYPE)
+                args = cdr(args);
+            if (args->type != CONS_TYPE)
+                return expr;
+            for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+                if (car(current)->type == CONS_TYPE)
+                    scope_walk_list(cdr(car(current)), inner, rewrite);
+            if (symbol_is(head, "do")) {
+                if (cdr(args)->type != CONS_TYPE)
+                    return expr;
+                scope_walk_list(car(cdr(args)), inner, rewrite);
+                args = cdr(args);
+            }
+            scope_walk_list(cdr(args), inner, rewrite);
+            return expr;
+        } else if (symbol_is(head, "cond")) {
+            for (current = args; current->type == CONS_TYPE; current = cdr(current))
+                scope_walk_list(car(current), env, rewrite);
+            return expr;
+        } else if (is_values_form(head)) {
+            inner = type_env_add_unknown(values_form_binders(expr), env);
+            if (!symbol_is(head, "receive")) {
+                for (current = car(args); current->type == CONS_TYPE; current = cdr(current))
+                    if (car(current)->type == CONS_TYPE)
+                        scope_walk_list(cdr(car(current)), inner, rewrite);
+            }
+            scope_walk_list(cdr(args), inner, rewrite);
+            return expr;
+        } else if (symbol_is(head, "case")) {
+            args->c.car = scope_walk(car(args), env, rewrite);
+            for (current = cdr(args); current->type == CONS_TYPE; current = cdr(current))
+                if (car(current)->type == CONS_TYPE)
+                    scope_walk_list(cdr(car(current)), env, rewrite);
+            return expr;
+        } else if (symbol_is(head, "guard") && car(args)->type == CONS_TYPE) {
+            inner = type_env_add_unknown(car(car(args)), env);
+            for (current = cdr(car(args)); current->type == CONS_TYPE; current = cdr(current))
+                scope_walk_list(car(current), inner, rewrite);
+            scope_walk_list(cdr(args), env, rewrite);
+            return expr;
+        }
+    }
+    scope_walk_list(expr, env, rewrite);
+    return expr;
+}
+
+/* Fuses map/filter/fold pipelines in every top-level form. */
+Value *deforest(Value *tree) {
+    scope_walk_list(tree, NULL, fuse_pipeline);
+    return tree;
+}
+
+
+////////////////////////////////////////
+/////////// ESCAPE ANALYSIS ////////////
+////////////////////////////////////////
+
+// call/cc copies the stack so that its continuation can be re-entered after
+// it has returned.  When the continuation is only ever called from within the
+// procedure receiving it, call/ec, which only escapes, behaves the same.
+
+/* Returns 1 if the symbol only occurs in the expression as the operator of a
+ * call evaluated before the expression returns: never as a value, and never
+ * inside a lambda, procedure define, promise or macro use, nor inside a
+ * named let whose name could be called after the loop returns. */
+int only_called(Value *symbol, Value *expr) {
+    Value *head;
+    if (expr->type == SYMBOL_TYPE)
+        return strcmp(expr->s, symbol->s) != 0;
+    if (expr->type != CONS_TYPE)
+        return 1;
+    head = car(expr);
+    if (symbol_is(head, "quote"))
+        return 1;
+    if (symbol_is(head, "lambda") || symbol_is(head, "define") || symbol_is(head, "delay")
+            || symbol_is(head, "delay-force") || symbol_is(head, "stream-cons") || is_syntax_form(expr))
+        return count_symbol(expr, symbol) == 0;
+    if (symbol_is(head, "let") && cdr(expr)->type == CONS_TYPE
+            && car(cdr(expr))->type == SYMBOL_TYPE && count_symbol(expr, symbol) > 0
+            && !only_called(car(cdr(expr)), cdr(cdr(expr))))
+        return 0;
+    if (head->type == SYMBOL_TYPE && strcmp(head->s, symbol->s) == 0)
+        expr = cdr(expr);
+    for (; expr->type == CONS_TYPE; expr = cdr(expr))
+        if (!only_called(symbol, car(expr)))
+            return 0;
+    return only_called(symbol, expr);
+}
+
+/* If the expression calls the builtin call/cc on a lambda of one parameter
+ * which is only called within it, returns the equivalent call to call/ec.
+ * Otherwise returns NULL. */
+Value *escape_continuation(Value *expr, struct TypeEnv *env) {
+    Value *head = car(expr), *f, *k;
+    if (!(symbol_is(head, "call/cc") || symbol_is(head, "call-with-current-continuation"))
+            || !is_builtin(head, env) || list_length(cdr(expr)) != 1)
+        return NULL;
+    f = car(cdr(expr));
+    if (f->type != CONS_TYPE || !symbol_is(car(f), "lambda") || !is_builtin(car(f), env)
+            || list_length(cdr(f)) < 2 || list_length(car(cdr(f))) != 1)
+        return NULL;
+    k = car(car(cdr(f)));
+    if (k->type != SYMBOL_TYPE || !only_called(k, cdr(cdr(f))))
+        return NULL;
+    return cons(escape_primitive(), cdr(expr));
+}
+
+/* Turns call/cc into call/ec in every top-level form wherever the
+ * continuation cannot be re-entered. */
+Value *analyze_escapes(Value *tree) {
+    scope_walk_list(tree, NULL, escape_continuation);
+    return tree;
+}
+
+
+////////////////////////////////////////
+/////////////// DRIVER /////////////////
+////////////////////////////////////////
+
+/* Replaces each well-formed define-record-type and define-memoized form in
+ * the expression, outside of quoted data and macros, by the definitions for
+ * which it stands, so that the passes below see the names it defines. */
+Value *expand_derived_definitions(Value *expr) {
+    Value *current, *expansion;
+    if (expr->type != CONS_TYPE || symbol_is(car(expr), "quote") || is_syntax_form(expr))
+        return expr;
+    if (symbol_is(car(expr), "define-record-type")) {
+        expansion = expand_define_record_type(cdr(expr));
+        return expansion != NULL ? expansion : expr;
+    }
+    if (symbol_is(car(expr), "define-memoized")) {
+        expansion = expand_define_memoized(cdr(expr));
+        if (expansion == NULL)
+            return expr;
+        expr = expansion;
+    }
+    for (current = expr; current->type == CONS_TYPE; current = cdr(current))
+        current->c.car = expand_derived_definitions(car(current));
+    return expr;
+}
+
+/* Takes the parse tree of a Scheme program and returns an equivalent parse
+ * tree with the enabled source-to-source optimizations applied.  The tree may
+ * be modified in place. */
+Value *optimize(Value *tree) {
+    SYNTAX_KEYWORDS = collect_targets(tree, "define-syntax", makeNull());
+    tree = expand_derived_definitions(tree);
+    DEFINED_SYMBOLS = collect_targets(tree, "define", makeNull());
+    ASSIGNED_SYMBOLS = collect_targets(tree, "set!", makeNull());
+    if (SYNTAX_KEYWORDS->type == CONS_TYPE) {
+        DEFINED_SYMBOLS = collect_syntax_symbols(tree, DEFINED_SYMBOLS);
+        ASSIGNED_SYMBOLS = collect_syntax_symbols(tree, ASSIGNED_SYMBOLS);
+    }
+    if (INLINE_ENABLED)
+        tree = inline_procedures(tree);
+    if (DEFORESTATION_ENABLED)
+        tree = deforest(tree);
+    if (ESCAPE_ANALYSIS_ENABLED)
+        tree = analyze_escapes(tree);
+    if (TYPE_INFERENCE_ENABLED)
+        tree = infer_types(tree);
+    return tree;
+}
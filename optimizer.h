@@ -0,0 +1,32 @@
+#include "value.h"
+
+#ifndef _OPTIMIZER
+#define _OPTIMIZER
+
+/* Set to 0 to disable inlining of small top-level procedures. */
+extern int INLINE_ENABLED;
+
+/* Set to 1 to print every inlined call site to stderr. */
+extern int INLINE_REPORT;
+
+/* Maximum number of nodes in a procedure body for it to be inlined. */
+extern int INLINE_SIZE_LIMIT;
+
+/* Set to 0 to disable rewriting arithmetic and comparisons on operands of
+ * proven type to unchecked primitives. */
+extern int TYPE_INFERENCE_ENABLED;
+
+/* Set to 0 to disable fusing compositions of map, filter and fold with pure
+ * procedures into a single traversal. */
+extern int DEFORESTATION_ENABLED;
+
+/* Set to 0 to disable turning call/cc into call/ec where the continuation
+ * cannot be called after call/cc returns. */
+extern int ESCAPE_ANALYSIS_ENABLED;
+
+/* Takes the parse tree of a Scheme program and returns an equivalent parse
+ * tree with the enabled source-to-source optimizations applied.  The tree may
+ * be modified in place. */
+Value *optimize(Value *tree);
+
+#endif
@@ -4,6 +4,7 @@
 #include "value.h"
 #include "talloc.h"
 #include "linkedlist.h"
+#include "error.h"
 
 
 /* Handle singlequote, and in particular, dot types in singlequote blocks. */
@@ -22,9 +23,9 @@ Value *handle_singlequotes(Value *tree) {
                 if (car(next)->type == CONS_TYPE)
                     next->c.car = handle_singlequotes(car(next));
                 if (cdr(next)->type != NULL_TYPE) {
-                    fprintf(stderr, "Syntax error: failed to parse DOT_TYPE: missing close paren: ");
-                    display_to_fd(tree, stderr);
-                    texit(3);
+                    fprintf(error_stream(), "Syntax error: failed to parse DOT_TYPE: missing close paren: ");
+                    display_to_fd(tree, error_stream());
+                    raise_error(3);
                 }
                 prev->c.cdr = car(next);
                 current = next;
@@ -48,6 +49,24 @@ Value *handle_singlequotes(Value *tree) {
     return tree;
 }
 
+/* Returns a new vector of the data in the given list, which were parsed
+ * between #( and ). */
+Value *make_vector_literal(Value *data) {
+    Value *vector, *current;
+    long length = 0, i;
+    data = handle_singlequotes(data);
+    for (current = data; current->type == CONS_TYPE; current = cdr(current))
+        length++;
+    if (current->type != NULL_TYPE) {
+        fprintf(error_stream(), "Syntax error: dot in vector literal\n");
+        raise_error(3);
+    }
+    vector = makeVector(length);
+    for (i = 0, current = data; i < length; i++, current = cdr(current))
+        vector->vec.items[i] = car(current);
+    return vector;
+}
+
 /* Takes a list of tokens from a Scheme program, and returns a pointer to a
  * parse tree representing that program. */
 Value *parse(Value *tokens) {
@@ -66,9 +85,11 @@ Value *parse(Value *tokens) {
         switch (token->type) {
             case OPEN_TYPE:
             case OPENBRACKET_TYPE:
+            case OPENVECTOR_TYPE:
                 depth++;
             case INT_TYPE:
             case DOUBLE_TYPE:
+            case BIGNUM_TYPE:
             case STR_TYPE:
             case BOOL_TYPE:
             case SYMBOL_TYPE:
@@ -88,8 +109,8 @@ CLOSE_TYPE_LOOP:
                 // the NULL_TYPE tmp value.
                 tmp = tree;
                 if (tmp->type == NULL_TYPE) {
-                    fprintf(stderr, "Syntax error: close parenthesis with no matching open parenthesis\n");
-                    texit(3);
+                    fprintf(error_stream(), "Syntax error: close parenthesis with no matching open parenthesis\n");
+                    raise_error(3);
                 }
                 tmp_val = car(tmp);
                 tree = cdr(tree);
@@ -97,11 +118,20 @@ CLOSE_TYPE_LOOP:
                     case OPEN_TYPE:
                     case OPENBRACKET_TYPE:
                         if (token->type - 1 != tmp_val->type) { // CLOSE*_TYPE - 1 is OPEN*_TYPE
-                            fprintf(stderr, "Syntax error: mismatched bracket or parenthesis\n");
-                            texit(3);
+                            fprintf(error_stream(), "Syntax error: mismatched bracket or parenthesis\n");
+                            raise_error(3);
                         }
                         tree = cons(tmp_stack, tree);
                         break;
+                    case OPENVECTOR_TYPE:
+                        if (token->type != CLOSE_TYPE) {
+                            fprintf(error_stream(), "Syntax error: mismatched bracket or parenthesis\n");
+                            raise_error(3);
+                        }
+                        // The elements are handled here, as handle_singlequotes
+                        // does not look inside vectors
+                        tree = cons(make_vector_literal(tmp_stack), tree);
+                        break;
                     default:
                         // tmp is already a cons cell, no need to allocate
                         // another to add to the stack
@@ -112,14 +142,14 @@ CLOSE_TYPE_LOOP:
                 break;
             default:
                 // Should not be possible to get here
-                fprintf(stderr, "Syntax error: invalid token of type %d in token list\n", token->type);
-                texit(3);
+                fprintf(error_stream(), "Syntax error: invalid token of type %d in token list\n", token->type);
+                raise_error(3);
         }
         current = cdr(current);
     }
     if (depth != 0) {
-        fprintf(stderr, "Syntax error: open parenthesis with no matching close parenthesis\n");
-        texit(3);
+        fprintf(error_stream(), "Syntax error: open parenthesis with no matching close parenthesis\n");
+        raise_error(3);
     }
     tree = reverse(tree);
     tree = handle_singlequotes(tree);
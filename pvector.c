@@ -0,0 +1,179 @@
+/* pvector.c
+ *
+ * Persistent vectors as radix-balanced tries of 32-way nodes, after
+ * Clojure's.  Indexing walks one node per five bits of the index, at most
+ * thirteen, and an update copies only the nodes on that path; appending
+ * copies the tail, and once every 32 elements moves it into the trie as a
+ * full leaf.
+ */
+
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "pvector.h"
+
+#define MASK (PVECTOR_WIDTH - 1)
+
+/* Returns a new node whose children are all NULL. */
+struct PVectorNode *pvector_node() {
+    struct PVectorNode *node = talloc(sizeof(struct PVectorNode));
+    memset(node, 0, sizeof(struct PVectorNode));
+    return node;
+}
+
+/* Returns a copy of the node, which may then be changed. */
+struct PVectorNode *pvector_copy_node(struct PVectorNode *node) {
+    struct PVectorNode *copy = talloc(sizeof(struct PVectorNode));
+    memcpy(copy, node, sizeof(struct PVectorNode));
+    return copy;
+}
+
+/* Returns a new vector of the given fields. */
+struct PVector *pvector_new(long length, int shift, struct PVectorNode *root, Value **tail) {
+    struct PVector *vector = talloc(sizeof(struct PVector));
+    vector->length = length;
+    vector->shift = shift;
+    vector->root = root;
+    vector->tail = tail;
+    return vector;
+}
+
+/* Returns the number of elements held in the trie rather than the tail. */
+long pvector_tail_offset(long length) {
+    return length < PVECTOR_WIDTH ? 0 : ((length - 1) >> PVECTOR_BITS) << PVECTOR_BITS;
+}
+
+/* Returns a copy of the first n elements of the tail, with room for one
+ * more. */
+Value **pvector_copy_tail(Value **tail, long n) {
+    Value **copy = talloc(sizeof(Value *) * (n + 1));
+    if (n > 0)
+        memcpy(copy, tail, sizeof(Value *) * n);
+    return copy;
+}
+
+struct PVector *pvector_empty() {
+    return pvector_new(0, PVECTOR_BITS, pvector_node(), NULL);
+}
+
+/* Returns the elements of the leaf or tail holding element i. */
+Value **pvector_leaf(struct PVector *vector, long i) {
+    struct PVectorNode *node = vector->root;
+    int level;
+    if (i >= pvector_tail_offset(vector->length))
+        return vector->tail;
+    for (level = vector->shift; level > 0; level -= PVECTOR_BITS)
+        node = node->children[(i >> level) & MASK];
+    return node->items;
+}
+
+Value *pvector_ref(struct PVector *vector, long i) {
+    return pvector_leaf(vector, i)[i & MASK];
+}
+
+/* Returns a copy of the subtrie at the given level with element i set. */
+struct PVectorNode *pvector_set_helper(struct PVectorNode *node, int level, long i, Value *value) {
+    struct PVectorNode *copy = pvector_copy_node(node);
+    if (level == 0)
+        copy->items[i & MASK] = value;
+    else
+        copy->children[(i >> level) & MASK] = pvector_set_helper(node->children[(i >> level) & MASK], level - PVECTOR_BITS, i, value);
+    return copy;
+}
+
+struct PVector *pvector_set(struct PVector *vector, long i, Value *value) {
+    long offset = pvector_tail_offset(vector->length);
+    Value **tail;
+    if (i >= offset) {
+        tail = pvector_copy_tail(vector->tail, vector->length - offset);
+        tail[i - offset] = value;
+        return pvector_new(vector->length, vector->shift, vector->root, tail);
+    }
+    return pvector_new(vector->length, vector->shift,
+            pvector_set_helper(vector->root, vector->shift, i, value), vector->tail);
+}
+
+/* Returns a new path of nodes down the given number of levels to the leaf. */
+struct PVectorNode *pvector_new_path(int level, struct PVectorNode *leaf) {
+    struct PVectorNode *node;
+    if (level == 0)
+        return leaf;
+    node = pvector_node();
+    node->children[0] = pvector_new_path(level - PVECTOR_BITS, leaf);
+    return node;
+}
+
+/* Returns a copy of the subtrie at the given level with the leaf added as
+ * the leaf holding element i. */
+struct PVectorNode *pvector_push_leaf(struct PVectorNode *node, int level, long i, struct PVectorNode *leaf) {
+    struct PVectorNode *copy = pvector_copy_node(node), *child;
+    int slot = (i >> level) & MASK;
+    if (level == PVECTOR_BITS) {
+        copy->children[slot] = leaf;
+    } else {
+        child = node->children[slot];
+        copy->children[slot] = child != NULL ? pvector_push_leaf(child, level - PVECTOR_BITS, i, leaf)
+            : pvector_new_path(level - PVECTOR_BITS, leaf);
+    }
+    return copy;
+}
+
+struct PVector *pvector_push(struct PVector *vector, Value *value) {
+    long offset = pvector_tail_offset(vector->length), tail_length = vector->length - offset;
+    struct PVectorNode *leaf, *root;
+    Value **tail;
+    int shift = vector->shift;
+    if (vector->length == 0 || tail_length < PVECTOR_WIDTH) {
+        tail = pvector_copy_tail(vector->tail, tail_length);
+        tail[tail_length] = value;
+        return pvector_new(vector->length + 1, shift, vector->root, tail);
+    }
+    // The tail is full: it becomes the leaf for elements offset onward
+    leaf = talloc(sizeof(struct PVectorNode));
+    memcpy(leaf->items, vector->tail, sizeof(leaf->items));
+    if ((offset >> PVECTOR_BITS) >= (1L << shift)) {
+        // The trie is full at this height
+        root = pvector_node();
+        root->children[0] = vector->root;
+        root->children[1] = pvector_new_path(shift, leaf);
+        shift += PVECTOR_BITS;
+    } else {
+        root = pvector_push_leaf(vector->root, shift, offset, leaf);
+    }
+    tail = talloc(sizeof(Value *));
+    tail[0] = value;
+    return pvector_new(vector->length + 1, shift, root, tail);
+}
+
+/* Returns a copy of the subtrie at the given level without the leaf holding
+ * element i, or NULL if that leaves it empty. */
+struct PVectorNode *pvector_pop_leaf(struct PVectorNode *node, int level, long i) {
+    struct PVectorNode *copy, *child = NULL;
+    int slot = (i >> level) & MASK;
+    if (level > PVECTOR_BITS)
+        child = pvector_pop_leaf(node->children[slot], level - PVECTOR_BITS, i);
+    if (child == NULL && slot == 0)
+        return NULL;
+    copy = pvector_copy_node(node);
+    copy->children[slot] = child;
+    return copy;
+}
+
+struct PVector *pvector_pop(struct PVector *vector) {
+    long offset = pvector_tail_offset(vector->length);
+    struct PVectorNode *root;
+    int shift = vector->shift;
+    if (vector->length == 1)
+        return pvector_empty();
+    if (vector->length - offset > 1)
+        return pvector_new(vector->length - 1, shift, vector->root, vector->tail);
+    // The tail empties: the last leaf of the trie becomes the tail
+    root = pvector_pop_leaf(vector->root, shift, offset - 1);
+    if (root == NULL)
+        root = pvector_node();
+    if (shift > PVECTOR_BITS && root->children[1] == NULL) {
+        root = root->children[0];
+        shift -= PVECTOR_BITS;
+    }
+    return pvector_new(vector->length - 1, shift, root, pvector_leaf(vector, offset - 1));
+}
@@ -0,0 +1,46 @@
+#include "value.h"
+
+#ifndef _PVECTOR
+#define _PVECTOR
+
+#define PVECTOR_BITS 5
+#define PVECTOR_WIDTH (1 << PVECTOR_BITS)
+
+// A node of a persistent vector's trie: an internal node of up to 32
+// children, or a leaf of exactly 32 elements.
+struct PVectorNode {
+    union {
+        struct PVectorNode *children[PVECTOR_WIDTH];
+        Value *items[PVECTOR_WIDTH];
+    };
+};
+
+// A persistent vector: a radix-balanced trie of 32-way nodes holding all but
+// its last elements, in full leaves, and a tail holding the last 1 to 32, so
+// that appending usually copies only the tail.  Neither the nodes nor the
+// tail are changed once built, so vectors share all but the path to the
+// elements in which they differ.
+struct PVector {
+    long length;
+    int shift;                  // of the root: 5 times its height above leaves
+    struct PVectorNode *root;
+    Value **tail;
+};
+
+/* Returns a new empty vector. */
+struct PVector *pvector_empty();
+
+/* Returns element i of the vector, 0 <= i < length. */
+Value *pvector_ref(struct PVector *vector, long i);
+
+/* Returns a vector like the given one but with element i, 0 <= i < length,
+ * set to the value. */
+struct PVector *pvector_set(struct PVector *vector, long i, Value *value);
+
+/* Returns a vector like the given one with the value appended. */
+struct PVector *pvector_push(struct PVector *vector, Value *value);
+
+/* Returns a vector like the given one without its last element, length > 0. */
+struct PVector *pvector_pop(struct PVector *vector);
+
+#endif
@@ -0,0 +1,526 @@
+/* simd.c
+ *
+ * Elementwise and reduction kernels for f64vectors, the inner kernel of
+ * matrix multiplication, and substring search for strings.  On x86-64 each has an
+ * AVX2 and an SSE2 version, compiled for that target alone with the target
+ * attribute so that the rest of the interpreter still runs on any x86-64;
+ * the version used is picked the first time a kernel is called, from what
+ * the CPU reports.  Elsewhere only the plain C versions are built.
+ */
+
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+int SIMD_ENABLED = 1;
+
+/* Returns the sum of the eight partial sums of a reduction, in the order
+ * which the vector versions reach by adding their halves. */
+double combine_sums(const double *acc) {
+    return ((acc[0] + acc[4]) + (acc[2] + acc[6])) + ((acc[1] + acc[5]) + (acc[3] + acc[7]));
+}
+
+
+////////////////////////////////////////
+/////////////// SCALAR /////////////////
+////////////////////////////////////////
+
+void f64_add_scalar(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i < n; i++)
+        r[i] = a[i] + b[i];
+}
+
+void f64_mul_scalar(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i < n; i++)
+        r[i] = a[i] * b[i];
+}
+
+void f64_scale_scalar(double *r, const double *a, double k, long n) {
+    long i;
+    for (i = 0; i < n; i++)
+        r[i] = a[i] * k;
+}
+
+double f64_sum_scalar(const double *a, long n) {
+    double acc[8] = {0, 0, 0, 0, 0, 0, 0, 0}, sum;
+    long i;
+    int j;
+    for (i = 0; i + 8 <= n; i += 8)
+        for (j = 0; j < 8; j++)
+            acc[j] += a[i + j];
+    sum = combine_sums(acc);
+    for (; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+double f64_dot_scalar(const double *a, const double *b, long n) {
+    double acc[8] = {0, 0, 0, 0, 0, 0, 0, 0}, sum;
+    long i;
+    int j;
+    for (i = 0; i + 8 <= n; i += 8)
+        for (j = 0; j < 8; j++)
+            acc[j] += a[i + j] * b[i + j];
+    sum = combine_sums(acc);
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+void f64_vecmat_add_scalar(double *c, const double *a, const double *b, long stride, long depth, long n) {
+    long j, k;
+    for (k = 0; k < depth; k++)
+        for (j = 0; j < n; j++)
+            c[j] += a[k] * b[k * stride + j];
+}
+
+double f64_min_scalar(const double *a, long n) {
+    double min = a[0];
+    long i;
+    for (i = 1; i < n; i++)
+        min = a[i] < min ? a[i] : min;
+    return min;
+}
+
+double f64_max_scalar(const double *a, long n) {
+    double max = a[0];
+    long i;
+    for (i = 1; i < n; i++)
+        max = a[i] > max ? a[i] : max;
+    return max;
+}
+
+long bytes_find_scalar(const char *s, long n, const char *pattern, long m) {
+    const char *p = s, *last;
+    if (m == 0)
+        return 0;
+    if (m > n)
+        return -1;
+    last = s + n - m;
+    while (p <= last) {
+        p = memchr(p, pattern[0], last - p + 1);
+        if (p == NULL)
+            return -1;
+        if (memcmp(p + 1, pattern + 1, m - 1) == 0)
+            return p - s;
+        p++;
+    }
+    return -1;
+}
+
+
+#ifdef SIMD_X86
+
+////////////////////////////////////////
+//////////////// SSE2 //////////////////
+////////////////////////////////////////
+
+__attribute__((target("sse2")))
+void f64_add_sse2(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i + 2 <= n; i += 2)
+        _mm_storeu_pd(r + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    for (; i < n; i++)
+        r[i] = a[i] + b[i];
+}
+
+__attribute__((target("sse2")))
+void f64_mul_sse2(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i + 2 <= n; i += 2)
+        _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    for (; i < n; i++)
+        r[i] = a[i] * b[i];
+}
+
+__attribute__((target("sse2")))
+void f64_scale_sse2(double *r, const double *a, double k, long n) {
+    __m128d factor = _mm_set1_pd(k);
+    long i;
+    for (i = 0; i + 2 <= n; i += 2)
+        _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    for (; i < n; i++)
+        r[i] = a[i] * k;
+}
+
+/* Returns the sum of the eight partial sums held two to a register. */
+__attribute__((target("sse2")))
+double combine_sums_sse2(__m128d acc0, __m128d acc1, __m128d acc2, __m128d acc3) {
+    __m128d sum = _mm_add_pd(_mm_add_pd(acc0, acc2), _mm_add_pd(acc1, acc3));
+    return _mm_cvtsd_f64(sum) + _mm_cvtsd_f64(_mm_unpackhi_pd(sum, sum));
+}
+
+__attribute__((target("sse2")))
+double f64_sum_sse2(const double *a, long n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    double sum;
+    long i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+        acc2 = _mm_add_pd(acc2, _mm_loadu_pd(a + i + 4));
+        acc3 = _mm_add_pd(acc3, _mm_loadu_pd(a + i + 6));
+    }
+    sum = combine_sums_sse2(acc0, acc1, acc2, acc3);
+    for (; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+__attribute__((target("sse2")))
+double f64_dot_sse2(const double *a, const double *b, long n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    double sum;
+    long i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        acc2 = _mm_add_pd(acc2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+        acc3 = _mm_add_pd(acc3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+    }
+    sum = combine_sums_sse2(acc0, acc1, acc2, acc3);
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("sse2")))
+void f64_vecmat_add_sse2(double *c, const double *a, const double *b, long stride, long depth, long n) {
+    __m128d acc0, acc1, acc2, acc3, factor;
+    const double *row;
+    long j, k;
+    // Four independent sums hide the latency of the additions
+    for (j = 0; j + 8 <= n; j += 8) {
+        acc0 = _mm_loadu_pd(c + j);
+        acc1 = _mm_loadu_pd(c + j + 2);
+        acc2 = _mm_loadu_pd(c + j + 4);
+        acc3 = _mm_loadu_pd(c + j + 6);
+        for (k = 0, row = b + j; k < depth; k++, row += stride) {
+            factor = _mm_set1_pd(a[k]);
+            acc0 = _mm_add_pd(acc0, _mm_mul_pd(factor, _mm_loadu_pd(row)));
+            acc1 = _mm_add_pd(acc1, _mm_mul_pd(factor, _mm_loadu_pd(row + 2)));
+            acc2 = _mm_add_pd(acc2, _mm_mul_pd(factor, _mm_loadu_pd(row + 4)));
+            acc3 = _mm_add_pd(acc3, _mm_mul_pd(factor, _mm_loadu_pd(row + 6)));
+        }
+        _mm_storeu_pd(c + j, acc0);
+        _mm_storeu_pd(c + j + 2, acc1);
+        _mm_storeu_pd(c + j + 4, acc2);
+        _mm_storeu_pd(c + j + 6, acc3);
+    }
+    if (j < n)
+        f64_vecmat_add_scalar(c + j, a, b + j, stride, depth, n - j);
+}
+
+__attribute__((target("sse2")))
+double f64_min_sse2(const double *a, long n) {
+    __m128d acc = _mm_set1_pd(a[0]);
+    double min;
+    long i;
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_min_pd(_mm_loadu_pd(a + i), acc);
+    acc = _mm_min_pd(_mm_unpackhi_pd(acc, acc), acc);
+    min = _mm_cvtsd_f64(acc);
+    for (; i < n; i++)
+        min = a[i] < min ? a[i] : min;
+    return min;
+}
+
+__attribute__((target("sse2")))
+double f64_max_sse2(const double *a, long n) {
+    __m128d acc = _mm_set1_pd(a[0]);
+    double max;
+    long i;
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_max_pd(_mm_loadu_pd(a + i), acc);
+    acc = _mm_max_pd(_mm_unpackhi_pd(acc, acc), acc);
+    max = _mm_cvtsd_f64(acc);
+    for (; i < n; i++)
+        max = a[i] > max ? a[i] : max;
+    return max;
+}
+
+// The vector searches compare a block of candidate starts at once against
+// the first and the last byte of the pattern, and check the bytes between
+// only at starts where both match, which in text is rare.
+
+__attribute__((target("sse2")))
+long bytes_find_sse2(const char *s, long n, const char *pattern, long m) {
+    __m128i first, last, eq;
+    unsigned mask;
+    long i, found;
+    if (m == 0)
+        return 0;
+    first = _mm_set1_epi8(pattern[0]);
+    last = _mm_set1_epi8(pattern[m - 1]);
+    for (i = 0; i + m - 1 + 16 <= n; i += 16) {
+        eq = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(s + i))),
+                _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(s + i + m - 1))));
+        for (mask = _mm_movemask_epi8(eq); mask != 0; mask &= mask - 1) {
+            found = i + __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + found + 1, pattern + 1, m - 2) == 0)
+                return found;
+        }
+    }
+    found = bytes_find_scalar(s + i, n - i, pattern, m);
+    return found < 0 ? -1 : i + found;
+}
+
+
+////////////////////////////////////////
+//////////////// AVX2 //////////////////
+////////////////////////////////////////
+
+__attribute__((target("avx2")))
+void f64_add_avx2(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    for (; i < n; i++)
+        r[i] = a[i] + b[i];
+}
+
+__attribute__((target("avx2")))
+void f64_mul_avx2(double *r, const double *a, const double *b, long n) {
+    long i;
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    for (; i < n; i++)
+        r[i] = a[i] * b[i];
+}
+
+__attribute__((target("avx2")))
+void f64_scale_avx2(double *r, const double *a, double k, long n) {
+    __m256d factor = _mm256_set1_pd(k);
+    long i;
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+    for (; i < n; i++)
+        r[i] = a[i] * k;
+}
+
+/* Returns the sum of the eight partial sums held four to a register. */
+__attribute__((target("avx2")))
+double combine_sums_avx2(__m256d acc0, __m256d acc1) {
+    __m256d quad = _mm256_add_pd(acc0, acc1);
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(quad), _mm256_extractf128_pd(quad, 1));
+    return _mm_cvtsd_f64(sum) + _mm_cvtsd_f64(_mm_unpackhi_pd(sum, sum));
+}
+
+__attribute__((target("avx2")))
+double f64_sum_avx2(const double *a, long n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = acc0;
+    double sum;
+    long i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    sum = combine_sums_avx2(acc0, acc1);
+    for (; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+double f64_dot_avx2(const double *a, const double *b, long n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = acc0;
+    double sum;
+    long i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    sum = combine_sums_avx2(acc0, acc1);
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+void f64_vecmat_add_avx2(double *c, const double *a, const double *b, long stride, long depth, long n) {
+    __m256d acc0, acc1, acc2, acc3, factor;
+    const double *row;
+    long j, k;
+    // Four independent sums hide the latency of the additions
+    for (j = 0; j + 16 <= n; j += 16) {
+        acc0 = _mm256_loadu_pd(c + j);
+        acc1 = _mm256_loadu_pd(c + j + 4);
+        acc2 = _mm256_loadu_pd(c + j + 8);
+        acc3 = _mm256_loadu_pd(c + j + 12);
+        for (k = 0, row = b + j; k < depth; k++, row += stride) {
+            factor = _mm256_set1_pd(a[k]);
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(factor, _mm256_loadu_pd(row)));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(factor, _mm256_loadu_pd(row + 4)));
+            acc2 = _mm256_add_pd(acc2, _mm256_mul_pd(factor, _mm256_loadu_pd(row + 8)));
+            acc3 = _mm256_add_pd(acc3, _mm256_mul_pd(factor, _mm256_loadu_pd(row + 12)));
+        }
+        _mm256_storeu_pd(c + j, acc0);
+        _mm256_storeu_pd(c + j + 4, acc1);
+        _mm256_storeu_pd(c + j + 8, acc2);
+        _mm256_storeu_pd(c + j + 12, acc3);
+    }
+    if (j < n)
+        f64_vecmat_add_sse2(c + j, a, b + j, stride, depth, n - j);
+}
+
+__attribute__((target("avx2")))
+double f64_min_avx2(const double *a, long n) {
+    __m256d acc = _mm256_set1_pd(a[0]);
+    __m128d pair;
+    double min;
+    long i;
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_min_pd(_mm256_loadu_pd(a + i), acc);
+    pair = _mm_min_pd(_mm256_extractf128_pd(acc, 1), _mm256_castpd256_pd128(acc));
+    pair = _mm_min_pd(_mm_unpackhi_pd(pair, pair), pair);
+    min = _mm_cvtsd_f64(pair);
+    for (; i < n; i++)
+        min = a[i] < min ? a[i] : min;
+    return min;
+}
+
+__attribute__((target("avx2")))
+double f64_max_avx2(const double *a, long n) {
+    __m256d acc = _mm256_set1_pd(a[0]);
+    __m128d pair;
+    double max;
+    long i;
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_max_pd(_mm256_loadu_pd(a + i), acc);
+    pair = _mm_max_pd(_mm256_extractf128_pd(acc, 1), _mm256_castpd256_pd128(acc));
+    pair = _mm_max_pd(_mm_unpackhi_pd(pair, pair), pair);
+    max = _mm_cvtsd_f64(pair);
+    for (; i < n; i++)
+        max = a[i] > max ? a[i] : max;
+    return max;
+}
+
+__attribute__((target("avx2")))
+long bytes_find_avx2(const char *s, long n, const char *pattern, long m) {
+    __m256i first, last, eq;
+    unsigned mask;
+    long i, found;
+    if (m == 0)
+        return 0;
+    first = _mm256_set1_epi8(pattern[0]);
+    last = _mm256_set1_epi8(pattern[m - 1]);
+    for (i = 0; i + m - 1 + 32 <= n; i += 32) {
+        eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(s + i))),
+                _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(s + i + m - 1))));
+        for (mask = _mm256_movemask_epi8(eq); mask != 0; mask &= mask - 1) {
+            found = i + __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + found + 1, pattern + 1, m - 2) == 0)
+                return found;
+        }
+    }
+    found = bytes_find_sse2(s + i, n - i, pattern, m);
+    return found < 0 ? -1 : i + found;
+}
+
+#endif
+
+
+////////////////////////////////////////
+////////////// DISPATCH ////////////////
+////////////////////////////////////////
+
+// One version of each kernel, for one instruction set.
+struct Kernels {
+    void (*add)(double *, const double *, const double *, long);
+    void (*mul)(double *, const double *, const double *, long);
+    void (*scale)(double *, const double *, double, long);
+    double (*sum)(const double *, long);
+    double (*dot)(const double *, const double *, long);
+    void (*vecmat_add)(double *, const double *, const double *, long, long, long);
+    double (*min)(const double *, long);
+    double (*max)(const double *, long);
+    long (*find)(const char *, long, const char *, long);
+};
+
+struct Kernels SCALAR_KERNELS = {
+    f64_add_scalar, f64_mul_scalar, f64_scale_scalar, f64_sum_scalar,
+    f64_dot_scalar, f64_vecmat_add_scalar, f64_min_scalar, f64_max_scalar,
+    bytes_find_scalar,
+};
+
+#ifdef SIMD_X86
+struct Kernels SSE2_KERNELS = {
+    f64_add_sse2, f64_mul_sse2, f64_scale_sse2, f64_sum_sse2,
+    f64_dot_sse2, f64_vecmat_add_sse2, f64_min_sse2, f64_max_sse2,
+    bytes_find_sse2,
+};
+
+struct Kernels AVX2_KERNELS = {
+    f64_add_avx2, f64_mul_avx2, f64_scale_avx2, f64_sum_avx2,
+    f64_dot_avx2, f64_vecmat_add_avx2, f64_min_avx2, f64_max_avx2,
+    bytes_find_avx2,
+};
+#endif
+
+// The kernels in use, chosen on the first call.
+struct Kernels *KERNELS = NULL;
+
+/* Returns the kernels for the widest instruction set which the CPU supports
+ * and SIMD_ENABLED allows. */
+struct Kernels *kernels() {
+    if (KERNELS == NULL)
+        simd_init();
+    return KERNELS;
+}
+
+void simd_init() {
+    if (KERNELS == NULL) {
+        KERNELS = &SCALAR_KERNELS;
+#ifdef SIMD_X86
+        if (SIMD_ENABLED) {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                KERNELS = &AVX2_KERNELS;
+            else if (__builtin_cpu_supports("sse2"))
+                KERNELS = &SSE2_KERNELS;
+        }
+#endif
+    }
+}
+
+void f64_add(double *r, const double *a, const double *b, long n) {
+    kernels()->add(r, a, b, n);
+}
+
+void f64_mul(double *r, const double *a, const double *b, long n) {
+    kernels()->mul(r, a, b, n);
+}
+
+void f64_scale(double *r, const double *a, double k, long n) {
+    kernels()->scale(r, a, k, n);
+}
+
+double f64_sum(const double *a, long n) {
+    return kernels()->sum(a, n);
+}
+
+double f64_dot(const double *a, const double *b, long n) {
+    return kernels()->dot(a, b, n);
+}
+
+void f64_vecmat_add(double *c, const double *a, const double *b, long stride, long depth, long n) {
+    kernels()->vecmat_add(c, a, b, stride, depth, n);
+}
+
+double f64_min(const double *a, long n) {
+    return kernels()->min(a, n);
+}
+
+double f64_max(const double *a, long n) {
+    return kernels()->max(a, n);
+}
+
+long bytes_find(const char *s, long n, const char *pattern, long m) {
+    return kernels()->find(s, n, pattern, m);
+}
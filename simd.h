@@ -0,0 +1,50 @@
+#ifndef _SIMD
+#define _SIMD
+
+/* Set to 0 to run the portable scalar kernels even where the CPU supports
+ * SSE2 or AVX2. */
+extern int SIMD_ENABLED;
+
+/* Chooses the kernels, which otherwise happens on the first call to one.
+ * Must be called before kernels are run on several threads at once. */
+void simd_init();
+
+// Kernels over arrays of n doubles, dispatched on first use to AVX2, SSE2 or
+// plain C according to the CPU.  The results of the reductions do not depend
+// on which is chosen: each sums in eight interleaved partial sums combined
+// in the same fixed order.
+
+/* Stores a[i] + b[i] in r[i].  r may be a or b. */
+void f64_add(double *r, const double *a, const double *b, long n);
+
+/* Stores a[i] * b[i] in r[i].  r may be a or b. */
+void f64_mul(double *r, const double *a, const double *b, long n);
+
+/* Stores a[i] * k in r[i].  r may be a. */
+void f64_scale(double *r, const double *a, double k, long n);
+
+/* Returns the sum of the a[i]. */
+double f64_sum(const double *a, long n);
+
+/* Returns the sum of the a[i] * b[i]. */
+double f64_dot(const double *a, const double *b, long n);
+
+/* Adds to each c[j], for j < n, the sum of a[k] * b[k * stride + j] for
+ * k < depth, accumulating in order of k: that is, adds the product of the
+ * vector a and the depth by n block of a matrix of row length stride at b.
+ * c must not overlap a or b. */
+void f64_vecmat_add(double *c, const double *a, const double *b, long stride, long depth, long n);
+
+/* Returns the least of the a[i], n >= 1.  The result is unspecified if any
+ * of them is a NaN. */
+double f64_min(const double *a, long n);
+
+/* Returns the greatest of the a[i], n >= 1.  The result is unspecified if
+ * any of them is a NaN. */
+double f64_max(const double *a, long n);
+
+/* Returns the index of the first occurrence of the m bytes of pattern in the
+ * n bytes of s, or -1 if there is none. */
+long bytes_find(const char *s, long n, const char *pattern, long m);
+
+#endif
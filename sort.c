@@ -0,0 +1,272 @@
+/* sort.c
+ *
+ * A stable merge sort over arrays of values, after timsort without its
+ * galloping: the input is split into the runs already in order, short runs
+ * are extended by binary insertion, and runs are merged as they are found so
+ * that the lengths on the stack of pending runs shrink geometrically.
+ * Presorted and reversed inputs therefore take one pass of comparisons.
+ *
+ * Large inputs whose ordering is safe to call from any thread are split
+ * into one piece per thread, each sorted on its own thread, and the pieces
+ * are merged pairwise, each merge itself split across the threads by where
+ * its output divides.  Nothing here allocates with talloc, which is not
+ * thread safe, or raises errors: the ordering of a sort which may call back
+ * into the interpreter is only ever called from the calling thread.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "value.h"
+#include "sort.h"
+
+// Sorts of fewer values than this are not worth the cost of starting
+// threads.
+#define THREAD_THRESHOLD 65536
+
+#define MAX_THREADS 64
+
+// Timsort's merge rules keep each pending run longer than the two above it
+// combined, so 85 are enough for any array that fits in memory.
+#define MAX_PENDING_RUNS 85
+
+int SORT_THREADS = 0;
+
+/* Returns the least run length to which runs are extended for an array of
+ * n values: n itself if small, otherwise a number from 32 to 64 which
+ * divides n into a power of two runs or a little fewer. */
+long sort_min_run(long n) {
+    long r = 0;
+    while (n >= 64) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+/* Extends the sorted run items[0..sorted) to items[0..n) by binary
+ * insertion, after any equal values so that the sort stays stable. */
+void sort_insertion(Value **items, long sorted, long n, sort_less less, void *context) {
+    Value *value;
+    long lo, hi, mid;
+    for (; sorted < n; sorted++) {
+        value = items[sorted];
+        lo = 0;
+        hi = sorted;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (less(value, items[mid], context))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        memmove(items + lo + 1, items + lo, sizeof(Value *) * (sorted - lo));
+        items[lo] = value;
+    }
+}
+
+/* Returns the length of the run at the start of items[0..n), reversing it
+ * first if it is strictly descending; a run which merely does not descend
+ * is left as it is, so equal values are never reordered. */
+long sort_count_run(Value **items, long n, sort_less less, void *context) {
+    Value *swap;
+    long i = 1, j;
+    if (n < 2)
+        return n;
+    if (less(items[1], items[0], context)) {
+        while (i < n && less(items[i], items[i - 1], context))
+            i++;
+        for (j = 0; j < i / 2; j++) {
+            swap = items[j];
+            items[j] = items[i - 1 - j];
+            items[i - 1 - j] = swap;
+        }
+    } else {
+        while (i < n && !less(items[i], items[i - 1], context))
+            i++;
+    }
+    return i;
+}
+
+/* Merges the adjacent sorted runs items[0..left) and items[left..n), using
+ * buffer for a copy of the first. */
+void sort_merge_runs(Value **items, long left, long n, Value **buffer, sort_less less, void *context) {
+    long i = 0, j = left, k = 0;
+    // Runs already in order, as in presorted input, are left as they are
+    if (!less(items[left], items[left - 1], context))
+        return;
+    memcpy(buffer, items, sizeof(Value *) * left);
+    while (i < left && j < n) {
+        if (less(items[j], buffer[i], context))
+            items[k++] = items[j++];
+        else
+            items[k++] = buffer[i++];
+    }
+    memcpy(items + k, buffer + i, sizeof(Value *) * (left - i));
+}
+
+/* Sorts items[0..n) on the calling thread. */
+void sort_sequential(Value **items, long n, Value **buffer, sort_less less, void *context) {
+    long base[MAX_PENDING_RUNS], length[MAX_PENDING_RUNS];
+    long min_run = sort_min_run(n), start = 0, run;
+    int pending = 0, k;
+    while (start < n) {
+        run = sort_count_run(items + start, n - start, less, context);
+        if (run < min_run) {
+            sort_insertion(items + start, run, min_run < n - start ? min_run : n - start, less, context);
+            run = min_run < n - start ? min_run : n - start;
+        }
+        base[pending] = start;
+        length[pending] = run;
+        pending++;
+        start += run;
+        // Merge until the pending lengths shrink geometrically, or merge all
+        // of them once the input is used up
+        while (pending > 1) {
+            k = pending - 2;
+            if (start == n) {
+                if (k > 0 && length[k - 1] < length[k + 1])
+                    k--;
+            } else if ((k > 0 && length[k - 1] <= length[k] + length[k + 1])
+                    || (k > 1 && length[k - 2] <= length[k - 1] + length[k])) {
+                if (length[k - 1] < length[k + 1])
+                    k--;
+            } else if (length[k] > length[k + 1]) {
+                break;
+            }
+            sort_merge_runs(items + base[k], length[k], length[k] + length[k + 1], buffer, less, context);
+            length[k] += length[k + 1];
+            if (k == pending - 3) {
+                base[k + 1] = base[k + 2];
+                length[k + 1] = length[k + 2];
+            }
+            pending--;
+        }
+    }
+}
+
+// A share of the work of a parallel sort: either sorting items[0..n), or
+// writing out[first..end) of the merge of a[0..na) and b[0..nb).
+struct SortTask {
+    Value **items;
+    long n;
+    Value **buffer;
+    Value **a;
+    long na;
+    Value **b;
+    long nb;
+    Value **out;
+    long first;
+    long end;
+    sort_less less;
+    void *context;
+};
+
+/* Returns how many of the first k values of the merge of a[0..na) and
+ * b[0..nb) come from a, by binary search for the split which keeps a's
+ * values before equal values of b. */
+long sort_co_rank(long k, Value **a, long na, Value **b, long nb, sort_less less, void *context) {
+    long lo = k > nb ? k - nb : 0, hi = k < na ? k : na, i;
+    while (lo < hi) {
+        i = lo + (hi - lo) / 2;
+        if (k - i > 0 && !less(b[k - i - 1], a[i], context))
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+void *sort_thread(void *data) {
+    struct SortTask *task = data;
+    sort_sequential(task->items, task->n, task->buffer, task->less, task->context);
+    return NULL;
+}
+
+void *merge_thread(void *data) {
+    struct SortTask *task = data;
+    long i = sort_co_rank(task->first, task->a, task->na, task->b, task->nb, task->less, task->context);
+    long i_end = sort_co_rank(task->end, task->a, task->na, task->b, task->nb, task->less, task->context);
+    long j = task->first - i, j_end = task->end - i_end, k;
+    for (k = task->first; k < task->end; k++) {
+        if (j >= j_end || (i < i_end && !task->less(task->b[j], task->a[i], task->context)))
+            task->out[k] = task->a[i++];
+        else
+            task->out[k] = task->b[j++];
+    }
+    return NULL;
+}
+
+/* Runs the routine on each of the count tasks, all but the first on new
+ * threads.  A task whose thread cannot be started is run by the calling
+ * thread instead. */
+void sort_run_tasks(void *(*routine)(void *), struct SortTask *tasks, int count) {
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS];
+    int t;
+    for (t = 1; t < count; t++)
+        started[t] = pthread_create(&threads[t], NULL, routine, &tasks[t]) == 0;
+    routine(&tasks[0]);
+    for (t = 1; t < count; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            routine(&tasks[t]);
+    }
+}
+
+/* Returns the number of threads to use for sorting n values. */
+int sort_thread_count(long n) {
+    long threads = SORT_THREADS;
+    if (n < THREAD_THRESHOLD)
+        return 1;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    return threads < 1 ? 1 : threads;
+}
+
+void sort_values(Value **items, long n, Value **buffer, sort_less less, void *context, int parallel) {
+    struct SortTask tasks[MAX_THREADS];
+    long bounds[MAX_THREADS + 1], lo, mid, hi;
+    int count = parallel ? sort_thread_count(n) : 1;
+    int pieces, p, t;
+    if (count == 1) {
+        sort_sequential(items, n, buffer, less, context);
+        return;
+    }
+    for (t = 0; t <= count; t++)
+        bounds[t] = n * t / count;
+    for (t = 0; t < count; t++) {
+        tasks[t].items = items + bounds[t];
+        tasks[t].n = bounds[t + 1] - bounds[t];
+        tasks[t].buffer = buffer + bounds[t];
+        tasks[t].less = less;
+        tasks[t].context = context;
+    }
+    sort_run_tasks(sort_thread, tasks, count);
+    // Merge neighbouring pieces into the buffer and copy them back, halving
+    // the pieces each round
+    for (pieces = count; pieces > 1; pieces = (pieces + 1) / 2) {
+        for (p = 0; p + 1 < pieces; p += 2) {
+            lo = bounds[p];
+            mid = bounds[p + 1];
+            hi = bounds[p + 2];
+            for (t = 0; t < count; t++) {
+                tasks[t].a = items + lo;
+                tasks[t].na = mid - lo;
+                tasks[t].b = items + mid;
+                tasks[t].nb = hi - mid;
+                tasks[t].out = buffer + lo;
+                tasks[t].first = (hi - lo) * t / count;
+                tasks[t].end = (hi - lo) * (t + 1) / count;
+            }
+            sort_run_tasks(merge_thread, tasks, count);
+            memcpy(items + lo, buffer + lo, sizeof(Value *) * (hi - lo));
+        }
+        for (p = 0; p < pieces; p += 2)
+            bounds[p / 2] = bounds[p];
+        bounds[(pieces + 1) / 2] = n;
+    }
+}
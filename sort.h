@@ -0,0 +1,21 @@
+#include "value.h"
+
+#ifndef _SORT
+#define _SORT
+
+/* The number of threads across which a large sort may be split, or 0 for
+ * one per online CPU. */
+extern int SORT_THREADS;
+
+/* A strict ordering for sorting: returns 1 if a must come before b,
+ * otherwise 0.  context is passed through from sort_values. */
+typedef int (*sort_less)(Value *a, Value *b, void *context);
+
+/* Sorts the n values in items by less, stably, using buffer, which must
+ * have room for n values, as scratch space.  If parallel, less must be safe
+ * to call from several threads at once, and must neither allocate with
+ * talloc nor raise errors; large inputs are then sorted and merged in
+ * pieces on SORT_THREADS threads. */
+void sort_values(Value **items, long n, Value **buffer, sort_less less, void *context, int parallel);
+
+#endif
@@ -0,0 +1,163 @@
+/* strlib.c
+ *
+ * Strings, which carry their length and so may hold NULs.  A substring
+ * shares the characters of the string it is taken from.  string-append of a
+ * long result makes a rope, a node joining its two halves, so that building
+ * a string by repeated appends does not copy it each time; its characters
+ * are copied out into one buffer the first time they are needed, after
+ * which the rope is dropped.  Strings are never changed once made, so
+ * neither sharing is visible.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "simd.h"
+#include "strlib.h"
+
+// Appends whose result is no longer than this copy it, since a rope node
+// costs as much as that many characters.
+#define ROPE_MIN_LENGTH 64
+
+// Appending a short string to a rope whose right half is flat and short
+// copies the two into one new right half, up to this length, so that
+// appending one piece at a time builds leaves of this size rather than one
+// node per piece.
+#define ROPE_LEAF_LENGTH 256
+
+Value *string_new(char *chars, long length) {
+    Value *string = talloc(sizeof(Value));
+    string->type = STR_TYPE;
+    string->str.chars = chars;
+    string->str.length = length;
+    string->str.rope = NULL;
+    return string;
+}
+
+Value *string_copy(const char *chars, long length) {
+    char *copy = talloc(length + 1);
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+    return string_new(copy, length);
+}
+
+/* Copies the characters of the rope into a new buffer, walking its nodes in
+ * order with an explicit stack, since a string built by appending one piece
+ * at a time is a rope as deep as the number of pieces. */
+void string_flatten(Value *string) {
+    Value *local[64], **stack = local, **grown, *node;
+    long capacity = 64, top = 0, position = 0;
+    char *chars = talloc(string->str.length + 1);
+    node = string;
+    while (1) {
+        if (node->str.chars == NULL) {
+            if (top + 1 >= capacity) {
+                grown = talloc(sizeof(Value *) * capacity * 2);
+                memcpy(grown, stack, sizeof(Value *) * top);
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[top++] = node->str.rope->right;
+            node = node->str.rope->left;
+            continue;
+        }
+        memcpy(chars + position, node->str.chars, node->str.length);
+        position += node->str.length;
+        if (top == 0)
+            break;
+        node = stack[--top];
+    }
+    chars[position] = '\0';
+    string->str.chars = chars;
+    string->str.rope = NULL;
+}
+
+char *string_chars(Value *string) {
+    if (string->str.chars == NULL)
+        string_flatten(string);
+    return string->str.chars;
+}
+
+char *string_cstr(Value *string) {
+    char *chars = string_chars(string), *copy;
+    // Every buffer ends in a NUL, so this reads at most one past a substring
+    if (chars[string->str.length] == '\0')
+        return chars;
+    copy = talloc(string->str.length + 1);
+    memcpy(copy, chars, string->str.length);
+    copy[string->str.length] = '\0';
+    return copy;
+}
+
+void string_write(Value *string, FILE *fd) {
+    fwrite(string_chars(string), 1, string->str.length, fd);
+}
+
+int string_equal(Value *first, Value *second) {
+    if (first->str.length != second->str.length)
+        return 0;
+    return memcmp(string_chars(first), string_chars(second), first->str.length) == 0;
+}
+
+Value *string_slice(Value *string, long start, long end) {
+    Value *slice;
+    if (start == 0 && end == string->str.length)
+        return string;
+    slice = talloc(sizeof(Value));
+    slice->type = STR_TYPE;
+    slice->str.chars = string_chars(string) + start;
+    slice->str.length = end - start;
+    slice->str.rope = NULL;
+    return slice;
+}
+
+/* Returns a new flat string of the characters of the two. */
+Value *string_join_flat(Value *left, Value *right) {
+    long length = left->str.length + right->str.length;
+    char *chars = talloc(length + 1);
+    memcpy(chars, string_chars(left), left->str.length);
+    memcpy(chars + left->str.length, string_chars(right), right->str.length);
+    chars[length] = '\0';
+    return string_new(chars, length);
+}
+
+/* Returns a new string joining the two, as a rope unless the result is
+ * short. */
+Value *string_join(Value *left, Value *right) {
+    Value *string;
+    if (left->str.length == 0)
+        return right;
+    if (right->str.length == 0)
+        return left;
+    if (left->str.length + right->str.length <= ROPE_MIN_LENGTH)
+        return string_join_flat(left, right);
+    string = string_new(NULL, left->str.length + right->str.length);
+    string->str.rope = talloc(sizeof(struct Rope));
+    if (left->str.chars == NULL && left->str.rope->right->str.chars != NULL
+            && left->str.rope->right->str.length + right->str.length <= ROPE_LEAF_LENGTH) {
+        string->str.rope->left = left->str.rope->left;
+        string->str.rope->right = string_join_flat(left->str.rope->right, right);
+    } else {
+        string->str.rope->left = left;
+        string->str.rope->right = right;
+    }
+    return string;
+}
+
+Value *string_concat(int count, Value **strings) {
+    Value *result = string_new("", 0);
+    int i;
+    for (i = 0; i < count; i++)
+        result = string_join(result, strings[i]);
+    return result;
+}
+
+long string_search(Value *pattern, Value *string, long start) {
+    long found;
+    if (pattern->str.length > string->str.length - start)
+        return -1;
+    found = bytes_find(string_chars(string) + start, string->str.length - start,
+            string_chars(pattern), pattern->str.length);
+    return found < 0 ? -1 : start + found;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _STRLIB
+#define _STRLIB
+
+// The two strings joined by a string made by string-append, until it is
+// first read.
+struct Rope {
+    Value *left;
+    Value *right;
+};
+
+/* Returns a new string of the length characters at chars, which are not
+ * copied, and must be followed by a NUL. */
+Value *string_new(char *chars, long length);
+
+/* Returns a new string holding a copy of the length characters at chars. */
+Value *string_copy(const char *chars, long length);
+
+/* Returns the characters of the string, copying them out of the strings it
+ * joins the first time it is read if it was made by string-append.  They
+ * are not followed by a NUL if the string is a substring. */
+char *string_chars(Value *string);
+
+/* Returns the characters of the string followed by a NUL, copying them if
+ * they are not, for use with C functions.  Any NUL within the string ends
+ * it early. */
+char *string_cstr(Value *string);
+
+/* Writes the characters of the string to the stream, NULs included. */
+void string_write(Value *string, FILE *fd);
+
+/* Returns 1 if the strings hold the same characters, otherwise 0. */
+int string_equal(Value *first, Value *second);
+
+/* Returns a new string of the characters of the string from start to end,
+ * 0 <= start <= end <= length, sharing them rather than copying them. */
+Value *string_slice(Value *string, long start, long end);
+
+/* Returns a new string of the characters of the count strings in turn.  A
+ * long result joins the strings rather than copying them; their characters
+ * are copied together the first time it is read. */
+Value *string_concat(int count, Value **strings);
+
+/* Returns the index of the first occurrence of the pattern in the string at
+ * or after start, or -1 if there is none. */
+long string_search(Value *pattern, Value *string, long start);
+
+#endif
@@ -0,0 +1,8 @@
+; A continuation used inside a promise may be called after call/cc has
+; returned, so call/cc must not be turned into call/ec.
+(define p (call/cc (lambda (k) (cons 1 (delay (k 5))))))
+(if (number? p) p (force (cdr p)))
+(define q (call/cc (lambda (k) (cons 1 (delay-force (k 9))))))
+(if (number? q) q (force (cdr q)))
+(define s (call/cc (lambda (k) (stream-cons 1 (k 7)))))
+(if (number? s) s (stream-pair? (stream-cdr s)))
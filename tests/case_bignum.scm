@@ -0,0 +1,16 @@
+; case matches bignum keys by value, whether it dispatches through a table
+; or not.
+(case 100000000000000000000 ((100000000000000000000) 'big) (else 'no))
+(case (* 10000000000 10000000000) ((1 2 3) 'small) ((100000000000000000000) 'big) (else 'no))
+(case (- 0 100000000000000000000) ((100000000000000000000) 'positive) ((-100000000000000000000) 'negative) (else 'no))
+(case 100000000000000000001 ((100000000000000000000) 'big) (else 'no))
+(define (classify n)
+  (case n
+    ((0) 'zero)
+    ((1 2 3 4 5 6 7 8 9) 'digit)
+    ((18446744073709551616) 'two-to-the-64)
+    ((a b c) 'letter)
+    (else 'other)))
+(classify (expt 2 64))
+(classify (+ (expt 2 64) 1))
+(classify 7)
@@ -0,0 +1,10 @@
+; A variable passed to an inlined procedure must be read when the call is
+; made, not after the body has called a procedure which assigns it.
+(define x 1)
+(define (bump) (set! x 100))
+(define (f a) (bump) a)
+(f x)
+x
+(define y 1)
+(define (g a b) (set! y 5) (+ a b))
+(g y 2)
@@ -0,0 +1,7 @@
+; A fused map/filter/fold pipeline raises the same error as the calls it
+; replaced, even when a later stage would fail on an earlier element.
+(guard (e (#t (error-object-message e))) (map (lambda (x) (quotient 1 (- (car x) 1))) (filter (lambda (x) (< (car x) 10)) (list (list 1) 5))))
+(guard (e (#t (error-object-message e))) (map (lambda (x) (car x)) (filter (lambda (x) #t) (cons 1 2))))
+(guard (e (#t (error-object-message e))) (fold + 0 (map (lambda (x) (* x x)) (list 1 2 'a))))
+(map (lambda (x) (* x x)) (filter (lambda (x) (< x 3)) '(1 2 3 4)))
+(fold + 0 (map (lambda (x) (* x x)) '(1 2 3)))
@@ -0,0 +1,19 @@
+; Multiple values are accepted only by the forms that receive them, and are
+; an error anywhere a single value is stored or passed on.
+(values 1 2)
+(call-with-values (lambda () (values 1 2)) +)
+(receive (a b) (values 1 2) (list a b))
+(let-values (((a b) (values 3 4))) (* a b))
+(define (two) (values 5 6))
+(call-with-values two list)
+(list (values 7))
+(define (f) (values 1 2))
+(define (g) (f))
+(call-with-values g list)
+(list (values 1 2))
+(define v (values 1 2))
+(let ((a (values 1 2))) a)
+(define w 0)
+(set! w (values 1 2))
+(map (lambda (x) (values x x)) '(1 2))
+(display "done")
@@ -7,9 +7,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
 #include "value.h"
 #include "talloc.h"
 #include "linkedlist.h"
+#include "error.h"
+#include "bignum.h"
+#include "strlib.h"
+#include "tokenizer.h"
 
 #define BUFSIZE 512
 
@@ -188,11 +194,15 @@ int is_symbol(const char *buf) {
 }
 
 /* Returns a Value* of type INT_TYPE which holds the integer representation of
- * the string in the given buffer.  Assumes the string is a valid integer. */
+ * the string in the given buffer, or of type BIGNUM_TYPE if it is too large
+ * for a fixnum.  Assumes the string is a valid integer. */
 Value *make_integer(const char *buf) {
     Value *val = talloc(sizeof(Value));
     val->type = INT_TYPE;
+    errno = 0;
     val->i = strtol(buf, NULL, 0);  // base 0 in case we support other bases later
+    if (errno == ERANGE)
+        return bignum_parse(buf);
     return val;
 }
 
@@ -205,6 +215,16 @@ Value *make_double(const char *buf) {
     return val;
 }
 
+Value *parse_number(const char *buf) {
+    if (strpbrk(buf, "0123456789") == NULL)
+        return NULL;
+    if (is_integer(buf))
+        return make_integer(buf);
+    if (is_double(buf))
+        return make_double(buf);
+    return NULL;
+}
+
 /* Returns a Value* of type DOUBLE_TYPE which holds the given boolean value. */
 Value *make_bool(int boolean) {
     Value *val = talloc(sizeof(Value));
@@ -213,14 +233,10 @@ Value *make_bool(int boolean) {
     return val;
 }
 
-/* Returns a Value* of type STR_TYPE which holds a copy of the string in the
- * given buffer. */
-Value *make_string(const char *buf) {
-    Value *val = talloc(sizeof(Value));
-    val->type = STR_TYPE;
-    val->s = talloc(sizeof(char) * strlen(buf) + 1);
-    strcpy(val->s, buf);
-    return val;
+/* Returns a Value* of type STR_TYPE which holds a copy of the length chars
+ * in the given buffer. */
+Value *make_string(const char *buf, int length) {
+    return string_copy(buf, length);
 }
 
 /* Returns a Value* of type SYMBOL_TYPE which holds a copy of the string in the
@@ -240,6 +256,23 @@ Value *make_special(valueType t) {
     return val;
 }
 
+/* Reads the hex digits and ; of a \x<hex>; escape in a string, after the x,
+ * and returns the character they give. */
+char read_hex_escape(int *line_num) {
+    int code = 0, digits = 0;
+    char c = get();
+    while (isxdigit((unsigned char)c) && digits < 2) {
+        code = code * 16 + (isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10);
+        digits++;
+        c = get();
+    }
+    if (digits == 0 || c != ';') {
+        fprintf(error_stream(), "Syntax error: line %d: invalid \\x escape in string; expected one or two hex digits and ;\n", *line_num);
+        raise_error(2);
+    }
+    return (char)code;
+}
+
 /* Reads a string from stdin into the buffer.  Whenever a newline occurs,
  * increments the value at line_num.  The first char read should be a double
  * quote, and continues to read chars until another double quote is seen, or
@@ -297,6 +330,10 @@ int read_string(char *buf, int *line_num) {
                 case '?':
                     char_read = 0x3f;
                     break;
+                case 'x':
+                    // \x<hex>; as in R7RS, which may write a NUL
+                    char_read = read_hex_escape(line_num);
+                    break;
                 default:
                     if (i < BUFSIZE - 2) {
                         buf[i] = '\\';
@@ -311,8 +348,8 @@ int read_string(char *buf, int *line_num) {
         char_read = get();
     }
     if (char_read == EOF) {
-        fprintf(stderr, "Syntax error: line %d: unexpected EOF when reading string; expected \"\n", *line_num);
-        texit(2);
+        fprintf(error_stream(), "Syntax error: line %d: unexpected EOF when reading string; expected \"\n", *line_num);
+        raise_error(2);
     }
     buf[i] = '\0';
     if (i == BUFSIZE - 1) {
@@ -396,12 +433,18 @@ Value *tokenize() {
             case '"':
                 unget(char_read);
                 token_len = read_string(buf, &line_num);
-                list = cons(make_string(buf), list);
+                list = cons(make_string(buf, token_len), list);
                 break;
             case '\'':
                 list = cons(make_special(SINGLEQUOTE_TYPE), list);
                 break;
             case '#':
+                char_read = get();
+                if (char_read == '(') {
+                    list = cons(make_special(OPENVECTOR_TYPE), list);
+                    break;
+                }
+                unget(char_read);
                 // we do NOT unget(#), as that loops forever
                 // instead, compare the remainder of the token after the leading #
                 token_len = read_token(buf, &line_num);
@@ -411,8 +454,8 @@ Value *tokenize() {
                     list = cons(make_bool(0), list);
                 } else {
                     // there are valid options we have not handled yet
-                    fprintf(stderr, "Syntax error: line %d: handling for special token %s not yet implemented\n", line_num, buf);
-                    texit(2);
+                    fprintf(error_stream(), "Syntax error: line %d: handling for special token %s not yet implemented\n", line_num, buf);
+                    raise_error(2);
                 }
                 break;
             default:
@@ -427,8 +470,8 @@ Value *tokenize() {
                     } else if (is_double(buf)) {
                         list = cons(make_double(buf), list);
                     } else {
-                        fprintf(stderr, "Syntax error: line %d: invalid symbol %s: Symbols may not begin with + or - unless the complete symbol is + or -\n", line_num, buf);
-                        texit(2);
+                        fprintf(error_stream(), "Syntax error: line %d: invalid symbol %s: Symbols may not begin with + or - unless the complete symbol is + or -\n", line_num, buf);
+                        raise_error(2);
                     }
                 } else if (buf[0] == '.') {
                     if (token_len == 1) {
@@ -438,8 +481,8 @@ Value *tokenize() {
                     } else if (is_double(buf)) {
                         list = cons(make_double(buf), list);
                     } else {
-                        fprintf(stderr, "Syntax error: line %d: invalid symbol %s: Symbols may not begin with . unless the complete symbol is . or ...\n", line_num, buf);
-                        texit(2);
+                        fprintf(error_stream(), "Syntax error: line %d: invalid symbol %s: Symbols may not begin with . unless the complete symbol is . or ...\n", line_num, buf);
+                        raise_error(2);
                     }
                 } else if (is_digit(buf[0])) {
                     if (is_integer(buf)) {
@@ -447,14 +490,14 @@ Value *tokenize() {
                     } else if (is_double(buf)) {
                         list = cons(make_double(buf), list);
                     } else {
-                        fprintf(stderr, "Syntax error: line %d: invalid symbol %s: Symbols may not begin with a number\n", line_num, buf);
-                        texit(2);
+                        fprintf(error_stream(), "Syntax error: line %d: invalid symbol %s: Symbols may not begin with a number\n", line_num, buf);
+                        raise_error(2);
                     }
                 } else if (is_symbol(buf)) {
                     list = cons(make_symbol(buf), list);
                 } else {
-                    fprintf(stderr, "Syntax error: line %d: invalid symbol %s: Symbol contains invalid character\n", line_num, buf);
-                    texit(2);
+                    fprintf(error_stream(), "Syntax error: line %d: invalid symbol %s: Symbol contains invalid character\n", line_num, buf);
+                    raise_error(2);
                 }
         }
         char_read = get();
@@ -469,13 +512,18 @@ void displayTokens(Value *list) {
     while (list->type != NULL_TYPE) {
         switch (car(list)->type) {
             case INT_TYPE:
-                printf("%d:integer\n", car(list)->i);
+                printf("%ld:integer\n", car(list)->i);
+                break;
+            case BIGNUM_TYPE:
+                bignum_print(car(list), stdout);
+                printf(":integer\n");
                 break;
             case DOUBLE_TYPE:
                 printf("%lf:double\n", car(list)->d);
                 break;
             case STR_TYPE:
-                printf("%s:string\n", car(list)->s);
+                string_write(car(list), stdout);
+                printf(":string\n");
                 break;
             case OPEN_TYPE:
                 printf("(:open\n");
@@ -483,6 +531,9 @@ void displayTokens(Value *list) {
             case CLOSE_TYPE:
                 printf("):close\n");
                 break;
+            case OPENVECTOR_TYPE:
+                printf("#(:openvector\n");
+                break;
             case BOOL_TYPE:
                 if (car(list)->i == 0)
                     printf("#f:boolean\n");
@@ -10,4 +10,8 @@ Value *tokenize();
 /* Displays the contents of the linked list as tokens, with type information. */
 void displayTokens(Value *list);
 
+/* Returns the number written in the string, read as by the tokenizer, or
+ * NULL if it is not one. */
+Value *parse_number(const char *buf);
+
 #endif
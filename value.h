@@ -1,6 +1,8 @@
 #ifndef _VALUE
 #define _VALUE
 
+#include <stdint.h>
+
 typedef enum {
     INT_TYPE, DOUBLE_TYPE, STR_TYPE, CONS_TYPE, NULL_TYPE, PTR_TYPE,
     OPEN_TYPE, CLOSE_TYPE, BOOL_TYPE, SYMBOL_TYPE,
@@ -15,15 +17,116 @@ typedef enum {
     PRIMITIVE_TYPE,
 
     // Type below is new for final portion
-    UNSPECIFIED_TYPE
+    UNSPECIFIED_TYPE,
+
+    // Type below is for syntax-rules macros
+    MACRO_TYPE,
+
+    // Type below marks the result of returning other than one value
+    VALUES_TYPE,
+
+    // Type below is for continuations created by call/cc and call/ec
+    CONTINUATION_TYPE,
+
+    // Type below is for error objects, raised by error and by failures
+    ERROR_TYPE,
+
+    // Type below is for integers too large to be fixnums
+    BIGNUM_TYPE,
+
+    // Types below are for homogeneous numeric vectors
+    F64VECTOR_TYPE, S64VECTOR_TYPE,
+
+    // Type below is for dense matrices of doubles
+    MATRIX_TYPE,
+
+    // Type below is for vectors of any values, and the #( token which opens
+    // their literals
+    VECTOR_TYPE, OPENVECTOR_TYPE,
+
+    // Type below is for hash tables
+    HASH_TABLE_TYPE,
+
+    // Types below are for persistent maps and vectors
+    PMAP_TYPE, PVECTOR_TYPE,
+
+    // Types below are for records, their types, and the procedures which
+    // make and use them
+    RECORD_TYPE, RECORD_DESCRIPTOR_TYPE, RECORD_PROCEDURE_TYPE,
+
+    // Type below is for procedures made by memoize
+    MEMO_TYPE,
+
+    // Type below is for promises, which are also streams
+    PROMISE_TYPE
 } valueType;
 
+// A record type: its name and the names of its fields, as symbols.
+struct RecordType {
+    char *name;
+    int field_count;
+    struct Value **field_names;
+};
+
+// A record: its type and its fields, in the order the type lists them.
+struct Record {
+    struct RecordType *type;
+    struct Value *fields[];
+};
+
+// A result cached by a memoized procedure: the list of arguments of the call
+// and its result, linked to the other entries in order of last use.
+struct MemoEntry {
+    struct Value *arguments;
+    struct Value *result;
+    struct MemoEntry *newer;
+    struct MemoEntry *older;
+};
+
+// A memoized procedure: the procedure it calls on a miss, and its cache, a
+// table from argument lists to PTR_TYPE values pointing to their entries.
+struct Memo {
+    struct Value *procedure;
+    struct HashTable *table;
+    long limit;     // the most entries kept, or 0 for no limit
+    long hits;
+    long misses;
+    struct MemoEntry *newest;
+    struct MemoEntry *oldest;
+};
+
+// The state of a promise, which promises share once one is found to stand
+// for another; see force_promise.  Until it is done, its value is found by
+// evaluating expression in frame, or if step is set, by calling step on
+// state; if lazy, that gives a promise for the value rather than the value.
+struct Promise {
+    int done;
+    int lazy;
+    struct Value *value;    // the value if done, else expression or state
+    struct Frame *frame;
+    struct Value *(*step)(struct Value *state);
+};
+
+// The kinds of procedure made for a record type.
+enum recordProcedureKind {
+    RECORD_CONSTRUCTOR, RECORD_PREDICATE, RECORD_ACCESSOR, RECORD_MODIFIER
+};
+
 struct Value {
     valueType type;
     union {
-        int i;
+        long i;     // INT_TYPE holds a 64-bit fixnum; BOOL_TYPE 0 or 1
         double d;
-        char *s;
+        char *s;    // SYMBOL_TYPE and the other types named by a C string
+        // A string, which may hold NULs.  chars is NULL while the string is
+        // a rope joining two others (see strlib.c), and is shared with the
+        // string it was taken from if it is a substring, so may not be
+        // followed by a NUL.
+        struct String {
+            char *chars;
+            long length;
+            struct Rope *rope;
+        } str;
         void *p;
         struct ConsCell {
             struct Value *car;
@@ -40,9 +143,97 @@ struct Value {
             struct Frame *frame;
         } cl;
 
-        // A primitive style function; just a pointer to it, with the right
-        // signature (pf = primitive function)
-        struct Value *(*pf)(struct Value *);
+        // A primitive style function; a pointer to it, with the right
+        // signature (pf = primitive function), which receives its evaluated
+        // arguments as an array, along with its name for error messages and
+        // the number of arguments it accepts, from min_args to max_args (-1
+        // if there is no upper bound).  apply checks the count before the
+        // call, so the function itself need not.
+        struct Primitive {
+            struct Value *(*pf)(int, struct Value **);
+            char *name;
+            int min_args;
+            int max_args;
+        } pr;
+
+        // A macro defined by syntax-rules: its list of literal symbols and
+        // its list of (pattern template) rules.
+        struct Macro {
+            struct Value *literals;
+            struct Value *rules;
+        } mac;
+
+        // A continuation; see interpreter.c.
+        struct Continuation *k;
+
+        // An error object: its message string, its list of irritants, and
+        // the exit status if it is not caught, which is 0 for errors raised
+        // by the error procedure, whose message is reported with a prefix.
+        struct Error {
+            struct Value *message;
+            struct Value *irritants;
+            int status;
+        } err;
+
+        // An integer outside the range of a fixnum: its sign, 1 or -1, and
+        // its magnitude as size 32-bit limbs, least significant first, the
+        // last of which is nonzero.  See bignum.c.
+        struct Bignum {
+            int sign;
+            int size;
+            uint32_t *limbs;
+        } big;
+
+        // An f64vector, s64vector or vector: its length and its elements,
+        // unboxed doubles or fixnums, or values, respectively.
+        struct NumVector {
+            long length;
+            union {
+                double *f64;
+                long *s64;
+                struct Value **items;
+            };
+        } vec;
+
+        // A hash table; see hashtable.h.
+        struct HashTable *ht;
+
+        // A persistent map: its number of keys and its trie; see hamt.h.
+        struct PMap {
+            long size;
+            struct HamtNode *root;
+        } pm;
+
+        // A persistent vector; see pvector.h.
+        struct PVector *pv;
+
+        // A record, or a record type.
+        struct Record *rec;
+        struct RecordType *rtd;
+
+        // A constructor, predicate, accessor or modifier of records of the
+        // given type.  An accessor or modifier uses the field at index; a
+        // constructor takes index arguments, which initialize the fields
+        // listed in arg_fields.
+        struct RecordProcedure {
+            enum recordProcedureKind kind;
+            int index;
+            struct RecordType *type;
+            int *arg_fields;
+        } rp;
+
+        // A memoized procedure.
+        struct Memo *memo;
+
+        // A promise.
+        struct Promise *promise;
+
+        // A matrix: its dimensions and its elements in row-major order.
+        struct Matrix {
+            long rows;
+            long cols;
+            double *elements;
+        } mat;
     };
 };
 